@@ -12,8 +12,6 @@
 
 GlobalState g_GlobalState;
 
-constexpr ULONG ASYNCIO_DRIVER_TAG = 0x11223344;
-
 /* ----------------------------------------------------------------------------
  *	DriverEntry
  */
@@ -29,13 +27,14 @@ NTSTATUS DriverEntry(
 	auto status = STATUS_SUCCESS;
 
 	// initialize internal state
-	InitializeListHead(&g_GlobalState.ListHeadRead);
-	InitializeListHead(&g_GlobalState.ListHeadWrite);
-	
-	g_GlobalState.ReadQueueCount = 0;
-	g_GlobalState.WriteQueueCount = 0;
+	status = g_GlobalState.Stats.Init();
+	if (!NT_SUCCESS(status))
+	{
+		KdPrint(("Failed to allocate statistics\n"));
+		return status;
+	}
 
-	g_GlobalState.GlobalStateLock.Init();
+	g_GlobalState.Channels.Init(&g_GlobalState.Stats);
 
 	BOOLEAN bSymlinkCreated = FALSE;
 	PDEVICE_OBJECT pDeviceObject = nullptr;
@@ -53,8 +52,9 @@ NTSTATUS DriverEntry(
 			break;
 		}
 
-		// specify buffered IO for reads / writes
-		pDeviceObject->Flags |= DO_BUFFERED_IO;
+		// specify direct IO for reads / writes: each side's pages are
+		// described by an MDL, and a match copies once, straight across
+		pDeviceObject->Flags |= DO_DIRECT_IO;
 
 		// create symbolic link to device object
 		status = IoCreateSymbolicLink(&SymlinkName, &DeviceName);
@@ -106,10 +106,9 @@ VOID DriverUnload(PDRIVER_OBJECT pDriverObject)
 	IoDeleteSymbolicLink(&SymlinkName);
 	IoDeleteDevice(pDriverObject->DeviceObject);
 
-	AutoLock<FastMutex> locker(g_GlobalState.GlobalStateLock);
-
-	FlushReadQueueUnsafe();
-	FlushWriteQueueUnsafe();
+	// only the statistics are left: a driver with open handles is not
+	// unloaded, and every channel went with the last handle on it
+	g_GlobalState.Stats.Free();
 }
 
 /* ----------------------------------------------------------------------------
@@ -119,14 +118,23 @@ VOID DriverUnload(PDRIVER_OBJECT pDriverObject)
 _Use_decl_annotations_
 NTSTATUS DispatchCreate(PDEVICE_OBJECT, PIRP pIrp)
 {
-	// unconditionally successful device handle acquisition
+	// the handle is bound to the channel named by the rest of its path
 
-	pIrp->IoStatus.Status = STATUS_SUCCESS;
+	auto pFileObject = IoGetCurrentIrpStackLocation(pIrp)->FileObject;
+
+	Channel* pChannel = nullptr;
+	auto status = g_GlobalState.Channels.Open(&pFileObject->FileName, &pChannel);
+	if (NT_SUCCESS(status))
+	{
+		pFileObject->FsContext = pChannel;
+	}
+
+	pIrp->IoStatus.Status = status;
 	pIrp->IoStatus.Information = 0;
 
 	IoCompleteRequest(pIrp, 0);
 	
-	return STATUS_SUCCESS;
+	return status;
 }
 
 _Use_decl_annotations_
@@ -134,6 +142,8 @@ NTSTATUS DispatchClose(PDEVICE_OBJECT, PIRP pIrp)
 {
 	// unconditionally successful device handle close
 
+	g_GlobalState.Channels.Close(GetChannel(pIrp));
+
 	pIrp->IoStatus.Status = STATUS_SUCCESS;
 	pIrp->IoStatus.Information = 0;
 
@@ -170,207 +180,818 @@ NTSTATUS DispatchRead(PDEVICE_OBJECT, PIRP pIrp)
 		return STATUS_INVALID_DEVICE_REQUEST;
 	}
 
-	// acquire the global state lock to protect queue operations
-	AutoLock<FastMutex> locker(g_GlobalState.GlobalStateLock);
+	CancelSafeQueue::SetPriority(pIrp, ASYNCIO_PRIORITY_NORMAL);
 
-	if (IsListEmpty(&g_GlobalState.ListHeadWrite))
-	{
-		return HandleReadNoPendingWrites(pIrp, pIoStack);
-	}
-	else
-	{
-		return HandleReadPendingWriteAvailable(pIrp, pIoStack);
-	}
+	return SubmitRequest(pIrp, TRUE, nullptr);
 }
 
-// no pending writes available, queue the read 
-NTSTATUS HandleReadNoPendingWrites(PIRP pIrp, PIO_STACK_LOCATION pIoStack)
+/* ----------------------------------------------------------------------------
+ *	Write Dispatch
+ */
+
+_Use_decl_annotations_
+NTSTATUS DispatchWrite(PDEVICE_OBJECT, PIRP pIrp)
 {
-	constexpr auto allocSize = sizeof(READ_QUEUE_ITEM);
-	auto newItem = static_cast<PREAD_QUEUE_ITEM>(ExAllocatePoolWithTag(PagedPool, allocSize, ASYNCIO_DRIVER_TAG));
-	if (nullptr == newItem)
+	// handle write requests
+
+	// Driver recvs a write request:
+	// - check to see if there are queued read requests
+	// - if there is a queued read, use the write to satisfy the read, and complete both requests
+	// - else, queue the write, and defer the request with STATUS_PENDING
+
+	PIO_STACK_LOCATION pIoStack = IoGetCurrentIrpStackLocation(pIrp);
+	if (0 == pIoStack->Parameters.Write.Length)
 	{
-		KdPrint(("Failed to ExAllocatePoolWithTag() [THIS IS REALLY BAD]"));
+		// zero-length writes are invalid
 
-		pIrp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+		pIrp->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
 		pIrp->IoStatus.Information = 0;
 
 		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
 
-		return STATUS_INSUFFICIENT_RESOURCES;
+		return STATUS_INVALID_DEVICE_REQUEST;
 	}
 
-	// add the pointer to the IRP to the new item
-	newItem->pIrp = pIrp;
-	newItem->ReadLength = pIoStack->Parameters.Read.Length;
+	CancelSafeQueue::SetPriority(pIrp, ASYNCIO_PRIORITY_NORMAL);
 
-	// push the new entry onto the read queue
-	PushItemReadQueueUnsafe(&newItem->ListEntry);
-	g_GlobalState.ReadQueueCount++;
+	return SubmitRequest(pIrp, FALSE, nullptr);
+}
 
-	IoMarkIrpPending(pIrp);
+/* ----------------------------------------------------------------------------
+ *	Rendezvous
+ */
 
-	// set the cancellation routine
-	IoSetCancelRoutine(pIrp, AsyncIoCancelRoutine);
+// Pairs a read (or receive) with a pending write (or send), or pends it.
+//
+// pCallerBuffer is the request's buffer in the caller's address space, for
+// METHOD_NEITHER requests; it is only used while still in the caller's
+// context, and is locked into an MDL if the request has to wait. Otherwise
+// the request's buffer is its MDL.
+//
+// Matched requests are collected and only completed once no queue lock is
+// held.
+NTSTATUS SubmitRequest(PIRP pIrp, BOOLEAN bRead, PVOID pCallerBuffer)
+{
+	auto pChannel = GetChannel(pIrp);
 
-	return STATUS_PENDING;
+	// read without the locks: modes only change while the channel is idle
+	if (0 != pChannel->Pipe.Capacity())
+	{
+		return PipeRequest(pChannel, pIrp, bRead, pCallerBuffer);
+	}
+
+	LIST_ENTRY Completions;
+	InitializeListHead(&Completions);
+
+	NTSTATUS status;
+
+	// only the opposite queue's lock is needed to take a pending request
+	auto& Opposite = bRead ? pChannel->WriteQueue : pChannel->ReadQueue;
+	auto pMatch = RendezvousTryMatch(Opposite);
+	if (nullptr != pMatch)
+	{
+		Opposite.Served(pMatch);
+
+		if (bRead)
+		{
+			TransferData(pIrp, pCallerBuffer, pMatch, nullptr, &Completions);
+		}
+		else
+		{
+			TransferData(pMatch, nullptr, pIrp, pCallerBuffer, &Completions);
+		}
+
+		status = pIrp->IoStatus.Status;
+	}
+	else
+	{
+		status = PendRequest(pChannel, pIrp, bRead, pCallerBuffer, &Completions);
+	}
+
+	CompleteRequests(&Completions);
+
+	return status;
 }
 
-NTSTATUS HandleReadPendingWriteAvailable(PIRP pIrp, PIO_STACK_LOCATION pIoStack)
+// nothing to pair with at first look: queue the request
+NTSTATUS PendRequest(Channel* pChannel, PIRP pIrp, BOOLEAN bRead, PVOID pCallerBuffer, PLIST_ENTRY pCompletions)
 {
-	// remove an item from the write queue
-	auto pListEntry = PopItemWriteQueueUnsafe();
-	auto pWriteEntry = CONTAINING_RECORD(pListEntry, WRITE_QUEUE_ITEM, ListEntry);
+	if (nullptr != pCallerBuffer)
+	{
+		auto status = LockCallerBuffer(pIrp, pCallerBuffer, GetRequestLength(pIrp), bRead);
+		if (!NT_SUCCESS(status))
+		{
+			pIrp->IoStatus.Status = status;
+			pIrp->IoStatus.Information = 0;
 
-	// prepare to complete the pending write request
+			InsertTailList(pCompletions, &pIrp->Tail.Overlay.ListEntry);
 
-	auto pWriteIrp = pWriteEntry->pIrp;
-	const auto WriteLength = pWriteEntry->WriteLength;
+			return status;
+		}
+	}
 
-	pWriteIrp->IoStatus.Status = STATUS_SUCCESS;
-	pWriteIrp->IoStatus.Information = WriteLength;
-	pWriteIrp->CancelRoutine = nullptr;
+	// nothing moved yet, should it be cancelled
+	pIrp->IoStatus.Information = 0;
 
-	// prepare to complete the read request
+	// once queued, the other side may complete the IRP at any time
+	IoMarkIrpPending(pIrp);
+
+	// a request of the other kind may have been queued since the first look
+	PIRP pMatch = nullptr;
+	auto result = RendezvousMatchOrQueue(pChannel->ReadQueue, pChannel->WriteQueue, bRead != FALSE, pIrp, &pMatch);
 
-	const auto ReadLength = pIoStack->Parameters.Read.Length;
+	if (RendezvousResult::Matched == result)
+	{
+		(bRead ? pChannel->WriteQueue : pChannel->ReadQueue).Served(pMatch);
+
+		if (bRead)
+		{
+			TransferData(pIrp, nullptr, pMatch, nullptr, pCompletions);
+		}
+		else
+		{
+			TransferData(pMatch, nullptr, pIrp, nullptr, pCompletions);
+		}
+	}
+	else if (RendezvousResult::Cancelled == result)
+	{
+		pIrp->IoStatus.Status = STATUS_CANCELLED;
+		pIrp->IoStatus.Information = 0;
+
+		InsertTailList(pCompletions, &pIrp->Tail.Overlay.ListEntry);
+	}
+
+	return STATUS_PENDING;
+}
+
+// Copies from the write to the read, once, and collects both for
+// completion. A null buffer means the request's MDL.
+VOID TransferData(PIRP pReadIrp, PVOID pReadBuffer, PIRP pWriteIrp, PVOID pWriteBuffer, PLIST_ENTRY pCompletions)
+{
+	const auto ReadLength  = GetRequestLength(pReadIrp);
+	const auto WriteLength = GetRequestLength(pWriteIrp);
 
 	// if the read is larger than the write from which the read is serviced,
 	// only read up to the length of the original write request
 	// otherwise, read the full requested read size
-	const ULONG CopyLength = (ReadLength >= WriteLength) ? WriteLength : ReadLength;
+	ULONG CopyLength = (ReadLength >= WriteLength) ? WriteLength : ReadLength;
 
-	// perform the data transfer
-	RtlCopyMemory(pIrp->AssociatedIrp.SystemBuffer, pWriteIrp->AssociatedIrp.SystemBuffer, CopyLength);
+	auto ReadStatus  = STATUS_SUCCESS;
+	auto WriteStatus = STATUS_SUCCESS;
 
-	pIrp->IoStatus.Status = STATUS_SUCCESS;
-	pIrp->IoStatus.Information = CopyLength;
+	if (nullptr == pReadBuffer)
+	{
+		pReadBuffer = MapRequestBuffer(pReadIrp);
+	}
 
-	// complete both requests
-	IoCompleteRequest(pWriteIrp, IO_NO_INCREMENT);
-	IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+	if (nullptr == pWriteBuffer)
+	{
+		pWriteBuffer = MapRequestBuffer(pWriteIrp);
+	}
+
+	if (nullptr == pReadBuffer || nullptr == pWriteBuffer)
+	{
+		// out of system PTEs; neither side has moved any data
+		ReadStatus  = STATUS_INSUFFICIENT_RESOURCES;
+		WriteStatus = STATUS_INSUFFICIENT_RESOURCES;
+		CopyLength  = 0;
+	}
+	else
+	{
+		// one side may be a METHOD_NEITHER caller's buffer, which can fault;
+		// that side fails, and the other completes having moved nothing
+		__try
+		{
+			RtlCopyMemory(pReadBuffer, pWriteBuffer, CopyLength);
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER)
+		{
+			const auto FaultStatus = GetExceptionCode();
+
+			if (nullptr == pReadIrp->MdlAddress)
+			{
+				ReadStatus = FaultStatus;
+			}
+			else
+			{
+				WriteStatus = FaultStatus;
+			}
+
+			CopyLength = 0;
+		}
+	}
+
+	pReadIrp->IoStatus.Status = ReadStatus;
+	pReadIrp->IoStatus.Information = CopyLength;
 
-	// decrement the number of pending writes
-	g_GlobalState.WriteQueueCount--;
+	pWriteIrp->IoStatus.Status = WriteStatus;
+	pWriteIrp->IoStatus.Information = CopyLength;
 
-	// cleanup the popped entry
-	ExFreePoolWithTag(pWriteEntry, ASYNCIO_DRIVER_TAG);
+	// a pair that failed moved nothing and is not a match
+	if (NT_SUCCESS(ReadStatus) && NT_SUCCESS(WriteStatus))
+	{
+		g_GlobalState.Stats.RecordMatch(CopyLength);
+	}
+
+	// complete both requests once the caller is done; neither is on a
+	// queue, so their list entries are free
+	InsertTailList(pCompletions, &pWriteIrp->Tail.Overlay.ListEntry);
+	InsertTailList(pCompletions, &pReadIrp->Tail.Overlay.ListEntry);
+}
+
+// transfer length of a read / write or a message or priority IOCTL, from
+// its stack location
+ULONG GetRequestLength(PIRP pIrp)
+{
+	auto pIoStack = IoGetCurrentIrpStackLocation(pIrp);
+
+	switch (pIoStack->MajorFunction)
+	{
+	case IRP_MJ_READ:
+		return pIoStack->Parameters.Read.Length;
+	case IRP_MJ_WRITE:
+		return pIoStack->Parameters.Write.Length;
+	default:
+		return (IOCTL_ASYNCIO_SEND_MESSAGE == pIoStack->Parameters.DeviceIoControl.IoControlCode)
+			? pIoStack->Parameters.DeviceIoControl.InputBufferLength
+			: pIoStack->Parameters.DeviceIoControl.OutputBufferLength;
+	}
+}
+
+// system address of the pages described by the request's MDL
+PVOID MapRequestBuffer(PIRP pIrp)
+{
+	if (nullptr == pIrp->MdlAddress)
+	{
+		return nullptr;
+	}
+
+	return MmGetSystemAddressForMdlSafe(pIrp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+}
+
+// Describes a METHOD_NEITHER caller's buffer with a locked MDL, so it can be
+// reached after the request is pended. The I/O manager unlocks and frees
+// the IRP's MDL when the request completes.
+NTSTATUS LockCallerBuffer(PIRP pIrp, PVOID pBuffer, ULONG Length, BOOLEAN bRead)
+{
+	auto pMdl = IoAllocateMdl(pBuffer, Length, FALSE, FALSE, nullptr);
+	if (nullptr == pMdl)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	__try
+	{
+		MmProbeAndLockPages(pMdl, pIrp->RequestorMode, bRead ? IoWriteAccess : IoReadAccess);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		IoFreeMdl(pMdl);
+		return GetExceptionCode();
+	}
+
+	pIrp->MdlAddress = pMdl;
 
 	return STATUS_SUCCESS;
 }
 
 /* ----------------------------------------------------------------------------
- *	Write Dispatch
+ *	Pipe Mode
  */
 
-_Use_decl_annotations_
-NTSTATUS DispatchWrite(PDEVICE_OBJECT, PIRP pIrp)
+// Reads and writes stream through the ring instead of pairing up: a write
+// completes once all of its data is in the ring, and a read completes with
+// whatever the ring holds, up to its length, regardless of where writes
+// began or ended. Reads wait only while the ring is empty and writes only
+// while it is full; each kind is serviced in arrival order.
+//
+// The ring's state is only touched with both queue locks held, but its
+// bytes are copied with them released: under the locks a request is picked
+// and a span of the ring claimed for it (see ByteRing.h), the copy runs
+// without them, and the span is published under them again. One copy of
+// each kind is under way at a time, which keeps each kind in order; a
+// request that finds one under way waits behind it. Whoever finishes a copy
+// begins the next ones it lets move, so nothing is left waiting on a ring
+// that could serve it. A METHOD_NEITHER caller's buffer is locked down
+// first, since the copy may run in another thread.
+NTSTATUS PipeRequest(Channel* pChannel, PIRP pIrp, BOOLEAN bRead, PVOID pCallerBuffer)
 {
-	// handle write requests
+	NTSTATUS status;
 
-	// Driver recvs a write request:
-	// - check to see if there are queued read requests
-	// - if there is a queued read, use the write to satisfy the read, and complete both requests
-	// - else, queue the write, and defer the request with STATUS_PENDING
+	if (nullptr != pCallerBuffer)
+	{
+		status = LockCallerBuffer(pIrp, pCallerBuffer, GetRequestLength(pIrp), bRead);
+		if (!NT_SUCCESS(status))
+		{
+			pIrp->IoStatus.Status = status;
+			pIrp->IoStatus.Information = 0;
+
+			IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+
+			return status;
+		}
+	}
+
+	LIST_ENTRY Completions;
+	InitializeListHead(&Completions);
+
+	auto& Queue = bRead ? pChannel->ReadQueue : pChannel->WriteQueue;
+	auto& Pipe  = pChannel->Pipe;
+
+	// counts the bytes moved so far
+	pIrp->IoStatus.Information = 0;
+
+	// indexed by bRead
+	PipeCopy Copies[2] = {};
 
-	PIO_STACK_LOCATION pIoStack = IoGetCurrentIrpStackLocation(pIrp);
-	if (0 == pIoStack->Parameters.Write.Length)
 	{
-		// zero-length writes are invalid
+		AutoLock<CancelSafeQueue> readLocker(pChannel->ReadQueue);
+		AutoLock<CancelSafeQueue> writeLocker(pChannel->WriteQueue);
 
-		pIrp->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
-		pIrp->IoStatus.Information = 0;
+		// only requests with nobody of their kind ahead of them may go
+		// straight to the ring, and a write only if all of it fits
+		const BOOLEAN bFirst = (0 == Queue.Count()) && !(bRead ? Pipe.Reading() : Pipe.Writing());
 
-		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+		if (bFirst && (bRead ? 0 != Pipe.Size() : GetRequestLength(pIrp) <= Pipe.Space()))
+		{
+			PipeBegin(pChannel, pIrp, bRead, FALSE, &Copies[bRead], &Completions);
 
-		return STATUS_INVALID_DEVICE_REQUEST;
+			// the copy itself cannot fail
+			status = (nullptr != Copies[bRead].pIrp) ? STATUS_SUCCESS : pIrp->IoStatus.Status;
+		}
+		else
+		{
+			status = STATUS_PENDING;
+			IoMarkIrpPending(pIrp);
+
+			if (!Queue.PushTail(pIrp))
+			{
+				pIrp->IoStatus.Status = STATUS_CANCELLED;
+				InsertTailList(&Completions, &pIrp->Tail.Overlay.ListEntry);
+			}
+		}
+
+		// a write that only partly fits starts from the queue
+		PipeStart(pChannel, Copies, &Completions);
 	}
 
-	// acquire the global state lock to protect queue operations
-	AutoLock<FastMutex> locker(g_GlobalState.GlobalStateLock);
+	CompleteRequests(&Completions);
+
+	PipeRun(pChannel, Copies, &Completions);
+
+	return status;
+}
+
+// Claims the ring span for the request's next copy, as much as the ring
+// allows, or finishes the request if its buffer cannot be mapped. bQueued
+// says whether it was taken from its queue.
+// IMPT: assumes both queue locks are held, no copy of its kind is under way
+// and the ring has bytes (for a read) or space (for a write)
+VOID PipeBegin(Channel* pChannel, PIRP pIrp, BOOLEAN bRead, BOOLEAN bQueued, PipeCopy* pCopy, PLIST_ENTRY pCompletions)
+{
+	auto& Pipe = pChannel->Pipe;
 
-	if (IsListEmpty(&g_GlobalState.ListHeadRead))
+	auto pBuffer = static_cast<PUCHAR>(MapRequestBuffer(pIrp));
+	if (nullptr == pBuffer)
 	{
-		return HandleWriteNoPendingReads(pIrp, pIoStack);
+		if (bQueued)
+		{
+			(bRead ? pChannel->ReadQueue : pChannel->WriteQueue).Served(pIrp);
+		}
+
+		pIrp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+		InsertTailList(pCompletions, &pIrp->Tail.Overlay.ListEntry);
+		return;
+	}
+
+	// a write carries on from where it left off; a read starts afresh
+	const auto Done = pIrp->IoStatus.Information;
+	const auto Left = GetRequestLength(pIrp) - Done;
+
+	pCopy->pIrp    = pIrp;
+	pCopy->pBuffer = pBuffer + Done;
+	pCopy->bQueued = bQueued;
+	pCopy->Length  = bRead ? Pipe.BeginRead(Left, &pCopy->Offset) : Pipe.BeginWrite(Left, &pCopy->Offset);
+}
+
+// Begins a copy for the oldest waiting request of each kind, if the ring
+// lets it move and no copy of its kind is under way.
+// IMPT: assumes both queue locks are held
+VOID PipeStart(Channel* pChannel, PipeCopy* pCopies, PLIST_ENTRY pCompletions)
+{
+	auto& Pipe = pChannel->Pipe;
+
+	// a request that cannot begin is finished with; go on to the next
+	while (!Pipe.Reading() && 0 != Pipe.Size())
+	{
+		auto pIrp = pChannel->ReadQueue.PopHead();
+		if (nullptr == pIrp)
+		{
+			break;
+		}
+
+		PipeBegin(pChannel, pIrp, TRUE, TRUE, &pCopies[TRUE], pCompletions);
+	}
+
+	while (!Pipe.Writing() && 0 != Pipe.Space())
+	{
+		auto pIrp = pChannel->WriteQueue.PopHead();
+		if (nullptr == pIrp)
+		{
+			break;
+		}
+
+		PipeBegin(pChannel, pIrp, FALSE, TRUE, &pCopies[FALSE], pCompletions);
+	}
+}
+
+// Publishes a finished copy. The request is done unless it is a write with
+// more to go, which keeps its place at the front of its queue.
+// IMPT: assumes both queue locks are held
+VOID PipeFinish(Channel* pChannel, PipeCopy* pCopy, BOOLEAN bRead, PLIST_ENTRY pCompletions)
+{
+	auto& Pipe  = pChannel->Pipe;
+	auto& Queue = bRead ? pChannel->ReadQueue : pChannel->WriteQueue;
+
+	auto pIrp = pCopy->pIrp;
+	pCopy->pIrp = nullptr;
+
+	if (bRead)
+	{
+		// a read is done with whatever it gets
+		Pipe.EndRead();
+		pIrp->IoStatus.Information = pCopy->Length;
+
+		g_GlobalState.Stats.RecordBytes(static_cast<ULONG>(pCopy->Length));
 	}
 	else
 	{
-		return HandleWritePendingReadAvailable(pIrp, pIoStack);
+		Pipe.EndWrite();
+		pIrp->IoStatus.Information += pCopy->Length;
+
+		if (pIrp->IoStatus.Information < GetRequestLength(pIrp))
+		{
+			// only queued writes are begun without room for all of them
+			NT_ASSERT(pCopy->bQueued);
+
+			if (!Queue.PushHead(pIrp))
+			{
+				pIrp->IoStatus.Status = STATUS_CANCELLED;
+				InsertTailList(pCompletions, &pIrp->Tail.Overlay.ListEntry);
+			}
+
+			return;
+		}
+	}
+
+	if (pCopy->bQueued)
+	{
+		Queue.Served(pIrp);
 	}
+
+	pIrp->IoStatus.Status = STATUS_SUCCESS;
+	InsertTailList(pCompletions, &pIrp->Tail.Overlay.ListEntry);
 }
 
-// no pending reads available, queue the write
-NTSTATUS HandleWriteNoPendingReads(PIRP pIrp, PIO_STACK_LOCATION pIoStack)
+// Carries out the copies begun in pCopies, then publishes them and begins
+// whatever they let move, until nothing is left to copy. Requests are
+// completed as they finish.
+// IMPT: assumes no queue lock is held
+VOID PipeRun(Channel* pChannel, PipeCopy* pCopies, PLIST_ENTRY pCompletions)
 {
-	constexpr auto allocSize = sizeof(WRITE_QUEUE_ITEM);
-	auto newItem = static_cast<PWRITE_QUEUE_ITEM>(ExAllocatePoolWithTag(PagedPool, allocSize, ASYNCIO_DRIVER_TAG));
-	if (nullptr == newItem)
+	auto& Pipe = pChannel->Pipe;
+
+	while (nullptr != pCopies[TRUE].pIrp || nullptr != pCopies[FALSE].pIrp)
 	{
-		KdPrint(("Failed to ExAllocatePoolWithTag() [THIS IS REALLY BAD]"));
+		// the claimed spans are this thread's alone, and the ring's buffer
+		// cannot be replaced while they are claimed
+		if (nullptr != pCopies[TRUE].pIrp)
+		{
+			Pipe.CopyOut(pCopies[TRUE].Offset, pCopies[TRUE].pBuffer, pCopies[TRUE].Length);
+		}
 
-		pIrp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
-		pIrp->IoStatus.Information = 0;
+		if (nullptr != pCopies[FALSE].pIrp)
+		{
+			Pipe.CopyIn(pCopies[FALSE].Offset, pCopies[FALSE].pBuffer, pCopies[FALSE].Length);
+		}
 
-		IoCompleteRequest(pIrp, 0);
+		{
+			AutoLock<CancelSafeQueue> readLocker(pChannel->ReadQueue);
+			AutoLock<CancelSafeQueue> writeLocker(pChannel->WriteQueue);
 
-		return STATUS_INSUFFICIENT_RESOURCES;
+			if (nullptr != pCopies[TRUE].pIrp)
+			{
+				PipeFinish(pChannel, &pCopies[TRUE], TRUE, pCompletions);
+			}
+
+			if (nullptr != pCopies[FALSE].pIrp)
+			{
+				PipeFinish(pChannel, &pCopies[FALSE], FALSE, pCompletions);
+			}
+
+			PipeStart(pChannel, pCopies, pCompletions);
+		}
+
+		CompleteRequests(pCompletions);
 	}
+}
 
-	// add the pointer to the IRP to the new item
-	newItem->pIrp = pIrp;
-	newItem->WriteLength = pIoStack->Parameters.Write.Length;
+// Switches the channel to pipe mode with a ring of RingSize bytes, or back
+// to pairing reads with writes when RingSize is 0. Only done while nothing
+// is pending and the ring is empty, so no data is dropped or delivered
+// twice.
+NTSTATUS SetPipeMode(Channel* pChannel, ULONG RingSize)
+{
+	if (RingSize > ASYNCIO_MAX_PIPE_SIZE)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
 
-	// push the new item onto the queue
-	PushItemWriteQueueUnsafe(&newItem->ListEntry);
-	g_GlobalState.WriteQueueCount++;
+	PUCHAR pBuffer = nullptr;
+	if (0 != RingSize)
+	{
+		pBuffer = static_cast<PUCHAR>(ExAllocatePoolWithTag(NonPagedPoolNx, RingSize, ASYNCIO_ALLOC_TAG));
+		if (nullptr == pBuffer)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
 
-	IoMarkIrpPending(pIrp);
+	auto status = STATUS_SUCCESS;
 
-	// set the cancellation routine
-	IoSetCancelRoutine(pIrp, AsyncIoCancelRoutine);
+	{
+		AutoLock<CancelSafeQueue> readLocker(pChannel->ReadQueue);
+		AutoLock<CancelSafeQueue> writeLocker(pChannel->WriteQueue);
 
-	return STATUS_PENDING;
+		auto& Pipe = pChannel->Pipe;
+
+		if (0 != pChannel->ReadQueue.Count() || 0 != pChannel->WriteQueue.Count()
+			|| 0 != Pipe.Size() || Pipe.Reading() || Pipe.Writing())
+		{
+			status = STATUS_DEVICE_BUSY;
+		}
+		else
+		{
+			auto pOldBuffer = Pipe.Buffer();
+			Pipe.Attach(pBuffer, RingSize);
+			pBuffer = pOldBuffer;
+		}
+	}
+
+	// whichever buffer is not in use
+	if (nullptr != pBuffer)
+	{
+		ExFreePoolWithTag(pBuffer, ASYNCIO_ALLOC_TAG);
+	}
+
+	return status;
 }
 
-NTSTATUS HandleWritePendingReadAvailable(PIRP pIrp, PIO_STACK_LOCATION pIoStack)
+/* ----------------------------------------------------------------------------
+ *	Batches
+ */
+
+// BatchMatch()'s engine in the driver: descriptor segments are the caller's
+// memory, already probed, and pending requests are reached through their
+// MDLs. Matched requests are collected for completion once the pass is over.
+class BatchEngine {
+public:
+	BatchEngine(Channel* pChannel, PLIST_ENTRY pCompletions)
+		: _pChannel(pChannel), _pCompletions(pCompletions) {}
+
+	bool TakePending(bool bRead, const ASYNCIO_BATCH_SEGMENT* pSegments, unsigned int Count, ASYNCIO_BATCH_COMPLETION* pCompletion)
+	{
+		auto& Queue = bRead ? _pChannel->WriteQueue : _pChannel->ReadQueue;
+		auto pIrp = RendezvousTryMatch(Queue);
+		if (nullptr == pIrp)
+		{
+			return false;
+		}
+
+		ASYNCIO_BATCH_SEGMENT IrpSegment = {};
+		IrpSegment.Address = reinterpret_cast<ULONG_PTR>(MapRequestBuffer(pIrp));
+		IrpSegment.Length  = GetRequestLength(pIrp);
+
+		ULONG Copied = 0;
+		auto status = STATUS_INSUFFICIENT_RESOURCES;
+
+		if (0 != IrpSegment.Address)
+		{
+			status = bRead
+				? CopyBatchSegments(pSegments, Count, &IrpSegment, 1, &Copied)
+				: CopyBatchSegments(&IrpSegment, 1, pSegments, Count, &Copied);
+		}
+
+		pCompletion->Status = status;
+		pCompletion->Information = Copied;
+
+		// a fault is in the caller's memory: only the descriptor fails, and
+		// the pending request goes back to wait for another partner
+		if (!NT_SUCCESS(status) && STATUS_INSUFFICIENT_RESOURCES != status)
+		{
+			Requeue(!bRead, pIrp);
+			return true;
+		}
+
+		Queue.Served(pIrp);
+
+		pIrp->IoStatus.Status = status;
+		pIrp->IoStatus.Information = Copied;
+
+		if (NT_SUCCESS(status))
+		{
+			g_GlobalState.Stats.RecordMatch(Copied);
+		}
+
+		InsertTailList(_pCompletions, &pIrp->Tail.Overlay.ListEntry);
+
+		return true;
+	}
+
+	void Transfer(
+		const ASYNCIO_BATCH_SEGMENT* pReadSegments, unsigned int ReadCount,
+		const ASYNCIO_BATCH_SEGMENT* pWriteSegments, unsigned int WriteCount,
+		ASYNCIO_BATCH_COMPLETION* pReadCompletion,
+		ASYNCIO_BATCH_COMPLETION* pWriteCompletion)
+	{
+		ULONG Copied = 0;
+		auto status = CopyBatchSegments(pReadSegments, ReadCount, pWriteSegments, WriteCount, &Copied);
+
+		// both sides are the caller's; either may have faulted
+		pReadCompletion->Status = status;
+		pReadCompletion->Information = Copied;
+		pWriteCompletion->Status = status;
+		pWriteCompletion->Information = Copied;
+
+		if (NT_SUCCESS(status))
+		{
+			g_GlobalState.Stats.RecordMatch(Copied);
+		}
+	}
+
+private:
+	// Puts a request taken by TakePending() back at the front of its queue.
+	// A request of the other kind may have been queued while it was off,
+	// having found the queue empty; then the two are paired instead, so at
+	// most one queue stays non-empty.
+	void Requeue(bool bIrpRead, PIRP pIrp)
+	{
+		auto& Own      = bIrpRead ? _pChannel->ReadQueue : _pChannel->WriteQueue;
+		auto& Opposite = bIrpRead ? _pChannel->WriteQueue : _pChannel->ReadQueue;
+
+		// lock order: read queue, then write queue
+		_pChannel->ReadQueue.Lock();
+		_pChannel->WriteQueue.Lock();
+
+		auto pMatch = Opposite.PopHead();
+		const auto bQueued = (nullptr == pMatch) && Own.PushHead(pIrp);
+
+		_pChannel->WriteQueue.Unlock();
+		_pChannel->ReadQueue.Unlock();
+
+		if (nullptr != pMatch)
+		{
+			Own.Served(pIrp);
+			Opposite.Served(pMatch);
+
+			if (bIrpRead)
+			{
+				TransferData(pIrp, nullptr, pMatch, nullptr, _pCompletions);
+			}
+			else
+			{
+				TransferData(pMatch, nullptr, pIrp, nullptr, _pCompletions);
+			}
+		}
+		else if (!bQueued)
+		{
+			pIrp->IoStatus.Status = STATUS_CANCELLED;
+			pIrp->IoStatus.Information = 0;
+
+			InsertTailList(_pCompletions, &pIrp->Tail.Overlay.ListEntry);
+		}
+	}
+
+	Channel*    _pChannel;
+	PLIST_ENTRY _pCompletions;
+};
+
+// Matches a batch (see Batch.h) against the channel's pending requests and
+// against itself, in one pass. The completions are built apart and copied
+// over the descriptors at the end, since METHOD_BUFFERED input and output
+// share the system buffer.
+NTSTATUS SubmitBatch(Channel* pChannel, PIRP pIrp, PIO_STACK_LOCATION pIoStack, PULONG pCompletionSize)
 {
-	// pending read is available, complete both requests
+	auto pHeader = static_cast<const ASYNCIO_BATCH_HEADER*>(pIrp->AssociatedIrp.SystemBuffer);
 
-	// remove the pending read entry from the queue
-	auto pListEntry = PopItemReadQueueUnsafe();
-	auto pReadEntry = CONTAINING_RECORD(pListEntry, READ_QUEUE_ITEM, ListEntry);
+	if (nullptr == pHeader || !BatchValidate(
+		pHeader,
+		pIoStack->Parameters.DeviceIoControl.InputBufferLength,
+		pIoStack->Parameters.DeviceIoControl.OutputBufferLength))
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
 
-	// compute the transfer size
+	// a pipe mode channel streams rather than pairs
+	if (0 != pChannel->Pipe.Capacity())
+	{
+		return STATUS_INVALID_DEVICE_STATE;
+	}
 
-	const auto ReadSize = pReadEntry->ReadLength;
-	const auto WriteSize = pIoStack->Parameters.Write.Length;
+	// the segments are only ever touched from here, in the caller's context
+	if (UserMode == pIrp->RequestorMode)
+	{
+		auto status = ProbeBatchSegments(pHeader);
+		if (!NT_SUCCESS(status))
+		{
+			return status;
+		}
+	}
 
-	const auto CopySize = (ReadSize >= WriteSize) ? WriteSize : ReadSize;
+	const ULONG CompletionSize = pHeader->DescriptorCount * sizeof(ASYNCIO_BATCH_COMPLETION);
 
-	// prepare to complete the pending read request
+	auto pBatchCompletions = static_cast<ASYNCIO_BATCH_COMPLETION*>(
+		ExAllocatePoolWithTag(NonPagedPoolNx, CompletionSize, ASYNCIO_ALLOC_TAG)
+		);
 
-	auto pReadIrp = pReadEntry->pIrp;
+	if (nullptr == pBatchCompletions)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
 
-	RtlCopyMemory(pReadIrp->AssociatedIrp.SystemBuffer, pIrp->AssociatedIrp.SystemBuffer, CopySize);
+	LIST_ENTRY Completions;
+	InitializeListHead(&Completions);
 
-	pReadIrp->IoStatus.Status = STATUS_SUCCESS;
-	pReadIrp->IoStatus.Information = CopySize;
-	pReadIrp->CancelRoutine = nullptr;
+	BatchEngine Engine(pChannel, &Completions);
+	BatchMatch(pHeader, pBatchCompletions, Engine);
 
-	// prepare to complete the write request
+	CompleteRequests(&Completions);
 
-	pIrp->IoStatus.Status = STATUS_SUCCESS;
-	pIrp->IoStatus.Information = CopySize;
+	RtlCopyMemory(pIrp->AssociatedIrp.SystemBuffer, pBatchCompletions, CompletionSize);
+	ExFreePoolWithTag(pBatchCompletions, ASYNCIO_ALLOC_TAG);
 
-	// complete both requests
-	IoCompleteRequest(pReadIrp, IO_NO_INCREMENT);
-	IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+	*pCompletionSize = CompletionSize;
 
-	// decrement the number of pending reads
-	g_GlobalState.ReadQueueCount--;
+	return STATUS_SUCCESS;
+}
 
-	// cleanup the dequeued item
-	ExFreePoolWithTag(pReadEntry, ASYNCIO_DRIVER_TAG);
+// reads' segments must be writable and writes' readable, in user space
+NTSTATUS ProbeBatchSegments(const ASYNCIO_BATCH_HEADER* pHeader)
+{
+	auto pDescriptors = BatchDescriptors(pHeader);
+	auto pSegments    = BatchSegments(pHeader);
+
+	__try
+	{
+		for (ULONG i = 0; i < pHeader->DescriptorCount; ++i)
+		{
+			const auto& Descriptor = pDescriptors[i];
+
+			for (ULONG j = 0; j < Descriptor.SegmentCount; ++j)
+			{
+				const auto& Segment = pSegments[Descriptor.FirstSegment + j];
+				auto pAddress = reinterpret_cast<PVOID>(static_cast<ULONG_PTR>(Segment.Address));
+
+				if (ASYNCIO_BATCH_READ == Descriptor.Operation)
+				{
+					ProbeForWrite(pAddress, Segment.Length, 1);
+				}
+				else
+				{
+					ProbeForRead(pAddress, Segment.Length, 1);
+				}
+			}
+		}
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		return GetExceptionCode();
+	}
+
+	return STATUS_SUCCESS;
+}
+
+VOID CopyBatchMemory(PVOID pTo, const VOID* pFrom, unsigned int Size)
+{
+	RtlCopyMemory(pTo, pFrom, Size);
+}
+
+// BatchCopySegments(), with faults on the caller's memory caught; nothing
+// counts as copied when one is
+NTSTATUS CopyBatchSegments(
+	const ASYNCIO_BATCH_SEGMENT* pReadSegments, ULONG ReadCount,
+	const ASYNCIO_BATCH_SEGMENT* pWriteSegments, ULONG WriteCount,
+	PULONG pCopied)
+{
+	__try
+	{
+		*pCopied = BatchCopySegments(pReadSegments, ReadCount, pWriteSegments, WriteCount, CopyBatchMemory);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		*pCopied = 0;
+		return GetExceptionCode();
+	}
 
 	return STATUS_SUCCESS;
 }
@@ -387,9 +1008,22 @@ NTSTATUS DispatchDeviceIoControl(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
 	auto status   = STATUS_SUCCESS;
 	auto infoSize = 0;
 	auto pIoStack = IoGetCurrentIrpStackLocation(pIrp);
+	auto pChannel = GetChannel(pIrp);
 
 	switch (pIoStack->Parameters.DeviceIoControl.IoControlCode)
 	{
+	case IOCTL_ASYNCIO_SEND_MESSAGE:
+	case IOCTL_ASYNCIO_RECEIVE_MESSAGE:
+	{
+		// completes or pends the request itself
+		return DispatchMessage(pIrp, pIoStack);
+	}
+	case IOCTL_ASYNCIO_READ_PRIORITY:
+	case IOCTL_ASYNCIO_WRITE_PRIORITY:
+	{
+		// likewise
+		return DispatchPriorityRequest(pIrp, pIoStack);
+	}
 	case IOCTL_ASYNCIO_QUERY_QUEUE_COUNTS:
 	{
 		if (pIoStack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(MARSHAL_HELPER))
@@ -404,9 +1038,13 @@ NTSTATUS DispatchDeviceIoControl(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
 		ULONG WriteQueueCount = 0;
 		
 		{
-			AutoLock<FastMutex> locker(g_GlobalState.GlobalStateLock);
-			ReadQueueCount  = g_GlobalState.ReadQueueCount;
-			WriteQueueCount = g_GlobalState.WriteQueueCount;
+			AutoLock<CancelSafeQueue> locker(pChannel->ReadQueue);
+			ReadQueueCount = pChannel->ReadQueue.Count();
+		}
+
+		{
+			AutoLock<CancelSafeQueue> locker(pChannel->WriteQueue);
+			WriteQueueCount = pChannel->WriteQueue.Count();
 		}
 
 		auto marshaller = static_cast<PMARSHAL_HELPER>(pIrp->AssociatedIrp.SystemBuffer);
@@ -418,36 +1056,71 @@ NTSTATUS DispatchDeviceIoControl(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
 		
 		break;
 	}
-	case IOCTL_ASYNCIO_CANCEL_ALL_PENDING_IRPS:
+	case IOCTL_ASYNCIO_QUERY_STATS:
 	{
-		AutoLock<FastMutex> locker(g_GlobalState.GlobalStateLock);
-
-		while (!IsListEmpty(&g_GlobalState.ListHeadRead))
+		// at least the version and size, and as much more as fits
+		const auto OutputLength = pIoStack->Parameters.DeviceIoControl.OutputBufferLength;
+		if (OutputLength < FIELD_OFFSET(ASYNCIO_STATS, Matches))
 		{
-			auto pListEntry = PopItemReadQueueUnsafe();
-			auto pReadEntry = CONTAINING_RECORD(pListEntry, READ_QUEUE_ITEM, ListEntry);
+			status = STATUS_BUFFER_TOO_SMALL;
+			infoSize = 0;
+			break;
+		}
 
-			// cancel the pended IRP
-			IoCancelIrp(pReadEntry->pIrp);
+		// no queue lock is taken; see Stats.h
+		ASYNCIO_STATS Stats;
+		g_GlobalState.Stats.Query(&Stats);
 
-			// and deallocate the queue entry
-			ExFreePoolWithTag(pReadEntry, ASYNCIO_DRIVER_TAG);
-		}
+		const ULONG Filled = (OutputLength < sizeof(Stats)) ? OutputLength : sizeof(Stats);
+		Stats.Size = Filled;
+
+		RtlCopyMemory(pIrp->AssociatedIrp.SystemBuffer, &Stats, Filled);
 
-		while (!IsListEmpty(&g_GlobalState.ListHeadWrite))
+		status = STATUS_SUCCESS;
+		infoSize = Filled;
+
+		break;
+	}
+	case IOCTL_ASYNCIO_SET_PIPE_MODE:
+	{
+		if (pIoStack->Parameters.DeviceIoControl.InputBufferLength < sizeof(ULONG))
 		{
-			auto pListEntry = PopItemWriteQueueUnsafe();
-			auto pWriteEntry = CONTAINING_RECORD(pListEntry, READ_QUEUE_ITEM, ListEntry);
+			status = STATUS_INVALID_BUFFER_SIZE;
+			infoSize = 0;
+			break;
+		}
+
+		status = SetPipeMode(pChannel, *static_cast<PULONG>(pIrp->AssociatedIrp.SystemBuffer));
+		infoSize = 0;
+
+		break;
+	}
+	case IOCTL_ASYNCIO_SUBMIT_BATCH:
+	{
+		ULONG CompletionSize = 0;
 
-			// cancel the pended IRP
-			IoCancelIrp(pWriteEntry->pIrp);
+		status = SubmitBatch(pChannel, pIrp, pIoStack, &CompletionSize);
+		infoSize = CompletionSize;
+
+		break;
+	}
+	case IOCTL_ASYNCIO_CANCEL_ALL_PENDING_IRPS:
+	{
+		LIST_ENTRY ReadIrps;
+		LIST_ENTRY WriteIrps;
 
-			// and deallocate the queue entry
-			ExFreePoolWithTag(pWriteEntry, ASYNCIO_DRIVER_TAG);
+		// take everything off the queues, then complete it as cancelled
+		// without holding the locks
+		{
+			AutoLock<CancelSafeQueue> readLocker(pChannel->ReadQueue);
+			AutoLock<CancelSafeQueue> writeLocker(pChannel->WriteQueue);
+
+			pChannel->ReadQueue.DetachAll(&ReadIrps);
+			pChannel->WriteQueue.DetachAll(&WriteIrps);
 		}
 
-		g_GlobalState.ReadQueueCount  = 0;
-		g_GlobalState.WriteQueueCount = 0;
+		CancelRequests(&ReadIrps);
+		CancelRequests(&WriteIrps);
 
 		status = STATUS_SUCCESS;
 		infoSize = 0;
@@ -469,80 +1142,119 @@ NTSTATUS DispatchDeviceIoControl(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
 	return status;
 }
 
-_Use_decl_annotations_
-VOID AsyncIoCancelRoutine(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
+// Small messages through METHOD_NEITHER: the driver works on the caller's
+// buffers directly, so nothing goes through a system buffer. A message that
+// finds its match right away is copied in the caller's context; one that
+// has to wait is locked down first.
+NTSTATUS DispatchMessage(PIRP pIrp, PIO_STACK_LOCATION pIoStack)
 {
-	UNREFERENCED_PARAMETER(pDeviceObject);
+	const BOOLEAN bRead = (IOCTL_ASYNCIO_RECEIVE_MESSAGE == pIoStack->Parameters.DeviceIoControl.IoControlCode);
 
-	// release the global cancel spinlock, after changing cancellable state of the IRP
-	IoReleaseCancelSpinLock(pIrp->CancelIrql);
-	
-	// NOTE: should remove from the internal queue here?
+	auto pBuffer = bRead ? pIrp->UserBuffer : pIoStack->Parameters.DeviceIoControl.Type3InputBuffer;
+	auto Length  = GetRequestLength(pIrp);
 
-	// set the cancel routine to nullptr before relinquishing control of IRP
-	pIrp->CancelRoutine = nullptr;
+	auto status = STATUS_SUCCESS;
 
-	// complete the IRP with CANCELLED status
-	pIrp->IoStatus.Status = STATUS_CANCELLED;
-	pIrp->IoStatus.Information = 0;
-	IoCompleteRequest(pIrp, IO_NO_INCREMENT);
-}
+	if (0 == Length || Length > ASYNCIO_MAX_MESSAGE_SIZE || nullptr == pBuffer)
+	{
+		status = STATUS_INVALID_BUFFER_SIZE;
+	}
+	else if (UserMode == pIrp->RequestorMode)
+	{
+		__try
+		{
+			if (bRead)
+			{
+				ProbeForWrite(pBuffer, Length, 1);
+			}
+			else
+			{
+				ProbeForRead(pBuffer, Length, 1);
+			}
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER)
+		{
+			status = GetExceptionCode();
+		}
+	}
 
-/* ----------------------------------------------------------------------------
- *	Utility Functions
- */
+	if (!NT_SUCCESS(status))
+	{
+		pIrp->IoStatus.Status = status;
+		pIrp->IoStatus.Information = 0;
 
-// IMPT: assumes lock is already held
-VOID PushItemReadQueueUnsafe(LIST_ENTRY* pListEntry)
-{
-	InsertTailList(&g_GlobalState.ListHeadRead, pListEntry);
-}
+		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
 
-// IMPT: assumes lock is already held
-VOID PushItemWriteQueueUnsafe(LIST_ENTRY* pListEntry)
-{
-	InsertTailList(&g_GlobalState.ListHeadWrite, pListEntry);
-}
+		return status;
+	}
 
-// IMPT: assumes lock is already held
-PLIST_ENTRY PopItemReadQueueUnsafe()
-{
-	return RemoveHeadList(&g_GlobalState.ListHeadRead);
-}
+	CancelSafeQueue::SetPriority(pIrp, ASYNCIO_PRIORITY_NORMAL);
 
-// IMPT: assumes lock is already held
-PLIST_ENTRY PopItemWriteQueueUnsafe()
-{
-	return RemoveHeadList(&g_GlobalState.ListHeadWrite);
+	return SubmitRequest(pIrp, bRead, pBuffer);
 }
 
-// flush the read queue
-VOID FlushReadQueueUnsafe()
+// Reads and writes with a priority class. The data buffer is the output
+// buffer, which the I/O manager has already locked into the IRP's MDL, so
+// the request goes through the same path as a ReadFile / WriteFile.
+NTSTATUS DispatchPriorityRequest(PIRP pIrp, PIO_STACK_LOCATION pIoStack)
 {
-	while (!IsListEmpty(&g_GlobalState.ListHeadRead))
+	const BOOLEAN bRead = (IOCTL_ASYNCIO_READ_PRIORITY == pIoStack->Parameters.DeviceIoControl.IoControlCode);
+
+	auto pRequest = static_cast<PASYNCIO_PRIORITY_REQUEST>(pIrp->AssociatedIrp.SystemBuffer);
+
+	auto status = STATUS_SUCCESS;
+
+	if (pIoStack->Parameters.DeviceIoControl.InputBufferLength < sizeof(ASYNCIO_PRIORITY_REQUEST)
+		|| 0 == GetRequestLength(pIrp)
+		|| nullptr == pIrp->MdlAddress)
 	{
-		auto pListEntry = PopItemReadQueueUnsafe();
-		auto pReadEntry = CONTAINING_RECORD(pListEntry, READ_QUEUE_ITEM, ListEntry);
+		status = STATUS_INVALID_BUFFER_SIZE;
+	}
+	else if (pRequest->Priority >= ASYNCIO_PRIORITY_CLASSES)
+	{
+		status = STATUS_INVALID_PARAMETER;
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		pIrp->IoStatus.Status = status;
+		pIrp->IoStatus.Information = 0;
+
+		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
 
-		ExFreePoolWithTag(pReadEntry, ASYNCIO_DRIVER_TAG);
+		return status;
 	}
+
+	CancelSafeQueue::SetPriority(pIrp, pRequest->Priority);
+
+	return SubmitRequest(pIrp, bRead, nullptr);
 }
 
-// flush the write queue
-VOID FlushWriteQueueUnsafe()
+/* ----------------------------------------------------------------------------
+ *	Utility Functions
+ */
+
+// complete the requests collected by a dispatch routine; called with no
+// queue lock held
+VOID CompleteRequests(PLIST_ENTRY pCompletions)
 {
-	while (!IsListEmpty(&g_GlobalState.ListHeadWrite))
+	while (!IsListEmpty(pCompletions))
 	{
-		auto pListEntry = PopItemWriteQueueUnsafe();
-		auto pWriteEntry = CONTAINING_RECORD(pListEntry, WRITE_QUEUE_ITEM, ListEntry);
-
-		ExFreePoolWithTag(pWriteEntry, ASYNCIO_DRIVER_TAG);
+		auto pIrp = CONTAINING_RECORD(RemoveHeadList(pCompletions), IRP, Tail.Overlay.ListEntry);
+		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
 	}
 }
 
-constexpr ULONG GetDriverAllocTag()
+// complete IRPs detached from a queue as cancelled; called with no queue
+// lock held
+VOID CancelRequests(PLIST_ENTRY pListHead)
 {
-	// TODO: placeholder
-	return 0x11223344;
-}
+	while (!IsListEmpty(pListHead))
+	{
+		auto pIrp = CONTAINING_RECORD(RemoveHeadList(pListHead), IRP, Tail.Overlay.ListEntry);
 
+		// Information already counts any bytes moved while it was queued
+		pIrp->IoStatus.Status = STATUS_CANCELLED;
+		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+	}
+}
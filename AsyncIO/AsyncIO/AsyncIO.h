@@ -6,40 +6,23 @@
 #include <ntddk.h>
 
 #include "SyncHelpers.h"
+#include "IrpQueue.h"
+#include "Rendezvous.h"
+#include "Channel.h"
+#include "Batch.h"
+#include "Stats.h"
 
-// generic queue entry header 
-struct QUEUE_ITEM_HEADER
-{
-	LIST_ENTRY ListEntry;
-};
-
-// individual read queue item
-typedef struct _READ_QUEUE_ITEM 
-	: QUEUE_ITEM_HEADER
-{
-	PIRP   pIrp;
-	ULONG  ReadLength;
-} READ_QUEUE_ITEM, *PREAD_QUEUE_ITEM;
-
-// individual write queue item
-typedef struct _WRITE_QUEUE_ITEM 
-	: QUEUE_ITEM_HEADER
-{
-	PIRP   pIrp;
-	ULONG  WriteLength;
-} WRITE_QUEUE_ITEM, *PWRITE_QUEUE_ITEM;
+// tag for dynamic allocations
+constexpr ULONG ASYNCIO_ALLOC_TAG = 0x11223344;
 
 // global state management 
 struct GlobalState
 {
-	LIST_ENTRY ListHeadRead;
-	LIST_ENTRY ListHeadWrite;
-
-	ULONG ReadQueueCount;
-	ULONG WriteQueueCount;
+	// every handle's queues are those of its channel
+	ChannelTable Channels;
 
-	// protects both queues, SAD!
-	FastMutex  GlobalStateLock;
+	// device-wide counters, for IOCTL_ASYNCIO_QUERY_STATS
+	DriverStats Stats;
 };
 
 extern "C" DRIVER_INITIALIZE DriverEntry;
@@ -56,26 +39,49 @@ NTSTATUS DispatchClose(PDEVICE_OBJECT, PIRP pIrp);
 _Dispatch_type_(IRP_MJ_READ)
 _Function_class_(DRIVER_DISPATCH)
 NTSTATUS DispatchRead(PDEVICE_OBJECT, PIRP pIrp);
-NTSTATUS HandleReadNoPendingWrites(PIRP pIrp, PIO_STACK_LOCATION pIoStack);
-NTSTATUS HandleReadPendingWriteAvailable(PIRP pIrp, PIO_STACK_LOCATION pIoStack);
 
 _Dispatch_type_(IRP_MJ_WRITE)
 _Function_class_(DRIVER_DISPATCH)
 NTSTATUS DispatchWrite(PDEVICE_OBJECT, PIRP pIrp);
-NTSTATUS HandleWriteNoPendingReads(PIRP pIrp, PIO_STACK_LOCATION pIoStack);
-NTSTATUS HandleWritePendingReadAvailable(PIRP pIrp, PIO_STACK_LOCATION pIoStack);
+
+NTSTATUS SubmitRequest(PIRP pIrp, BOOLEAN bRead, PVOID pCallerBuffer);
+NTSTATUS PendRequest(Channel* pChannel, PIRP pIrp, BOOLEAN bRead, PVOID pCallerBuffer, PLIST_ENTRY pCompletions);
+VOID TransferData(PIRP pReadIrp, PVOID pReadBuffer, PIRP pWriteIrp, PVOID pWriteBuffer, PLIST_ENTRY pCompletions);
+ULONG GetRequestLength(PIRP pIrp);
+PVOID MapRequestBuffer(PIRP pIrp);
+NTSTATUS LockCallerBuffer(PIRP pIrp, PVOID pBuffer, ULONG Length, BOOLEAN bRead);
+
+// a copy between a pipe mode request and the ring, begun under both queue
+// locks and carried out with them released
+struct PipeCopy
+{
+	PIRP    pIrp;      // nullptr when there is none
+	PUCHAR  pBuffer;   // where the request's data for this copy starts
+	SIZE_T  Offset;    // of the span claimed in the ring
+	SIZE_T  Length;
+	BOOLEAN bQueued;   // taken from its queue, rather than straight from dispatch
+};
+
+NTSTATUS PipeRequest(Channel* pChannel, PIRP pIrp, BOOLEAN bRead, PVOID pCallerBuffer);
+VOID PipeBegin(Channel* pChannel, PIRP pIrp, BOOLEAN bRead, BOOLEAN bQueued, PipeCopy* pCopy, PLIST_ENTRY pCompletions);
+VOID PipeStart(Channel* pChannel, PipeCopy* pCopies, PLIST_ENTRY pCompletions);
+VOID PipeFinish(Channel* pChannel, PipeCopy* pCopy, BOOLEAN bRead, PLIST_ENTRY pCompletions);
+VOID PipeRun(Channel* pChannel, PipeCopy* pCopies, PLIST_ENTRY pCompletions);
+NTSTATUS SetPipeMode(Channel* pChannel, ULONG RingSize);
+
+NTSTATUS SubmitBatch(Channel* pChannel, PIRP pIrp, PIO_STACK_LOCATION pIoStack, PULONG pCompletionSize);
+NTSTATUS ProbeBatchSegments(const ASYNCIO_BATCH_HEADER* pHeader);
+VOID CopyBatchMemory(PVOID pTo, const VOID* pFrom, unsigned int Size);
+NTSTATUS CopyBatchSegments(
+	const ASYNCIO_BATCH_SEGMENT* pReadSegments, ULONG ReadCount,
+	const ASYNCIO_BATCH_SEGMENT* pWriteSegments, ULONG WriteCount,
+	PULONG pCopied);
 
 _Dispatch_type_(IRP_MJ_DEVICE_CONTROL)
 _Function_class_(DRIVER_DISPATCH)
 NTSTATUS DispatchDeviceIoControl(PDEVICE_OBJECT pDeviceObject, PIRP pIrp);
+NTSTATUS DispatchMessage(PIRP pIrp, PIO_STACK_LOCATION pIoStack);
+NTSTATUS DispatchPriorityRequest(PIRP pIrp, PIO_STACK_LOCATION pIoStack);
 
-_Function_class_(DRIVER_CANCEL)
-VOID AsyncIoCancelRoutine(PDEVICE_OBJECT pDeviceObject, PIRP pIrp);
-
-VOID PushItemReadQueueUnsafe(LIST_ENTRY* pListEntry);
-VOID PushItemWriteQueueUnsafe(LIST_ENTRY* pListEntry);
-PLIST_ENTRY PopItemReadQueueUnsafe();
-PLIST_ENTRY PopItemWriteQueueUnsafe();
-
-VOID FlushReadQueueUnsafe();
-VOID FlushWriteQueueUnsafe();
+VOID CompleteRequests(PLIST_ENTRY pCompletions);
+VOID CancelRequests(PLIST_ENTRY pListHead);
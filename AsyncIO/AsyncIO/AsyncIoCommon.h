@@ -3,6 +3,9 @@
 
 #pragma once
 
+#include "Batch.h"
+#include "PriorityPolicy.h"
+
 // from ntddk.h
 #define CTL_CODE( DeviceType, Function, Method, Access ) (                 \
     ((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method) \
@@ -10,12 +13,101 @@
 
 #define ASYNCIO_DEVICE 0x8000
 
+// Every request, IOCTLs included, acts on the channel of the handle it is
+// made on; reads only ever pair with writes on the same channel. Opening
+// \\.\AsyncIO\<name> (e.g. \\.\AsyncIO\7) gives a handle on channel <name>,
+// compared without regard to case; \\.\AsyncIO itself is the unnamed one.
+constexpr auto ASYNCIO_MAX_CHANNEL_NAME = 64;
+
 #define IOCTL_ASYNCIO_QUERY_QUEUE_COUNTS        CTL_CODE(ASYNCIO_DEVICE, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_ASYNCIO_CANCEL_ALL_PENDING_IRPS   CTL_CODE(ASYNCIO_DEVICE, 0x801, METHOD_NEITHER, FILE_ANY_ACCESS)
 
+// small messages: the input buffer of a send is matched with the output
+// buffer of a receive, exactly like a write with a read
+#define IOCTL_ASYNCIO_SEND_MESSAGE              CTL_CODE(ASYNCIO_DEVICE, 0x802, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define IOCTL_ASYNCIO_RECEIVE_MESSAGE           CTL_CODE(ASYNCIO_DEVICE, 0x803, METHOD_NEITHER, FILE_ANY_ACCESS)
+
+// input is a ULONG ring size in bytes: the channel's reads and writes then
+// stream through a ring of that size, as through a pipe; 0 goes back to
+// pairing each read with a write. Fails with ERROR_BUSY while anything is
+// pending or buffered.
+#define IOCTL_ASYNCIO_SET_PIPE_MODE             CTL_CODE(ASYNCIO_DEVICE, 0x804, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// input is a batch of reads and writes, output its completions; see Batch.h
+#define IOCTL_ASYNCIO_SUBMIT_BATCH              CTL_CODE(ASYNCIO_DEVICE, 0x805, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// a read / write of a given priority class: input is an
+// ASYNCIO_PRIORITY_REQUEST, and the output buffer is the data, read into or
+// written from. Pending requests are taken by class as PriorityPolicy.h
+// describes; ReadFile / WriteFile and messages are ASYNCIO_PRIORITY_NORMAL.
+#define IOCTL_ASYNCIO_READ_PRIORITY             CTL_CODE(ASYNCIO_DEVICE, 0x806, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_ASYNCIO_WRITE_PRIORITY            CTL_CODE(ASYNCIO_DEVICE, 0x807, METHOD_IN_DIRECT, FILE_ANY_ACCESS)
+
+// output is an ASYNCIO_STATS for the whole device, every channel, since the
+// driver loaded
+#define IOCTL_ASYNCIO_QUERY_STATS               CTL_CODE(ASYNCIO_DEVICE, 0x808, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// request sizes used by the interactive clients; reads and writes use
+// direct IO and may be any length
 constexpr auto MAX_READ_SIZE  = 12;
 constexpr auto MAX_WRITE_SIZE = 12;
 
+// largest send / receive message; larger transfers go through ReadFile /
+// WriteFile
+constexpr auto ASYNCIO_MAX_MESSAGE_SIZE = 4096;
+
+// largest pipe mode ring
+constexpr auto ASYNCIO_MAX_PIPE_SIZE = 16 * 1024 * 1024;
+
+typedef struct _ASYNCIO_PRIORITY_REQUEST
+{
+	ULONG Priority;   // ASYNCIO_PRIORITY
+} ASYNCIO_PRIORITY_REQUEST, * PASYNCIO_PRIORITY_REQUEST;
+
+// The statistics returned by IOCTL_ASYNCIO_QUERY_STATS. Later versions only
+// add fields at the end: the driver fills in as much of the structure as the
+// output buffer holds (at least Version and Size), and Size says how much it
+// has, so a caller uses the fields that fit in both.
+constexpr ULONG ASYNCIO_STATS_VERSION = 1;
+
+// indexes of the per-queue arrays
+constexpr ULONG ASYNCIO_STATS_READS  = 0;
+constexpr ULONG ASYNCIO_STATS_WRITES = 1;
+
+// time-in-queue buckets: bucket 0 is under 1us, bucket b from 2^(b-1)us up
+// to 2^b us, and the last one everything from 2^22us (about 4s) up
+constexpr ULONG ASYNCIO_STATS_BUCKETS = 24;
+
+typedef struct _ASYNCIO_STATS
+{
+	ULONG     Version;        // ASYNCIO_STATS_VERSION
+	ULONG     Size;           // bytes filled in
+
+	ULONGLONG Matches;        // reads paired with writes that succeeded, batches included
+	ULONGLONG BytesTransferred;  // into reads, in every mode
+
+	ULONGLONG Pended[2];      // requests that had to wait
+	ULONGLONG Cancelled[2];   // requests cancelled, pending or not
+	ULONG     HighWater[2];   // most requests pending on any one queue
+
+	// how long requests were pending before being served, counted once
+	// per request; cancelled requests are not counted
+	ULONGLONG WaitHistogram[2][ASYNCIO_STATS_BUCKETS];
+} ASYNCIO_STATS, * PASYNCIO_STATS;
+
+// the time-in-queue bucket of a wait of WaitUs microseconds
+inline ULONG StatsBucket(ULONG WaitUs)
+{
+	ULONG Bucket = 0;
+	while (0 != WaitUs && Bucket < ASYNCIO_STATS_BUCKETS - 1)
+	{
+		WaitUs >>= 1;
+		Bucket++;
+	}
+
+	return Bucket;
+}
+
 // marshalling queue count queries
 typedef struct _MARSHAL_HELPER
 {
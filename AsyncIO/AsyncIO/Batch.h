@@ -0,0 +1,252 @@
+// Batch.h
+// Batched reads and writes: the IOCTL_ASYNCIO_SUBMIT_BATCH format, and the
+// loop that matches a batch.
+
+#pragma once
+
+// A batch submits many reads and writes in one IOCTL. Its input is a header,
+// followed by DescriptorCount descriptors, followed by SegmentCount
+// segments. Each descriptor is a read or a write whose buffer is the
+// scatter / gather list of SegmentCount segments starting at FirstSegment;
+// a segment is an address in the caller's process and a length.
+//
+// The output is one completion per descriptor, in order. Status is an
+// NTSTATUS: STATUS_SUCCESS with Information bytes moved, or
+// ASYNCIO_BATCH_UNMATCHED for a descriptor that found nothing to pair with.
+// A batch never waits: descriptors that are left unmatched are simply not
+// done, and can be submitted again.
+//
+// Kept free of kernel and Windows headers, like Rendezvous.h, so that the
+// format and BatchMatch() build and run on the host as well.
+
+enum ASYNCIO_BATCH_OPERATION : unsigned int
+{
+	ASYNCIO_BATCH_READ  = 0,
+	ASYNCIO_BATCH_WRITE = 1
+};
+
+struct ASYNCIO_BATCH_HEADER
+{
+	unsigned int DescriptorCount;
+	unsigned int SegmentCount;
+};
+
+struct ASYNCIO_BATCH_DESCRIPTOR
+{
+	unsigned int Operation;     // ASYNCIO_BATCH_OPERATION
+	unsigned int FirstSegment;
+	unsigned int SegmentCount;
+	unsigned int Reserved;      // must be 0
+};
+
+struct ASYNCIO_BATCH_SEGMENT
+{
+	unsigned long long Address;
+	unsigned int       Length;
+	unsigned int       Reserved;  // must be 0
+};
+
+struct ASYNCIO_BATCH_COMPLETION
+{
+	int          Status;
+	unsigned int Information;
+};
+
+// STATUS_CANT_WAIT: nothing was there to pair with
+constexpr int ASYNCIO_BATCH_UNMATCHED = static_cast<int>(0xC00000D8);
+
+constexpr unsigned int ASYNCIO_MAX_BATCH_DESCRIPTORS = 256;
+constexpr unsigned int ASYNCIO_MAX_BATCH_SEGMENTS    = 1024;
+
+/* ----------------------------------------------------------------------------
+ *	Layout
+ */
+
+inline unsigned long long BatchInputSize(unsigned int descriptorCount, unsigned int segmentCount)
+{
+	return sizeof(ASYNCIO_BATCH_HEADER)
+		+ static_cast<unsigned long long>(descriptorCount) * sizeof(ASYNCIO_BATCH_DESCRIPTOR)
+		+ static_cast<unsigned long long>(segmentCount) * sizeof(ASYNCIO_BATCH_SEGMENT);
+}
+
+inline const ASYNCIO_BATCH_DESCRIPTOR* BatchDescriptors(const ASYNCIO_BATCH_HEADER* header)
+{
+	return reinterpret_cast<const ASYNCIO_BATCH_DESCRIPTOR*>(header + 1);
+}
+
+inline const ASYNCIO_BATCH_SEGMENT* BatchSegments(const ASYNCIO_BATCH_HEADER* header)
+{
+	return reinterpret_cast<const ASYNCIO_BATCH_SEGMENT*>(BatchDescriptors(header) + header->DescriptorCount);
+}
+
+// checks that inputLength bytes at header hold a well-formed batch, and
+// that completionLength bytes hold its completions
+inline bool BatchValidate(const ASYNCIO_BATCH_HEADER* header, unsigned long long inputLength, unsigned long long completionLength)
+{
+	if (inputLength < sizeof(ASYNCIO_BATCH_HEADER))
+		return false;
+
+	if (0 == header->DescriptorCount
+		|| header->DescriptorCount > ASYNCIO_MAX_BATCH_DESCRIPTORS
+		|| header->SegmentCount > ASYNCIO_MAX_BATCH_SEGMENTS)
+		return false;
+
+	if (inputLength < BatchInputSize(header->DescriptorCount, header->SegmentCount)
+		|| completionLength < header->DescriptorCount * sizeof(ASYNCIO_BATCH_COMPLETION))
+		return false;
+
+	auto descriptors = BatchDescriptors(header);
+	auto segments = BatchSegments(header);
+
+	for (unsigned int i = 0; i < header->DescriptorCount; ++i)
+	{
+		const auto& descriptor = descriptors[i];
+
+		if (descriptor.Operation > ASYNCIO_BATCH_WRITE || 0 != descriptor.Reserved || 0 == descriptor.SegmentCount)
+			return false;
+
+		// both limits are small, so the sum cannot wrap
+		if (descriptor.FirstSegment > header->SegmentCount
+			|| descriptor.SegmentCount > header->SegmentCount - descriptor.FirstSegment)
+			return false;
+
+		// a descriptor moves at most what a completion can report
+		unsigned long long length = 0;
+		for (unsigned int j = 0; j < descriptor.SegmentCount; ++j)
+		{
+			const auto& segment = segments[descriptor.FirstSegment + j];
+			if (0 != segment.Reserved)
+				return false;
+
+			length += segment.Length;
+		}
+
+		if (length > 0xFFFFFFFFull)
+			return false;
+	}
+
+	return true;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Copying
+ */
+
+// Copies from the write's segments into the read's, in order across segment
+// boundaries, until either list runs out; returns the bytes copied. Copy is
+// called as Copy(void* to, const void* from, size) for each contiguous run.
+template<typename TCopy>
+unsigned int BatchCopySegments(
+	const ASYNCIO_BATCH_SEGMENT* readSegments, unsigned int readCount,
+	const ASYNCIO_BATCH_SEGMENT* writeSegments, unsigned int writeCount,
+	TCopy copy)
+{
+	unsigned int copied = 0;
+	unsigned int readIndex = 0, readOffset = 0;
+	unsigned int writeIndex = 0, writeOffset = 0;
+
+	while (readIndex < readCount && writeIndex < writeCount)
+	{
+		const auto& to = readSegments[readIndex];
+		const auto& from = writeSegments[writeIndex];
+
+		auto run = to.Length - readOffset;
+		if (run > from.Length - writeOffset)
+			run = from.Length - writeOffset;
+
+		if (0 != run)
+		{
+			copy(
+				reinterpret_cast<void*>(to.Address + readOffset),
+				reinterpret_cast<const void*>(from.Address + writeOffset),
+				run);
+		}
+
+		copied += run;
+		readOffset += run;
+		writeOffset += run;
+
+		if (readOffset == to.Length)
+		{
+			readIndex++;
+			readOffset = 0;
+		}
+
+		if (writeOffset == from.Length)
+		{
+			writeIndex++;
+			writeOffset = 0;
+		}
+	}
+
+	return copied;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Matching
+ */
+
+// Matches a validated batch in one pass, in submission order, and fills in
+// completions. A descriptor first takes the oldest request of the other
+// kind already pending outside the batch, then the oldest unmatched one of
+// the other kind earlier in the batch; failing both it stays unmatched,
+// for later descriptors in the batch to take.
+//
+// TEngine provides
+//   bool TakePending(bool bRead, const ASYNCIO_BATCH_SEGMENT* segments,
+//                    unsigned int count, ASYNCIO_BATCH_COMPLETION* completion)
+//     pairs the descriptor with a pending request of the other kind, moving
+//     the data and filling in completion, or returns false if none is
+//     pending; and
+//   void Transfer(const ASYNCIO_BATCH_SEGMENT* readSegments, unsigned int readCount,
+//                 const ASYNCIO_BATCH_SEGMENT* writeSegments, unsigned int writeCount,
+//                 ASYNCIO_BATCH_COMPLETION* readCompletion,
+//                 ASYNCIO_BATCH_COMPLETION* writeCompletion)
+//     moves the data between two descriptors of the batch.
+template<typename TEngine>
+void BatchMatch(const ASYNCIO_BATCH_HEADER* header, ASYNCIO_BATCH_COMPLETION* completions, TEngine& engine)
+{
+	auto descriptors = BatchDescriptors(header);
+	auto segments = BatchSegments(header);
+	const auto count = header->DescriptorCount;
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		completions[i].Status = ASYNCIO_BATCH_UNMATCHED;
+		completions[i].Information = 0;
+	}
+
+	// everything before a cursor is of the other kind, or already matched;
+	// both only move forward, so the pass stays linear
+	unsigned int readCursor = 0;
+	unsigned int writeCursor = 0;
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const auto& descriptor = descriptors[i];
+		const bool bRead = ASYNCIO_BATCH_READ == descriptor.Operation;
+		const auto own = segments + descriptor.FirstSegment;
+
+		if (engine.TakePending(bRead, own, descriptor.SegmentCount, &completions[i]))
+			continue;
+
+		const unsigned int opposite = bRead ? ASYNCIO_BATCH_WRITE : ASYNCIO_BATCH_READ;
+		auto& cursor = bRead ? writeCursor : readCursor;
+
+		while (cursor < i && (opposite != descriptors[cursor].Operation || ASYNCIO_BATCH_UNMATCHED != completions[cursor].Status))
+			cursor++;
+
+		if (cursor == i)
+			continue;
+
+		const auto& other = descriptors[cursor];
+		const auto theirs = segments + other.FirstSegment;
+
+		if (bRead)
+			engine.Transfer(own, descriptor.SegmentCount, theirs, other.SegmentCount, &completions[i], &completions[cursor]);
+		else
+			engine.Transfer(theirs, other.SegmentCount, own, descriptor.SegmentCount, &completions[cursor], &completions[i]);
+
+		cursor++;
+	}
+}
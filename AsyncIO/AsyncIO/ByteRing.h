@@ -0,0 +1,184 @@
+// ByteRing.h
+// Fixed-size ring of bytes, the buffer behind AsyncIO's pipe mode.
+
+#pragma once
+
+#include <string.h>
+
+// A byte stream over a caller-supplied buffer: Write() appends as much as
+// fits, Read() takes as much as is there, and neither cares where earlier
+// writes began or ended. At most two copies are made per call, one up to the
+// end of the buffer and one from its start.
+//
+// Writes and reads can also be done in two phases, so that an owner can copy
+// with its lock released: BeginWrite() / BeginRead() claim a span under the
+// lock, CopyIn() / CopyOut() fill or drain it without the lock, and
+// EndWrite() / EndRead() publish it under the lock again. At most one write
+// and one read are begun at a time; a claimed span is left out of Space() or
+// Size() until it is ended, and nothing else touches it meanwhile.
+//
+// Not synchronized; the owner serializes access. Kept free of kernel headers
+// so the driver and the host benchmark share it, and free of constructors so
+// that a zeroed ring, as in a driver global, is a valid empty one with no
+// buffer.
+class ByteRing {
+public:
+	// takes over buffer as an empty ring; pass nullptr, 0 to detach
+	void Attach(unsigned char* buffer, size_t capacity)
+	{
+		_buffer = buffer;
+		_capacity = capacity;
+		_head = 0;
+		_size = 0;
+		_writing = 0;
+		_reading = 0;
+	}
+
+	unsigned char* Buffer() const
+	{
+		return _buffer;
+	}
+
+	size_t Capacity() const
+	{
+		return _capacity;
+	}
+
+	// bytes ready to be read, and not claimed by a read
+	size_t Size() const
+	{
+		return _size - _reading;
+	}
+
+	// bytes that can be written, and are not claimed by a write
+	size_t Space() const
+	{
+		return _capacity - _size - _writing;
+	}
+
+	// whether a write / read has been begun and not yet ended
+	bool Writing() const
+	{
+		return 0 != _writing;
+	}
+
+	bool Reading() const
+	{
+		return 0 != _reading;
+	}
+
+	// returns the number of bytes taken from data, at most length
+	size_t Write(const void* data, size_t length)
+	{
+		size_t offset;
+		length = BeginWrite(length, &offset);
+
+		if (0 == length)
+			return 0;
+
+		CopyIn(offset, data, length);
+		EndWrite();
+
+		return length;
+	}
+
+	// returns the number of bytes placed in data, at most length
+	size_t Read(void* data, size_t length)
+	{
+		size_t offset;
+		length = BeginRead(length, &offset);
+
+		if (0 == length)
+			return 0;
+
+		CopyOut(offset, data, length);
+		EndRead();
+
+		return length;
+	}
+
+	// claims up to length bytes of space for a write, returning how many;
+	// they start at *offset
+	size_t BeginWrite(size_t length, size_t* offset)
+	{
+		if (length > Space())
+			length = Space();
+
+		auto tail = _head + _size;
+		if (tail >= _capacity)
+			tail -= _capacity;
+
+		*offset = tail;
+		_writing = length;
+
+		return length;
+	}
+
+	// makes the bytes claimed by BeginWrite() ready to be read
+	void EndWrite()
+	{
+		_size += _writing;
+		_writing = 0;
+	}
+
+	// claims up to length of the bytes ready for a read, returning how
+	// many; they start at *offset
+	size_t BeginRead(size_t length, size_t* offset)
+	{
+		if (length > Size())
+			length = Size();
+
+		*offset = _head;
+		_reading = length;
+
+		return length;
+	}
+
+	// frees the bytes claimed by BeginRead()
+	void EndRead()
+	{
+		_head += _reading;
+		if (_head >= _capacity)
+			_head -= _capacity;
+
+		_size -= _reading;
+		_reading = 0;
+
+		// an empty ring restarts at the front, keeping later copies in one
+		// piece; not while a write has claimed space after the old tail
+		if (0 == _size && 0 == _writing)
+			_head = 0;
+	}
+
+	// copies length bytes from data into a span claimed at offset
+	void CopyIn(size_t offset, const void* data, size_t length) const
+	{
+		auto first = _capacity - offset;
+		if (first > length)
+			first = length;
+
+		auto source = static_cast<const unsigned char*>(data);
+		memcpy(_buffer + offset, source, first);
+		memcpy(_buffer, source + first, length - first);
+	}
+
+	// copies length bytes of a span claimed at offset into data
+	void CopyOut(size_t offset, void* data, size_t length) const
+	{
+		auto first = _capacity - offset;
+		if (first > length)
+			first = length;
+
+		auto target = static_cast<unsigned char*>(data);
+		memcpy(target, _buffer + offset, first);
+		memcpy(target + first, _buffer, length - first);
+	}
+
+private:
+	unsigned char* _buffer;
+	size_t         _capacity;
+	size_t         _head;
+	size_t         _size;      // written and not yet read, claimed or not
+	size_t         _writing;   // claimed by a write in progress
+	size_t         _reading;   // claimed by a read in progress
+};
@@ -0,0 +1,109 @@
+// Channel.cpp
+// Named channels: independent sets of AsyncIO queues.
+
+#include <ntddk.h>
+
+#include "Channel.h"
+#include "AsyncIO.h"
+#include "AsyncIoCommon.h"
+
+#pragma warning( disable : 28166 )  // C28166 changes IRQL and does not restore (doesn't like dtors)
+#pragma warning( disable : 28167 )  // C28167 changes IRQL and does not restore (doesn't like dtors)
+
+/* ----------------------------------------------------------------------------
+ *	ChannelTable
+ */
+
+VOID ChannelTable::Init(DriverStats* pStats)
+{
+	_pStats = pStats;
+
+	_lock.Init();
+	InitializeListHead(&_channels);
+}
+
+_Use_decl_annotations_
+NTSTATUS ChannelTable::Open(PCUNICODE_STRING pName, Channel** ppChannel)
+{
+	UNICODE_STRING Name = *pName;
+
+	// "\logs" and "logs" are the same channel
+	if (Name.Length >= sizeof(WCHAR) && L'\\' == Name.Buffer[0])
+	{
+		Name.Buffer++;
+		Name.Length -= sizeof(WCHAR);
+		Name.MaximumLength -= sizeof(WCHAR);
+	}
+
+	if (Name.Length > ASYNCIO_MAX_CHANNEL_NAME * sizeof(WCHAR))
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	AutoLock<FastMutex> locker(_lock);
+
+	for (auto pEntry = _channels.Flink; pEntry != &_channels; pEntry = pEntry->Flink)
+	{
+		auto pChannel = CONTAINING_RECORD(pEntry, Channel, Link);
+
+		if (RtlEqualUnicodeString(&pChannel->Name, &Name, TRUE))
+		{
+			pChannel->References++;
+			*ppChannel = pChannel;
+
+			return STATUS_SUCCESS;
+		}
+	}
+
+	// first handle on this channel: the name is kept right after it
+	auto pChannel = static_cast<Channel*>(
+		ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(Channel) + Name.Length, ASYNCIO_ALLOC_TAG)
+		);
+
+	if (nullptr == pChannel)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	// a zeroed ring is an empty one, in rendezvous mode
+	RtlZeroMemory(pChannel, sizeof(Channel));
+
+	pChannel->ReadQueue.Init(_pStats, ASYNCIO_STATS_READS);
+	pChannel->WriteQueue.Init(_pStats, ASYNCIO_STATS_WRITES);
+	pChannel->References = 1;
+
+	pChannel->Name.Buffer = reinterpret_cast<PWCH>(pChannel + 1);
+	pChannel->Name.Length = Name.Length;
+	pChannel->Name.MaximumLength = Name.Length;
+	RtlCopyMemory(pChannel->Name.Buffer, Name.Buffer, Name.Length);
+
+	InsertTailList(&_channels, &pChannel->Link);
+
+	*ppChannel = pChannel;
+
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+VOID ChannelTable::Close(Channel* pChannel)
+{
+	{
+		AutoLock<FastMutex> locker(_lock);
+
+		if (0 != --pChannel->References)
+		{
+			return;
+		}
+
+		RemoveEntryList(&pChannel->Link);
+	}
+
+	// IRP_MJ_CLOSE only arrives once the handle's last request has
+	// completed, so nothing is queued; whatever is left in the ring goes
+	if (nullptr != pChannel->Pipe.Buffer())
+	{
+		ExFreePoolWithTag(pChannel->Pipe.Buffer(), ASYNCIO_ALLOC_TAG);
+	}
+
+	ExFreePoolWithTag(pChannel, ASYNCIO_ALLOC_TAG);
+}
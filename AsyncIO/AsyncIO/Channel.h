@@ -0,0 +1,62 @@
+// Channel.h
+// Named channels: independent sets of AsyncIO queues.
+
+#pragma once
+
+#include <ntddk.h>
+
+#include "SyncHelpers.h"
+#include "IrpQueue.h"
+#include "ByteRing.h"
+
+// Requests are only paired with requests made on handles opened on the same
+// channel. A handle's channel is named by the rest of the path it was opened
+// with (\\.\AsyncIO\7, \\.\AsyncIO\logs), compared without regard to case;
+// the device itself is the unnamed channel. The channel is the handle's
+// FsContext, and lives as long as any handle on it.
+struct Channel
+{
+	// each queue has its own lock; code that holds both takes the read
+	// queue's first (see Rendezvous.h)
+	CancelSafeQueue ReadQueue;
+	CancelSafeQueue WriteQueue;
+
+	// pipe mode's ring, with no buffer in rendezvous mode; its state is only
+	// touched with both queue locks held, its claimed spans without them
+	// (see PipeRequest())
+	ByteRing Pipe;
+
+	// the rest is the table's, under its lock
+	LIST_ENTRY     Link;
+	ULONG          References;
+	UNICODE_STRING Name;
+};
+
+// The open channels. Channels are created by the first handle opened on
+// them and freed, ring and all, with the last one closed; only create and
+// close go through the table, so its lock is a fast mutex.
+class ChannelTable {
+public:
+	// every channel's queues record into pStats
+	VOID Init(DriverStats* pStats);
+
+	// finds or creates the channel named pName, minus any leading '\',
+	// and takes a reference on it
+	_IRQL_requires_max_(APC_LEVEL)
+	NTSTATUS Open(PCUNICODE_STRING pName, Channel** ppChannel);
+
+	// drops a reference taken by Open()
+	_IRQL_requires_max_(APC_LEVEL)
+	VOID Close(Channel* pChannel);
+
+private:
+	DriverStats* _pStats;
+	FastMutex    _lock;
+	LIST_ENTRY   _channels;
+};
+
+// the channel of the handle the IRP was issued on
+inline Channel* GetChannel(PIRP pIrp)
+{
+	return static_cast<Channel*>(IoGetCurrentIrpStackLocation(pIrp)->FileObject->FsContext);
+}
@@ -0,0 +1,246 @@
+// IrpQueue.cpp
+// Cancel-safe queue of pending IRPs.
+
+#include <ntddk.h>
+
+#include "IrpQueue.h"
+
+#pragma warning( disable : 28166 )  // C28166 changes IRQL and does not restore (doesn't like dtors)
+#pragma warning( disable : 28167 )  // C28167 changes IRQL and does not restore (doesn't like dtors)
+#pragma warning( disable : 26110 )  // C26110 caller failing to hold global cancel spin lock
+
+// the owning queue of a queued IRP, for its cancel routine
+constexpr auto IRP_CONTEXT_QUEUE = 0;
+
+// its priority class, and when PushTail() queued it (in microseconds of
+// interrupt time, compared modulo 2^32)
+constexpr auto IRP_CONTEXT_PRIORITY  = 1;
+constexpr auto IRP_CONTEXT_QUEUED_AT = 2;
+
+static ULONG CurrentMicroseconds()
+{
+	// the plain interrupt time only moves once a clock tick
+	ULONG64 QpcTimeStamp;
+	return static_cast<ULONG>(KeQueryInterruptTimePrecise(&QpcTimeStamp) / 10);
+}
+
+static ULONG QueuedAt(PLIST_ENTRY pEntry)
+{
+	auto pIrp = CONTAINING_RECORD(pEntry, IRP, Tail.Overlay.ListEntry);
+	return static_cast<ULONG>(reinterpret_cast<ULONG_PTR>(pIrp->Tail.Overlay.DriverContext[IRP_CONTEXT_QUEUED_AT]));
+}
+
+/* ----------------------------------------------------------------------------
+ *	CancelSafeQueue
+ */
+
+VOID CancelSafeQueue::Init(DriverStats* pStats, ULONG Queue)
+{
+	_pStats     = pStats;
+	_statsQueue = Queue;
+
+	KeInitializeSpinLock(&_lock);
+
+	for (auto& ListHead : _lists)
+	{
+		InitializeListHead(&ListHead);
+	}
+
+	_bitmap = 0;
+	_count  = 0;
+}
+
+VOID CancelSafeQueue::SetPriority(PIRP pIrp, ULONG Priority)
+{
+	NT_ASSERT(Priority < ASYNCIO_PRIORITY_CLASSES);
+	pIrp->Tail.Overlay.DriverContext[IRP_CONTEXT_PRIORITY] = reinterpret_cast<PVOID>(static_cast<ULONG_PTR>(Priority));
+}
+
+ULONG CancelSafeQueue::GetPriority(PIRP pIrp)
+{
+	return static_cast<ULONG>(reinterpret_cast<ULONG_PTR>(pIrp->Tail.Overlay.DriverContext[IRP_CONTEXT_PRIORITY]));
+}
+
+_Use_decl_annotations_
+VOID CancelSafeQueue::Lock()
+{
+	KIRQL OldIrql;
+	KeAcquireSpinLock(&_lock, &OldIrql);
+
+	// only written by the owner; when both queues are held the second one
+	// saves DISPATCH_LEVEL, and they are released in reverse order
+	_oldIrql = OldIrql;
+}
+
+_Use_decl_annotations_
+VOID CancelSafeQueue::Unlock()
+{
+	KeReleaseSpinLock(&_lock, _oldIrql);
+}
+
+// IMPT: assumes lock is already held
+PIRP CancelSafeQueue::PopHead()
+{
+	const auto Now = CurrentMicroseconds();
+	auto Candidates = _bitmap;
+
+	while (0 != Candidates)
+	{
+		const auto Class = PrioritySelectClass(Candidates, ASYNCIO_PRIORITY_AGE_US,
+			[this, Now](int c) { return Now - QueuedAt(_lists[c].Flink); });
+
+		auto pListHead = &_lists[Class];
+		for (auto pEntry = pListHead->Flink; pEntry != pListHead; pEntry = pEntry->Flink)
+		{
+			auto pIrp = CONTAINING_RECORD(pEntry, IRP, Tail.Overlay.ListEntry);
+
+			// a cancel routine already gone means the IRP is being cancelled;
+			// its cancel routine is waiting on our lock to unlink it
+			if (nullptr != IoSetCancelRoutine(pIrp, nullptr))
+			{
+				RemoveEntryList(pEntry);
+				Unlinked(Class);
+
+				// counted as served by Served(), once it is done with
+				return pIrp;
+			}
+		}
+
+		// every IRP of the class is being cancelled; try the next one
+		Candidates &= ~(1u << Class);
+	}
+
+	return nullptr;
+}
+
+// IMPT: assumes lock is already held
+BOOLEAN CancelSafeQueue::PushTail(PIRP pIrp)
+{
+	if (!MakeCancellable(pIrp))
+	{
+		_pStats->RecordCancelled(_statsQueue);
+		return FALSE;
+	}
+
+	const auto Class = GetPriority(pIrp);
+	pIrp->Tail.Overlay.DriverContext[IRP_CONTEXT_QUEUED_AT] = reinterpret_cast<PVOID>(static_cast<ULONG_PTR>(CurrentMicroseconds()));
+
+	InsertTailList(&_lists[Class], &pIrp->Tail.Overlay.ListEntry);
+	_bitmap |= 1u << Class;
+	_count++;
+
+	_pStats->RecordPended(_statsQueue, _count);
+
+	return TRUE;
+}
+
+// IMPT: assumes lock is already held
+BOOLEAN CancelSafeQueue::PushHead(PIRP pIrp)
+{
+	if (!MakeCancellable(pIrp))
+	{
+		_pStats->RecordCancelled(_statsQueue);
+		return FALSE;
+	}
+
+	// keeps the time it was first queued, so it goes on aging
+	const auto Class = GetPriority(pIrp);
+
+	InsertHeadList(&_lists[Class], &pIrp->Tail.Overlay.ListEntry);
+	_bitmap |= 1u << Class;
+	_count++;
+
+	return TRUE;
+}
+
+// IMPT: assumes lock is already held
+VOID CancelSafeQueue::DetachAll(PLIST_ENTRY pListHead)
+{
+	InitializeListHead(pListHead);
+
+	for (ULONG Class = 0; Class < ASYNCIO_PRIORITY_CLASSES; ++Class)
+	{
+		auto pEntry = _lists[Class].Flink;
+		while (pEntry != &_lists[Class])
+		{
+			auto pNext = pEntry->Flink;
+			auto pIrp  = CONTAINING_RECORD(pEntry, IRP, Tail.Overlay.ListEntry);
+
+			if (nullptr != IoSetCancelRoutine(pIrp, nullptr))
+			{
+				RemoveEntryList(pEntry);
+				InsertTailList(pListHead, pEntry);
+				Unlinked(Class);
+
+				// detached only to be cancelled
+				_pStats->RecordCancelled(_statsQueue);
+			}
+
+			pEntry = pNext;
+		}
+	}
+}
+
+ULONG CancelSafeQueue::Count() const
+{
+	return _count;
+}
+
+VOID CancelSafeQueue::Served(PIRP pIrp)
+{
+	_pStats->RecordServed(_statsQueue, CurrentMicroseconds() - QueuedAt(&pIrp->Tail.Overlay.ListEntry));
+}
+
+// IMPT: assumes lock is already held
+// bookkeeping for an IRP just unlinked from _lists[Priority]
+VOID CancelSafeQueue::Unlinked(ULONG Priority)
+{
+	_count--;
+
+	if (IsListEmpty(&_lists[Priority]))
+	{
+		_bitmap &= ~(1u << Priority);
+	}
+}
+
+// IMPT: assumes lock is already held
+BOOLEAN CancelSafeQueue::MakeCancellable(PIRP pIrp)
+{
+	pIrp->Tail.Overlay.DriverContext[IRP_CONTEXT_QUEUE] = this;
+
+	IoSetCancelRoutine(pIrp, CancelRoutine);
+
+	// cancelled before it got here, and we got the cancel routine back: the
+	// IRP was never cancellable, so the caller completes it
+	if (pIrp->Cancel && nullptr != IoSetCancelRoutine(pIrp, nullptr))
+	{
+		return FALSE;
+	}
+
+	// otherwise, if the IRP is being cancelled, its cancel routine removes
+	// it as soon as the caller releases the lock
+	return TRUE;
+}
+
+_Use_decl_annotations_
+VOID CancelSafeQueue::CancelRoutine(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
+{
+	UNREFERENCED_PARAMETER(pDeviceObject);
+
+	// release the global cancel spinlock; our own lock protects the queue
+	IoReleaseCancelSpinLock(pIrp->CancelIrql);
+
+	auto pQueue = static_cast<CancelSafeQueue*>(pIrp->Tail.Overlay.DriverContext[IRP_CONTEXT_QUEUE]);
+
+	// whoever cleared the cancel routine left the IRP linked for us
+	pQueue->Lock();
+	RemoveEntryList(&pIrp->Tail.Overlay.ListEntry);
+	pQueue->Unlinked(GetPriority(pIrp));
+	pQueue->_pStats->RecordCancelled(pQueue->_statsQueue);
+	pQueue->Unlock();
+
+	// complete the IRP with CANCELLED status; Information already counts
+	// any bytes moved before it was queued (a partly written pipe write)
+	pIrp->IoStatus.Status = STATUS_CANCELLED;
+	IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+}
@@ -0,0 +1,86 @@
+// IrpQueue.h
+// Cancel-safe queue of pending IRPs.
+
+#pragma once
+
+#include <ntddk.h>
+
+#include "PriorityPolicy.h"
+#include "Stats.h"
+
+// an IRP is served as one class higher for every this long it has waited
+constexpr ULONG ASYNCIO_PRIORITY_AGE_US = 50 * 1000;
+
+// A queue of pended IRPs that also owns their cancellation. IRPs are linked
+// through Tail.Overlay.ListEntry, so queueing allocates nothing.
+//
+// Whoever clears an IRP's cancel routine first owns the IRP: the queue's
+// cancel routine unlinks the IRP in O(1) and completes it as cancelled,
+// while PopHead() and DetachAll() pass over IRPs whose cancel routine is
+// already running, leaving them for it to remove.
+//
+// IRPs wait in one list per priority class, with a bitmap of the non-empty
+// lists; PopHead() picks a class as PriorityPolicy.h describes, so "oldest"
+// below means oldest within that class.
+//
+// The queue records its own pends, waits, depths and cancellations in
+// pStats, as the Queue (ASYNCIO_STATS_READS or _WRITES) given to Init().
+//
+// Lock() / Unlock() take a spinlock, which may be held together with
+// another queue's (see Rendezvous.h).
+class CancelSafeQueue {
+public:
+	VOID Init(DriverStats* pStats, ULONG Queue);
+
+	// the priority class PushTail() / PushHead() queue the IRP in; set by
+	// the dispatch routine before the IRP can reach a queue
+	static VOID SetPriority(PIRP pIrp, ULONG Priority);
+
+	_IRQL_raises_(DISPATCH_LEVEL)
+	VOID Lock();
+
+	_IRQL_requires_(DISPATCH_LEVEL)
+	VOID Unlock();
+
+	// IMPT: the following assume the lock is already held
+
+	// removes the oldest IRP of the class due next that is not being
+	// cancelled
+	PIRP PopHead();
+
+	// queues the IRP and makes it cancellable; returns FALSE, without
+	// queueing it, if it has already been cancelled
+	BOOLEAN PushTail(PIRP pIrp);
+
+	// as PushTail(), but ahead of every other IRP of its class: puts back an
+	// IRP taken by PopHead() that could only be partly serviced
+	BOOLEAN PushHead(PIRP pIrp);
+
+	// moves every IRP not being cancelled to pListHead
+	VOID DetachAll(PLIST_ENTRY pListHead);
+
+	ULONG Count() const;
+
+	// an IRP taken by PopHead() has left the queue for good, rather than
+	// going back through PushHead(): records how long it waited in all.
+	// Needs no lock
+	VOID Served(PIRP pIrp);
+
+private:
+	BOOLEAN MakeCancellable(PIRP pIrp);
+
+	VOID Unlinked(ULONG Priority);
+
+	static ULONG GetPriority(PIRP pIrp);
+
+	static DRIVER_CANCEL CancelRoutine;
+
+	DriverStats* _pStats;
+	ULONG        _statsQueue;
+
+	KSPIN_LOCK   _lock;
+	KIRQL        _oldIrql;
+	LIST_ENTRY   _lists[ASYNCIO_PRIORITY_CLASSES];
+	ULONG        _bitmap;   // bit c set while _lists[c] is not empty
+	ULONG        _count;
+};
@@ -0,0 +1,64 @@
+// PriorityPolicy.h
+// Priority classes of pending requests, and which one is served next.
+
+#pragma once
+
+// Pending requests wait in one FIFO per priority class, with a bitmap of the
+// classes that are not empty. A request's effective priority is its class
+// plus one for every age limit it has waited, and the next request is the
+// oldest of the class whose oldest has the highest effective priority (the
+// higher class on a tie). With little waiting that is simply the highest
+// non-empty class; under overload, latency-critical requests still overtake
+// bulk ones, but only by a bounded wait, so no class is ever starved.
+//
+// Kept free of kernel headers so the driver's queues and the host benchmark
+// share the policy.
+
+enum ASYNCIO_PRIORITY : unsigned int
+{
+	ASYNCIO_PRIORITY_BULK     = 0,
+	ASYNCIO_PRIORITY_NORMAL   = 1,   // ReadFile() / WriteFile() and messages
+	ASYNCIO_PRIORITY_HIGH     = 2,
+	ASYNCIO_PRIORITY_CRITICAL = 3
+};
+
+constexpr unsigned int ASYNCIO_PRIORITY_CLASSES = 4;
+
+// the highest class set in bitmap, or -1 if none is
+inline int PriorityHighestClass(unsigned int bitmap)
+{
+	static_assert(4 == ASYNCIO_PRIORITY_CLASSES, "the table covers four classes");
+
+	static const signed char Highest[16] = { -1, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3 };
+	return Highest[bitmap & 0xF];
+}
+
+// The class to take the next request from, or -1 if bitmap is empty.
+// headWait(c) is how long the oldest request of non-empty class c has
+// waited, in the unit of ageLimit; an ageLimit of 0 turns aging off.
+template<typename THeadWait>
+int PrioritySelectClass(unsigned int bitmap, unsigned int ageLimit, THeadWait headWait)
+{
+	const int top = PriorityHighestClass(bitmap);
+	if (top <= 0 || 0 == ageLimit)
+		return top;
+
+	// effective priorities, scaled by ageLimit to stay in integers
+	int chosen = top;
+	unsigned long long best = static_cast<unsigned long long>(top) * ageLimit + headWait(top);
+
+	for (int c = top - 1; c >= 0; --c)
+	{
+		if (0 == (bitmap & (1u << c)))
+			continue;
+
+		const auto score = static_cast<unsigned long long>(c) * ageLimit + headWait(c);
+		if (score > best)
+		{
+			chosen = c;
+			best = score;
+		}
+	}
+
+	return chosen;
+}
@@ -0,0 +1,67 @@
+// Rendezvous.h
+// Pairing of pending reads with pending writes.
+
+#pragma once
+
+// Reads and writes wait in two queues, each under its own lock, and at most
+// one of the two queues is ever non-empty.
+//
+// A new request first tries to take the oldest request from the opposite
+// queue holding only that queue's lock; under load this is the common case,
+// and readers never touch the read lock nor writers the write lock. Only when
+// the opposite queue is empty are both locks taken, always the read queue's
+// first, to look again and queue the request. The second look is what keeps
+// a read and a write that arrive together from both being queued.
+//
+// Matched requests are returned to the caller, which completes them after
+// all locks are released.
+//
+// Kept free of kernel headers so the driver and the host benchmark share the
+// protocol. TQueue provides Lock(), Unlock(), PopHead(), returning nullptr
+// when the queue is empty, and PushTail(), returning false when the request
+// was cancelled before it could be queued; PopHead() and PushTail() are only
+// called with the queue's lock held.
+
+enum class RendezvousResult
+{
+	Matched,    // paired with the returned request
+	Queued,     // pending on its own queue
+	Cancelled   // neither; the caller completes it as cancelled
+};
+
+// takes the oldest request from the opposite queue, or returns nullptr
+template<typename TQueue>
+auto RendezvousTryMatch(TQueue& opposite) -> decltype(opposite.PopHead())
+{
+	opposite.Lock();
+	auto pMatch = opposite.PopHead();
+	opposite.Unlock();
+
+	return pMatch;
+}
+
+// called after RendezvousTryMatch() found nothing: pairs pItem with a
+// request that arrived in the meantime, returned in *ppMatch, or queues it
+template<typename TQueue, typename TItem>
+RendezvousResult RendezvousMatchOrQueue(TQueue& readQueue, TQueue& writeQueue, bool bRead, TItem* pItem, TItem** ppMatch)
+{
+	auto& own      = bRead ? readQueue : writeQueue;
+	auto& opposite = bRead ? writeQueue : readQueue;
+
+	// lock order: read queue, then write queue
+	readQueue.Lock();
+	writeQueue.Lock();
+
+	auto result = RendezvousResult::Matched;
+
+	*ppMatch = opposite.PopHead();
+	if (nullptr == *ppMatch)
+	{
+		result = own.PushTail(pItem) ? RendezvousResult::Queued : RendezvousResult::Cancelled;
+	}
+
+	writeQueue.Unlock();
+	readQueue.Unlock();
+
+	return result;
+}
@@ -0,0 +1,139 @@
+// Stats.cpp
+// Per-CPU counters behind IOCTL_ASYNCIO_QUERY_STATS.
+
+#include <ntddk.h>
+
+#include "Stats.h"
+#include "AsyncIO.h"
+
+constexpr SIZE_T CACHE_LINE_SIZE = 64;
+
+// one processor's counters, padded to whole cache lines
+struct DriverStats::Slot
+{
+	LONG64 Matches;
+	LONG64 BytesTransferred;
+	LONG64 Pended[2];
+	LONG64 Cancelled[2];
+	LONG64 WaitHistogram[2][ASYNCIO_STATS_BUCKETS];
+	ULONG  HighWater[2];
+
+	UCHAR  Padding[CACHE_LINE_SIZE - ((6 + 2 * ASYNCIO_STATS_BUCKETS) * sizeof(LONG64) + 2 * sizeof(ULONG)) % CACHE_LINE_SIZE];
+};
+
+/* ----------------------------------------------------------------------------
+ *	DriverStats
+ */
+
+_Use_decl_annotations_
+NTSTATUS DriverStats::Init()
+{
+	static_assert(0 == sizeof(Slot) % CACHE_LINE_SIZE, "slots must not share cache lines");
+
+	// every processor that can ever be present, hot-added ones included
+	_slotCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+	// pool is only 16 byte aligned below a page, so align by hand
+	const SIZE_T Size = _slotCount * sizeof(Slot) + CACHE_LINE_SIZE;
+
+	_pAllocation = ExAllocatePoolWithTag(NonPagedPoolNx, Size, ASYNCIO_ALLOC_TAG);
+	if (nullptr == _pAllocation)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(_pAllocation, Size);
+
+	const auto Address = reinterpret_cast<ULONG_PTR>(_pAllocation);
+	_slots = reinterpret_cast<Slot*>((Address + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+
+	return STATUS_SUCCESS;
+}
+
+VOID DriverStats::Free()
+{
+	if (nullptr != _pAllocation)
+	{
+		ExFreePoolWithTag(_pAllocation, ASYNCIO_ALLOC_TAG);
+		_pAllocation = nullptr;
+		_slots = nullptr;
+	}
+}
+
+_Use_decl_annotations_
+VOID DriverStats::RecordPended(ULONG Queue, ULONG Depth)
+{
+	auto pSlot = Current();
+
+	InterlockedIncrement64(&pSlot->Pended[Queue]);
+
+	if (Depth > pSlot->HighWater[Queue])
+	{
+		pSlot->HighWater[Queue] = Depth;
+	}
+}
+
+VOID DriverStats::RecordServed(ULONG Queue, ULONG WaitUs)
+{
+	InterlockedIncrement64(&Current()->WaitHistogram[Queue][StatsBucket(WaitUs)]);
+}
+
+VOID DriverStats::RecordCancelled(ULONG Queue)
+{
+	InterlockedIncrement64(&Current()->Cancelled[Queue]);
+}
+
+VOID DriverStats::RecordMatch(ULONG Bytes)
+{
+	auto pSlot = Current();
+
+	InterlockedIncrement64(&pSlot->Matches);
+	InterlockedAdd64(&pSlot->BytesTransferred, Bytes);
+}
+
+VOID DriverStats::RecordBytes(ULONG Bytes)
+{
+	InterlockedAdd64(&Current()->BytesTransferred, Bytes);
+}
+
+VOID DriverStats::Query(PASYNCIO_STATS pStats)
+{
+	RtlZeroMemory(pStats, sizeof(ASYNCIO_STATS));
+
+	pStats->Version = ASYNCIO_STATS_VERSION;
+	pStats->Size    = sizeof(ASYNCIO_STATS);
+
+	for (ULONG i = 0; i < _slotCount; ++i)
+	{
+		auto pSlot = &_slots[i];
+
+		pStats->Matches          += ReadNoFence64(&pSlot->Matches);
+		pStats->BytesTransferred += ReadNoFence64(&pSlot->BytesTransferred);
+
+		for (ULONG Queue = ASYNCIO_STATS_READS; Queue <= ASYNCIO_STATS_WRITES; ++Queue)
+		{
+			pStats->Pended[Queue]    += ReadNoFence64(&pSlot->Pended[Queue]);
+			pStats->Cancelled[Queue] += ReadNoFence64(&pSlot->Cancelled[Queue]);
+
+			// the deepest any processor saw
+			const ULONG HighWater = pSlot->HighWater[Queue];
+			if (HighWater > pStats->HighWater[Queue])
+			{
+				pStats->HighWater[Queue] = HighWater;
+			}
+
+			for (ULONG Bucket = 0; Bucket < ASYNCIO_STATS_BUCKETS; ++Bucket)
+			{
+				pStats->WaitHistogram[Queue][Bucket] += ReadNoFence64(&pSlot->WaitHistogram[Queue][Bucket]);
+			}
+		}
+	}
+}
+
+// the slot of the processor we are running on
+DriverStats::Slot* DriverStats::Current()
+{
+	const auto Index = KeGetCurrentProcessorNumberEx(nullptr);
+
+	return &_slots[(Index < _slotCount) ? Index : Index % _slotCount];
+}
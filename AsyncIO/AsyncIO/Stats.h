@@ -0,0 +1,52 @@
+// Stats.h
+// Per-CPU counters behind IOCTL_ASYNCIO_QUERY_STATS.
+
+#pragma once
+
+#include <ntddk.h>
+
+#include "AsyncIoCommon.h"
+
+// Counters are kept per processor, each processor's in cache lines of its
+// own, so that recording never takes a queue lock or writes a line another
+// processor is writing. Counts are added with interlocked operations on the
+// current processor's slot, which stay uncontended and remain correct if a
+// thread below DISPATCH_LEVEL moves to another processor midway. High-water
+// marks are only raised under a queue lock, at DISPATCH_LEVEL, where
+// nothing else runs on the processor to race with.
+//
+// Query() adds up the slots without stopping anyone, so the counts it
+// returns are each exact but not a snapshot of a single instant.
+class DriverStats {
+public:
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	NTSTATUS Init();
+
+	VOID Free();
+
+	// a request had to wait, leaving its queue Depth long
+	_IRQL_requires_(DISPATCH_LEVEL)
+	VOID RecordPended(ULONG Queue, ULONG Depth);
+
+	// a pending request was served after WaitUs microseconds
+	VOID RecordServed(ULONG Queue, ULONG WaitUs);
+
+	VOID RecordCancelled(ULONG Queue);
+
+	// a read was paired with a write, and Bytes moved between them
+	VOID RecordMatch(ULONG Bytes);
+
+	// Bytes moved into a read without a pairing (pipe mode)
+	VOID RecordBytes(ULONG Bytes);
+
+	VOID Query(PASYNCIO_STATS pStats);
+
+private:
+	struct Slot;
+
+	Slot* Current();
+
+	PVOID _pAllocation;
+	Slot* _slots;
+	ULONG _slotCount;
+};
@@ -0,0 +1,489 @@
+// BatchBench.cpp
+// Checks of the IOCTL_ASYNCIO_SUBMIT_BATCH format and matching loop, and the
+// cost of batched against one-at-a-time submission.
+//
+// The checks run Batch.h's BatchValidate() and BatchMatch() on hand-built
+// batches: scatter / gather copies across mismatched segments, pairing in
+// submission order, pairing with requests pending outside the batch, and
+// rejection of malformed input.
+//
+// The benchmark moves --message byte messages as write / read pairs. Singly,
+// every request is its own call, costing --call-ns of busy work standing in
+// for the system call and IRP round trip, and goes through Rendezvous.h. In
+// batches of 1 to 128 pairs (the 256 descriptor limit), a whole batch costs
+// one call and one BatchMatch() pass; each write is gathered from two
+// segments.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "Bench.h"
+#include "Batch.h"
+#include "Rendezvous.h"
+
+/* ----------------------------------------------------------------------------
+ *	Pending Requests
+ */
+
+// a request pending outside any batch, as an IRP with its mapped buffer
+struct PendingRequest {
+	PendingRequest*          Next;
+	unsigned char*           Buffer;
+	unsigned int             Length;
+	ASYNCIO_BATCH_COMPLETION Completion;
+};
+
+class PendingQueue {
+public:
+	void Lock()
+	{
+		_lock.lock();
+	}
+
+	void Unlock()
+	{
+		_lock.unlock();
+	}
+
+	PendingRequest* PopHead()
+	{
+		auto request = _head;
+		if (nullptr != request)
+		{
+			_head = request->Next;
+			if (nullptr == _head)
+				_tail = nullptr;
+		}
+
+		return request;
+	}
+
+	bool PushTail(PendingRequest* request)
+	{
+		request->Next = nullptr;
+
+		if (nullptr != _tail)
+			_tail->Next = request;
+		else
+			_head = request;
+
+		_tail = request;
+		return true;
+	}
+
+private:
+	std::mutex      _lock;
+	PendingRequest* _head = nullptr;
+	PendingRequest* _tail = nullptr;
+};
+
+void CopyMemory(void* to, const void* from, unsigned int size)
+{
+	std::memcpy(to, from, size);
+}
+
+// BatchMatch()'s engine, as the driver's but without faults to catch
+class HostBatchEngine {
+public:
+	PendingQueue Reads;
+	PendingQueue Writes;
+
+	bool TakePending(bool bRead, const ASYNCIO_BATCH_SEGMENT* segments, unsigned int count, ASYNCIO_BATCH_COMPLETION* completion)
+	{
+		auto request = RendezvousTryMatch(bRead ? Writes : Reads);
+		if (nullptr == request)
+			return false;
+
+		ASYNCIO_BATCH_SEGMENT segment = {};
+		segment.Address = reinterpret_cast<unsigned long long>(request->Buffer);
+		segment.Length = request->Length;
+
+		auto copied = bRead
+			? BatchCopySegments(segments, count, &segment, 1, CopyMemory)
+			: BatchCopySegments(&segment, 1, segments, count, CopyMemory);
+
+		completion->Status = 0;
+		completion->Information = copied;
+		request->Completion = *completion;
+
+		return true;
+	}
+
+	void Transfer(
+		const ASYNCIO_BATCH_SEGMENT* readSegments, unsigned int readCount,
+		const ASYNCIO_BATCH_SEGMENT* writeSegments, unsigned int writeCount,
+		ASYNCIO_BATCH_COMPLETION* readCompletion,
+		ASYNCIO_BATCH_COMPLETION* writeCompletion)
+	{
+		auto copied = BatchCopySegments(readSegments, readCount, writeSegments, writeCount, CopyMemory);
+
+		readCompletion->Status = 0;
+		readCompletion->Information = copied;
+		*writeCompletion = *readCompletion;
+	}
+};
+
+/* ----------------------------------------------------------------------------
+ *	Building Batches
+ */
+
+class BatchBuilder {
+public:
+	// adds a descriptor over the given buffers
+	void Add(unsigned int operation, std::initializer_list<std::pair<void*, unsigned int>> buffers)
+	{
+		ASYNCIO_BATCH_DESCRIPTOR descriptor = {};
+		descriptor.Operation = operation;
+		descriptor.FirstSegment = static_cast<unsigned int>(_segments.size());
+		descriptor.SegmentCount = static_cast<unsigned int>(buffers.size());
+
+		for (const auto& buffer : buffers)
+		{
+			ASYNCIO_BATCH_SEGMENT segment = {};
+			segment.Address = reinterpret_cast<unsigned long long>(buffer.first);
+			segment.Length = buffer.second;
+			_segments.push_back(segment);
+		}
+
+		_descriptors.push_back(descriptor);
+	}
+
+	// lays the batch out as the IOCTL's input
+	const std::vector<unsigned char>& Build()
+	{
+		ASYNCIO_BATCH_HEADER header = {};
+		header.DescriptorCount = static_cast<unsigned int>(_descriptors.size());
+		header.SegmentCount = static_cast<unsigned int>(_segments.size());
+
+		_input.resize(static_cast<size_t>(BatchInputSize(header.DescriptorCount, header.SegmentCount)));
+
+		auto out = _input.data();
+		std::memcpy(out, &header, sizeof(header));
+		out += sizeof(header);
+
+		if (!_descriptors.empty())
+			std::memcpy(out, _descriptors.data(), _descriptors.size() * sizeof(ASYNCIO_BATCH_DESCRIPTOR));
+		out += _descriptors.size() * sizeof(ASYNCIO_BATCH_DESCRIPTOR);
+
+		if (!_segments.empty())
+			std::memcpy(out, _segments.data(), _segments.size() * sizeof(ASYNCIO_BATCH_SEGMENT));
+
+		return _input;
+	}
+
+	std::vector<ASYNCIO_BATCH_DESCRIPTOR>& Descriptors()
+	{
+		return _descriptors;
+	}
+
+	std::vector<ASYNCIO_BATCH_SEGMENT>& Segments()
+	{
+		return _segments;
+	}
+
+private:
+	std::vector<ASYNCIO_BATCH_DESCRIPTOR> _descriptors;
+	std::vector<ASYNCIO_BATCH_SEGMENT>    _segments;
+	std::vector<unsigned char>            _input;
+};
+
+const ASYNCIO_BATCH_HEADER* AsHeader(const std::vector<unsigned char>& input)
+{
+	return reinterpret_cast<const ASYNCIO_BATCH_HEADER*>(input.data());
+}
+
+// validates and matches the batch built so far
+std::vector<ASYNCIO_BATCH_COMPLETION> Submit(BatchBuilder& builder, HostBatchEngine& engine)
+{
+	const auto& input = builder.Build();
+	std::vector<ASYNCIO_BATCH_COMPLETION> completions(builder.Descriptors().size());
+
+	if (!BatchValidate(AsHeader(input), input.size(), completions.size() * sizeof(ASYNCIO_BATCH_COMPLETION)))
+	{
+		completions.clear();
+		return completions;
+	}
+
+	BatchMatch(AsHeader(input), completions.data(), engine);
+	return completions;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Checks
+ */
+
+int g_failures = 0;
+
+void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", what);
+		g_failures++;
+	}
+}
+
+bool IsMatched(const ASYNCIO_BATCH_COMPLETION& completion, unsigned int bytes)
+{
+	return 0 == completion.Status && bytes == completion.Information;
+}
+
+void CheckScatterGather()
+{
+	HostBatchEngine engine;
+	BatchBuilder builder;
+
+	// "hello, world" gathered from three pieces, scattered into two
+	char w1[] = "hel", w2[] = "lo, w", w3[] = "orld";
+	char r1[7] = {}, r2[16] = {};
+
+	builder.Add(ASYNCIO_BATCH_WRITE, { { w1, 3 }, { w2, 5 }, { w3, 4 } });
+	builder.Add(ASYNCIO_BATCH_READ, { { r1, 7 }, { r2, 16 } });
+
+	auto completions = Submit(builder, engine);
+	Check(2 == completions.size(), "scatter / gather: batch accepted");
+	if (2 != completions.size())
+		return;
+
+	Check(IsMatched(completions[0], 12) && IsMatched(completions[1], 12), "scatter / gather: both sides move 12 bytes");
+	Check(0 == std::memcmp(r1, "hello, ", 7) && 0 == std::memcmp(r2, "world", 5), "scatter / gather: data lands in order");
+}
+
+void CheckOrder()
+{
+	HostBatchEngine engine;
+	BatchBuilder builder;
+
+	char a[4] = { 'a', 'a', 'a', 'a' }, b[4] = { 'b', 'b', 'b', 'b' };
+	char r1[4] = {}, r2[4] = {}, r3[4] = {};
+
+	// R R W W R: the reads pair with the writes oldest first, the last is left
+	builder.Add(ASYNCIO_BATCH_READ, { { r1, 4 } });
+	builder.Add(ASYNCIO_BATCH_READ, { { r2, 4 } });
+	builder.Add(ASYNCIO_BATCH_WRITE, { { a, 4 } });
+	builder.Add(ASYNCIO_BATCH_WRITE, { { b, 2 } });
+	builder.Add(ASYNCIO_BATCH_READ, { { r3, 4 } });
+
+	auto completions = Submit(builder, engine);
+	Check(5 == completions.size(), "order: batch accepted");
+	if (5 != completions.size())
+		return;
+
+	Check(IsMatched(completions[0], 4) && 'a' == r1[0], "order: first read takes first write");
+	Check(IsMatched(completions[1], 2) && 'b' == r2[0] && 0 == r2[2], "order: second read takes the short second write");
+	Check(IsMatched(completions[2], 4) && IsMatched(completions[3], 2), "order: writes report what they moved");
+	Check(ASYNCIO_BATCH_UNMATCHED == completions[4].Status && 0 == completions[4].Information, "order: last read is unmatched");
+}
+
+void CheckPending()
+{
+	HostBatchEngine engine;
+	BatchBuilder builder;
+
+	unsigned char pendingBuffer[8] = {};
+	PendingRequest pending = { nullptr, pendingBuffer, sizeof(pendingBuffer), { ASYNCIO_BATCH_UNMATCHED, 0 } };
+	engine.Reads.PushTail(&pending);
+
+	unsigned char first[8] = { 1, 2, 3, 4, 5, 6, 7, 8 }, second[8] = {};
+	unsigned char read[8] = {};
+
+	// the pending read is older than the batch's, so it gets the first write
+	builder.Add(ASYNCIO_BATCH_READ, { { read, 8 } });
+	builder.Add(ASYNCIO_BATCH_WRITE, { { first, 8 } });
+	builder.Add(ASYNCIO_BATCH_WRITE, { { second, 8 } });
+
+	auto completions = Submit(builder, engine);
+	Check(3 == completions.size(), "pending: batch accepted");
+	if (3 != completions.size())
+		return;
+
+	Check(IsMatched(pending.Completion, 8) && 0 == std::memcmp(pendingBuffer, first, 8), "pending: older read takes the first write");
+	Check(IsMatched(completions[0], 8) && IsMatched(completions[2], 8), "pending: batch read takes the second write");
+}
+
+void CheckValidation()
+{
+	char buffer[4] = {};
+	BatchBuilder builder;
+
+	auto rejects = [&](const char* what) {
+		const auto& input = builder.Build();
+		Check(!BatchValidate(AsHeader(input), input.size(), 4096), what);
+	};
+
+	rejects("validation: empty batch");
+
+	builder.Add(ASYNCIO_BATCH_WRITE, { { buffer, 4 } });
+	builder.Descriptors()[0].Operation = 7;
+	rejects("validation: unknown operation");
+
+	builder.Descriptors()[0].Operation = ASYNCIO_BATCH_WRITE;
+	builder.Descriptors()[0].SegmentCount = 2;
+	rejects("validation: segments past the end");
+
+	builder.Descriptors()[0].SegmentCount = 1;
+	builder.Segments()[0].Reserved = 1;
+	rejects("validation: reserved segment field");
+
+	builder.Segments()[0].Reserved = 0;
+	{
+		const auto& input = builder.Build();
+		Check(BatchValidate(AsHeader(input), input.size(), sizeof(ASYNCIO_BATCH_COMPLETION)), "validation: well-formed batch");
+		Check(!BatchValidate(AsHeader(input), input.size() - 1, sizeof(ASYNCIO_BATCH_COMPLETION)), "validation: truncated input");
+		Check(!BatchValidate(AsHeader(input), input.size(), sizeof(ASYNCIO_BATCH_COMPLETION) - 1), "validation: short completion buffer");
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ *	Measurement
+ */
+
+void BusyCall(int ns)
+{
+	if (ns <= 0)
+		return;
+
+	const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+	while (std::chrono::steady_clock::now() < end)
+	{
+	}
+}
+
+// messages per second sent one request per call
+double RunSingly(size_t messageSize, size_t messages, int callNs)
+{
+	HostBatchEngine engine;
+
+	std::vector<unsigned char> source(messageSize, 0x5A), target(messageSize);
+	PendingRequest write = { nullptr, source.data(), static_cast<unsigned int>(messageSize), {} };
+	PendingRequest read = { nullptr, target.data(), static_cast<unsigned int>(messageSize), {} };
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < messages; ++i)
+	{
+		// the write pends, the read takes it
+		BusyCall(callNs);
+		PendingRequest* match = nullptr;
+		RendezvousMatchOrQueue(engine.Reads, engine.Writes, false, &write, &match);
+
+		BusyCall(callNs);
+		match = RendezvousTryMatch(engine.Writes);
+		std::memcpy(read.Buffer, match->Buffer, std::min(read.Length, match->Length));
+	}
+
+	return messages / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// messages per second sent batch pairs per call
+double RunBatched(size_t messageSize, size_t messages, size_t batch, int callNs)
+{
+	HostBatchEngine engine;
+	BatchBuilder builder;
+
+	const auto half = static_cast<unsigned int>(messageSize / 2);
+	std::vector<unsigned char> source(messageSize * batch, 0x5A), target(messageSize * batch);
+
+	for (size_t i = 0; i < batch; ++i)
+	{
+		auto from = source.data() + i * messageSize;
+		auto to = target.data() + i * messageSize;
+
+		builder.Add(ASYNCIO_BATCH_WRITE, { { from, half }, { from + half, static_cast<unsigned int>(messageSize) - half } });
+		builder.Add(ASYNCIO_BATCH_READ, { { to, static_cast<unsigned int>(messageSize) } });
+	}
+
+	const auto& input = builder.Build();
+	std::vector<ASYNCIO_BATCH_COMPLETION> completions(2 * batch);
+
+	const auto rounds = std::max<size_t>(1, messages / batch);
+	const auto start = std::chrono::steady_clock::now();
+
+	for (size_t round = 0; round < rounds; ++round)
+	{
+		BusyCall(callNs);
+
+		if (!BatchValidate(AsHeader(input), input.size(), completions.size() * sizeof(ASYNCIO_BATCH_COMPLETION)))
+			std::abort();
+
+		BatchMatch(AsHeader(input), completions.data(), engine);
+	}
+
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (!IsMatched(completions.back(), static_cast<unsigned int>(messageSize)) || source != target)
+	{
+		printf("MISMATCH in batches of %zu\n", batch);
+		std::exit(1);
+	}
+
+	return rounds * batch / seconds;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+// AsyncIoBench batch [--message N] [--call-ns N] [--messages N]
+int RunBatchBench(int argc, char* argv[])
+{
+	size_t messageSize = 64;
+	int callNs = 1000;
+	size_t messages = 500000;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		auto value = ::strtoull(argv[i + 1], nullptr, 10);
+
+		if (0 == ::strcmp(argv[i], "--message"))
+			messageSize = static_cast<size_t>(value);
+		else if (0 == ::strcmp(argv[i], "--call-ns"))
+			callNs = static_cast<int>(value);
+		else if (0 == ::strcmp(argv[i], "--messages"))
+			messages = static_cast<size_t>(value);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (messageSize < 2 || 0 == messages)
+	{
+		printf("messages must be at least 2 bytes, and there must be some\n");
+		return 1;
+	}
+
+	CheckScatterGather();
+	CheckOrder();
+	CheckPending();
+	CheckValidation();
+
+	if (0 != g_failures)
+	{
+		printf("%d checks failed\n", g_failures);
+		return 1;
+	}
+
+	printf("format and matching checks passed\n");
+	printf("%zu byte messages, %d ns per call\n", messageSize, callNs);
+
+	const auto singly = RunSingly(messageSize, messages, callNs);
+	printf("%8s %14s %8s\n", "batch", "messages/s", "x");
+	printf("%8s %14.0f %8.2f\n", "singly", singly, 1.0);
+
+	for (size_t batch = 1; batch <= ASYNCIO_MAX_BATCH_DESCRIPTORS / 2; batch *= 2)
+	{
+		const auto batched = RunBatched(messageSize, messages, batch, callNs);
+		printf("%8zu %14.0f %8.2f\n", batch, batched, batched / singly);
+	}
+
+	return 0;
+}
@@ -0,0 +1,48 @@
+// Bench.cpp
+// Host-side benchmarks for the AsyncIO driver.
+
+#include <cstdio>
+#include <cstring>
+
+#include "Bench.h"
+
+struct BenchCommand {
+	const char* Name;
+	int (*Run)(int argc, char* argv[]);
+	const char* Description;
+};
+
+const BenchCommand Commands[] = {
+	{ "batch", RunBatchBench, "batch format / matching checks, and batched against single submission" },
+	{ "channel", RunChannelBench, "independent client pairs on one shared channel and on 1 to 256 channels" },
+	{ "load", RunLoadBench, "the load generator's core against an in-process stand-in for the driver" },
+	{ "match", RunMatchBench, "read / write rendezvous throughput from 1 to 32 threads" },
+	{ "queue", RunQueueBench, "pend / match cost with allocated items and embedded links" },
+	{ "pipe", RunPipeBench, "rendezvous and ring pipe throughput and latency per message size" },
+	{ "priority", RunPriorityBench, "tail latency per priority class with FIFO, strict priority and aging" },
+	{ "transfer", RunTransferBench, "buffered and direct IO throughput from 4KB to 16MB messages" },
+};
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 2)
+	{
+		for (const auto& command : Commands)
+		{
+			if (0 == ::strcmp(argv[1], command.Name))
+				return command.Run(argc - 2, argv + 2);
+		}
+	}
+
+	printf("usage: %s <command> [options]\n", argc > 0 ? argv[0] : "AsyncIoBench");
+	for (const auto& command : Commands)
+	{
+		printf("  %-10s %s\n", command.Name, command.Description);
+	}
+
+	return 1;
+}
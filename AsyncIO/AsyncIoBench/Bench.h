@@ -0,0 +1,14 @@
+// Bench.h
+// Host-side benchmarks for the AsyncIO driver.
+
+#pragma once
+
+// each returns the process exit code; argv excludes the command name
+int RunBatchBench(int argc, char* argv[]);
+int RunChannelBench(int argc, char* argv[]);
+int RunLoadBench(int argc, char* argv[]);
+int RunMatchBench(int argc, char* argv[]);
+int RunPipeBench(int argc, char* argv[]);
+int RunPriorityBench(int argc, char* argv[]);
+int RunQueueBench(int argc, char* argv[]);
+int RunTransferBench(int argc, char* argv[]);
@@ -0,0 +1,275 @@
+// ChannelBench.cpp
+// Throughput of independent client pairs on shared and per-pair channels.
+//
+// From 1 to --max-pairs producer / consumer pairs each keep one write and
+// one read outstanding, resubmitting each as soon as it completes; the
+// pairs are spread over --threads submitting threads. Two layouts are compared:
+//
+//  shared    every pair opens \\.\AsyncIO, so all of them meet on one pair
+//            of queues and locks, and a pair's write may be matched with
+//            any pair's read.
+//  channels  every pair opens its own channel, with queues and locks of
+//            its own, through Rendezvous.h as the driver does.
+//
+// Matches between requests of different pairs are counted; only the shared
+// layout can have them.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "Rendezvous.h"
+
+/* ----------------------------------------------------------------------------
+ *	Requests and Channels
+ */
+
+struct PairRequest {
+	PairRequest*      Next;
+	int               Pair;
+	std::atomic<bool> Done;
+};
+
+class PairQueue {
+public:
+	void Lock()
+	{
+		_lock.lock();
+	}
+
+	void Unlock()
+	{
+		_lock.unlock();
+	}
+
+	PairRequest* PopHead()
+	{
+		auto request = _head;
+		if (nullptr != request)
+		{
+			_head = request->Next;
+			if (nullptr == _head)
+				_tail = nullptr;
+		}
+
+		return request;
+	}
+
+	bool PushTail(PairRequest* request)
+	{
+		request->Next = nullptr;
+
+		if (nullptr != _tail)
+			_tail->Next = request;
+		else
+			_head = request;
+
+		_tail = request;
+		return true;
+	}
+
+private:
+	std::mutex   _lock;
+	PairRequest* _head = nullptr;
+	PairRequest* _tail = nullptr;
+};
+
+// a channel's two queues, padded so that no two locks share a cache line
+// (padding rather than alignas, which new[] only honours from C++17)
+struct BenchChannel {
+	PairQueue Reads;
+	char      ReadsPad[64];
+	PairQueue Writes;
+	char      WritesPad[64];
+};
+
+class ChannelSet {
+public:
+	explicit ChannelSet(int channels)
+		: _channels(new BenchChannel[channels]), _count(channels) {}
+
+	void Submit(PairRequest* request, bool bRead)
+	{
+		auto& channel = _channels[request->Pair % _count];
+
+		auto match = RendezvousTryMatch(bRead ? channel.Writes : channel.Reads);
+		if (nullptr == match && RendezvousResult::Matched != RendezvousMatchOrQueue(channel.Reads, channel.Writes, bRead, request, &match))
+			return;
+
+		if (match->Pair != request->Pair)
+			_crossMatches.fetch_add(1, std::memory_order_relaxed);
+
+		match->Done.store(true, std::memory_order_release);
+		request->Done.store(true, std::memory_order_release);
+	}
+
+	unsigned long long CrossMatches() const
+	{
+		return _crossMatches.load();
+	}
+
+private:
+	std::unique_ptr<BenchChannel[]> _channels;
+	int                             _count;
+	std::atomic<unsigned long long> _crossMatches{ 0 };
+};
+
+/* ----------------------------------------------------------------------------
+ *	Measurement
+ */
+
+struct ClientPair {
+	PairRequest        Read;
+	PairRequest        Write;
+	unsigned long long Submitted = 0;
+};
+
+struct ChannelResult {
+	double             OpsPerSecond;
+	unsigned long long CrossMatches;
+};
+
+// resubmits the completed requests of pairs first, first + step, ...
+void DrivePairs(ChannelSet& set, std::vector<ClientPair>& pairs, size_t first, size_t step, const std::atomic<bool>& stop)
+{
+	while (!stop.load(std::memory_order_relaxed))
+	{
+		bool submitted = false;
+
+		for (auto i = first; i < pairs.size(); i += step)
+		{
+			auto& pair = pairs[i];
+
+			if (pair.Write.Done.load(std::memory_order_acquire))
+			{
+				pair.Write.Done.store(false, std::memory_order_relaxed);
+				set.Submit(&pair.Write, false);
+				pair.Submitted++;
+				submitted = true;
+			}
+
+			if (pair.Read.Done.load(std::memory_order_acquire))
+			{
+				pair.Read.Done.store(false, std::memory_order_relaxed);
+				set.Submit(&pair.Read, true);
+				pair.Submitted++;
+				submitted = true;
+			}
+		}
+
+		if (!submitted)
+			std::this_thread::yield();
+	}
+}
+
+ChannelResult RunChannels(int pairCount, int channels, int threads, int durationMs)
+{
+	ChannelSet set(channels);
+	std::vector<ClientPair> pairs(pairCount);
+
+	for (int i = 0; i < pairCount; ++i)
+	{
+		pairs[i].Read.Pair = i;
+		pairs[i].Read.Done.store(true);
+		pairs[i].Write.Pair = i;
+		pairs[i].Write.Done.store(true);
+	}
+
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> workers;
+
+	const auto workerCount = std::min(threads, pairCount);
+	const auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < workerCount; ++i)
+	{
+		workers.emplace_back(DrivePairs, std::ref(set), std::ref(pairs), static_cast<size_t>(i), static_cast<size_t>(workerCount), std::cref(stop));
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+	stop.store(true);
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned long long submitted = 0;
+	for (const auto& pair : pairs)
+	{
+		submitted += pair.Submitted;
+	}
+
+	ChannelResult result;
+	result.OpsPerSecond = submitted / seconds;
+	result.CrossMatches = set.CrossMatches();
+
+	return result;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+// AsyncIoBench channel [--threads N] [--max-pairs N] [--ms N]
+int RunChannelBench(int argc, char* argv[])
+{
+	int threads = static_cast<int>(std::max(2u, std::thread::hardware_concurrency()));
+	int maxPairs = 256;
+	int durationMs = 300;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		auto value = ::atoi(argv[i + 1]);
+
+		if (0 == ::strcmp(argv[i], "--threads"))
+			threads = value;
+		else if (0 == ::strcmp(argv[i], "--max-pairs"))
+			maxPairs = value;
+		else if (0 == ::strcmp(argv[i], "--ms"))
+			durationMs = value;
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (threads < 1 || maxPairs < 1 || durationMs < 1)
+	{
+		printf("threads, pairs and duration must be positive\n");
+		return 1;
+	}
+
+	printf("%d submitting threads, %d ms per run, %u hardware threads\n",
+		threads, durationMs, std::thread::hardware_concurrency());
+	printf("%6s %14s %14s %14s %8s\n", "pairs", "shared ops/s", "cross-matched", "channel ops/s", "chan/x");
+
+	for (int pairs = 1; pairs <= maxPairs; pairs *= 2)
+	{
+		auto shared   = RunChannels(pairs, 1, threads, durationMs);
+		auto channels = RunChannels(pairs, pairs, threads, durationMs);
+
+		printf("%6d %14.0f %14llu %14.0f %8.2f\n", pairs,
+			shared.OpsPerSecond, shared.CrossMatches, channels.OpsPerSecond,
+			channels.OpsPerSecond / shared.OpsPerSecond);
+
+		if (0 != channels.CrossMatches)
+		{
+			printf("CROSS-MATCHED ON PRIVATE CHANNELS\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,252 @@
+// LoadBench.cpp
+// AsyncIoLoad's generator, off Windows: LoadCore.h driving an in-process
+// stand-in for the driver's matching instead of a completion port.
+//
+// The stand-in does what the driver does with each request, on the
+// submitting thread: Rendezvous.h pairs a read with a pending write (or the
+// other way round) or queues it, and a pair's data is copied straight
+// across. Both completions then go on a completion queue, a locked list
+// with a condition variable standing in for the completion port, which the
+// generator's workers drain up to 64 at a time.
+//
+// By default the run is repeated at queue depths from 2 to 4096.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "LoadCore.h"
+#include "Rendezvous.h"
+
+/* ----------------------------------------------------------------------------
+ *	Stand-in Transport
+ */
+
+struct StandInRequest {
+	StandInRequest* Next;
+	LoadRequest*    Request;
+};
+
+class StandInQueue {
+public:
+	void Lock()
+	{
+		_lock.lock();
+	}
+
+	void Unlock()
+	{
+		_lock.unlock();
+	}
+
+	StandInRequest* PopHead()
+	{
+		auto request = _head;
+		if (nullptr != request)
+		{
+			_head = request->Next;
+			if (nullptr == _head)
+				_tail = nullptr;
+		}
+
+		return request;
+	}
+
+	bool PushTail(StandInRequest* request)
+	{
+		request->Next = nullptr;
+
+		if (nullptr != _tail)
+			_tail->Next = request;
+		else
+			_head = request;
+
+		_tail = request;
+		return true;
+	}
+
+private:
+	std::mutex      _lock;
+	StandInRequest* _head = nullptr;
+	StandInRequest* _tail = nullptr;
+};
+
+class StandInTransport {
+public:
+	bool Prepare(LoadRequest* requests, unsigned int count)
+	{
+		_requests.assign(count, StandInRequest{});
+
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			_requests[i].Request = &requests[i];
+		}
+
+		return true;
+	}
+
+	bool Submit(LoadRequest* request)
+	{
+		auto own = &_requests[request->Index];
+		const bool bRead = request->bRead;
+
+		auto match = RendezvousTryMatch(bRead ? _writes : _reads);
+		if (nullptr == match && RendezvousResult::Matched != RendezvousMatchOrQueue(_reads, _writes, bRead, own, &match))
+			return true;
+
+		auto read  = bRead ? request : match->Request;
+		auto write = bRead ? match->Request : request;
+		const auto length = std::min(read->Length, write->Length);
+
+		std::memcpy(read->Buffer, write->Buffer, length);
+
+		LoadCompletion completions[2] = {
+			{ write, length, true },
+			{ read, length, true }
+		};
+
+		Post(completions, 2);
+		return true;
+	}
+
+	unsigned int Reap(LoadCompletion* completions, unsigned int max)
+	{
+		std::unique_lock<std::mutex> locker(_lock);
+		_posted.wait(locker, [this] { return !_completions.empty(); });
+
+		const auto count = static_cast<unsigned int>(std::min<size_t>(max, _completions.size()));
+		std::copy(_completions.begin(), _completions.begin() + count, completions);
+		_completions.erase(_completions.begin(), _completions.begin() + count);
+
+		return count;
+	}
+
+	void CancelAll()
+	{
+		CancelQueue(_reads);
+		CancelQueue(_writes);
+	}
+
+	void Wake(unsigned int count)
+	{
+		std::vector<LoadCompletion> wakeups(count, LoadCompletion{});
+		Post(wakeups.data(), count);
+	}
+
+private:
+	void Post(const LoadCompletion* completions, unsigned int count)
+	{
+		{
+			std::lock_guard<std::mutex> locker(_lock);
+			_completions.insert(_completions.end(), completions, completions + count);
+		}
+
+		_posted.notify_all();
+	}
+
+	void CancelQueue(StandInQueue& queue)
+	{
+		std::vector<LoadCompletion> cancelled;
+
+		queue.Lock();
+		for (auto request = queue.PopHead(); nullptr != request; request = queue.PopHead())
+		{
+			cancelled.push_back(LoadCompletion{ request->Request, 0, false });
+		}
+		queue.Unlock();
+
+		if (!cancelled.empty())
+			Post(cancelled.data(), static_cast<unsigned int>(cancelled.size()));
+	}
+
+	std::vector<StandInRequest> _requests;
+	StandInQueue                _reads;
+	StandInQueue                _writes;
+
+	std::mutex                  _lock;
+	std::condition_variable     _posted;
+	std::deque<LoadCompletion>  _completions;
+};
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+// AsyncIoBench load [--size N] [--depth N] [--read-pct N] [--workers N] [--ms N]
+int RunLoadBench(int argc, char* argv[])
+{
+	LoadConfig config;
+	config.Workers = std::max(2u, std::thread::hardware_concurrency());
+	config.DurationMs = 500;
+
+	unsigned int depth = 0;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		auto value = static_cast<unsigned int>(::strtoul(argv[i + 1], nullptr, 10));
+
+		if (0 == ::strcmp(argv[i], "--size"))
+			config.MessageSize = value;
+		else if (0 == ::strcmp(argv[i], "--depth"))
+			depth = value;
+		else if (0 == ::strcmp(argv[i], "--read-pct"))
+			config.ReadPercent = value;
+		else if (0 == ::strcmp(argv[i], "--workers"))
+			config.Workers = value;
+		else if (0 == ::strcmp(argv[i], "--ms"))
+			config.DurationMs = value;
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == config.MessageSize || 0 == config.Workers || 0 == config.DurationMs
+		|| config.ReadPercent > 100 || (0 != depth && (depth < 2 || depth > 65536)))
+	{
+		printf("size, workers and duration must be positive, read-pct at most 100, depth 2 to 65536\n");
+		return 1;
+	}
+
+	printf("in-process stand-in, %u workers, %u ms per run, %u hardware threads\n",
+		config.Workers, config.DurationMs, std::thread::hardware_concurrency());
+	PrintLoadHeader();
+
+	const unsigned int depths[] = { 2, 16, 128, 1024, 4096 };
+
+	for (auto each : depths)
+	{
+		config.QueueDepth = (0 != depth) ? depth : each;
+
+		StandInTransport transport;
+		LoadGenerator<StandInTransport> generator(transport, config);
+		LoadResult result;
+
+		if (!generator.Run(&result))
+		{
+			printf("run failed\n");
+			return 1;
+		}
+
+		PrintLoadResult(config, result);
+
+		if (0 != result.Errors)
+		{
+			printf("ERRORS DURING THE RUN\n");
+			return 1;
+		}
+
+		if (0 != depth)
+			break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,353 @@
+// MatchBench.cpp
+// Throughput of the AsyncIO read / write rendezvous as threads are added.
+//
+// Every thread submits reads and writes in turn, keeping up to --depth of
+// each outstanding as an overlapped client would. Two engines are compared:
+//
+//  global  the original scheme: one lock over both queues, with matched
+//          requests completed while it is still held.
+//  split   Rendezvous.h as the driver uses it: a lock per queue, and
+//          completions issued once the locks are released.
+//
+// Completing a request costs --complete-ns of busy work, standing in for
+// IoCompleteRequest(). Requests are counted when submitted; the few still
+// pending when a run stops are not subtracted.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "Rendezvous.h"
+
+/* ----------------------------------------------------------------------------
+ *	Requests and Queues
+ */
+
+struct BenchRequest {
+	BenchRequest*     Next;
+	std::atomic<bool> Done;
+};
+
+// FIFO of pending requests; PopHead() / PushTail() as Rendezvous.h expects
+class RequestList {
+public:
+	BenchRequest* PopHead()
+	{
+		auto request = _head;
+		if (nullptr != request)
+		{
+			_head = request->Next;
+			if (nullptr == _head)
+				_tail = nullptr;
+		}
+
+		return request;
+	}
+
+	bool PushTail(BenchRequest* request)
+	{
+		request->Next = nullptr;
+
+		if (nullptr != _tail)
+			_tail->Next = request;
+		else
+			_head = request;
+
+		_tail = request;
+		return true;
+	}
+
+private:
+	BenchRequest* _head = nullptr;
+	BenchRequest* _tail = nullptr;
+};
+
+// a list with its own lock, on its own cache line
+class alignas(64) LockedQueue : public RequestList {
+public:
+	void Lock()
+	{
+		_lock.lock();
+	}
+
+	void Unlock()
+	{
+		_lock.unlock();
+	}
+
+private:
+	std::mutex _lock;
+};
+
+void BusyWork(int ns)
+{
+	if (ns <= 0)
+		return;
+
+	const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+	while (std::chrono::steady_clock::now() < end)
+	{
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ *	Engines
+ */
+
+class GlobalEngine {
+public:
+	explicit GlobalEngine(int completeNs)
+		: _completeNs(completeNs) {}
+
+	void Submit(BenchRequest* request, bool bRead)
+	{
+		std::lock_guard<std::mutex> locker(_lock);
+
+		auto& own      = bRead ? _reads : _writes;
+		auto& opposite = bRead ? _writes : _reads;
+
+		auto match = opposite.PopHead();
+		if (nullptr == match)
+		{
+			own.PushTail(request);
+			return;
+		}
+
+		// both completed with the lock held, as DispatchRead() used to
+		Complete(match);
+		Complete(request);
+	}
+
+private:
+	void Complete(BenchRequest* request)
+	{
+		BusyWork(_completeNs);
+		request->Done.store(true, std::memory_order_release);
+	}
+
+	int         _completeNs;
+	std::mutex  _lock;
+	RequestList _reads;
+	RequestList _writes;
+};
+
+class SplitEngine {
+public:
+	explicit SplitEngine(int completeNs)
+		: _completeNs(completeNs) {}
+
+	void Submit(BenchRequest* request, bool bRead)
+	{
+		auto match = RendezvousTryMatch(bRead ? _writes : _reads);
+		if (nullptr == match)
+		{
+			if (RendezvousResult::Matched != RendezvousMatchOrQueue(_reads, _writes, bRead, request, &match))
+				return;
+		}
+
+		// no lock is held here
+		Complete(match);
+		Complete(request);
+	}
+
+private:
+	void Complete(BenchRequest* request)
+	{
+		BusyWork(_completeNs);
+		request->Done.store(true, std::memory_order_release);
+	}
+
+	int         _completeNs;
+	LockedQueue _reads;
+	LockedQueue _writes;
+};
+
+/* ----------------------------------------------------------------------------
+ *	Measurement
+ */
+
+struct MatchConfig {
+	int Depth;
+	int CompleteNs;
+	int DurationMs;
+};
+
+// one submitting thread's requests: depth reads and depth writes, reused
+// in order as they complete
+struct ThreadSlots {
+	std::vector<BenchRequest> Reads;
+	std::vector<BenchRequest> Writes;
+	size_t                    NextRead = 0;
+	size_t                    NextWrite = 0;
+	unsigned long long        Submitted = 0;
+
+	explicit ThreadSlots(int depth)
+		: Reads(depth), Writes(depth)
+	{
+		for (auto& request : Reads)
+			request.Done.store(true);
+		for (auto& request : Writes)
+			request.Done.store(true);
+	}
+};
+
+template<typename TEngine>
+void SubmitLoop(TEngine& engine, ThreadSlots& slots, const std::atomic<bool>& stop, bool bRead)
+{
+	while (!stop.load(std::memory_order_relaxed))
+	{
+		// a thread's reads (and its writes) complete in the order submitted,
+		// so the oldest slot is the one to wait for. Reads and writes are
+		// never both pending, so one of the two kinds always frees up.
+		auto& read  = slots.Reads[slots.NextRead];
+		auto& write = slots.Writes[slots.NextWrite];
+
+		const bool readFree  = read.Done.load(std::memory_order_acquire);
+		const bool writeFree = write.Done.load(std::memory_order_acquire);
+
+		if (!readFree && !writeFree)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (!(bRead ? readFree : writeFree))
+			bRead = !bRead;
+
+		auto& request = bRead ? read : write;
+		request.Done.store(false, std::memory_order_relaxed);
+
+		if (bRead)
+			slots.NextRead = (slots.NextRead + 1) % slots.Reads.size();
+		else
+			slots.NextWrite = (slots.NextWrite + 1) % slots.Writes.size();
+
+		engine.Submit(&request, bRead);
+		slots.Submitted++;
+
+		bRead = !bRead;
+	}
+}
+
+// requests submitted per second by threads threads
+template<typename TEngine>
+double RunEngine(const MatchConfig& config, int threads)
+{
+	TEngine engine(config.CompleteNs);
+	std::atomic<bool> stop(false);
+
+	std::vector<ThreadSlots> slots;
+	slots.reserve(threads);
+	for (int i = 0; i < threads; ++i)
+	{
+		slots.emplace_back(config.Depth);
+	}
+
+	std::vector<std::thread> workers;
+	const auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < threads; ++i)
+	{
+		workers.emplace_back(SubmitLoop<TEngine>, std::ref(engine), std::ref(slots[i]), std::cref(stop), 0 == (i & 1));
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(config.DurationMs));
+	stop.store(true);
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned long long submitted = 0;
+	for (const auto& slot : slots)
+	{
+		submitted += slot.Submitted;
+	}
+
+	// requests still queued point into slots, which the engine never touches
+	// again
+	return submitted / seconds;
+}
+
+std::vector<int> ParseThreadList(const char* list)
+{
+	std::vector<int> threads;
+	std::string text(list);
+
+	size_t start = 0;
+	while (start <= text.size())
+	{
+		auto end = text.find(',', start);
+		if (std::string::npos == end)
+			end = text.size();
+
+		auto count = ::atoi(text.substr(start, end - start).c_str());
+		if (count > 0)
+			threads.push_back(count);
+
+		start = end + 1;
+	}
+
+	return threads;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+// AsyncIoBench match [--threads 1,2,4,...] [--depth N] [--complete-ns N] [--ms N]
+int RunMatchBench(int argc, char* argv[])
+{
+	MatchConfig config = { 16, 200, 500 };
+	std::vector<int> threads = { 1, 2, 4, 8, 16, 32 };
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		auto value = argv[i + 1];
+
+		if (0 == ::strcmp(argv[i], "--threads"))
+			threads = ParseThreadList(value);
+		else if (0 == ::strcmp(argv[i], "--depth"))
+			config.Depth = std::max(1, ::atoi(value));
+		else if (0 == ::strcmp(argv[i], "--complete-ns"))
+			config.CompleteNs = std::max(0, ::atoi(value));
+		else if (0 == ::strcmp(argv[i], "--ms"))
+			config.DurationMs = std::max(1, ::atoi(value));
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (threads.empty())
+	{
+		printf("no thread counts given\n");
+		return 1;
+	}
+
+	printf("depth %d per kind per thread, %d ns per completion, %d ms per run, %u hardware threads\n",
+		config.Depth, config.CompleteNs, config.DurationMs, std::thread::hardware_concurrency());
+	printf("%8s %14s %14s %8s\n", "threads", "global ops/s", "split ops/s", "split/x");
+
+	for (auto count : threads)
+	{
+		auto global = RunEngine<GlobalEngine>(config, count);
+		auto split  = RunEngine<SplitEngine>(config, count);
+
+		printf("%8d %14.0f %14.0f %8.2f\n", count, global, split, split / global);
+	}
+
+	return 0;
+}
@@ -0,0 +1,288 @@
+// PipeBench.cpp
+// Throughput and latency of AsyncIO's rendezvous and pipe modes.
+//
+// One thread writes a stream of messages and another reads them back with
+// reads of the same size, each side with a single request outstanding, as a
+// synchronous client would. Two modes are compared:
+//
+//  rendezvous  a write waits for a read and is copied straight into it, so
+//              every message is a hand-off between the two threads.
+//  pipe        ByteRing.h as the driver uses it: a write completes once it
+//              is in the ring and a read takes whatever is there; either
+//              side only waits when the ring is full or empty. Spans are
+//              claimed under the lock and copied with it released.
+//
+// A message's latency runs from the start of its write to the end of the
+// read that delivered its last byte. The writer never pauses, so in pipe
+// mode that is mostly time spent behind a full ring, and grows with
+// --ring-kb. The bytes read are checked against the pattern written.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "ByteRing.h"
+
+typedef std::chrono::steady_clock BenchClock;
+
+/* ----------------------------------------------------------------------------
+ *	Modes
+ */
+
+class RendezvousPipe {
+public:
+	explicit RendezvousPipe(size_t)
+	{
+	}
+
+	void Write(const unsigned char* data, size_t length)
+	{
+		std::unique_lock<std::mutex> locker(_lock);
+
+		// wait for a read to pair with, as a queued write IRP would
+		_changed.wait(locker, [this] { return nullptr != _read; });
+
+		_readLength = std::min(_readLength, length);
+		std::memcpy(_read, data, _readLength);
+		_read = nullptr;
+
+		_changed.notify_all();
+	}
+
+	size_t Read(unsigned char* data, size_t length)
+	{
+		std::unique_lock<std::mutex> locker(_lock);
+
+		_read = data;
+		_readLength = length;
+		_changed.notify_all();
+
+		_changed.wait(locker, [this] { return nullptr == _read; });
+
+		return _readLength;
+	}
+
+private:
+	std::mutex              _lock;
+	std::condition_variable _changed;
+	unsigned char*          _read = nullptr;
+	size_t                  _readLength = 0;
+};
+
+class RingPipe {
+public:
+	explicit RingPipe(size_t capacity)
+		: _storage(capacity)
+	{
+		_ring.Attach(_storage.data(), capacity);
+	}
+
+	void Write(const unsigned char* data, size_t length)
+	{
+		std::unique_lock<std::mutex> locker(_lock);
+
+		size_t done = 0;
+		while (done < length)
+		{
+			_notFull.wait(locker, [this] { return 0 != _ring.Space(); });
+
+			size_t offset;
+			auto claimed = _ring.BeginWrite(length - done, &offset);
+
+			locker.unlock();
+			_ring.CopyIn(offset, data + done, claimed);
+			locker.lock();
+
+			_ring.EndWrite();
+			done += claimed;
+
+			_notEmpty.notify_one();
+		}
+	}
+
+	size_t Read(unsigned char* data, size_t length)
+	{
+		std::unique_lock<std::mutex> locker(_lock);
+
+		_notEmpty.wait(locker, [this] { return 0 != _ring.Size(); });
+
+		size_t offset;
+		auto done = _ring.BeginRead(length, &offset);
+
+		locker.unlock();
+		_ring.CopyOut(offset, data, done);
+		locker.lock();
+
+		_ring.EndRead();
+		_notFull.notify_one();
+
+		return done;
+	}
+
+private:
+	std::vector<unsigned char> _storage;
+	ByteRing                   _ring;
+	std::mutex                 _lock;
+	std::condition_variable    _notFull;
+	std::condition_variable    _notEmpty;
+};
+
+/* ----------------------------------------------------------------------------
+ *	Measurement
+ */
+
+struct PipeResult {
+	double MegabytesPerSecond;
+	double P50Us;
+	double P99Us;
+	bool   Intact;
+};
+
+unsigned char PatternByte(size_t offset)
+{
+	return static_cast<unsigned char>(offset * 131 + (offset >> 8));
+}
+
+template<typename TPipe>
+PipeResult RunPipe(size_t messageSize, size_t messages, size_t ringSize)
+{
+	TPipe pipe(ringSize);
+
+	std::vector<BenchClock::time_point> sent(messages);
+	std::vector<BenchClock::time_point> received(messages);
+
+	bool intact = true;
+	const auto start = BenchClock::now();
+
+	std::thread reader([&] {
+		std::vector<unsigned char> buffer(messageSize);
+
+		size_t offset = 0;
+		const size_t total = messageSize * messages;
+
+		while (offset < total)
+		{
+			auto length = pipe.Read(buffer.data(), buffer.size());
+			const auto now = BenchClock::now();
+
+			for (size_t i = 0; i < length; ++i)
+			{
+				if (buffer[i] != PatternByte(offset + i))
+				{
+					intact = false;
+					break;
+				}
+			}
+
+			// every message whose last byte arrived with this read
+			for (auto message = offset / messageSize; message < (offset + length) / messageSize; ++message)
+			{
+				received[message] = now;
+			}
+
+			offset += length;
+		}
+	});
+
+	std::vector<unsigned char> message(messageSize);
+
+	for (size_t i = 0; i < messages; ++i)
+	{
+		for (size_t j = 0; j < messageSize; ++j)
+		{
+			message[j] = PatternByte(i * messageSize + j);
+		}
+
+		sent[i] = BenchClock::now();
+		pipe.Write(message.data(), messageSize);
+	}
+
+	reader.join();
+
+	const auto seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+	std::vector<double> latencies(messages);
+	for (size_t i = 0; i < messages; ++i)
+	{
+		latencies[i] = std::chrono::duration<double, std::micro>(received[i] - sent[i]).count();
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	PipeResult result;
+	result.MegabytesPerSecond = messageSize * messages / seconds / 1e6;
+	result.P50Us = latencies[messages / 2];
+	result.P99Us = latencies[std::min(messages - 1, messages * 99 / 100)];
+	result.Intact = intact;
+
+	return result;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+// AsyncIoBench pipe [--ring-kb N] [--mb N] [--max-messages N]
+int RunPipeBench(int argc, char* argv[])
+{
+	size_t ringSize = 1u << 20;
+	size_t total = 64u << 20;
+	size_t maxMessages = 200000;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		auto value = static_cast<size_t>(::strtoull(argv[i + 1], nullptr, 10));
+
+		if (0 == ::strcmp(argv[i], "--ring-kb"))
+			ringSize = value << 10;
+		else if (0 == ::strcmp(argv[i], "--mb"))
+			total = value << 20;
+		else if (0 == ::strcmp(argv[i], "--max-messages"))
+			maxMessages = value;
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == ringSize || 0 == total || 0 == maxMessages)
+	{
+		printf("ring, total and message count must be positive\n");
+		return 1;
+	}
+
+	const size_t sizes[] = { 64, 1024, 16 * 1024, 256 * 1024 };
+
+	printf("%zu KB ring, up to %zu MB or %zu messages per run, %u hardware threads\n",
+		ringSize >> 10, total >> 20, maxMessages, std::thread::hardware_concurrency());
+	printf("%9s %10s %9s %9s %10s %9s %9s\n",
+		"message", "rdv MB/s", "p50 us", "p99 us", "pipe MB/s", "p50 us", "p99 us");
+
+	for (auto size : sizes)
+	{
+		const auto messages = std::max<size_t>(1, std::min(maxMessages, total / size));
+
+		auto rendezvous = RunPipe<RendezvousPipe>(size, messages, ringSize);
+		auto ring = RunPipe<RingPipe>(size, messages, ringSize);
+
+		printf("%9zu %10.1f %9.1f %9.1f %10.1f %9.1f %9.1f\n", size,
+			rendezvous.MegabytesPerSecond, rendezvous.P50Us, rendezvous.P99Us,
+			ring.MegabytesPerSecond, ring.P50Us, ring.P99Us);
+
+		if (!rendezvous.Intact || !ring.Intact)
+		{
+			printf("MISMATCH\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
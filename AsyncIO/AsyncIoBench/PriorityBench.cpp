@@ -0,0 +1,271 @@
+// PriorityBench.cpp
+// Tail latency per priority class of pending reads, with FIFO, strict
+// priority and priority with aging.
+//
+// A simulation, in steps of one microsecond: each step, reads of the four
+// classes arrive at random at --load times the device's rate (40% bulk, 40%
+// normal, 15% high, 5% critical), and one write arrives and takes the read
+// due next, as a write IRP takes a pending read. With no read pending the
+// write goes unused, as an idle server would. Three ways of choosing the
+// read are compared, all on per-class FIFOs with a bitmap:
+//
+//  fifo      the oldest read of any class, as the single queue used to.
+//  priority  PriorityPolicy.h without aging: the highest non-empty class.
+//  aging     PriorityPolicy.h, a class higher for every --age-us waited.
+//
+// A read's latency is the time it spent pending. Reads still pending when
+// the run ends count with the time they have waited so far, so a starved
+// class shows up in the maximum even if it is never served. By default the
+// run is repeated just under, at, and just over full load.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "Bench.h"
+#include "PriorityPolicy.h"
+
+/* ----------------------------------------------------------------------------
+ *	Pending Reads
+ */
+
+enum class SimPolicy {
+	Fifo,
+	Priority,
+	Aging
+};
+
+// per-class FIFOs of arrival times, with a bitmap of the non-empty ones
+class SimQueue {
+public:
+	SimQueue(SimPolicy policy, unsigned int ageLimit)
+		: _policy(policy), _ageLimit(SimPolicy::Aging == policy ? ageLimit : 0) {}
+
+	void Push(int priority, unsigned long long now)
+	{
+		_classes[priority].push_back(now);
+		_bitmap |= 1u << priority;
+	}
+
+	// takes the read due next; returns its class, or -1 if none is pending
+	int Pop(unsigned long long now, unsigned long long* arrived)
+	{
+		if (0 == _bitmap)
+			return -1;
+
+		int priority;
+		if (SimPolicy::Fifo == _policy)
+		{
+			priority = PriorityHighestClass(_bitmap);
+			for (int c = 0; c < static_cast<int>(ASYNCIO_PRIORITY_CLASSES); ++c)
+			{
+				if (!_classes[c].empty() && _classes[c].front() < _classes[priority].front())
+					priority = c;
+			}
+		}
+		else
+		{
+			priority = PrioritySelectClass(_bitmap, _ageLimit,
+				[this, now](int c) { return static_cast<unsigned int>(now - _classes[c].front()); });
+		}
+
+		auto& fifo = _classes[priority];
+		*arrived = fifo.front();
+		fifo.pop_front();
+
+		if (fifo.empty())
+			_bitmap &= ~(1u << priority);
+
+		return priority;
+	}
+
+	const std::deque<unsigned long long>& Pending(int priority) const
+	{
+		return _classes[priority];
+	}
+
+private:
+	SimPolicy                      _policy;
+	unsigned int                   _ageLimit;
+	unsigned int                   _bitmap = 0;
+	std::deque<unsigned long long> _classes[ASYNCIO_PRIORITY_CLASSES];
+};
+
+/* ----------------------------------------------------------------------------
+ *	Simulation
+ */
+
+const char* const ClassNames[ASYNCIO_PRIORITY_CLASSES] = { "bulk", "normal", "high", "critical" };
+const double ClassShares[ASYNCIO_PRIORITY_CLASSES] = { 0.40, 0.40, 0.15, 0.05 };
+
+struct ClassResult {
+	unsigned long long Served;
+	unsigned long long Pending;
+	unsigned int       P50;
+	unsigned int       P99;
+	unsigned int       P999;
+	unsigned int       Max;
+};
+
+unsigned long long NextRandom(unsigned long long* state)
+{
+	// xorshift64: fixed seed, so every policy sees the same arrivals
+	auto x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+unsigned int Percentile(const std::vector<unsigned int>& sorted, unsigned int perMille)
+{
+	if (sorted.empty())
+		return 0;
+
+	return sorted[std::min(sorted.size() - 1, sorted.size() * perMille / 1000)];
+}
+
+void RunPolicy(SimPolicy policy, double load, unsigned int ageLimit, unsigned long long steps, ClassResult* results)
+{
+	SimQueue queue(policy, ageLimit);
+	std::vector<unsigned int> latencies[ASYNCIO_PRIORITY_CLASSES];
+
+	// an arrival in a step is a draw below the class's threshold
+	unsigned long long thresholds[ASYNCIO_PRIORITY_CLASSES];
+	for (unsigned int c = 0; c < ASYNCIO_PRIORITY_CLASSES; ++c)
+	{
+		thresholds[c] = static_cast<unsigned long long>(std::min(1.0, load * ClassShares[c]) * 18446744073709551615.0);
+	}
+
+	unsigned long long random = 0x9E3779B97F4A7C15ull;
+
+	for (unsigned long long now = 0; now < steps; ++now)
+	{
+		for (unsigned int c = 0; c < ASYNCIO_PRIORITY_CLASSES; ++c)
+		{
+			if (NextRandom(&random) < thresholds[c])
+				queue.Push(c, now);
+		}
+
+		unsigned long long arrived;
+		auto priority = queue.Pop(now, &arrived);
+		if (priority >= 0)
+			latencies[priority].push_back(static_cast<unsigned int>(now - arrived));
+	}
+
+	for (unsigned int c = 0; c < ASYNCIO_PRIORITY_CLASSES; ++c)
+	{
+		auto& sorted = latencies[c];
+		const auto served = sorted.size();
+
+		for (auto arrived : queue.Pending(c))
+		{
+			sorted.push_back(static_cast<unsigned int>(steps - arrived));
+		}
+
+		std::sort(sorted.begin(), sorted.end());
+
+		results[c].Served  = served;
+		results[c].Pending = sorted.size() - served;
+		results[c].P50     = Percentile(sorted, 500);
+		results[c].P99     = Percentile(sorted, 990);
+		results[c].P999    = Percentile(sorted, 999);
+		results[c].Max     = sorted.empty() ? 0 : sorted.back();
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ *	Checks
+ */
+
+// PrioritySelectClass() against hand-worked cases
+bool CheckPolicy()
+{
+	const unsigned int waits[ASYNCIO_PRIORITY_CLASSES] = { 70, 90, 10, 5 };
+	auto headWait = [&waits](int c) { return waits[c]; };
+
+	return -1 == PriorityHighestClass(0)
+		&& 3 == PriorityHighestClass(0xF)
+		&& 2 == PriorityHighestClass(0x5)
+		&& 3 == PrioritySelectClass(0xF, 0, headWait)      // no aging: highest
+		&& 3 == PrioritySelectClass(0xF, 60, headWait)     // 70, 150, 130, 185
+		&& 1 == PrioritySelectClass(0xF, 20, headWait)     // 70, 110, 50, 65
+		&& 0 == PrioritySelectClass(0xD, 20, headWait)     // class 1 is empty
+		&& 3 == PrioritySelectClass(0x9, 55, headWait)     // a tie: 70, 70
+		&& 2 == PrioritySelectClass(0x4, 1, headWait)      // nothing lower
+		&& 0 == PrioritySelectClass(0x1, 60, headWait);
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+// AsyncIoBench priority [--load X] [--age-us N] [--steps N]
+int RunPriorityBench(int argc, char* argv[])
+{
+	double loads[] = { 0.95, 1.00, 1.05 };
+	size_t loadCount = 3;
+	unsigned int ageLimit = 2000;
+	unsigned long long steps = 5000000;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--load"))
+		{
+			loads[0] = ::atof(argv[i + 1]);
+			loadCount = 1;
+		}
+		else if (0 == ::strcmp(argv[i], "--age-us"))
+			ageLimit = static_cast<unsigned int>(::strtoul(argv[i + 1], nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--steps"))
+			steps = ::strtoull(argv[i + 1], nullptr, 10);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (loads[0] <= 0 || 0 == ageLimit || 0 == steps)
+	{
+		printf("load, age limit and steps must be positive\n");
+		return 1;
+	}
+
+	if (!CheckPolicy())
+	{
+		printf("POLICY CHECK FAILED\n");
+		return 1;
+	}
+
+	const SimPolicy policies[] = { SimPolicy::Fifo, SimPolicy::Priority, SimPolicy::Aging };
+	const char* const policyNames[] = { "fifo", "priority", "aging" };
+
+	printf("%llu steps of 1 us, aging after %u us; latencies in us, pending reads included\n", steps, ageLimit);
+
+	for (size_t l = 0; l < loadCount; ++l)
+	{
+		printf("\nload %.2f\n", loads[l]);
+		printf("%-9s %-9s %10s %8s %8s %8s %9s %9s\n",
+			"policy", "class", "served", "pending", "p50", "p99", "p99.9", "max");
+
+		for (size_t p = 0; p < 3; ++p)
+		{
+			ClassResult results[ASYNCIO_PRIORITY_CLASSES];
+			RunPolicy(policies[p], loads[l], ageLimit, steps, results);
+
+			for (int c = ASYNCIO_PRIORITY_CLASSES - 1; c >= 0; --c)
+			{
+				const auto& result = results[c];
+				printf("%-9s %-9s %10llu %8llu %8u %8u %8u %9u\n",
+					policyNames[p], ClassNames[c], result.Served, result.Pending,
+					result.P50, result.P99, result.P999, result.Max);
+			}
+		}
+	}
+
+	return 0;
+}
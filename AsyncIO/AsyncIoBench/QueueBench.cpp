@@ -0,0 +1,279 @@
+// QueueBench.cpp
+// Cost of pending and matching requests in the AsyncIO queue engine.
+//
+// A single thread pends a batch of reads, satisfies them with a batch of
+// writes, then does the same with the roles swapped, through Rendezvous.h
+// and a queue lock, so that only the queueing itself is measured. Two
+// queues are compared:
+//
+//  item      the original scheme: a small heap item per pended request,
+//            holding the request and its length, freed when it is matched.
+//  embedded  the request is linked through its own list entry, as the
+//            driver now links IRPs through Tail.Overlay.ListEntry, and the
+//            length is read back from the request.
+//
+// The transferred lengths are summed so that both are known to have paired
+// the same requests.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "Bench.h"
+#include "Rendezvous.h"
+
+/* ----------------------------------------------------------------------------
+ *	Requests and Queues
+ */
+
+// stands in for an IRP: the driver-owned link and the stack location length
+struct QueueRequest {
+	QueueRequest* Next;
+	unsigned      Length;
+};
+
+// pending requests, each wrapped in an allocated item
+class ItemQueue {
+public:
+	~ItemQueue()
+	{
+		while (nullptr != PopHead())
+		{
+		}
+	}
+
+	QueueRequest* PopHead()
+	{
+		auto item = _head;
+		if (nullptr == item)
+			return nullptr;
+
+		_head = item->Next;
+		if (nullptr == _head)
+			_tail = nullptr;
+
+		auto request = item->Request;
+		request->Length = item->Length;
+		std::free(item);
+
+		return request;
+	}
+
+	bool PushTail(QueueRequest* request)
+	{
+		auto item = static_cast<Item*>(std::malloc(sizeof(Item)));
+		if (nullptr == item)
+			return false;
+
+		item->Next = nullptr;
+		item->Request = request;
+		item->Length = request->Length;
+
+		if (nullptr != _tail)
+			_tail->Next = item;
+		else
+			_head = item;
+
+		_tail = item;
+		_allocations++;
+
+		return true;
+	}
+
+	unsigned long long Allocations() const
+	{
+		return _allocations;
+	}
+
+private:
+	struct Item {
+		Item*         Next;
+		QueueRequest* Request;
+		unsigned      Length;
+	};
+
+	Item*              _head = nullptr;
+	Item*              _tail = nullptr;
+	unsigned long long _allocations = 0;
+};
+
+// pending requests linked through themselves
+class EmbeddedQueue {
+public:
+	QueueRequest* PopHead()
+	{
+		auto request = _head;
+		if (nullptr != request)
+		{
+			_head = request->Next;
+			if (nullptr == _head)
+				_tail = nullptr;
+		}
+
+		return request;
+	}
+
+	bool PushTail(QueueRequest* request)
+	{
+		request->Next = nullptr;
+
+		if (nullptr != _tail)
+			_tail->Next = request;
+		else
+			_head = request;
+
+		_tail = request;
+		return true;
+	}
+
+	unsigned long long Allocations() const
+	{
+		return 0;
+	}
+
+private:
+	QueueRequest* _head = nullptr;
+	QueueRequest* _tail = nullptr;
+};
+
+template<typename TList>
+class Locked : public TList {
+public:
+	void Lock()
+	{
+		_lock.lock();
+	}
+
+	void Unlock()
+	{
+		_lock.unlock();
+	}
+
+private:
+	std::mutex _lock;
+};
+
+/* ----------------------------------------------------------------------------
+ *	Measurement
+ */
+
+struct QueueResult {
+	double             Seconds;
+	unsigned long long Requests;
+	unsigned long long Bytes;
+	unsigned long long Allocations;
+};
+
+template<typename TQueue>
+void Submit(TQueue& reads, TQueue& writes, QueueRequest* request, bool bRead, unsigned long long& bytes)
+{
+	auto match = RendezvousTryMatch(bRead ? writes : reads);
+	if (nullptr == match && RendezvousResult::Matched != RendezvousMatchOrQueue(reads, writes, bRead, request, &match))
+		return;
+
+	bytes += (request->Length < match->Length) ? request->Length : match->Length;
+}
+
+template<typename TList>
+QueueResult RunQueue(size_t batch, int rounds)
+{
+	Locked<TList> reads;
+	Locked<TList> writes;
+
+	std::vector<QueueRequest> first(batch);
+	std::vector<QueueRequest> second(batch);
+
+	for (size_t i = 0; i < batch; ++i)
+	{
+		first[i].Length = static_cast<unsigned>(1 + i % 64);
+		second[i].Length = static_cast<unsigned>(1 + (i * 7) % 64);
+	}
+
+	QueueResult result = { 0, 0, 0, 0 };
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for (int round = 0; round < rounds; ++round)
+	{
+		// even rounds pend reads, odd rounds pend writes
+		const bool bReadFirst = 0 == (round & 1);
+
+		for (auto& request : first)
+		{
+			Submit(reads, writes, &request, bReadFirst, result.Bytes);
+		}
+
+		for (auto& request : second)
+		{
+			Submit(reads, writes, &request, !bReadFirst, result.Bytes);
+		}
+	}
+
+	result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.Requests = 2ull * batch * rounds;
+	result.Allocations = reads.Allocations() + writes.Allocations();
+
+	return result;
+}
+
+void Report(const char* name, const QueueResult& result)
+{
+	printf("%-9s %14.0f %10.1f %14llu %14llu\n",
+		name,
+		result.Requests / result.Seconds,
+		result.Seconds * 1e9 / result.Requests,
+		result.Allocations,
+		result.Bytes);
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+// AsyncIoBench queue [--batch N] [--rounds N]
+int RunQueueBench(int argc, char* argv[])
+{
+	size_t batch = 4096;
+	int rounds = 500;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		auto value = argv[i + 1];
+
+		if (0 == ::strcmp(argv[i], "--batch"))
+			batch = static_cast<size_t>(::strtoull(value, nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--rounds"))
+			rounds = ::atoi(value);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == batch || rounds < 1)
+	{
+		printf("batch and rounds must be positive\n");
+		return 1;
+	}
+
+	printf("batches of %zu pended requests, %d rounds\n", batch, rounds);
+	printf("%-9s %14s %10s %14s %14s\n", "queue", "ops/s", "ns/op", "allocations", "bytes");
+
+	auto item = RunQueue<ItemQueue>(batch, rounds);
+	Report("item", item);
+
+	auto embedded = RunQueue<EmbeddedQueue>(batch, rounds);
+	Report("embedded", embedded);
+
+	if (item.Bytes != embedded.Bytes)
+	{
+		printf("MISMATCH\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -5,6 +5,7 @@
 #include <windows.h>
 
 #include <string>
+#include <iomanip>
 #include <iostream>
 
 #include "AsyncIoCommon.h"
@@ -12,10 +13,20 @@
 constexpr auto STATUS_SUCCESS_I = 0x0;
 constexpr auto STATUS_FAILURE_I = 0x1;
 
+// an overlapped request and its buffer, which must both outlive the call
+// that issues the request; freed by the completion routine
+struct OVERLAPPED_REQUEST
+{
+	OVERLAPPED Overlapped;
+	UCHAR      Buffer[(MAX_READ_SIZE > MAX_WRITE_SIZE) ? MAX_READ_SIZE : MAX_WRITE_SIZE];
+};
+
 VOID DoReadCommand(HANDLE hDevice);
 VOID DoWriteCommand(HANDLE hDevice);
 VOID DoCountCommand(HANDLE hDevice);
 VOID DoKillCommand(HANDLE hDevice);
+VOID DoPipeCommand(HANDLE hDevice, ULONG RingSize);
+VOID DoStatsCommand(HANDLE hDevice);
 
 VOID CALLBACK OverlappedReadCompletionRoutine(_In_ DWORD, _In_ DWORD, _Inout_ LPOVERLAPPED);
 VOID CALLBACK OverlappedWriteCompletionRoutine(_In_ DWORD, _In_ DWORD, _Inout_ LPOVERLAPPED);
@@ -24,12 +35,20 @@ VOID LogInfo(const std::string& msg);
 VOID LogWarning(const std::string& msg);
 VOID LogError(const std::string& msg);
 
-INT _tmain()
+INT _tmain(INT argc, TCHAR* argv[])
 {
 	LogInfo("AsyncIO Driver Client");
 
+	// an optional argument names the channel to open, e.g. 7 or logs
+	std::string DevicePath = "\\\\.\\AsyncIO";
+	if (argc > 1)
+	{
+		DevicePath += "\\";
+		DevicePath += argv[1];
+	}
+
 	HANDLE hDevice = CreateFile(
-		"\\\\.\\AsyncIO",
+		DevicePath.c_str(),
 		GENERIC_READ | GENERIC_WRITE,
 		FILE_SHARE_READ | FILE_SHARE_WRITE,
 		nullptr,
@@ -50,6 +69,8 @@ INT _tmain()
 	LogInfo("\t(w) issue WRITE request");
 	LogInfo("\t(c) issue COUNT query");
 	LogInfo("\t(k) issue KILL command");
+	LogInfo("\t(p <bytes>) switch to PIPE mode with a ring of <bytes>, 0 to pair reads with writes");
+	LogInfo("\t(t) issue STATS query");
 	LogInfo("\t(s) begin SLEEP to enter alertable wait state");
 	LogInfo("\t(q) exit the command loop");
 
@@ -93,6 +114,20 @@ INT _tmain()
 			DoKillCommand(hDevice);
 			break;
 		}
+		case 'p':
+		case 'P':
+		{
+			LogInfo("Handling PIPE command");
+			DoPipeCommand(hDevice, strtoul(cmdBuffer + 1, nullptr, 10));
+			break;
+		}
+		case 't':
+		case 'T':
+		{
+			LogInfo("Handling STATS query");
+			DoStatsCommand(hDevice);
+			break;
+		}
 		case 's':
 		case 'S':
 		{
@@ -126,23 +161,22 @@ INT _tmain()
 // handle a read command
 VOID DoReadCommand(HANDLE hDevice)
 {
-	UCHAR buffer[MAX_READ_SIZE];
-
-	// allocate a new OVERLAPPED structure
-	LPOVERLAPPED pOverlapped = new OVERLAPPED{};
-	pOverlapped->Offset = 0;
-	pOverlapped->OffsetHigh = 0;
+	// allocate a new request, zeroed
+	auto pRequest = new OVERLAPPED_REQUEST{};
 
 	BOOL bRet = ReadFileEx(
 		hDevice, 
-		static_cast<PVOID>(buffer), 
+		static_cast<PVOID>(pRequest->Buffer), 
 		MAX_READ_SIZE, 
-		pOverlapped, 
+		&pRequest->Overlapped, 
 		OverlappedReadCompletionRoutine
 		);
 	
 	if (!bRet)
 	{
+		// the completion routine never runs
+		delete pRequest;
+
 		LogError("READ request failed (ReadFileEx())");
 		return;
 	}
@@ -160,36 +194,33 @@ OverlappedReadCompletionRoutine(
 	std::cout << "[+]	Bytes transferred: " << dwNumberOfBytesTransferred << '\n';
 	std::cout << std::flush;
 
-	// deallocate the overlapped structure
-	delete lpOverlapped;
+	// deallocate the request, buffer included
+	delete CONTAINING_RECORD(lpOverlapped, OVERLAPPED_REQUEST, Overlapped);
 }
 
 // handle a write command
 VOID DoWriteCommand(HANDLE hDevice)
 {
-	UCHAR buffer[MAX_WRITE_SIZE];
-	RtlZeroMemory(buffer, MAX_WRITE_SIZE);
+	auto pRequest = new OVERLAPPED_REQUEST{};
 
 	// just fill with recognizable data
 	for (UINT i = 0; i < MAX_WRITE_SIZE; ++i)
 	{
-		buffer[i] = i;
+		pRequest->Buffer[i] = i;
 	}
 
-	LPOVERLAPPED pOverlapped = new OVERLAPPED{};
-	pOverlapped->Offset = 0;
-	pOverlapped->OffsetHigh = 0;
-
 	BOOL bRet = WriteFileEx(
 		hDevice, 
-		static_cast<PVOID>(buffer), 
+		static_cast<PVOID>(pRequest->Buffer), 
 		MAX_WRITE_SIZE, 
-		pOverlapped, 
+		&pRequest->Overlapped, 
 		OverlappedWriteCompletionRoutine
 		);
 
 	if (!bRet)
 	{
+		delete pRequest;
+
 		LogError("WRITE request failed (WriteFileEx())");
 		return;
 	}
@@ -207,8 +238,8 @@ OverlappedWriteCompletionRoutine(
 	std::cout << "[+]	Bytes transferred: " << dwNumberOfBytesTransferred << '\n';
 	std::cout << std::flush;
 
-	// deallocate the overlapped structure
-	delete lpOverlapped;
+	// deallocate the request, buffer included
+	delete CONTAINING_RECORD(lpOverlapped, OVERLAPPED_REQUEST, Overlapped);
 }
 
 // handle a count command
@@ -264,6 +295,101 @@ VOID DoKillCommand(HANDLE hDevice)
 	LogInfo("Successfully sent KILL command to cancel all pending IRPs");
 }
 
+VOID DoPipeCommand(HANDLE hDevice, ULONG RingSize)
+{
+	DWORD dwBytesReturned;
+
+	BOOL status = DeviceIoControl(
+		hDevice,
+		IOCTL_ASYNCIO_SET_PIPE_MODE,
+		&RingSize,
+		sizeof(RingSize),
+		nullptr,
+		0,
+		&dwBytesReturned,
+		nullptr
+		);
+
+	if (!status)
+	{
+		LogError("PIPE command failed (DeviceIoControl())");
+		return;
+	}
+
+	if (0 == RingSize)
+	{
+		LogInfo("Successfully switched back to pairing reads with writes");
+	}
+	else
+	{
+		LogInfo("Successfully switched to pipe mode with a ring of " + std::to_string(RingSize) + " bytes");
+	}
+}
+
+// handle a stats query: device-wide counters and time-in-queue histograms
+VOID DoStatsCommand(HANDLE hDevice)
+{
+	DWORD dwBytesReturned;
+	ASYNCIO_STATS stats{};
+
+	BOOL status = DeviceIoControl(
+		hDevice,
+		IOCTL_ASYNCIO_QUERY_STATS,
+		nullptr,
+		0,
+		&stats,
+		sizeof(stats),
+		&dwBytesReturned,
+		nullptr
+		);
+
+	if (!status)
+	{
+		LogError("STATS query failed (DeviceIoControl())");
+		return;
+	}
+
+	// a driver older than this client fills in less
+	if (dwBytesReturned < sizeof(stats) || stats.Version < ASYNCIO_STATS_VERSION)
+	{
+		LogWarning("Driver returned statistics version " + std::to_string(stats.Version) + ", expected " + std::to_string(ASYNCIO_STATS_VERSION));
+		return;
+	}
+
+	LogInfo("Successfully completed STATS query:");
+	std::cout << "[+] \tMatches:           " << stats.Matches << '\n';
+	std::cout << "[+] \tBytes transferred: " << stats.BytesTransferred << '\n';
+	std::cout << "[+] \t                   reads        writes\n";
+	std::cout << "[+] \tPended:            " << std::left
+		<< std::setw(12) << stats.Pended[ASYNCIO_STATS_READS] << ' ' << stats.Pended[ASYNCIO_STATS_WRITES] << '\n';
+	std::cout << "[+] \tCancelled:         "
+		<< std::setw(12) << stats.Cancelled[ASYNCIO_STATS_READS] << ' ' << stats.Cancelled[ASYNCIO_STATS_WRITES] << '\n';
+	std::cout << "[+] \tQueue high water:  "
+		<< std::setw(12) << stats.HighWater[ASYNCIO_STATS_READS] << ' ' << stats.HighWater[ASYNCIO_STATS_WRITES] << '\n';
+
+	// time in queue, skipping buckets empty on both sides
+	std::cout << "[+] \tTime in queue:\n";
+	for (ULONG bucket = 0; bucket < ASYNCIO_STATS_BUCKETS; ++bucket)
+	{
+		const auto reads  = stats.WaitHistogram[ASYNCIO_STATS_READS][bucket];
+		const auto writes = stats.WaitHistogram[ASYNCIO_STATS_WRITES][bucket];
+		if (0 == reads && 0 == writes)
+		{
+			continue;
+		}
+
+		std::string range = (0 == bucket)
+			? "< 1us"
+			: (bucket + 1 == ASYNCIO_STATS_BUCKETS)
+				? ">= " + std::to_string(1ull << (bucket - 1)) + "us"
+				: std::to_string(1ull << (bucket - 1)) + "-" + std::to_string((1ull << bucket) - 1) + "us";
+
+		std::cout << "[+] \t  " << std::setw(17) << range << std::setw(12) << reads << ' ' << writes << '\n';
+	}
+
+	std::cout << std::right << std::flush;
+}
+
 /* ----------------------------------------------------------------------------
  * Utility Functions
  */
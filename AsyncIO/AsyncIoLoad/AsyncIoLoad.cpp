@@ -0,0 +1,299 @@
+// AsyncIoLoad.cpp
+// Load generator for the AsyncIO driver: thousands of overlapped reads and
+// writes through an I/O completion port.
+//
+// Opens \\.\AsyncIO (or a channel of it) once, overlapped, and associates
+// the handle with a completion port drained by a pool of worker threads,
+// each taking up to 64 completions per GetQueuedCompletionStatusEx() call.
+// LoadCore.h keeps --depth requests outstanding, --read-pct percent of them
+// reads, and reissues each as it completes; at the end of the run
+// whatever is still pending is cancelled with CancelIoEx().
+//
+// Every request has its own OVERLAPPED and buffer for the whole run, so
+// nothing is allocated per request and nothing can leak when one fails.
+
+// LoadCore.h uses std::min / std::max
+#define NOMINMAX
+
+#include <tchar.h>
+#include <windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "AsyncIoCommon.h"
+#include "LoadCore.h"
+
+constexpr auto STATUS_SUCCESS_I = 0x0;
+constexpr auto STATUS_FAILURE_I = 0x1;
+
+/* ----------------------------------------------------------------------------
+ *	Completion Port Transport
+ */
+
+class IocpTransport {
+public:
+	~IocpTransport()
+	{
+		if (nullptr != _hPort)
+		{
+			CloseHandle(_hPort);
+		}
+
+		if (INVALID_HANDLE_VALUE != _hDevice)
+		{
+			CloseHandle(_hDevice);
+		}
+	}
+
+	BOOL Open(const std::string& DevicePath, DWORD Workers)
+	{
+		_hDevice = CreateFile(
+			DevicePath.c_str(),
+			GENERIC_READ | GENERIC_WRITE,
+			FILE_SHARE_READ | FILE_SHARE_WRITE,
+			nullptr,
+			OPEN_EXISTING,
+			FILE_FLAG_OVERLAPPED,
+			nullptr
+		);
+
+		if (INVALID_HANDLE_VALUE == _hDevice)
+		{
+			return FALSE;
+		}
+
+		// at most as many workers run at once as there are in the pool
+		_hPort = CreateIoCompletionPort(_hDevice, nullptr, 0, Workers);
+
+		return nullptr != _hPort;
+	}
+
+	bool Prepare(LoadRequest* pRequests, unsigned int Count)
+	{
+		_requests.assign(Count, IocpRequest{});
+
+		for (unsigned int i = 0; i < Count; ++i)
+		{
+			_requests[i].pRequest = &pRequests[i];
+		}
+
+		return true;
+	}
+
+	bool Submit(LoadRequest* pRequest)
+	{
+		auto& Slot = _requests[pRequest->Index];
+		RtlZeroMemory(&Slot.Overlapped, sizeof(Slot.Overlapped));
+
+		// a request that completes at once still queues its completion,
+		// since the handle does not skip the port on success
+		BOOL bRet = pRequest->bRead
+			? ReadFile(_hDevice, pRequest->Buffer, pRequest->Length, nullptr, &Slot.Overlapped)
+			: WriteFile(_hDevice, pRequest->Buffer, pRequest->Length, nullptr, &Slot.Overlapped);
+
+		return bRet || ERROR_IO_PENDING == GetLastError();
+	}
+
+	unsigned int Reap(LoadCompletion* pCompletions, unsigned int Max)
+	{
+		OVERLAPPED_ENTRY Entries[64];
+		ULONG Count = 0;
+
+		if (!GetQueuedCompletionStatusEx(_hPort, Entries, std::min(Max, 64u), &Count, INFINITE, FALSE))
+		{
+			return 0;
+		}
+
+		for (ULONG i = 0; i < Count; ++i)
+		{
+			auto& Completion = pCompletions[i];
+			auto pOverlapped = Entries[i].lpOverlapped;
+
+			if (nullptr == pOverlapped)
+			{
+				// posted by Wake()
+				Completion = LoadCompletion{};
+				continue;
+			}
+
+			auto pSlot = CONTAINING_RECORD(pOverlapped, IocpRequest, Overlapped);
+
+			// Internal holds the request's final NTSTATUS
+			Completion.Request   = pSlot->pRequest;
+			Completion.Bytes     = Entries[i].dwNumberOfBytesTransferred;
+			Completion.Succeeded = (0 == pOverlapped->Internal);
+		}
+
+		return Count;
+	}
+
+	void CancelAll()
+	{
+		CancelIoEx(_hDevice, nullptr);
+	}
+
+	void Wake(unsigned int Count)
+	{
+		for (unsigned int i = 0; i < Count; ++i)
+		{
+			PostQueuedCompletionStatus(_hPort, 0, 0, nullptr);
+		}
+	}
+
+private:
+	struct IocpRequest {
+		OVERLAPPED   Overlapped;
+		LoadRequest* pRequest;
+	};
+
+	HANDLE                   _hDevice = INVALID_HANDLE_VALUE;
+	HANDLE                   _hPort = nullptr;
+	std::vector<IocpRequest> _requests;
+};
+
+/* ----------------------------------------------------------------------------
+ *	Pipe Mode
+ */
+
+// Sets the channel's pipe mode through a second, synchronous handle, so the
+// IOCTL neither needs an OVERLAPPED nor lands on the completion port. The
+// load handle must already be open: a channel only lives while some handle
+// is open on it.
+BOOL SetPipeMode(const std::string& DevicePath, ULONG RingSize)
+{
+	HANDLE hControl = CreateFile(
+		DevicePath.c_str(),
+		GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		nullptr,
+		OPEN_EXISTING,
+		0,
+		nullptr
+	);
+
+	if (INVALID_HANDLE_VALUE == hControl)
+	{
+		return FALSE;
+	}
+
+	DWORD dwBytesReturned;
+
+	BOOL bRet = DeviceIoControl(
+		hControl,
+		IOCTL_ASYNCIO_SET_PIPE_MODE,
+		&RingSize,
+		sizeof(RingSize),
+		nullptr,
+		0,
+		&dwBytesReturned,
+		nullptr
+		);
+
+	CloseHandle(hControl);
+
+	return bRet;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+VOID PrintUsage()
+{
+	printf("AsyncIoLoad [--channel NAME] [--size BYTES] [--depth N] [--read-pct N]\n");
+	printf("            [--workers N] [--seconds N] [--pipe-kb N]\n");
+}
+
+INT _tmain(INT argc, TCHAR* argv[])
+{
+	LoadConfig Config;
+	std::string DevicePath = "\\\\.\\AsyncIO";
+	ULONG PipeKb = 0;
+
+	SYSTEM_INFO SystemInfo;
+	GetSystemInfo(&SystemInfo);
+	Config.Workers = SystemInfo.dwNumberOfProcessors;
+
+	for (INT i = 1; i + 1 < argc; i += 2)
+	{
+		const auto Value = static_cast<unsigned int>(strtoul(argv[i + 1], nullptr, 10));
+
+		if (0 == strcmp(argv[i], "--channel"))
+		{
+			DevicePath += "\\";
+			DevicePath += argv[i + 1];
+		}
+		else if (0 == strcmp(argv[i], "--size"))
+			Config.MessageSize = Value;
+		else if (0 == strcmp(argv[i], "--depth"))
+			Config.QueueDepth = Value;
+		else if (0 == strcmp(argv[i], "--read-pct"))
+			Config.ReadPercent = Value;
+		else if (0 == strcmp(argv[i], "--workers"))
+			Config.Workers = Value;
+		else if (0 == strcmp(argv[i], "--seconds"))
+			Config.DurationMs = Value * 1000;
+		else if (0 == strcmp(argv[i], "--pipe-kb"))
+			PipeKb = Value;
+		else
+		{
+			PrintUsage();
+			return STATUS_FAILURE_I;
+		}
+	}
+
+	if (0 == (argc % 2)
+		|| 0 == Config.MessageSize
+		|| Config.QueueDepth < 2 || Config.QueueDepth > 65536
+		|| Config.ReadPercent > 100
+		|| 0 == Config.Workers
+		|| 0 == Config.DurationMs
+		|| static_cast<ULONGLONG>(PipeKb) * 1024 > ASYNCIO_MAX_PIPE_SIZE)
+	{
+		PrintUsage();
+		return STATUS_FAILURE_I;
+	}
+
+	IocpTransport Transport;
+	if (!Transport.Open(DevicePath, Config.Workers))
+	{
+		printf("[!] Failed to open %s (GLE): %lu\n", DevicePath.c_str(), GetLastError());
+		return STATUS_FAILURE_I;
+	}
+
+	if (0 != PipeKb && !SetPipeMode(DevicePath, PipeKb * 1024))
+	{
+		printf("[!] Failed to switch to pipe mode (GLE): %lu\n", GetLastError());
+		return STATUS_FAILURE_I;
+	}
+
+	printf("%s, %u workers, %u ms, %s\n", DevicePath.c_str(), Config.Workers, Config.DurationMs,
+		(0 != PipeKb) ? (std::to_string(PipeKb) + " KB pipe").c_str() : "rendezvous");
+
+	LoadGenerator<IocpTransport> Generator(Transport, Config);
+	LoadResult Result;
+
+	const auto bRan = Generator.Run(&Result);
+
+	// only possible once everything has drained and the ring is empty; a
+	// ring left holding data keeps the channel in pipe mode until closed
+	if (0 != PipeKb && !SetPipeMode(DevicePath, 0))
+	{
+		printf("[-] Channel left in pipe mode (GLE): %lu\n", GetLastError());
+	}
+
+	if (!bRan)
+	{
+		printf("[!] Failed to set up the run\n");
+		return STATUS_FAILURE_I;
+	}
+
+	PrintLoadHeader();
+	PrintLoadResult(Config, Result);
+
+	return STATUS_SUCCESS_I;
+}
@@ -0,0 +1,363 @@
+// LoadCore.h
+// The portable core of the AsyncIO load generator: keeps a fixed set of
+// reads and writes outstanding on a transport, reaps their completions with
+// a pool of workers, and measures throughput and latency.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// The generator keeps QueueDepth requests outstanding at all times, of
+// which ReadPercent percent are reads; every request that completes is
+// issued again at once, as the same kind, until the run is over. Holding
+// the mix of outstanding requests fixed, rather than drawing each one at
+// random, means there is always a read and a write outstanding, so a
+// transport that pairs reads with writes can never run dry.
+//
+// Kept free of Windows headers: AsyncIoLoad drives the driver through a
+// completion port, and AsyncIoBench drives an in-process stand-in for the
+// driver's matching, both through this core.
+//
+// TTransport provides
+//   bool Prepare(LoadRequest* requests, unsigned int count)
+//     sets up per-request state before anything is submitted;
+//   bool Submit(LoadRequest* request)
+//     starts the request, or returns false if it failed at once, in which
+//     case it never completes;
+//   unsigned int Reap(LoadCompletion* completions, unsigned int max)
+//     waits for completions and returns up to max of them; a completion
+//     with no request is a wake-up;
+//   void CancelAll()
+//     cancels every outstanding request; each still completes, as failed;
+//     and
+//   void Wake(unsigned int count)
+//     queues count wake-ups.
+
+typedef std::chrono::steady_clock LoadClock;
+
+struct LoadConfig {
+	unsigned int MessageSize = 4096;
+	unsigned int QueueDepth  = 1024;
+	unsigned int ReadPercent = 50;
+	unsigned int Workers     = 4;
+	unsigned int DurationMs  = 5000;
+};
+
+struct LoadRequest {
+	unsigned char*        Buffer;
+	unsigned int          Length;
+	unsigned int          Index;     // in the generator's array
+	bool                  bRead;
+	LoadClock::time_point Started;
+};
+
+struct LoadCompletion {
+	LoadRequest* Request;    // nullptr for a wake-up
+	unsigned int Bytes;
+	bool         Succeeded;
+};
+
+/* ----------------------------------------------------------------------------
+ *	Latency Histogram
+ */
+
+// Nanosecond latencies in log-linear buckets: exact below 32ns, and within
+// 1/32 (about 3%) above, in a fixed 15KB whatever the count.
+class LatencyHistogram {
+public:
+	LatencyHistogram()
+		: _counts(Buckets, 0) {}
+
+	void Record(unsigned long long ns)
+	{
+		_counts[Index(ns)]++;
+		_count++;
+		_max = std::max(_max, ns);
+	}
+
+	void Merge(const LatencyHistogram& other)
+	{
+		for (unsigned int i = 0; i < Buckets; ++i)
+		{
+			_counts[i] += other._counts[i];
+		}
+
+		_count += other._count;
+		_max = std::max(_max, other._max);
+	}
+
+	unsigned long long Count() const
+	{
+		return _count;
+	}
+
+	unsigned long long Max() const
+	{
+		return _max;
+	}
+
+	// the upper bound of the bucket holding the perMille'th latency
+	unsigned long long Percentile(unsigned int perMille) const
+	{
+		if (0 == _count)
+			return 0;
+
+		const auto rank = std::min(_count - 1, _count * perMille / 1000);
+
+		unsigned long long seen = 0;
+		for (unsigned int i = 0; i < Buckets; ++i)
+		{
+			seen += _counts[i];
+			if (seen > rank)
+				return std::min(_max, UpperBound(i));
+		}
+
+		return _max;
+	}
+
+private:
+	static constexpr unsigned int SubBuckets = 32;
+	static constexpr unsigned int Buckets = 60 * SubBuckets;
+
+	// below 32, the value; above, 32 buckets per power of two
+	static unsigned int Index(unsigned long long value)
+	{
+		if (value < SubBuckets)
+			return static_cast<unsigned int>(value);
+
+		unsigned int shift = 0;
+		while (value >> (shift + 6))
+			shift++;
+
+		return (shift + 1) * SubBuckets + static_cast<unsigned int>((value >> shift) - SubBuckets);
+	}
+
+	static unsigned long long UpperBound(unsigned int index)
+	{
+		if (index < SubBuckets)
+			return index;
+
+		const auto shift = index / SubBuckets - 1;
+		const auto lower = static_cast<unsigned long long>(SubBuckets + index % SubBuckets) << shift;
+		return lower + (1ull << shift) - 1;
+	}
+
+	std::vector<unsigned long long> _counts;
+	unsigned long long              _count = 0;
+	unsigned long long              _max = 0;
+};
+
+/* ----------------------------------------------------------------------------
+ *	Generator
+ */
+
+struct LoadResult {
+	double             Seconds = 0;
+	unsigned long long Operations = 0;   // completed successfully in the run
+	unsigned long long Bytes = 0;        // delivered into reads, each byte moved once
+	unsigned long long Errors = 0;       // failed, cancellation at the end aside
+	LatencyHistogram   Latency;
+};
+
+template<typename TTransport>
+class LoadGenerator {
+public:
+	LoadGenerator(TTransport& transport, const LoadConfig& config)
+		: _transport(transport), _config(config) {}
+
+	// returns false if the configuration is unusable or Prepare() failed
+	bool Run(LoadResult* result)
+	{
+		const auto depth = _config.QueueDepth;
+		if (depth < 2 || 0 == _config.MessageSize || 0 == _config.Workers)
+			return false;
+
+		// at least one of each kind, whatever the percentage
+		const auto reads = std::min(depth - 1, std::max(1u, depth * _config.ReadPercent / 100));
+
+		_storage.assign(static_cast<size_t>(depth) * _config.MessageSize, 0);
+		_requests.resize(depth);
+
+		for (unsigned int i = 0; i < depth; ++i)
+		{
+			auto& request = _requests[i];
+			request.Buffer = &_storage[static_cast<size_t>(i) * _config.MessageSize];
+			request.Length = _config.MessageSize;
+			request.Index  = i;
+
+			// spread the reads evenly among the writes
+			request.bRead = (static_cast<unsigned long long>(i + 1) * reads / depth) != (static_cast<unsigned long long>(i) * reads / depth);
+
+			for (unsigned int j = 0; !request.bRead && j < request.Length; ++j)
+			{
+				request.Buffer[j] = static_cast<unsigned char>(i + j);
+			}
+		}
+
+		if (!_transport.Prepare(_requests.data(), depth))
+			return false;
+
+		std::vector<WorkerState> states(_config.Workers);
+		std::vector<std::thread> workers;
+
+		_stop.store(false);
+		_outstanding.store(0);
+
+		for (auto& state : states)
+		{
+			workers.emplace_back(&LoadGenerator::Work, this, &state);
+		}
+
+		unsigned long long submitFailures = 0;
+		const auto start = LoadClock::now();
+
+		for (auto& request : _requests)
+		{
+			_outstanding.fetch_add(1);
+			request.Started = LoadClock::now();
+
+			if (!_transport.Submit(&request))
+			{
+				_outstanding.fetch_sub(1);
+				submitFailures++;
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(_config.DurationMs));
+		_stop.store(true);
+
+		const auto end = LoadClock::now();
+
+		// a worker may reissue a request just after a cancellation pass,
+		// so keep cancelling until everything is back
+		while (0 != _outstanding.load())
+		{
+			_transport.CancelAll();
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		_transport.Wake(_config.Workers);
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+
+		*result = LoadResult();
+		result->Seconds = std::chrono::duration<double>(end - start).count();
+		result->Errors = submitFailures;
+
+		for (const auto& state : states)
+		{
+			result->Operations += state.Operations;
+			result->Bytes      += state.Bytes;
+			result->Errors     += state.Errors;
+			result->Latency.Merge(state.Latency);
+		}
+
+		return true;
+	}
+
+private:
+	struct WorkerState {
+		unsigned long long Operations = 0;
+		unsigned long long Bytes = 0;
+		unsigned long long Errors = 0;
+		LatencyHistogram   Latency;
+	};
+
+	// reaps completions and reissues each request until a wake-up arrives
+	// after the run
+	void Work(WorkerState* state)
+	{
+		LoadCompletion completions[64];
+		unsigned int wakeups = 0;
+
+		while (0 == wakeups)
+		{
+			const auto count = _transport.Reap(completions, 64);
+			const auto now = LoadClock::now();
+			const bool stopping = _stop.load(std::memory_order_relaxed);
+
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				const auto& completion = completions[i];
+				auto request = completion.Request;
+
+				if (nullptr == request)
+				{
+					wakeups++;
+					continue;
+				}
+
+				if (stopping)
+				{
+					_outstanding.fetch_sub(1);
+					continue;
+				}
+
+				if (completion.Succeeded)
+				{
+					state->Operations++;
+
+					// a write's bytes are counted when a read receives them, so
+					// that each byte moved counts once
+					if (request->bRead)
+						state->Bytes += completion.Bytes;
+
+					state->Latency.Record(static_cast<unsigned long long>(
+						std::chrono::duration_cast<std::chrono::nanoseconds>(now - request->Started).count()));
+				}
+				else
+				{
+					state->Errors++;
+				}
+
+				request->Started = now;
+				if (!_transport.Submit(request))
+				{
+					state->Errors++;
+					_outstanding.fetch_sub(1);
+				}
+			}
+		}
+
+		// one batch can hold several workers' wake-ups; pass the rest on
+		if (wakeups > 1)
+			_transport.Wake(wakeups - 1);
+	}
+
+	TTransport&                _transport;
+	LoadConfig                 _config;
+	std::vector<unsigned char> _storage;
+	std::vector<LoadRequest>   _requests;
+	std::atomic<bool>          _stop{ false };
+	std::atomic<unsigned int>  _outstanding{ 0 };
+};
+
+/* ----------------------------------------------------------------------------
+ *	Reporting
+ */
+
+inline void PrintLoadHeader()
+{
+	printf("%7s %6s %6s %12s %10s %8s %9s %9s %9s %9s %9s\n",
+		"depth", "size", "read%", "ops/s", "MB/s", "errors",
+		"p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+}
+
+inline void PrintLoadResult(const LoadConfig& config, const LoadResult& result)
+{
+	const auto& latency = result.Latency;
+
+	printf("%7u %6u %6u %12.0f %10.1f %8llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+		config.QueueDepth, config.MessageSize, config.ReadPercent,
+		result.Operations / result.Seconds, result.Bytes / result.Seconds / 1e6, result.Errors,
+		latency.Percentile(500) / 1e3, latency.Percentile(900) / 1e3, latency.Percentile(990) / 1e3,
+		latency.Percentile(999) / 1e3, latency.Max() / 1e3);
+}
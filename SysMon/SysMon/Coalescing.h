@@ -0,0 +1,84 @@
+/*
+ * Coalescing.h
+ * Policy for when a pended read is completed with queued events.
+ *
+ * Kept free of kernel headers so the policy can be exercised on the host.
+ */
+
+#pragma once
+
+// times are in 100ns units, as returned by KeQueryInterruptTime()
+struct CoalescingPolicy {
+	unsigned long MinBytes;  // complete as soon as this much is queued
+	long long     Window;    // at most one early completion per window
+};
+
+struct CoalescingState {
+	long long LastCompletion;  // when a read was last completed
+	bool      TimerArmed;      // a flush is already scheduled
+};
+
+enum class CoalesceDecision {
+	Wait,         // leave the read pending; a flush is already due
+	CompleteNow,  // complete the oldest pending read now
+	ArmTimer      // leave the read pending and schedule a flush at DueTime
+};
+
+// Decide what to do after queueing an event while a read is pending.
+//
+// A read that has been idle for a full window is completed at once, so a
+// quiet system sees its events immediately. Under load, reads complete
+// when MinBytes have built up or one window after the previous
+// completion, whichever comes first, so the client is woken at most
+// about once per window unless it is falling behind.
+inline CoalesceDecision DecideOnPush(
+	const CoalescingPolicy& policy,
+	CoalescingState& state,
+	unsigned long queuedBytes,
+	long long now,
+	long long* dueTime)
+{
+	if (queuedBytes >= policy.MinBytes || now - state.LastCompletion >= policy.Window)
+		return CoalesceDecision::CompleteNow;
+
+	if (state.TimerArmed)
+		return CoalesceDecision::Wait;
+
+	state.TimerArmed = true;
+	*dueTime = state.LastCompletion + policy.Window;
+
+	return CoalesceDecision::ArmTimer;
+}
+
+// record a completed read; any scheduled flush becomes a no-op
+inline void OnReadCompleted(CoalescingState& state, long long now)
+{
+	state.LastCompletion = now;
+	state.TimerArmed = false;
+}
+
+// A flush ran, from the timer or because a push asked for one; true to
+// complete a read now. A flush scheduled before the last completion finds
+// nothing due and completes nothing; if events are still queued the timer
+// is re-armed instead (TimerArmed set, *dueTime filled in) for the end of
+// the current window.
+inline bool ShouldFlush(
+	const CoalescingPolicy& policy,
+	CoalescingState& state,
+	unsigned long queuedBytes,
+	long long now,
+	long long* dueTime)
+{
+	state.TimerArmed = false;
+
+	if (0 == queuedBytes)
+		return false;
+
+	if (queuedBytes >= policy.MinBytes || now - state.LastCompletion >= policy.Window)
+		return true;
+
+	state.TimerArmed = true;
+	*dueTime = state.LastCompletion + policy.Window;
+
+	return false;
+}
@@ -0,0 +1,194 @@
+/*
+ * EventLog.h
+ * Preallocated circular byte log of SysMon records.
+ *
+ * Kept free of kernel headers so the log can be built and benchmarked on
+ * the host; the includer provides the Windows types (pch.h, Windows.h, or
+ * the shim in SysMonCommon.h).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include "SysMonCommon.h"
+
+#ifdef _WIN32
+#define LOG_READ_ACQUIRE16(p)      ReadAcquire16(p)
+#define LOG_WRITE_RELEASE16(p, v)  WriteRelease16((p), (v))
+#define LOG_READ_ACQUIRE64(p)      static_cast<ULONGLONG>(ReadAcquire64(reinterpret_cast<const volatile LONG64*>(p)))
+#define LOG_WRITE_RELEASE64(p, v)  WriteRelease64(reinterpret_cast<volatile LONG64*>(p), static_cast<LONG64>(v))
+#else
+#define LOG_READ_ACQUIRE16(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define LOG_WRITE_RELEASE16(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LOG_READ_ACQUIRE64(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define LOG_WRITE_RELEASE64(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+// Records are stored back to back, each starting with its ItemHeader, in
+// exactly the form SysMonRead returns them, so a read is one memcpy, or
+// two when the readable range wraps.
+//
+// Producers, serialized by the caller, Reserve() space at the tail, then
+// Publish() the record without the lock: its Type is written last, and a
+// reserved record reads as ItemType::None until then. A single reader
+// copies whole published records from the head and Consume()s them under
+// the producers' lock. When the log is full new records are dropped; the
+// bytes a reader is copying are never overwritten.
+class EventLog {
+public:
+	// record sizes are padded to this, so a header's Type and Size never
+	// straddle the end of the buffer
+	static const ULONG Alignment = 8;
+
+	// largest record, as ItemHeader::Size is a USHORT
+	static const ULONG MaxRecordSize = 0x10000 - Alignment;
+
+	static ULONG RecordSize(ULONG bytes)
+	{
+		return (bytes + Alignment - 1) & ~(Alignment - 1);
+	}
+
+	// capacity must be a power of two and at least MaxRecordSize
+	void Init(void* storage, ULONG capacity)
+	{
+		_buffer = static_cast<UCHAR*>(storage);
+		_capacity = capacity;
+		_mask = capacity - 1;
+		_head = 0;
+		_tail = 0;
+		_dropped = 0;
+
+		// padding is never written, so do not let it expose old pool contents
+		::memset(_buffer, 0, capacity);
+	}
+
+	void* Storage() const
+	{
+		return _buffer;
+	}
+
+	// Claims size bytes (a RecordSize() result) at the tail. Called under
+	// the producers' lock; fails, counting a drop, when the log is full.
+	bool Reserve(ULONG size, ULONGLONG* position)
+	{
+		if (_tail + size - _head > _capacity)
+		{
+			_dropped++;
+			return false;
+		}
+
+		auto header = reinterpret_cast<ItemHeader*>(_buffer + (_tail & _mask));
+		header->Type = ItemType::None;
+		header->Size = static_cast<USHORT>(size);
+
+		*position = _tail;
+		LOG_WRITE_RELEASE64(&_tail, _tail + size);
+
+		return true;
+	}
+
+	// Fills a reserved record with item (fixedSize bytes, its Size already
+	// set to the reserved size) followed by extra, then makes it readable.
+	// Needs no lock.
+	void Publish(ULONGLONG position, const ItemHeader* item, ULONG fixedSize, const void* extra, ULONG extraSize)
+	{
+		// everything but the Type, which goes last
+		const auto skip = static_cast<ULONG>(offsetof(ItemHeader, Size));
+		CopyIn(position + skip, reinterpret_cast<const UCHAR*>(item) + skip, fixedSize - skip);
+
+		if (extraSize > 0)
+		{
+			CopyIn(position + fixedSize, extra, extraSize);
+		}
+
+		auto header = reinterpret_cast<ItemHeader*>(_buffer + (position & _mask));
+		LOG_WRITE_RELEASE16(reinterpret_cast<volatile short*>(&header->Type), static_cast<short>(item->Type));
+	}
+
+	// Bytes of whole published records, from the head, that fit in
+	// maxBytes. Reader only; needs no lock.
+	ULONG Readable(ULONG maxBytes) const
+	{
+		const auto tail = LOG_READ_ACQUIRE64(&_tail);
+		auto position = _head;
+		ULONG bytes = 0;
+
+		while (position < tail)
+		{
+			auto header = reinterpret_cast<const ItemHeader*>(_buffer + (position & _mask));
+			if (LOG_READ_ACQUIRE16(reinterpret_cast<const volatile short*>(&header->Type)) == static_cast<short>(ItemType::None))
+				break;
+
+			const ULONG size = header->Size;
+			if (bytes + size > maxBytes)
+				break;
+
+			bytes += size;
+			position += size;
+		}
+
+		return bytes;
+	}
+
+	// whether the oldest record is published. Reader only.
+	bool HeadReady() const
+	{
+		if (_head == LOG_READ_ACQUIRE64(&_tail))
+			return false;
+
+		auto header = reinterpret_cast<const ItemHeader*>(_buffer + (_head & _mask));
+		return LOG_READ_ACQUIRE16(reinterpret_cast<const volatile short*>(&header->Type)) != static_cast<short>(ItemType::None);
+	}
+
+	// copies bytes (a Readable() result) from the head. Reader only.
+	void CopyOut(void* dest, ULONG bytes) const
+	{
+		const auto start = static_cast<ULONG>(_head & _mask);
+		const auto first = (bytes < _capacity - start) ? bytes : _capacity - start;
+
+		::memcpy(dest, _buffer + start, first);
+		if (first < bytes)
+		{
+			::memcpy(static_cast<UCHAR*>(dest) + first, _buffer, bytes - first);
+		}
+	}
+
+	// releases bytes copied out; called by the reader under the producers' lock
+	void Consume(ULONG bytes)
+	{
+		_head += bytes;
+	}
+
+	// reserved and not yet consumed; under the producers' lock
+	ULONG UsedBytes() const
+	{
+		return static_cast<ULONG>(_tail - _head);
+	}
+
+	ULONGLONG DroppedRecords() const
+	{
+		return _dropped;
+	}
+
+private:
+	void CopyIn(ULONGLONG position, const void* source, ULONG bytes)
+	{
+		const auto start = static_cast<ULONG>(position & _mask);
+		const auto first = (bytes < _capacity - start) ? bytes : _capacity - start;
+
+		::memcpy(_buffer + start, source, first);
+		if (first < bytes)
+		{
+			::memcpy(_buffer, static_cast<const UCHAR*>(source) + first, bytes - first);
+		}
+	}
+
+	UCHAR*    _buffer;
+	ULONG     _capacity;
+	ULONG     _mask;
+	ULONGLONG _head;     // oldest unconsumed byte; advanced by the reader
+	ULONGLONG _tail;     // end of the newest reservation
+	ULONGLONG _dropped;
+};
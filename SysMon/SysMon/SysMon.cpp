@@ -15,13 +15,42 @@
 void SysMonUnload(PDRIVER_OBJECT DriverObject);
 
 NTSTATUS SysMonCreateClose(PDEVICE_OBJECT, PIRP Irp);
+NTSTATUS SysMonCleanup(PDEVICE_OBJECT, PIRP Irp);
 NTSTATUS SysMonRead(PDEVICE_OBJECT, PIRP Irp);
 
 void OnProcessNotify(PEPROCESS Process, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO CreateInfo);
 void OnThreadNotify(HANDLE ProcessId, HANDLE ThreadId, BOOLEAN Create);
 
 
-void PushItem(LIST_ENTRY* entry);
+void PushItem(const ItemHeader& item, ULONG fixedSize, const void* extra, ULONG extraSize);
+ULONG DrainItems(UCHAR* buffer, ULONG len);
+PIRP FillNextPendingRead();
+void QueueFlush();
+
+void CsqInsertIrp(PIO_CSQ Csq, PIRP Irp);
+void CsqRemoveIrp(PIO_CSQ Csq, PIRP Irp);
+PIRP CsqPeekNextIrp(PIO_CSQ Csq, PIRP Irp, PVOID PeekContext);
+void CsqAcquireLock(PIO_CSQ Csq, PKIRQL Irql);
+void CsqReleaseLock(PIO_CSQ Csq, KIRQL Irql);
+void CsqCompleteCanceledIrp(PIO_CSQ Csq, PIRP Irp);
+
+KDEFERRED_ROUTINE OnFlushTimer;
+IO_WORKITEM_ROUTINE FlushPendingRead;
+
+/* ----------------------------------------------------------------------------
+	Event Log
+*/
+
+// room for roughly 40000 thread events
+const ULONG LogCapacity = 1 << 20;
+
+/* ----------------------------------------------------------------------------
+	Read Coalescing
+*/
+
+// a pended read completes once 32KB is queued, or 10ms after the previous
+// completion; an idle reader gets the first event immediately
+const CoalescingPolicy ReadCoalescing = { 32 * 1024, 10 * 10000 };
 
 /* ----------------------------------------------------------------------------
 	Global Variables
@@ -38,8 +67,25 @@ DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING)
 {
 	auto status = STATUS_SUCCESS;
 
-	InitializeListHead(&g_Globals.ItemsHead);
-	g_Globals.Mutex.Init();
+	auto logBuffer = ExAllocatePoolWithTag(NonPagedPoolNx, LogCapacity, DRIVER_TAG);
+	if (nullptr == logBuffer)
+	{
+		KdPrint(("Failed to allocate event log\n"));
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	g_Globals.Log.Init(logBuffer, LogCapacity);
+	KeInitializeSpinLock(&g_Globals.ItemsLock);
+	g_Globals.ReadMutex.Init();
+
+	InitializeListHead(&g_Globals.PendingReadsHead);
+	KeInitializeSpinLock(&g_Globals.PendingReadsLock);
+	IoCsqInitialize(&g_Globals.ReadQueue, CsqInsertIrp, CsqRemoveIrp, CsqPeekNextIrp,
+		CsqAcquireLock, CsqReleaseLock, CsqCompleteCanceledIrp);
+
+	g_Globals.Coalescing = ReadCoalescing;
+	KeInitializeTimer(&g_Globals.FlushTimer);
+	KeInitializeDpc(&g_Globals.FlushDpc, OnFlushTimer, nullptr);
 
 	PDEVICE_OBJECT DeviceObject = nullptr;
 	UNICODE_STRING symLink = RTL_CONSTANT_STRING(L"\\??\\sysmon");
@@ -56,6 +102,14 @@ DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING)
 
 		DeviceObject->Flags |= DO_DIRECT_IO;
 
+		g_Globals.FlushWorkItem = IoAllocateWorkItem(DeviceObject);
+		if (nullptr == g_Globals.FlushWorkItem)
+		{
+			KdPrint(("Failed to allocate flush work item\n"));
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			break;
+		}
+
 		status = IoCreateSymbolicLink(&symLink, &devName);
 		if (!NT_SUCCESS(status))
 		{
@@ -78,6 +132,7 @@ DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING)
 		if (!NT_SUCCESS(status))
 		{
 			KdPrint(("Failed to set thread notify routine (0x%08x)\n", status));
+			PsSetCreateProcessNotifyRoutineEx(OnProcessNotify, TRUE);
 			break;
 		}
 	} while (false);
@@ -89,35 +144,50 @@ DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING)
 			IoDeleteSymbolicLink(&symLink);
 		}
 
+		if (g_Globals.FlushWorkItem)
+		{
+			IoFreeWorkItem(g_Globals.FlushWorkItem);
+		}
+
 		if (DeviceObject)
 		{
 			IoDeleteDevice(DeviceObject);
 		}
+
+		ExFreePool(logBuffer);
 	}
 
 	DriverObject->DriverUnload = SysMonUnload;
 	DriverObject->MajorFunction[IRP_MJ_CREATE] = SysMonCreateClose;
-	DriverObject->MajorFunction[IRP_MJ_CLOSE]  = SysMonCreateClose;
-	DriverObject->MajorFunction[IRP_MJ_READ]   = SysMonRead;
+	DriverObject->MajorFunction[IRP_MJ_CLOSE]   = SysMonCreateClose;
+	DriverObject->MajorFunction[IRP_MJ_CLEANUP] = SysMonCleanup;
+	DriverObject->MajorFunction[IRP_MJ_READ]    = SysMonRead;
 
 	return status;
 }
 
 void SysMonUnload(PDRIVER_OBJECT DriverObject)
 {
-	// unregister process notifications
+	// unregister process and thread notifications
 	PsSetCreateProcessNotifyRoutineEx(OnProcessNotify, TRUE);
+	PsRemoveCreateThreadNotifyRoutine(OnThreadNotify);
+
+	// no handles remain, so no reads are pending; drain any scheduled flush
+	KeCancelTimer(&g_Globals.FlushTimer);
+	KeFlushQueuedDpcs();
+	while (InterlockedCompareExchange(&g_Globals.FlushQueued, 0, 0) != 0)
+	{
+		LARGE_INTEGER interval;
+		interval.QuadPart = -10 * 1000;  // 1ms
+		KeDelayExecutionThread(KernelMode, FALSE, &interval);
+	}
+	IoFreeWorkItem(g_Globals.FlushWorkItem);
 
 	UNICODE_STRING symLink = RTL_CONSTANT_STRING(L"\\??\\sysmon");
 	IoDeleteSymbolicLink(&symLink);
 	IoDeleteDevice(DriverObject->DeviceObject);
 
-	// free remaining items in our list, lest we leak memory
-	while (!IsListEmpty(&g_Globals.ItemsHead))
-	{
-		auto entry = RemoveHeadList(&g_Globals.ItemsHead);
-		ExFreePool(CONTAINING_RECORD(entry, FullItem<ItemHeader>, Entry));
-	}
+	ExFreePool(g_Globals.Log.Storage());
 }
 
 /* ----------------------------------------------------------------------------
@@ -133,14 +203,37 @@ NTSTATUS SysMonCreateClose(PDEVICE_OBJECT, PIRP Irp)
 	return STATUS_SUCCESS;
 }
 
+// completes all reads still pended on the file object being cleaned up
+NTSTATUS SysMonCleanup(PDEVICE_OBJECT, PIRP Irp)
+{
+	auto fileObject = IoGetCurrentIrpStackLocation(Irp)->FileObject;
+
+	PIRP pending;
+	while ((pending = IoCsqRemoveNextIrp(&g_Globals.ReadQueue, fileObject)) != nullptr)
+	{
+		pending->IoStatus.Status = STATUS_CANCELLED;
+		pending->IoStatus.Information = 0;
+		IoCompleteRequest(pending, 0);
+	}
+
+	Irp->IoStatus.Status = STATUS_SUCCESS;
+	Irp->IoStatus.Information = 0;
+	IoCompleteRequest(Irp, 0);
+
+	return STATUS_SUCCESS;
+}
+
+// Completes at once with whatever is queued. With nothing queued the read
+// is pended and completed later by PushItem() or the flush timer.
 NTSTATUS SysMonRead(PDEVICE_OBJECT, PIRP Irp)
 {
 	auto stack = IoGetCurrentIrpStackLocation(Irp);
 	auto len = stack->Parameters.Read.Length;
 	auto status = STATUS_SUCCESS;
-	auto count = 0;
+	ULONG count = 0;
 	NT_ASSERT(Irp->MdlAddress);
 
+	// map now, while in the caller's context; completion reuses the mapping
 	auto buffer = (UCHAR*)MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
 	if (!buffer)
 	{
@@ -148,29 +241,31 @@ NTSTATUS SysMonRead(PDEVICE_OBJECT, PIRP Irp)
 	}
 	else
 	{
-		AutoLock<FastMutex> lock(g_Globals.Mutex);
-		while (true)
+		AutoLock<FastMutex> lock(g_Globals.ReadMutex);
+
+		// queue behind reads already waiting so they complete in order; the
+		// insert happens under ItemsLock so the next producer sees the read.
+		// Pend too while the oldest record is reserved but not yet
+		// published, as FlushPendingRead does, rather than complete empty
+		KLOCK_QUEUE_HANDLE lockHandle;
+		KeAcquireInStackQueuedSpinLock(&g_Globals.ItemsLock, &lockHandle);
+		if (!g_Globals.Log.HeadReady() || g_Globals.PendingReadCount > 0)
 		{
-			if (IsListEmpty(&g_Globals.ItemsHead))
-				break;
-
-			auto entry = RemoveHeadList(&g_Globals.ItemsHead);
-			auto info = CONTAINING_RECORD(entry, FullItem<ItemHeader>, Entry);
-			auto size = info->Data.Size;
-			if (len < size)
+			if (g_Globals.Log.UsedBytes() > 0 && !g_Globals.Log.HeadReady())
 			{
-				// user's buffer is full, insert item back into list
-				InsertHeadList(&g_Globals.ItemsHead, entry);
-				break;
+				// its producer already looked for pending reads; look again shortly
+				LARGE_INTEGER due;
+				due.QuadPart = -10 * 1000;  // 1ms
+				KeSetTimer(&g_Globals.FlushTimer, due, &g_Globals.FlushDpc);
 			}
 
-			g_Globals.ItemCount--;
-			::memcpy(buffer, &info->Data, size);
-			len -= size;
-			buffer += size;
-			count  += size;
+			IoCsqInsertIrp(&g_Globals.ReadQueue, Irp, nullptr);
+			KeReleaseInStackQueuedSpinLock(&lockHandle);
+			return STATUS_PENDING;
 		}
+		KeReleaseInStackQueuedSpinLock(&lockHandle);
 
+		count = DrainItems(buffer, len);
 	}
 
 	Irp->IoStatus.Status = status;
@@ -191,95 +286,294 @@ void OnProcessNotify(PEPROCESS Process, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO
 	if (CreateInfo)
 	{
 		// process create
-		USHORT allocSize = sizeof(FullItem<ProcessCreateInfo>);
-		USHORT commandLineSize = 0;
+		ProcessCreateInfo item;
+		// padding is copied to the client as well
+		RtlZeroMemory(&item, sizeof(item));
+		ULONG commandLineSize = 0;
 		if (CreateInfo->CommandLine)
 		{
+			// truncate what would not fit in a single record
+			const ULONG maxSize = (EventLog::MaxRecordSize - sizeof(item)) & ~1UL;
 			commandLineSize = CreateInfo->CommandLine->Length;
-			allocSize += commandLineSize;
-		}
-		auto info = (FullItem<ProcessCreateInfo>*)ExAllocatePoolWithTag(PagedPool, allocSize, DRIVER_TAG);
-		if (nullptr == info)
-		{
-			KdPrint(("Failed to allocate memory for ProcessCreateInfo\n"));
-			return;
+			if (commandLineSize > maxSize)
+				commandLineSize = maxSize;
 		}
 
-		auto& item = info->Data;
 		KeQuerySystemTimePrecise(&item.Time);
 		item.Type = ItemType::ProcessCreate;
+		item.Size = (USHORT)EventLog::RecordSize(sizeof(item) + commandLineSize);
 		item.ProcessId = HandleToUlong(ProcessId);
 		item.ParentProcessId = HandleToUlong(CreateInfo->ParentProcessId);
+		item.CommandLineLength = (USHORT)(commandLineSize / sizeof(WCHAR));
+		item.CommandLineOffset = sizeof(item);
 
-		if (commandLineSize > 0)
-		{
-			::memcpy((UCHAR*)& item + sizeof(item), CreateInfo->CommandLine->Buffer, commandLineSize);
-			item.CommandLineLength = commandLineSize / sizeof(WCHAR);
-			item.CommandLineOffset = sizeof(item);
-		}
-		else
-		{
-			item.CommandLineLength = 0;
-		}
-
-		PushItem(&info->Entry);
+		// the command line is copied straight into the log
+		PushItem(item, sizeof(item), commandLineSize > 0 ? CreateInfo->CommandLine->Buffer : nullptr, commandLineSize);
 	}
 	else
 	{
 		// process exit 
-		auto info = (FullItem<ProcessExitInfo>*) ExAllocatePoolWithTag(PagedPool, sizeof(FullItem<ProcessExitInfo>), DRIVER_TAG);
-		if (nullptr == info)
-		{
-			KdPrint(("Failed to allocate memory for ProcessExitInfo\n"));
-			return;
-		}
-
-		auto& item = info->Data;
+		ProcessExitInfo item;
+		RtlZeroMemory(&item, sizeof(item));
 		KeQuerySystemTimePrecise(&item.Time);
 		item.Type = ItemType::ProcessExit;
 		item.ProcessId = HandleToULong(ProcessId);
-		item.Size = sizeof(ProcessExitInfo);
+		item.Size = (USHORT)EventLog::RecordSize(sizeof(item));
 
-		PushItem(&info->Entry);
+		PushItem(item, sizeof(item), nullptr, 0);
 	}
 }
 
 void OnThreadNotify(HANDLE ProcessId, HANDLE ThreadId, BOOLEAN Create)
 {
-	auto size = sizeof(FullItem<ThreadCreateExitInfo>);
-	auto info = (FullItem<ThreadCreateExitInfo>*) ExAllocatePoolWithTag(PagedPool, size, DRIVER_TAG);
-	if (nullptr == info)
-	{
-		KdPrint(("Failed to allocate memory for ThreadCreateExitInfo\n"));
-		return;
-	}
-
-	auto& item = info->Data;
+	ThreadCreateExitInfo item;
+	RtlZeroMemory(&item, sizeof(item));
 	KeQuerySystemTimePrecise(&item.Time);
-	item.Size = sizeof(item);
+	item.Size = (USHORT)EventLog::RecordSize(sizeof(item));
 	item.Type = Create ? ItemType::ThreadCreate : ItemType::ThreadExit;
 	item.ProcessId = HandleToULong(ProcessId);
 	item.ThreadId = HandleToULong(ThreadId);
 
-	PushItem(&info->Entry);
+	PushItem(item, sizeof(item), nullptr, 0);
 }
 
 /* ----------------------------------------------------------------------------
 	Helpers
 */
 
-void PushItem(LIST_ENTRY* entry)
+// Appends item (fixedSize bytes, its Size set to the padded record size)
+// followed by extra to the log and, if a read is waiting, schedules its
+// completion as the coalescing policy decides. Only the reservation is
+// made under the lock; the record is filled after it is released, so
+// producers never wait on a copy or on a reader.
+void PushItem(const ItemHeader& item, ULONG fixedSize, const void* extra, ULONG extraSize)
 {
-	AutoLock<FastMutex> lock(g_Globals.Mutex);
-	if (g_Globals.ItemCount > 1024)
+	ULONGLONG position;
+	bool flush = false;
+
+	KLOCK_QUEUE_HANDLE lockHandle;
+	KeAcquireInStackQueuedSpinLock(&g_Globals.ItemsLock, &lockHandle);
+
+	// when the log is full the new event is dropped (and counted)
+	auto reserved = g_Globals.Log.Reserve(item.Size, &position);
+
+	if (reserved && g_Globals.PendingReadCount > 0)
 	{
-		// too many items, remove oldest
-		auto head = RemoveHeadList(&g_Globals.ItemsHead);
-		g_Globals.ItemCount--;
-		auto item = CONTAINING_RECORD(head, FullItem<ItemHeader>, Entry);
-		ExFreePool(item);
+		LONGLONG now = KeQueryInterruptTime();
+		LONGLONG dueTime = 0;
+
+		switch (DecideOnPush(g_Globals.Coalescing, g_Globals.Coalesce, g_Globals.Log.UsedBytes(), now, &dueTime))
+		{
+		case CoalesceDecision::CompleteNow:
+			flush = true;
+			break;
+		case CoalesceDecision::ArmTimer:
+		{
+			LARGE_INTEGER due;
+			due.QuadPart = -(dueTime - now);  // relative
+			KeSetTimer(&g_Globals.FlushTimer, due, &g_Globals.FlushDpc);
+			break;
+		}
+		default:
+			break;
+		}
 	}
 
-	InsertTailList(&g_Globals.ItemsHead, entry);
-	g_Globals.ItemCount++;
+	KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+	if (!reserved)
+		return;
+
+	g_Globals.Log.Publish(position, &item, fixedSize, extra, extraSize);
+
+	// queued only now, so the worker finds this record published
+	if (flush)
+	{
+		QueueFlush();
+	}
+}
+
+// Copies as many whole records as fit into buffer and records the read as
+// completed. Called with ReadMutex held.
+ULONG DrainItems(UCHAR* buffer, ULONG len)
+{
+	// producers never write over unconsumed bytes, so the copy needs no
+	// lock: one memcpy, or two when the range wraps
+	auto count = g_Globals.Log.Readable(len);
+	g_Globals.Log.CopyOut(buffer, count);
+
+	KLOCK_QUEUE_HANDLE lockHandle;
+	KeAcquireInStackQueuedSpinLock(&g_Globals.ItemsLock, &lockHandle);
+
+	g_Globals.Log.Consume(count);
+	OnReadCompleted(g_Globals.Coalesce, KeQueryInterruptTime());
+
+	KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+	return count;
+}
+
+// Takes the oldest pending read off the queue and fills it. Called with
+// ReadMutex held; the caller completes the returned IRP after releasing it.
+PIRP FillNextPendingRead()
+{
+	auto irp = IoCsqRemoveNextIrp(&g_Globals.ReadQueue, nullptr);
+	if (nullptr == irp)
+	{
+		// cancelled in the meantime
+		return nullptr;
+	}
+
+	auto len = IoGetCurrentIrpStackLocation(irp)->Parameters.Read.Length;
+	auto buffer = (UCHAR*)MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority);
+	if (!buffer)
+	{
+		irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+		irp->IoStatus.Information = 0;
+	}
+	else
+	{
+		irp->IoStatus.Status = STATUS_SUCCESS;
+		irp->IoStatus.Information = DrainItems(buffer, len);
+	}
+
+	return irp;
+}
+
+/* ----------------------------------------------------------------------------
+	Flush Worker
+*/
+
+// filling a read takes ReadMutex, so it is done at PASSIVE_LEVEL by a
+// work item; at most one is queued at a time
+void QueueFlush()
+{
+	if (InterlockedExchange(&g_Globals.FlushQueued, 1) == 0)
+	{
+		IoQueueWorkItem(g_Globals.FlushWorkItem, FlushPendingRead, DelayedWorkQueue, nullptr);
+	}
+}
+
+void OnFlushTimer(PKDPC, PVOID, PVOID, PVOID)
+{
+	QueueFlush();
+}
+
+// fills pending reads while there are events to give them
+void FlushPendingRead(PDEVICE_OBJECT, PVOID)
+{
+	InterlockedExchange(&g_Globals.FlushQueued, 0);
+
+	while (true)
+	{
+		PIRP irp = nullptr;
+
+		{
+			AutoLock<FastMutex> lock(g_Globals.ReadMutex);
+
+			KLOCK_QUEUE_HANDLE lockHandle;
+			KeAcquireInStackQueuedSpinLock(&g_Globals.ItemsLock, &lockHandle);
+			bool flush = false;
+
+			if (g_Globals.PendingReadCount > 0)
+			{
+				LONGLONG now = KeQueryInterruptTime();
+				LONGLONG dueTime = 0;
+
+				flush = ShouldFlush(g_Globals.Coalescing, g_Globals.Coalesce, g_Globals.Log.UsedBytes(), now, &dueTime);
+
+				if (g_Globals.Coalesce.TimerArmed)
+				{
+					// events remain but a read completed within the window
+					LARGE_INTEGER due;
+					due.QuadPart = -(dueTime - now);  // relative
+					KeSetTimer(&g_Globals.FlushTimer, due, &g_Globals.FlushDpc);
+				}
+			}
+			else
+			{
+				// nothing to complete; the next read takes what is queued
+				g_Globals.Coalesce.TimerArmed = false;
+			}
+
+			if (flush && !g_Globals.Log.HeadReady())
+			{
+				// the oldest record is still being filled; look again shortly
+				LARGE_INTEGER due;
+				due.QuadPart = -10 * 1000;  // 1ms
+				KeSetTimer(&g_Globals.FlushTimer, due, &g_Globals.FlushDpc);
+				flush = false;
+			}
+
+			KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+			if (flush)
+			{
+				irp = FillNextPendingRead();
+			}
+		}
+
+		if (nullptr == irp)
+			break;
+
+		IoCompleteRequest(irp, IO_NO_INCREMENT);
+	}
+}
+
+/* ----------------------------------------------------------------------------
+	Pending Read Queue
+*/
+
+// the queue callbacks run under PendingReadsLock, taken by IoCsqXxx
+
+void CsqInsertIrp(PIO_CSQ, PIRP Irp)
+{
+	InsertTailList(&g_Globals.PendingReadsHead, &Irp->Tail.Overlay.ListEntry);
+	g_Globals.PendingReadCount++;
+}
+
+void CsqRemoveIrp(PIO_CSQ, PIRP Irp)
+{
+	RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+	g_Globals.PendingReadCount--;
+}
+
+// the first read after Irp (or the first read overall), optionally only
+// those issued on the file object given as PeekContext
+PIRP CsqPeekNextIrp(PIO_CSQ, PIRP Irp, PVOID PeekContext)
+{
+	auto head = &g_Globals.PendingReadsHead;
+	auto next = Irp ? Irp->Tail.Overlay.ListEntry.Flink : head->Flink;
+
+	while (next != head)
+	{
+		auto nextIrp = CONTAINING_RECORD(next, IRP, Tail.Overlay.ListEntry);
+		if (nullptr == PeekContext || IoGetCurrentIrpStackLocation(nextIrp)->FileObject == PeekContext)
+		{
+			return nextIrp;
+		}
+
+		next = next->Flink;
+	}
+
+	return nullptr;
+}
+
+_IRQL_raises_(DISPATCH_LEVEL)
+void CsqAcquireLock(PIO_CSQ, PKIRQL Irql)
+{
+	KeAcquireSpinLock(&g_Globals.PendingReadsLock, Irql);
+}
+
+_IRQL_requires_(DISPATCH_LEVEL)
+void CsqReleaseLock(PIO_CSQ, KIRQL Irql)
+{
+	KeReleaseSpinLock(&g_Globals.PendingReadsLock, Irql);
+}
+
+void CsqCompleteCanceledIrp(PIO_CSQ, PIRP Irp)
+{
+	Irp->IoStatus.Status = STATUS_CANCELLED;
+	Irp->IoStatus.Information = 0;
+	IoCompleteRequest(Irp, 0);
 }
\ No newline at end of file
@@ -6,18 +6,30 @@
 #pragma once
 
 #include "SyncHelpers.h"
+#include "Coalescing.h"
+#include "EventLog.h"
 
 // for pool allocation tags 
 #define DRIVER_TAG 'nmys'
 
-template<typename T>
-struct FullItem {
-	LIST_ENTRY Entry;
-	T          Data;
-};
-
 struct Globals {
-	LIST_ENTRY ItemsHead;
-	int        ItemCount;
-	FastMutex  Mutex;
+	// producers reserve log space under ItemsLock, taken as an in-stack
+	// queued spinlock; readers are serialized by ReadMutex
+	EventLog   Log;
+	KSPIN_LOCK ItemsLock;
+	FastMutex  ReadMutex;
+
+	// reads pended while there is nothing (or too little) to return
+	IO_CSQ     ReadQueue;
+	LIST_ENTRY PendingReadsHead;
+	KSPIN_LOCK PendingReadsLock;
+	LONG       PendingReadCount;
+
+	// delayed completion of pending reads, under ItemsLock
+	CoalescingPolicy Coalescing;
+	CoalescingState  Coalesce;
+	KTIMER           FlushTimer;
+	KDPC             FlushDpc;
+	PIO_WORKITEM     FlushWorkItem;
+	LONG             FlushQueued;
 };
@@ -5,6 +5,31 @@
 
 #pragma once
 
+#ifndef _WIN32
+#include <cstdint>
+
+// off Windows (host builds of the client and benchmarks), the subset of
+// the Windows types used by these structures and their users
+typedef uint8_t  BYTE;
+typedef uint8_t  UCHAR;
+typedef uint16_t USHORT;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int64_t  LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef char16_t WCHAR;
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		ULONG   LowPart;
+		int32_t HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+#endif
+
 // item type enumeration
 enum class ItemType : short {
 	None, 
@@ -0,0 +1,45 @@
+/*
+ * Bench.cpp
+ * Host-side simulations and benchmarks for the SysMon driver.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "Bench.h"
+
+struct BenchCommand {
+	const char* Name;
+	int (*Run)(int argc, char* argv[]);
+	const char* Description;
+};
+
+const BenchCommand Commands[] = {
+	{ "producers", RunProducerSim, "simulate producer lock latency at many CPUs" },
+	{ "log",       RunLogBench,    "compare the event log with the per-event item list" },
+	{ "coalescing", RunCoalescingCheck, "check the read coalescing policy and count reader wakeups" },
+};
+
+/* ----------------------------------------------------------------------------
+	Entry Point
+*/
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 2)
+	{
+		for (const auto& command : Commands)
+		{
+			if (0 == ::strcmp(argv[1], command.Name))
+				return command.Run(argc - 2, argv + 2);
+		}
+	}
+
+	printf("usage: %s <command> [options]\n", argc > 0 ? argv[0] : "SysMonBench");
+	for (const auto& command : Commands)
+	{
+		printf("  %-10s %s\n", command.Name, command.Description);
+	}
+
+	return 1;
+}
@@ -0,0 +1,11 @@
+/*
+ * Bench.h
+ * Host-side simulations and benchmarks for the SysMon driver.
+ */
+
+#pragma once
+
+// each returns the process exit code; argv excludes the command name
+int RunProducerSim(int argc, char* argv[]);
+int RunLogBench(int argc, char* argv[]);
+int RunCoalescingCheck(int argc, char* argv[]);
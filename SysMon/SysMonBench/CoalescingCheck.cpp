@@ -0,0 +1,203 @@
+/*
+ * CoalescingCheck.cpp
+ * Checks of SysMon's read coalescing policy, and how often it wakes the
+ * reader.
+ *
+ * The checks drive DecideOnPush, OnReadCompleted and ShouldFlush through
+ * the cases the driver depends on: a push after an idle window completes
+ * at once, MinBytes completes at once within a window, a burst arms the
+ * timer once and then waits, and a flush scheduled before a completion
+ * completes nothing.
+ *
+ * Then a steady event stream is simulated at several rates, with a read
+ * always pending and the timer firing when due, as PushItem and
+ * FlushPendingRead use the policy; the report gives completions per
+ * second and the most events handed over in one read.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Bench.h"
+#include "Coalescing.h"
+
+// the driver's policy: 32KB, or 10ms in 100ns units
+const CoalescingPolicy CheckPolicy = { 32 * 1024, 10 * 10000 };
+
+/* ----------------------------------------------------------------------------
+	Checks
+*/
+
+bool Check(bool condition, const char* what)
+{
+	if (!condition)
+		printf("FAILED: %s\n", what);
+
+	return condition;
+}
+
+bool RunChecks()
+{
+	const auto& policy = CheckPolicy;
+	long long due = 0;
+	bool ok = true;
+
+	// nothing completed for longer than a window: the first event goes at once
+	CoalescingState state = { -policy.Window, false };
+	ok &= Check(DecideOnPush(policy, state, 100, 0, &due) == CoalesceDecision::CompleteNow,
+		"a push after an idle window completes at once");
+	OnReadCompleted(state, 0);
+
+	// within the window, small pushes arm the timer once and then wait
+	due = 0;
+	ok &= Check(DecideOnPush(policy, state, 100, 10, &due) == CoalesceDecision::ArmTimer && due == policy.Window,
+		"the first push within the window arms the timer for its end");
+	ok &= Check(DecideOnPush(policy, state, 200, 20, &due) == CoalesceDecision::Wait,
+		"a second push while armed waits");
+	ok &= Check(DecideOnPush(policy, state, 300, 30, &due) == CoalesceDecision::Wait,
+		"a third push while armed waits");
+
+	// MinBytes queued completes at once, armed or not
+	ok &= Check(DecideOnPush(policy, state, policy.MinBytes - 1, 40, &due) == CoalesceDecision::Wait,
+		"one byte short of MinBytes waits");
+	ok &= Check(DecideOnPush(policy, state, policy.MinBytes, 50, &due) == CoalesceDecision::CompleteNow,
+		"MinBytes queued completes at once");
+	OnReadCompleted(state, 50);
+	ok &= Check(!state.TimerArmed, "a completion disarms the timer");
+
+	// the timer armed before that completion fires at the old due time:
+	// nothing is due, so it completes nothing and re-arms for the new window
+	due = 0;
+	ok &= Check(!ShouldFlush(policy, state, 100, policy.Window, &due),
+		"a timer left over from before a completion completes nothing");
+	ok &= Check(state.TimerArmed && due == 50 + policy.Window,
+		"with events queued, the timer is re-armed for the end of the new window");
+
+	// with nothing queued it neither completes nor re-arms
+	ok &= Check(!ShouldFlush(policy, state, 0, policy.Window, &due) && !state.TimerArmed,
+		"a flush with nothing queued does nothing");
+
+	// the re-armed timer fires at the end of the window and completes
+	state.TimerArmed = true;
+	ok &= Check(ShouldFlush(policy, state, 100, 50 + policy.Window, &due) && !state.TimerArmed,
+		"the timer at the end of the window completes a read");
+	OnReadCompleted(state, 50 + policy.Window);
+
+	// a flush asked for by a push past MinBytes completes within the window
+	ok &= Check(ShouldFlush(policy, state, policy.MinBytes, 60 + policy.Window, &due),
+		"a flush with MinBytes queued completes within the window");
+
+	if (ok)
+		printf("checks: idle window, MinBytes, one timer while armed, stale timer\n");
+
+	return ok;
+}
+
+/* ----------------------------------------------------------------------------
+	Simulation
+*/
+
+struct StreamResult {
+	unsigned long long Completions;
+	unsigned long long MostEvents;   // events handed over in one read
+	unsigned long long TimerFlushes;
+	unsigned long long StaleFlushes; // timer fired and completed nothing
+};
+
+// one second of events every interval (100ns units) of eventSize bytes,
+// a read always pending
+StreamResult SimulateStream(const CoalescingPolicy& policy, long long interval, unsigned long eventSize)
+{
+	const long long second = 10 * 1000 * 1000;
+
+	StreamResult result = {};
+	CoalescingState state = { -policy.Window, false };
+	long long timerAt = -1;
+	long long due = 0;
+	unsigned long queued = 0;
+
+	const auto complete = [&](long long now)
+	{
+		result.MostEvents = std::max<unsigned long long>(result.MostEvents, queued / eventSize);
+		result.Completions++;
+		queued = 0;
+		OnReadCompleted(state, now);
+	};
+
+	for (long long now = 0; now < second; now += interval)
+	{
+		if (timerAt >= 0 && now >= timerAt)
+		{
+			timerAt = -1;
+			result.TimerFlushes++;
+
+			if (ShouldFlush(policy, state, queued, now, &due))
+				complete(now);
+			else if (state.TimerArmed)
+			{
+				result.StaleFlushes++;
+				timerAt = due;
+			}
+		}
+
+		queued += eventSize;
+
+		switch (DecideOnPush(policy, state, queued, now, &due))
+		{
+		case CoalesceDecision::CompleteNow:
+			complete(now);
+			break;
+		case CoalesceDecision::ArmTimer:
+			timerAt = due;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return result;
+}
+
+// SysMonBench coalescing [--size BYTES]
+int RunCoalescingCheck(int argc, char* argv[])
+{
+	unsigned long eventSize = 48;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--size"))
+			eventSize = std::strtoul(argv[i + 1], nullptr, 10);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == eventSize || eventSize > CheckPolicy.MinBytes)
+	{
+		printf("size must be positive and at most %lu\n", CheckPolicy.MinBytes);
+		return 1;
+	}
+
+	if (!RunChecks())
+		return 1;
+
+	printf("\n%lu-byte events, a read always pending, one second\n", eventSize);
+	printf("%12s %12s %12s %12s %12s\n", "events/s", "reads/s", "most/read", "timer", "stale");
+
+	// intervals in 100ns units: 10/s up to 10M/s
+	const long long intervals[] = { 1000000, 10000, 1000, 100, 10, 1 };
+
+	for (auto interval : intervals)
+	{
+		auto result = SimulateStream(CheckPolicy, interval, eventSize);
+
+		printf("%12lld %12llu %12llu %12llu %12llu\n", 10 * 1000 * 1000 / interval,
+			result.Completions, result.MostEvents, result.TimerFlushes, result.StaleFlushes);
+	}
+
+	return 0;
+}
@@ -0,0 +1,378 @@
+/*
+ * LogBench.cpp
+ * Throughput of SysMon's event log against the per-event item list.
+ *
+ * Both stores are fed the same mix of records in bursts and drained with
+ * 64KB reads, as SysMonRead does, single-threaded so only the data path
+ * is measured:
+ *
+ *  list  one heap allocation per event, linked at the tail; a read walks
+ *        the list, copying and freeing one item at a time.
+ *  log   records reserved and published in place in a preallocated
+ *        circular buffer; a read is one or two memcpys.
+ *
+ * The drained bytes are checked record by record so that both stores are
+ * known to return the same events.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include "Bench.h"
+#include "EventLog.h"
+
+// SysMonClient reads with a 64KB buffer
+const ULONG ReadBufferSize = 1 << 16;
+
+// the driver's log size
+const ULONG BenchLogCapacity = 1 << 20;
+
+/* ----------------------------------------------------------------------------
+	Workload
+*/
+
+// one record to append: a fixed part and an optional command line
+struct BenchRecord {
+	std::vector<UCHAR> Fixed;
+	std::vector<WCHAR> CommandLine;
+};
+
+template<typename T>
+BenchRecord MakeRecord(const T& item)
+{
+	BenchRecord record;
+	record.Fixed.assign(reinterpret_cast<const UCHAR*>(&item), reinterpret_cast<const UCHAR*>(&item) + sizeof(item));
+	return record;
+}
+
+// mostly thread churn, with some process creates carrying ~100 character
+// command lines
+std::vector<BenchRecord> MakeWorkload(size_t count)
+{
+	std::vector<BenchRecord> records;
+	records.reserve(count);
+
+	const char* commandLine = "\"C:\\Program Files\\Example\\worker.exe\" --type=renderer --lang=en-US --field-trial-handle=1744,2";
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto kind = i % 20;
+
+		if (0 == kind)
+		{
+			ProcessCreateInfo item;
+			std::memset(&item, 0, sizeof(item));
+
+			const auto length = static_cast<ULONG>(std::strlen(commandLine));
+			item.Type = ItemType::ProcessCreate;
+			item.Size = static_cast<USHORT>(EventLog::RecordSize(sizeof(item) + length * sizeof(WCHAR)));
+			item.Time.QuadPart = static_cast<LONGLONG>(i);
+			item.ProcessId = static_cast<ULONG>(1000 + i % 500);
+			item.ParentProcessId = 4;
+			item.CommandLineLength = static_cast<USHORT>(length);
+			item.CommandLineOffset = sizeof(item);
+
+			auto record = MakeRecord(item);
+			record.CommandLine.assign(commandLine, commandLine + length);
+			records.push_back(std::move(record));
+		}
+		else if (1 == kind)
+		{
+			ProcessExitInfo item;
+			std::memset(&item, 0, sizeof(item));
+
+			item.Type = ItemType::ProcessExit;
+			item.Size = static_cast<USHORT>(EventLog::RecordSize(sizeof(item)));
+			item.Time.QuadPart = static_cast<LONGLONG>(i);
+			item.ProcessId = static_cast<ULONG>(1000 + i % 500);
+			records.push_back(MakeRecord(item));
+		}
+		else
+		{
+			ThreadCreateExitInfo item;
+			std::memset(&item, 0, sizeof(item));
+
+			item.Type = (kind & 1) ? ItemType::ThreadExit : ItemType::ThreadCreate;
+			item.Size = static_cast<USHORT>(EventLog::RecordSize(sizeof(item)));
+			item.Time.QuadPart = static_cast<LONGLONG>(i);
+			item.ProcessId = static_cast<ULONG>(1000 + i % 500);
+			item.ThreadId = static_cast<ULONG>(i);
+			records.push_back(MakeRecord(item));
+		}
+	}
+
+	return records;
+}
+
+/* ----------------------------------------------------------------------------
+	Stores
+*/
+
+// the original scheme: a heap allocation and a link per event
+class ItemList {
+public:
+	~ItemList()
+	{
+		while (_head)
+		{
+			auto next = _head->Next;
+			std::free(_head);
+			_head = next;
+		}
+	}
+
+	void Push(const BenchRecord& record)
+	{
+		const auto fixedSize = record.Fixed.size();
+		const auto extraSize = record.CommandLine.size() * sizeof(WCHAR);
+		const auto size = reinterpret_cast<const ItemHeader*>(record.Fixed.data())->Size;
+
+		auto item = static_cast<Item*>(std::malloc(sizeof(Item) + size));
+		if (nullptr == item)
+			return;
+
+		auto data = reinterpret_cast<UCHAR*>(item + 1);
+		std::memcpy(data, record.Fixed.data(), fixedSize);
+		std::memcpy(data + fixedSize, record.CommandLine.data(), extraSize);
+		std::memset(data + fixedSize + extraSize, 0, size - fixedSize - extraSize);
+
+		item->Next = nullptr;
+		item->Size = size;
+
+		if (_tail)
+			_tail->Next = item;
+		else
+			_head = item;
+		_tail = item;
+	}
+
+	ULONG Read(UCHAR* buffer, ULONG len)
+	{
+		ULONG count = 0;
+
+		while (_head && _head->Size <= len)
+		{
+			auto item = _head;
+			std::memcpy(buffer, item + 1, item->Size);
+			buffer += item->Size;
+			len -= item->Size;
+			count += item->Size;
+
+			_head = item->Next;
+			if (nullptr == _head)
+				_tail = nullptr;
+
+			std::free(item);
+		}
+
+		return count;
+	}
+
+private:
+	struct Item {
+		Item* Next;
+		ULONG Size;
+	};
+
+	Item* _head = nullptr;
+	Item* _tail = nullptr;
+};
+
+// the event log, as the driver drives it
+class LogStore {
+public:
+	LogStore()
+		: _storage(BenchLogCapacity)
+	{
+		_log.Init(_storage.data(), BenchLogCapacity);
+	}
+
+	void Push(const BenchRecord& record)
+	{
+		auto item = reinterpret_cast<const ItemHeader*>(record.Fixed.data());
+
+		ULONGLONG position;
+		if (!_log.Reserve(item->Size, &position))
+			return;
+
+		_log.Publish(position, item, static_cast<ULONG>(record.Fixed.size()),
+			record.CommandLine.data(), static_cast<ULONG>(record.CommandLine.size() * sizeof(WCHAR)));
+	}
+
+	ULONG Read(UCHAR* buffer, ULONG len)
+	{
+		auto count = _log.Readable(len);
+		_log.CopyOut(buffer, count);
+		_log.Consume(count);
+		return count;
+	}
+
+	ULONGLONG Dropped() const
+	{
+		return _log.DroppedRecords();
+	}
+
+private:
+	std::vector<UCHAR> _storage;
+	EventLog           _log;
+};
+
+/* ----------------------------------------------------------------------------
+	Measurement
+*/
+
+struct BenchResult {
+	double    PushSeconds;
+	double    ReadSeconds;
+	ULONGLONG Bytes;
+	ULONGLONG Reads;
+	bool      Valid;
+};
+
+// checks that a read buffer holds the next records of the workload, in order
+bool CheckRecords(const UCHAR* buffer, ULONG size, const std::vector<BenchRecord>& records, size_t& next)
+{
+	ULONG offset = 0;
+
+	while (offset < size)
+	{
+		auto header = reinterpret_cast<const ItemHeader*>(buffer + offset);
+		if (next >= records.size())
+			return false;
+
+		const auto& expected = records[next++];
+		if (header->Size < expected.Fixed.size() || offset + header->Size > size)
+			return false;
+
+		if (0 != std::memcmp(header, expected.Fixed.data(), expected.Fixed.size()))
+			return false;
+
+		if (0 != std::memcmp(buffer + offset + expected.Fixed.size(), expected.CommandLine.data(), expected.CommandLine.size() * sizeof(WCHAR)))
+			return false;
+
+		offset += header->Size;
+	}
+
+	return true;
+}
+
+template<typename TStore>
+BenchResult RunStore(const std::vector<BenchRecord>& records, size_t burst, int rounds)
+{
+	using Clock = std::chrono::steady_clock;
+
+	BenchResult result = { 0, 0, 0, 0, true };
+	std::vector<UCHAR> buffer(ReadBufferSize);
+
+	for (int round = 0; round < rounds; ++round)
+	{
+		TStore store;
+		size_t checked = 0;
+
+		for (size_t start = 0; start < records.size(); start += burst)
+		{
+			const auto end = (start + burst < records.size()) ? start + burst : records.size();
+
+			auto pushStart = Clock::now();
+			for (auto i = start; i < end; ++i)
+			{
+				store.Push(records[i]);
+			}
+			auto pushEnd = Clock::now();
+
+			// drain the burst, checking only outside the timed region
+			while (true)
+			{
+				auto readStart = Clock::now();
+				auto bytes = store.Read(buffer.data(), ReadBufferSize);
+				auto readEnd = Clock::now();
+
+				if (0 == bytes)
+					break;
+
+				result.ReadSeconds += std::chrono::duration<double>(readEnd - readStart).count();
+				result.Bytes += bytes;
+				result.Reads++;
+
+				if (0 == round && !CheckRecords(buffer.data(), bytes, records, checked))
+					result.Valid = false;
+			}
+
+			result.PushSeconds += std::chrono::duration<double>(pushEnd - pushStart).count();
+		}
+
+		if (0 == round && checked != records.size())
+			result.Valid = false;
+	}
+
+	return result;
+}
+
+void Report(const char* name, const BenchResult& result, size_t events, int rounds)
+{
+	const auto total = static_cast<double>(events) * rounds;
+
+	printf("%-6s %10.1f %10.1f %10.1f %12.0f %10.1f %s\n",
+		name,
+		result.PushSeconds * 1e9 / total,
+		result.ReadSeconds * 1e9 / total,
+		total / (result.PushSeconds + result.ReadSeconds) / 1e6,
+		result.Bytes / result.ReadSeconds / 1e6,
+		static_cast<double>(result.Bytes) / result.Reads / 1024,
+		result.Valid ? "ok" : "MISMATCH");
+}
+
+/* ----------------------------------------------------------------------------
+	Entry Point
+*/
+
+// SysMonBench log [--events N] [--burst N] [--rounds N]
+int RunLogBench(int argc, char* argv[])
+{
+	size_t events = 1000000;
+	size_t burst = 8192;
+	int rounds = 5;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		auto value = argv[i + 1];
+
+		if (0 == ::strcmp(argv[i], "--events"))
+			events = static_cast<size_t>(::strtoull(value, nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--burst"))
+			burst = static_cast<size_t>(::strtoull(value, nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--rounds"))
+			rounds = ::atoi(value);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == burst || rounds < 1)
+	{
+		printf("burst and rounds must be positive\n");
+		return 1;
+	}
+
+	auto records = MakeWorkload(events);
+
+	printf("%zu events in bursts of %zu, %d rounds, %u byte reads\n", events, burst, rounds, ReadBufferSize);
+	printf("%-6s %10s %10s %10s %12s %10s\n", "store", "push ns", "read ns", "Mevents/s", "read MB/s", "KB/read");
+
+	auto list = RunStore<ItemList>(records, burst, rounds);
+	Report("list", list, events, rounds);
+
+	auto log = RunStore<LogStore>(records, burst, rounds);
+	Report("log", log, events, rounds);
+
+	return (list.Valid && log.Valid) ? 0 : 1;
+}
@@ -5,12 +5,8 @@
 
 #include <Windows.h>
 #include <stdio.h>
-#include <string>
 
-#include "SysMonCommon.h"
-
-void DisplayInfo(BYTE* buffer, DWORD size);
-void DisplayTime(const LARGE_INTEGER& time);
+#include "Display.h"
 
 int Error(const char* msg);
 
@@ -26,6 +22,7 @@ int main()
 
 	BYTE buffer[1 << 16];  // 64KB buffer
 
+	// the driver holds each read until it has events to return
 	while (true)
 	{
 		DWORD bytes;
@@ -33,9 +30,7 @@ int main()
 			return Error("Failed to read");
 
 		if (0 != bytes)
-			DisplayInfo(buffer, bytes);
-
-		::Sleep(200);
+			DisplayInfo(buffer, bytes, stdout);
 	}
 
 	return 0;
@@ -45,65 +40,6 @@ int main()
 	Helpers
 */
 
-// display information recvd from driver
-void DisplayInfo(BYTE* buffer, DWORD size)
-{
-	auto count = size;
-	while (count > 0)
-	{
-		auto header = (ItemHeader*) buffer;
-
-		switch (header->Type) {
-			case ItemType::ProcessExit:
-			{
-				DisplayTime(header->Time);
-				auto info = (ProcessExitInfo*)buffer;
-				printf("Process %d Exited\n", info->ProcessId);
-				break;
-			}
-
-			case ItemType::ProcessCreate:
-			{
-				DisplayTime(header->Time);
-				auto info = (ProcessCreateInfo*)buffer;
-				std::wstring commandLine((WCHAR*)buffer + info->CommandLineOffset);
-				printf("Process %d Created. Coommand Line: %ws\n", info->ProcessId, commandLine.c_str());
-				break;
-			}
-
-			case ItemType::ThreadCreate:
-			{
-				DisplayTime(header->Time);
-				auto info = (ThreadCreateExitInfo*)buffer;
-				printf("Thread %d Created in Process %d\n", info->ThreadId, info->ProcessId);
-				break;
-			}
-
-			case ItemType::ThreadExit:
-			{
-				DisplayTime(header->Time);
-				auto info = (ThreadCreateExitInfo*)buffer;
-				printf("Thread %d Exited from Process %d\n", info->ThreadId, info->ProcessId);
-				break;
-			}
-
-			default:
-				break;
-		}
-
-		buffer += header->Size;
-		count -= header->Size;
-	}
-}
-
-// disiplay time in human-readable format
-void DisplayTime(const LARGE_INTEGER& time)
-{
-	SYSTEMTIME st;
-	::FileTimeToSystemTime((FILETIME*)& time, &st);
-	printf("%02d:%02d:%02d.%03d: ", st.wHour, st.wMinute, st.wSecond, st.wMilliseconds);
-}
-
 // error handling helper
 int Error(const char* msg)
 {
@@ -0,0 +1,140 @@
+/*
+ * Display.cpp
+ * Formatting of SysMon driver results, shared by the client and the
+ * replay harness.
+ */
+
+#include <string>
+
+#include "Display.h"
+
+static void AppendUtf8(std::string& out, const WCHAR* source, USHORT length);
+
+/* ----------------------------------------------------------------------------
+	Display
+*/
+
+// display information recvd from driver
+void DisplayInfo(const BYTE* buffer, DWORD size, FILE* out)
+{
+	auto count = size;
+	while (count >= sizeof(ItemHeader))
+	{
+		auto header = (const ItemHeader*) buffer;
+		if (header->Size < sizeof(ItemHeader) || header->Size > count)
+			break;
+
+		switch (header->Type) {
+			case ItemType::ProcessExit:
+			{
+				DisplayTime(header->Time, out);
+				auto info = (const ProcessExitInfo*)buffer;
+				fprintf(out, "Process %u Exited\n", info->ProcessId);
+				break;
+			}
+
+			case ItemType::ProcessCreate:
+			{
+				DisplayTime(header->Time, out);
+				auto info = (const ProcessCreateInfo*)buffer;
+
+				// the offset is in bytes and the string is not terminated
+				std::string commandLine;
+				if (info->CommandLineLength > 0
+					&& info->CommandLineOffset + info->CommandLineLength * sizeof(WCHAR) <= header->Size)
+				{
+					AppendUtf8(commandLine, (const WCHAR*)(buffer + info->CommandLineOffset), info->CommandLineLength);
+				}
+
+				fprintf(out, "Process %u Created. Command Line: %s\n", info->ProcessId, commandLine.c_str());
+				break;
+			}
+
+			case ItemType::ThreadCreate:
+			{
+				DisplayTime(header->Time, out);
+				auto info = (const ThreadCreateExitInfo*)buffer;
+				fprintf(out, "Thread %u Created in Process %u\n", info->ThreadId, info->ProcessId);
+				break;
+			}
+
+			case ItemType::ThreadExit:
+			{
+				DisplayTime(header->Time, out);
+				auto info = (const ThreadCreateExitInfo*)buffer;
+				fprintf(out, "Thread %u Exited from Process %u\n", info->ThreadId, info->ProcessId);
+				break;
+			}
+
+			default:
+				break;
+		}
+
+		buffer += header->Size;
+		count -= header->Size;
+	}
+}
+
+// disiplay time in human-readable format
+void DisplayTime(const LARGE_INTEGER& time, FILE* out)
+{
+	// FILETIME counts 100ns intervals from midnight (UTC), so the time of
+	// day falls out of the remainders directly
+	const auto milliseconds = time.QuadPart / 10000;
+
+	fprintf(out, "%02d:%02d:%02d.%03d: ",
+		(int)((milliseconds / 3600000) % 24),
+		(int)((milliseconds / 60000) % 60),
+		(int)((milliseconds / 1000) % 60),
+		(int)(milliseconds % 1000));
+}
+
+/* ----------------------------------------------------------------------------
+	Helpers
+*/
+
+// UTF-16 to UTF-8; unpaired surrogates become U+FFFD
+static void AppendUtf8(std::string& out, const WCHAR* source, USHORT length)
+{
+	for (USHORT i = 0; i < length; ++i)
+	{
+		ULONG cp = (USHORT)source[i];
+
+		if (cp >= 0xD800 && cp <= 0xDFFF)
+		{
+			const ULONG next = (i + 1 < length) ? (USHORT)source[i + 1] : 0;
+			if (cp <= 0xDBFF && next >= 0xDC00 && next <= 0xDFFF)
+			{
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (next - 0xDC00);
+				++i;
+			}
+			else
+			{
+				cp = 0xFFFD;
+			}
+		}
+
+		if (cp < 0x80)
+		{
+			out.push_back((char)cp);
+		}
+		else if (cp < 0x800)
+		{
+			out.push_back((char)(0xC0 | (cp >> 6)));
+			out.push_back((char)(0x80 | (cp & 0x3F)));
+		}
+		else if (cp < 0x10000)
+		{
+			out.push_back((char)(0xE0 | (cp >> 12)));
+			out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back((char)(0x80 | (cp & 0x3F)));
+		}
+		else
+		{
+			out.push_back((char)(0xF0 | (cp >> 18)));
+			out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+			out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back((char)(0x80 | (cp & 0x3F)));
+		}
+	}
+}
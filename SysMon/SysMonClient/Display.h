@@ -0,0 +1,21 @@
+/*
+ * Display.h
+ * Formatting of SysMon driver results, shared by the client and the
+ * replay harness.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include "SysMonCommon.h"
+
+// write every item in a driver results buffer to out
+void DisplayInfo(const BYTE* buffer, DWORD size, FILE* out);
+
+// write a timestamp as "HH:MM:SS.mmm: "
+void DisplayTime(const LARGE_INTEGER& time, FILE* out);
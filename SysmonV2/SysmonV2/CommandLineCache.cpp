@@ -0,0 +1,322 @@
+// CommandLineCache.cpp
+// Deferred command line capture for process creation events.
+
+#include <ntddk.h>
+
+#include "CommandLineCache.h"
+
+#pragma warning( disable : 28166 ) // C28166 changes IRQL and does not restore (doesn't like dtors)
+#pragma warning( disable : 28167 ) // C28167 changes IRQL and does not restore (doesn't like dtors)
+
+// tag for command line allocations
+constexpr ULONG COMMAND_LINE_ALLOC_TAG = 0x13371338;
+
+// not exposed by the PROCESSINFOCLASS enumeration in ntddk.h
+constexpr ULONG ProcessCommandLineInformation = 60;
+
+extern "C" NTSYSAPI NTSTATUS NTAPI ZwQueryInformationProcess(
+	HANDLE ProcessHandle,
+	PROCESSINFOCLASS ProcessInformationClass,
+	PVOID ProcessInformation,
+	ULONG ProcessInformationLength,
+	PULONG ReturnLength);
+
+static PUNICODE_STRING QueryProcessCommandLine(PEPROCESS Process);
+
+static ULONG MakeHandle(ULONG Index, USHORT Generation)
+{
+	return (static_cast<ULONG>(Generation) << 16) | Index;
+}
+
+static ULONG HashProcessId(ULONG ProcessId)
+{
+	// process IDs are multiples of 4
+	return (ProcessId >> 2) % COMMAND_LINE_CACHE_SLOTS;
+}
+
+VOID CommandLineCache::Init()
+{
+	Lock.Init();
+	RtlZeroMemory(Slots, sizeof(Slots));
+}
+
+// drop all outstanding process references and cached strings
+VOID CommandLineCache::Destroy()
+{
+	AutoLock<FastMutex> locker(Lock);
+
+	for (auto& Slot : Slots)
+	{
+		ReleaseSlotUnsafe(&Slot);
+	}
+}
+
+ULONG CommandLineCache::Track(PEPROCESS Process, HANDLE ProcessId)
+{
+	const auto Pid = HandleToULong(ProcessId);
+	const auto Start = HashProcessId(Pid);
+
+	AutoLock<FastMutex> locker(Lock);
+
+	// linear probe for the first free or deleted slot
+	for (ULONG i = 0; i < COMMAND_LINE_CACHE_SLOTS; ++i)
+	{
+		const auto Index = (Start + i) % COMMAND_LINE_CACHE_SLOTS;
+		auto& Slot = Slots[Index];
+
+		if (Slot.State == CommandLineSlotState::Free
+			|| Slot.State == CommandLineSlotState::Deleted)
+		{
+			ObReferenceObject(Process);
+
+			Slot.State       = CommandLineSlotState::Referenced;
+			Slot.ProcessId   = Pid;
+			Slot.Process     = Process;
+			Slot.CommandLine = nullptr;
+
+			return MakeHandle(Index, Slot.Generation);
+		}
+	}
+
+	// table is full; the record simply goes without a command line
+	return INVALID_COMMAND_LINE_HANDLE;
+}
+
+VOID CommandLineCache::OnProcessExit(PEPROCESS Process, HANDLE ProcessId)
+{
+	const auto Pid = HandleToULong(ProcessId);
+	const auto Start = HashProcessId(Pid);
+	auto Handle = INVALID_COMMAND_LINE_HANDLE;
+
+	{
+		AutoLock<FastMutex> locker(Lock);
+
+		for (ULONG i = 0; i < COMMAND_LINE_CACHE_SLOTS; ++i)
+		{
+			const auto Index = (Start + i) % COMMAND_LINE_CACHE_SLOTS;
+			auto& Slot = Slots[Index];
+
+			if (Slot.State == CommandLineSlotState::Free)
+			{
+				// end of the probe chain, process was never tracked
+				return;
+			}
+
+			if (Slot.State == CommandLineSlotState::Referenced && Slot.Process == Process)
+			{
+				Handle = MakeHandle(Index, Slot.Generation);
+				break;
+			}
+		}
+
+		if (INVALID_COMMAND_LINE_HANDLE == Handle)
+		{
+			return;
+		}
+	}
+
+	// the process is about to go away and its creation record has not been
+	// drained; capture while we still can, as the next drain may want it
+	Resolve(Handle);
+}
+
+ULONG CommandLineCache::Materialize(ULONG Handle, PUCHAR Buffer, ULONG BufferSize)
+{
+	Resolve(Handle);
+
+	AutoLock<FastMutex> locker(Lock);
+
+	auto pSlot = LookupUnsafe(Handle);
+	if (nullptr == pSlot || nullptr == pSlot->CommandLine)
+	{
+		return 0;
+	}
+
+	const ULONG Required = pSlot->CommandLine->Length;
+	if (Required <= BufferSize)
+	{
+		RtlCopyMemory(Buffer, pSlot->CommandLine->Buffer, Required);
+	}
+
+	return Required;
+}
+
+VOID CommandLineCache::Release(ULONG Handle)
+{
+	AutoLock<FastMutex> locker(Lock);
+
+	auto pSlot = LookupUnsafe(Handle);
+	if (pSlot != nullptr)
+	{
+		ReleaseSlotUnsafe(pSlot);
+	}
+}
+
+// move a slot from Referenced to Resolved, querying the process
+// for its command line; the query runs without the lock held
+VOID CommandLineCache::Resolve(ULONG Handle)
+{
+	PEPROCESS Process = nullptr;
+
+	{
+		AutoLock<FastMutex> locker(Lock);
+
+		auto pSlot = LookupUnsafe(Handle);
+		if (nullptr == pSlot || pSlot->State != CommandLineSlotState::Referenced)
+		{
+			return;
+		}
+
+		// keep the process alive across the query
+		Process = pSlot->Process;
+		ObReferenceObject(Process);
+	}
+
+	auto CommandLine = QueryProcessCommandLine(Process);
+
+	{
+		AutoLock<FastMutex> locker(Lock);
+
+		auto pSlot = LookupUnsafe(Handle);
+		if (pSlot != nullptr && pSlot->State == CommandLineSlotState::Referenced)
+		{
+			ObDereferenceObject(pSlot->Process);
+
+			pSlot->Process     = nullptr;
+			pSlot->CommandLine = CommandLine;
+			pSlot->State       = CommandLineSlotState::Resolved;
+
+			CommandLine = nullptr;
+		}
+	}
+
+	// lost a race with another resolver or a release
+	if (CommandLine != nullptr)
+	{
+		ExFreePoolWithTag(CommandLine, COMMAND_LINE_ALLOC_TAG);
+	}
+
+	ObDereferenceObject(Process);
+}
+
+// IMPT: assumes lock is already held
+PCOMMAND_LINE_SLOT CommandLineCache::LookupUnsafe(ULONG Handle)
+{
+	if (INVALID_COMMAND_LINE_HANDLE == Handle)
+	{
+		return nullptr;
+	}
+
+	const auto Index = Handle & 0xFFFF;
+	const auto Generation = static_cast<USHORT>(Handle >> 16);
+
+	if (Index >= COMMAND_LINE_CACHE_SLOTS)
+	{
+		return nullptr;
+	}
+
+	auto& Slot = Slots[Index];
+	if (Slot.Generation != Generation
+		|| Slot.State == CommandLineSlotState::Free
+		|| Slot.State == CommandLineSlotState::Deleted)
+	{
+		return nullptr;
+	}
+
+	return &Slot;
+}
+
+// IMPT: assumes lock is already held
+VOID CommandLineCache::ReleaseSlotUnsafe(PCOMMAND_LINE_SLOT pSlot)
+{
+	if (pSlot->Process != nullptr)
+	{
+		ObDereferenceObject(pSlot->Process);
+		pSlot->Process = nullptr;
+	}
+
+	if (pSlot->CommandLine != nullptr)
+	{
+		ExFreePoolWithTag(pSlot->CommandLine, COMMAND_LINE_ALLOC_TAG);
+		pSlot->CommandLine = nullptr;
+	}
+
+	if (pSlot->State == CommandLineSlotState::Free)
+	{
+		return;
+	}
+
+	pSlot->State = CommandLineSlotState::Deleted;
+	pSlot->Generation++;
+
+	// if this slot ends a probe chain, turn the trailing run of
+	// tombstones back into free slots so lookups stay short
+	auto Index = static_cast<ULONG>(pSlot - Slots);
+	if (Slots[(Index + 1) % COMMAND_LINE_CACHE_SLOTS].State != CommandLineSlotState::Free)
+	{
+		return;
+	}
+
+	while (Slots[Index].State == CommandLineSlotState::Deleted)
+	{
+		Slots[Index].State = CommandLineSlotState::Free;
+		Index = (Index + COMMAND_LINE_CACHE_SLOTS - 1) % COMMAND_LINE_CACHE_SLOTS;
+	}
+}
+
+// read the command line of a process into a single PagedPool allocation
+// (the UNICODE_STRING header is followed by its buffer)
+static PUNICODE_STRING QueryProcessCommandLine(PEPROCESS Process)
+{
+	HANDLE hProcess = nullptr;
+
+	auto status = ObOpenObjectByPointer(
+		Process,
+		OBJ_KERNEL_HANDLE,
+		nullptr,
+		0,
+		*PsProcessType,
+		KernelMode,
+		&hProcess);
+	if (!NT_SUCCESS(status))
+	{
+		return nullptr;
+	}
+
+	PUNICODE_STRING CommandLine = nullptr;
+	ULONG ReturnLength = 0;
+
+	status = ZwQueryInformationProcess(
+		hProcess,
+		static_cast<PROCESSINFOCLASS>(ProcessCommandLineInformation),
+		nullptr,
+		0,
+		&ReturnLength);
+
+	if (STATUS_INFO_LENGTH_MISMATCH == status && ReturnLength > 0)
+	{
+		CommandLine = static_cast<PUNICODE_STRING>(
+			ExAllocatePoolWithTag(PagedPool, ReturnLength, COMMAND_LINE_ALLOC_TAG)
+			);
+
+		if (CommandLine != nullptr)
+		{
+			status = ZwQueryInformationProcess(
+				hProcess,
+				static_cast<PROCESSINFOCLASS>(ProcessCommandLineInformation),
+				CommandLine,
+				ReturnLength,
+				&ReturnLength);
+
+			if (!NT_SUCCESS(status))
+			{
+				ExFreePoolWithTag(CommandLine, COMMAND_LINE_ALLOC_TAG);
+				CommandLine = nullptr;
+			}
+		}
+	}
+
+	ZwClose(hProcess);
+
+	return CommandLine;
+}
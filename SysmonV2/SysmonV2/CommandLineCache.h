@@ -0,0 +1,65 @@
+// CommandLineCache.h
+// Deferred command line capture for process creation events.
+
+#pragma once
+
+#include <ntddk.h>
+
+#include "SyncHelpers.h"
+
+// number of tracked processes; must cover every queued creation record
+constexpr ULONG COMMAND_LINE_CACHE_SLOTS = 1024;
+
+// handle value for records that do not reference a slot
+constexpr ULONG INVALID_COMMAND_LINE_HANDLE = 0xFFFFFFFF;
+
+enum class CommandLineSlotState : UCHAR
+{
+	Free,
+	Deleted,     // tombstone, keeps probe chains intact
+	Referenced,  // holds a reference to the process object
+	Resolved,    // holds a copy of the command line (may be empty)
+};
+
+typedef struct _COMMAND_LINE_SLOT
+{
+	CommandLineSlotState State;
+	USHORT               Generation;
+	ULONG                ProcessId;
+	PEPROCESS            Process;      // valid while Referenced
+	PUNICODE_STRING      CommandLine;  // valid while Resolved, may be nullptr
+} COMMAND_LINE_SLOT, *PCOMMAND_LINE_SLOT;
+
+// Process creation records store a fixed-size handle into this table
+// rather than a copy of the command line. The command line is read from
+// the process when a drain asks for it, or when the process exits before
+// then, so a record keeps its command line however late it is drained.
+// Capturing on exit is bounded by the slots still referenced.
+class CommandLineCache
+{
+public:
+	VOID Init();
+	VOID Destroy();
+
+	// begin tracking a newly created process, returns a record handle
+	ULONG Track(PEPROCESS Process, HANDLE ProcessId);
+
+	// capture the command line of an exiting process still referenced
+	VOID OnProcessExit(PEPROCESS Process, HANDLE ProcessId);
+
+	// resolve the command line for a handle and copy it to the buffer;
+	// returns the number of bytes required, copies only if they fit
+	ULONG Materialize(ULONG Handle, PUCHAR Buffer, ULONG BufferSize);
+
+	// release the slot referenced by a handle
+	VOID Release(ULONG Handle);
+
+private:
+	VOID Resolve(ULONG Handle);
+
+	PCOMMAND_LINE_SLOT LookupUnsafe(ULONG Handle);
+	VOID               ReleaseSlotUnsafe(PCOMMAND_LINE_SLOT pSlot);
+
+	FastMutex         Lock;
+	COMMAND_LINE_SLOT Slots[COMMAND_LINE_CACHE_SLOTS];
+};
@@ -44,6 +44,14 @@ DriverEntry(
 	// NOTE: only planning to use IOCTLs, so this doesn't really matter
 	pDeviceObject->Characteristics |= DO_DIRECT_IO;
 
+	g_GlobalState.CompleteWorkItem = IoAllocateWorkItem(pDeviceObject);
+	if (nullptr == g_GlobalState.CompleteWorkItem)
+	{
+		KdPrint(("Failed to allocate query completion work item\n"));
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto EXIT;
+	}
+
 	// create the symbolic link
 
 	status = IoCreateSymbolicLink(&SymlinkName, &DeviceName);
@@ -60,6 +68,7 @@ DriverEntry(
 	pDriverObject->DriverUnload = DriverUnload;
 	pDriverObject->MajorFunction[IRP_MJ_CREATE]         = DispatchCreate;
 	pDriverObject->MajorFunction[IRP_MJ_CLOSE]          = DispatchClose;
+	pDriverObject->MajorFunction[IRP_MJ_CLEANUP]        = DispatchCleanup;
 	pDriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = DispatchDeviceIoControl;
 
 	// register callback routines
@@ -83,6 +92,11 @@ EXIT:
 	// cleanup if we failed
 	if (!NT_SUCCESS(status))
 	{
+		if (g_GlobalState.CompleteWorkItem != nullptr)
+		{
+			IoFreeWorkItem(g_GlobalState.CompleteWorkItem);
+		}
+
 		if (pDeviceObject != nullptr)
 		{
 			IoDeleteDevice(pDeviceObject);
@@ -106,6 +120,15 @@ VOID InitializeGlobalState()
 	g_GlobalState.ThreadEventQueueLock.Init();
 	g_GlobalState.ProcessEventQueueCount = 0;
 	g_GlobalState.ThreadEventQueueCount = 0;
+	g_GlobalState.ProcessEventQueueDropped = 0;
+	g_GlobalState.ThreadEventQueueDropped = 0;
+	g_GlobalState.CaptureFlags = 0;
+	g_GlobalState.CommandLines.Init();
+	g_GlobalState.CompleteWorkItem = nullptr;
+	g_GlobalState.CompleteQueued = 0;
+
+	InitializePendingQueries(&g_GlobalState.ProcessQueries);
+	InitializePendingQueries(&g_GlobalState.ThreadQueries);
 }
 
 /* ----------------------------------------------------------------------------
@@ -116,6 +139,21 @@ VOID DriverUnload(_In_ PDRIVER_OBJECT pDriverObject)
 {
 	UNICODE_STRING SymlinkName = RTL_CONSTANT_STRING(L"\\??\\SysmonV2");
 
+	// stop receiving events before tearing down the queues
+	PsRemoveCreateThreadNotifyRoutine(OnThreadNotify);
+	PsSetCreateProcessNotifyRoutineEx(OnProcessNotify, TRUE);
+
+	// no handles remain, so no queries are pending; wait out a fill
+	// that was queued before the last one was cancelled
+	while (InterlockedCompareExchange(&g_GlobalState.CompleteQueued, 0, 0) != 0)
+	{
+		LARGE_INTEGER interval;
+		interval.QuadPart = -10 * 1000;  // 1ms
+		KeDelayExecutionThread(KernelMode, FALSE, &interval);
+	}
+
+	IoFreeWorkItem(g_GlobalState.CompleteWorkItem);
+
 	// remove the symbolic link
 	IoDeleteSymbolicLink(&SymlinkName);
 
@@ -124,6 +162,9 @@ VOID DriverUnload(_In_ PDRIVER_OBJECT pDriverObject)
 
 	FlushQueueSafe(&g_GlobalState.ProcessEventQueueHead, g_GlobalState.ProcessEventQueueLock);
 	FlushQueueSafe(&g_GlobalState.ThreadEventQueueHead, g_GlobalState.ThreadEventQueueLock);
+
+	// drop any process references still held for lazy command lines
+	g_GlobalState.CommandLines.Destroy();
 }
 
 /* ----------------------------------------------------------------------------
@@ -164,6 +205,39 @@ NTSTATUS DispatchClose(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
 	return STATUS_SUCCESS;
 }
 
+/* ----------------------------------------------------------------------------
+ *	Cleanup Dispatch
+ */
+
+// complete the queries still pending on the handle being closed
+_Use_decl_annotations_
+NTSTATUS DispatchCleanup(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
+{
+	UNREFERENCED_PARAMETER(pDeviceObject);
+
+	auto pFileObject = IoGetCurrentIrpStackLocation(pIrp)->FileObject;
+
+	PPENDING_QUERIES queues[] = { &g_GlobalState.ProcessQueries, &g_GlobalState.ThreadQueries };
+	for (auto pQueries : queues)
+	{
+		PIRP pPending;
+		while ((pPending = IoCsqRemoveNextIrp(&pQueries->Csq, pFileObject)) != nullptr)
+		{
+			pPending->IoStatus.Status = STATUS_CANCELLED;
+			pPending->IoStatus.Information = 0;
+
+			IoCompleteRequest(pPending, IO_NO_INCREMENT);
+		}
+	}
+
+	pIrp->IoStatus.Status = STATUS_SUCCESS;
+	pIrp->IoStatus.Information = 0;
+
+	IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+
+	return STATUS_SUCCESS;
+}
+
 /* ----------------------------------------------------------------------------
  *	Primary Device IO Control Dispatch
  */
@@ -178,10 +252,93 @@ NTSTATUS DispatchDeviceIoControl(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
 	auto pIoStackLocation = IoGetCurrentIrpStackLocation(pIrp);
 	auto ControlCode      = pIoStackLocation->Parameters.DeviceIoControl.IoControlCode;
 
+	if (IOCTL_SYSMONV2_SET_CAPTURE_MODE == ControlCode)
+	{
+		if (pIoStackLocation->Parameters.DeviceIoControl.InputBufferLength < sizeof(CaptureModeRequest))
+		{
+			status = STATUS_INVALID_BUFFER_SIZE;
+		}
+		else
+		{
+			auto pRequest = static_cast<CaptureModeRequest*>(pIrp->AssociatedIrp.SystemBuffer);
+			InterlockedExchange(reinterpret_cast<volatile LONG*>(&g_GlobalState.CaptureFlags), pRequest->Flags);
+		}
+
+		pIrp->IoStatus.Status = status;
+		pIrp->IoStatus.Information = 0;
+
+		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+		return status;
+	}
+
+	if (IOCTL_SYSMONV2_QUERY_STATS == ControlCode)
+	{
+		if (pIoStackLocation->Parameters.DeviceIoControl.OutputBufferLength < sizeof(QueueStats))
+		{
+			status = STATUS_BUFFER_TOO_SMALL;
+		}
+		else
+		{
+			// read without the queue locks; the values are only a snapshot anyway
+			auto pStats = static_cast<QueueStats*>(pIrp->AssociatedIrp.SystemBuffer);
+			pStats->ProcessQueueDepth    = g_GlobalState.ProcessEventQueueCount;
+			pStats->ThreadQueueDepth     = g_GlobalState.ThreadEventQueueCount;
+			pStats->ProcessEventsDropped = g_GlobalState.ProcessEventQueueDropped;
+			pStats->ThreadEventsDropped  = g_GlobalState.ThreadEventQueueDropped;
+
+			information = sizeof(QueueStats);
+		}
+
+		pIrp->IoStatus.Status = status;
+		pIrp->IoStatus.Information = information;
+
+		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+		return status;
+	}
+
+	PPENDING_QUERIES pQueries = nullptr;
+	PLIST_ENTRY      pQueueHead = nullptr;
+	FastMutex*       pQueueLock = nullptr;
+
+	switch (ControlCode)
+	{
+	case IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX:
+		if (pIoStackLocation->Parameters.DeviceIoControl.InputBufferLength < sizeof(QueryRequest))
+		{
+			status = STATUS_INVALID_BUFFER_SIZE;
+			break;
+		}
+
+		// fall through
+	case IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS:
+		pQueries   = &g_GlobalState.ProcessQueries;
+		pQueueHead = &g_GlobalState.ProcessEventQueueHead;
+		pQueueLock = &g_GlobalState.ProcessEventQueueLock;
+		break;
+	case IOCTL_SYSMONV2_QUERY_THREAD_EVENTS:
+		pQueries   = &g_GlobalState.ThreadQueries;
+		pQueueHead = &g_GlobalState.ThreadEventQueueHead;
+		pQueueLock = &g_GlobalState.ThreadEventQueueLock;
+		break;
+	default:
+		status = STATUS_INVALID_DEVICE_REQUEST;
+		break;
+	}
+
+	if (nullptr == pQueries)
+	{
+		pIrp->IoStatus.Status = status;
+		pIrp->IoStatus.Information = 0;
+
+		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+		return status;
+	}
+
 	// NOTE: what if this fails?? bugcheck??
 	NT_ASSERT(pIrp->MdlAddress);
 
-	// grab the MDL buffer and cast to fit our needs
+	// map the MDL buffer now, in the caller's context; a query completed
+	// later by the fill work item reuses the mapping
 	auto buffer = static_cast<PUCHAR>(MmGetSystemAddressForMdlSafe(pIrp->MdlAddress, NormalPagePriority));
 	if (!buffer)
 	{
@@ -192,51 +349,33 @@ NTSTATUS DispatchDeviceIoControl(PDEVICE_OBJECT pDeviceObject, PIRP pIrp)
 		return STATUS_INSUFFICIENT_RESOURCES;
 	}
 
-	// get the size of the output buffer
-	auto bufferSize = pIoStackLocation->Parameters.DeviceIoControl.OutputBufferLength;
-	
-	switch (ControlCode)
-	{
-	case IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS:
-	{
-		Tuple<NTSTATUS, ULONG> res = FlushEventQueueToBufferSafe(
-			&g_GlobalState.ProcessEventQueueHead,
-			g_GlobalState.ProcessEventQueueLock,
-			g_GlobalState.ProcessEventQueueCount,
-			buffer,
-			bufferSize
-		);
+	AutoLock<FastMutex> drainer(pQueries->DrainLock);
 
-		// structured bindings?
-		status      = res.First();
-		information = res.Second();
+	// only overlapped handles pend; a synchronous caller (the interactive
+	// queries) still gets whatever is queued, possibly nothing, at once
+	const BOOLEAN bCanPend = (pIoStackLocation->FileObject->Flags & FO_SYNCHRONOUS_IO) ? FALSE : TRUE;
 
-		break;
-	}
-	case IOCTL_SYSMONV2_QUERY_THREAD_EVENTS:
+	if (bCanPend)
 	{
-		Tuple<NTSTATUS, ULONG> res = FlushEventQueueToBufferSafe(
-			&g_GlobalState.ThreadEventQueueHead,
-			g_GlobalState.ThreadEventQueueLock,
-			g_GlobalState.ThreadEventQueueCount,
-			buffer,
-			bufferSize
-		);
-
-		// structured bindings?
-		status      = res.First();
-		information = res.Second();
+		// pend with nothing queued, or behind queries already waiting so
+		// they are filled in order; the insert is made under the queue lock
+		// so the next push sees the query
+		AutoLock<FastMutex> locker(*pQueueLock);
 
-		break;
-	}
-	default:
-	{
-		status      = STATUS_INVALID_DEVICE_REQUEST;
-		information = 0;
-		break;
-	}
+		if (IsListEmpty(pQueueHead) || pQueries->Count > 0)
+		{
+			IoCsqInsertIrp(&pQueries->Csq, pIrp, nullptr);
+			return STATUS_PENDING;
+		}
 	}
 
+	Tuple<NTSTATUS, ULONG> res = DrainQuery(pIrp);
+
+	// structured bindings?
+	status      = res.First();
+	information = res.Second();
+
+	// completed under the drain lock, so no later query completes first
 	pIrp->IoStatus.Status      = status;
 	pIrp->IoStatus.Information = information;
 
@@ -255,25 +394,27 @@ VOID OnProcessNotify(
 	HANDLE ProcessId,
 	PPS_CREATE_NOTIFY_INFO pCreateInfo)
 {
-	UNREFERENCED_PARAMETER(pProcess);
-
 	if (pCreateInfo)
 	{
 		// process creation
-		HandleProcessCreate(ProcessId, pCreateInfo);
+		HandleProcessCreate(pProcess, ProcessId, pCreateInfo);
 	}
 	else
 	{
 		// process exit
-		HandleProcessExit(ProcessId, pCreateInfo);
+		HandleProcessExit(pProcess, ProcessId, pCreateInfo);
 	}
 }
 
-VOID HandleProcessCreate(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
+VOID HandleProcessCreate(PEPROCESS pProcess, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
 {
+	// in lazy mode the record only carries a handle to the process;
+	// the command line is read at drain time, if anyone asks for it
+	const BOOLEAN bLazy = (g_GlobalState.CaptureFlags & CAPTURE_FLAG_LAZY_COMMAND_LINE) ? TRUE : FALSE;
+
 	USHORT CommandlineSize = 0;
 	auto allocSize = sizeof(QUEUE_ITEM<ProcessCreateItem>);
-	if (pCreateInfo->CommandLine)
+	if (!bLazy && pCreateInfo->CommandLine)
 	{
 		CommandlineSize = pCreateInfo->CommandLine->Length;
 		allocSize += CommandlineSize;
@@ -293,6 +434,10 @@ VOID HandleProcessCreate(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
 
 	KeQuerySystemTimePrecise(&Data.Time);
 	
+	pQueueItem->CommandLineHandle = bLazy
+		? g_GlobalState.CommandLines.Track(pProcess, ProcessId)
+		: INVALID_COMMAND_LINE_HANDLE;
+
 	Data.Type = ItemType::ProcessCreate;
 	Data.Size = sizeof(ProcessCreateItem) + CommandlineSize;
 	Data.ProcessId = HandleToUlong(ProcessId);
@@ -301,7 +446,7 @@ VOID HandleProcessCreate(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
 	if (CommandlineSize > 0)
 	{
 		// commandline is present
-		RtlCopyMemory(reinterpret_cast<PUCHAR>(&Data + sizeof(Data)), pCreateInfo->CommandLine, CommandlineSize);
+		RtlCopyMemory(reinterpret_cast<PUCHAR>(&Data) + sizeof(Data), pCreateInfo->CommandLine->Buffer, CommandlineSize);
 
 		Data.CommandLineLength = CommandlineSize / sizeof(WCHAR);
 		Data.CommandLineOffset = sizeof(Data);
@@ -318,14 +463,19 @@ VOID HandleProcessCreate(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
 		&g_GlobalState.ProcessEventQueueHead,
 		g_GlobalState.ProcessEventQueueLock,
 		g_GlobalState.ProcessEventQueueCount,
+		g_GlobalState.ProcessEventQueueDropped,
+		&g_GlobalState.ProcessQueries,
 		&pQueueItem->ListEntry
 	);
 }
 
-VOID HandleProcessExit(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
+VOID HandleProcessExit(PEPROCESS pProcess, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
 {
 	UNREFERENCED_PARAMETER(pCreateInfo);
 
+	// a lazily captured creation record may still be waiting for a drain
+	g_GlobalState.CommandLines.OnProcessExit(pProcess, ProcessId);
+
 	auto allocSize = sizeof(QUEUE_ITEM<ProcessExitItem>);
 	auto pQueueItem = static_cast<QUEUE_ITEM<ProcessExitItem>*>(
 		ExAllocatePoolWithTag(PagedPool, allocSize, SYSMONV2_ALLOC_TAG)
@@ -336,6 +486,8 @@ VOID HandleProcessExit(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
 		return;
 	}
 
+	pQueueItem->CommandLineHandle = INVALID_COMMAND_LINE_HANDLE;
+
 	auto& Data = pQueueItem->Data;
 
 	KeQuerySystemTimePrecise(&Data.Time);
@@ -348,6 +500,8 @@ VOID HandleProcessExit(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo)
 		&g_GlobalState.ProcessEventQueueHead,
 		g_GlobalState.ProcessEventQueueLock,
 		g_GlobalState.ProcessEventQueueCount,
+		g_GlobalState.ProcessEventQueueDropped,
+		&g_GlobalState.ProcessQueries,
 		&pQueueItem->ListEntry
 	);
 }
@@ -383,6 +537,8 @@ VOID HandleThreadCreate(HANDLE ProcessId, HANDLE ThreadId)
 		return;
 	}
 
+	pQueueItem->CommandLineHandle = INVALID_COMMAND_LINE_HANDLE;
+
 	auto& Data = pQueueItem->Data;
 	
 	KeQuerySystemTimePrecise(&Data.Time);
@@ -396,6 +552,8 @@ VOID HandleThreadCreate(HANDLE ProcessId, HANDLE ThreadId)
 		&g_GlobalState.ThreadEventQueueHead,
 		g_GlobalState.ThreadEventQueueLock,
 		g_GlobalState.ThreadEventQueueCount,
+		g_GlobalState.ThreadEventQueueDropped,
+		&g_GlobalState.ThreadQueries,
 		&pQueueItem->ListEntry
 	);
 }
@@ -412,6 +570,8 @@ VOID HandleThreadExit(HANDLE ProcessId, HANDLE ThreadId)
 		return;
 	}
 
+	pQueueItem->CommandLineHandle = INVALID_COMMAND_LINE_HANDLE;
+
 	auto& Data = pQueueItem->Data;
 
 	KeQuerySystemTimePrecise(&Data.Time);
@@ -425,6 +585,8 @@ VOID HandleThreadExit(HANDLE ProcessId, HANDLE ThreadId)
 		&g_GlobalState.ThreadEventQueueHead, 
 		g_GlobalState.ThreadEventQueueLock, 
 		g_GlobalState.ThreadEventQueueCount, 
+		g_GlobalState.ThreadEventQueueDropped, 
+		&g_GlobalState.ThreadQueries,
 		&pQueueItem->ListEntry
 	);
 }
@@ -477,7 +639,7 @@ Tuple<NTSTATUS, ULONG> FlushEventQueueToBufferSafe(
 		RtlCopyMemory(buffer, &Data, itemSize);
 
 		// deallocate the removed item
-		ExFreePool(pFullItem);
+		FreeQueueItem(pQueueEntry);
 
 		// bookkeeping
 		QueueCount--;
@@ -489,32 +651,138 @@ Tuple<NTSTATUS, ULONG> FlushEventQueueToBufferSafe(
 	return Tuple<NTSTATUS, ULONG>{status, information};
 }
 
-// add a new element to the queue, under lock
+// remove process events from the queue one at a time and serialize
+// to the provided buffer; unlike the generic flush, the queue lock is
+// only held to pop and requeue, as lazy command lines are resolved
+// from the owning process while the item is out of the queue
+_Use_decl_annotations_
+template<typename LockType>
+Tuple<NTSTATUS, ULONG> FlushProcessEventQueueToBufferSafe(
+	PLIST_ENTRY pQueueHead,
+	LockType& QueueLock,
+	ULONG& QueueCount,
+	PUCHAR buffer,
+	ULONG bufferSize,
+	BOOLEAN bWantCommandLine)
+{
+	auto status = STATUS_SUCCESS;
+	ULONG information = 0;
+
+	auto bufferRemaining = bufferSize;
+
+	while (TRUE)
+	{
+		PLIST_ENTRY pQueueEntry = nullptr;
+
+		{
+			AutoLock<LockType> locker(QueueLock);
+
+			if (IsListEmpty(pQueueHead))
+			{
+				break;
+			}
+
+			pQueueEntry = RemoveHeadList(pQueueHead);
+			QueueCount--;
+		}
+
+		auto pFullItem = CONTAINING_RECORD(pQueueEntry, QUEUE_ITEM<ItemHeader>, ListEntry);
+		auto& Data = pFullItem->Data;
+
+		const auto bLazy = (pFullItem->CommandLineHandle != INVALID_COMMAND_LINE_HANDLE);
+
+		ULONG itemSize = Data.Size;
+		ULONG commandLineSize = 0;
+
+		if (bLazy && bWantCommandLine && bufferRemaining >= itemSize)
+		{
+			// the command line lands directly after the fixed record
+			commandLineSize = g_GlobalState.CommandLines.Materialize(
+				pFullItem->CommandLineHandle,
+				buffer + itemSize,
+				bufferRemaining - itemSize);
+
+			itemSize += commandLineSize;
+		}
+
+		if (bufferRemaining < itemSize)
+		{
+			// user's buffer is full, insert item back into list
+			AutoLock<LockType> locker(QueueLock);
+
+			InsertHeadList(pQueueHead, pQueueEntry);
+			QueueCount++;
+
+			break;
+		}
+
+		// copy the fixed part of the item to the user buffer
+		RtlCopyMemory(buffer, &Data, Data.Size);
+
+		if (bLazy)
+		{
+			auto pItem = reinterpret_cast<ProcessCreateItem*>(buffer);
+
+			pItem->Size              = itemSize;
+			pItem->CommandLineLength = static_cast<USHORT>(commandLineSize / sizeof(WCHAR));
+			pItem->CommandLineOffset = commandLineSize > 0 ? sizeof(ProcessCreateItem) : 0;
+		}
+
+		// deallocate the removed item, releasing its command line slot
+		FreeQueueItem(pQueueEntry);
+
+		// bookkeeping
+		bufferRemaining -= itemSize;
+		buffer          += itemSize;
+		information     += itemSize;
+	}
+
+	return Tuple<NTSTATUS, ULONG>{status, information};
+}
+
+// add a new element to the queue, under lock, and have any query
+// waiting on the queue filled
 _Use_decl_annotations_
 template <typename LockType>
 VOID PushQueueSafe(
 	PLIST_ENTRY pQueueHead,
 	LockType& QueueLock,
 	ULONG& QueueCount,
+	ULONGLONG& DroppedCount,
+	PPENDING_QUERIES pQueries,
 	PLIST_ENTRY entry)
 {
-	AutoLock<LockType> lock(QueueLock);
+	BOOLEAN bWaiting;
 
-	// NOTE: here we impose the limitation that only a fixed, maximum
-	// number of events are maintained in the internal queue;
-	// this maximum number may quickly be exhausted, given the number of events we register
-	if (QueueCount > MAX_QUEUE_ITEMS)
 	{
-		// too many items, remove oldest
-		auto head = RemoveHeadList(pQueueHead);
-		QueueCount--;
-		
-		auto item = CONTAINING_RECORD(head, QUEUE_ITEM<ItemHeader>, ListEntry);
-		ExFreePool(item);
+		AutoLock<LockType> lock(QueueLock);
+
+		// NOTE: here we impose the limitation that only a fixed, maximum
+		// number of events are maintained in the internal queue;
+		// this maximum number may quickly be exhausted, given the number of events we register
+		if (QueueCount > MAX_QUEUE_ITEMS)
+		{
+			// too many items, remove oldest
+			auto head = RemoveHeadList(pQueueHead);
+			QueueCount--;
+			DroppedCount++;
+
+			FreeQueueItem(head);
+		}
+
+		InsertTailList(pQueueHead, entry);
+		QueueCount++;
+
+		// queries are pended under this lock, so none is missed
+		bWaiting = pQueries->Count > 0;
 	}
 
-	InsertTailList(pQueueHead, entry);
-	QueueCount++;
+	// filled by a work item rather than here, as resolving a lazy command
+	// line must not happen inside the notify routine of its own process
+	if (bWaiting)
+	{
+		QueueQueryCompletion();
+	}
 }
 
 // remove all elements from queue and deallocate, under lock
@@ -527,8 +795,223 @@ VOID FlushQueueSafe(const PLIST_ENTRY pQueueHead, LockType& QueueLock)
 	while (!IsListEmpty(pQueueHead))
 	{
 		auto pQueueEntry = RemoveHeadList(pQueueHead);
-		auto pItem = CONTAINING_RECORD(pQueueEntry, QUEUE_ITEM<ItemHeader>, ListEntry);
 
-		ExFreePool(pItem);
+		FreeQueueItem(pQueueEntry);
+	}
+}
+
+// deallocate a queue item, releasing any lazy command line it references
+VOID FreeQueueItem(PLIST_ENTRY entry)
+{
+	auto pItem = CONTAINING_RECORD(entry, QUEUE_ITEM<ItemHeader>, ListEntry);
+
+	if (pItem->CommandLineHandle != INVALID_COMMAND_LINE_HANDLE)
+	{
+		g_GlobalState.CommandLines.Release(pItem->CommandLineHandle);
+	}
+
+	ExFreePool(pItem);
+}
+
+/* ----------------------------------------------------------------------------
+ *	Pending Queries
+ */
+
+// serialize queued events into the query's buffer; the MDL was mapped
+// when the query arrived
+_Use_decl_annotations_
+Tuple<NTSTATUS, ULONG> DrainQuery(PIRP pIrp)
+{
+	auto pIoStackLocation = IoGetCurrentIrpStackLocation(pIrp);
+	auto ControlCode      = pIoStackLocation->Parameters.DeviceIoControl.IoControlCode;
+
+	auto buffer     = static_cast<PUCHAR>(MmGetSystemAddressForMdlSafe(pIrp->MdlAddress, NormalPagePriority));
+	auto bufferSize = pIoStackLocation->Parameters.DeviceIoControl.OutputBufferLength;
+
+	if (IOCTL_SYSMONV2_QUERY_THREAD_EVENTS == ControlCode)
+	{
+		return FlushEventQueueToBufferSafe(
+			&g_GlobalState.ThreadEventQueueHead,
+			g_GlobalState.ThreadEventQueueLock,
+			g_GlobalState.ThreadEventQueueCount,
+			buffer,
+			bufferSize
+		);
+	}
+
+	// the original query always returns command lines
+	BOOLEAN bWantCommandLine = TRUE;
+
+	if (IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX == ControlCode)
+	{
+		auto pRequest = static_cast<QueryRequest*>(pIrp->AssociatedIrp.SystemBuffer);
+		bWantCommandLine = (pRequest->Flags & QUERY_FLAG_COMMAND_LINE) ? TRUE : FALSE;
+	}
+
+	return FlushProcessEventQueueToBufferSafe(
+		&g_GlobalState.ProcessEventQueueHead,
+		g_GlobalState.ProcessEventQueueLock,
+		g_GlobalState.ProcessEventQueueCount,
+		buffer,
+		bufferSize,
+		bWantCommandLine
+	);
+}
+
+// complete pending queries, oldest first, for as long as events remain
+_Use_decl_annotations_
+template<typename LockType>
+VOID FillPendingQueries(
+	PPENDING_QUERIES pQueries,
+	PLIST_ENTRY pQueueHead,
+	LockType& QueueLock)
+{
+	AutoLock<FastMutex> drainer(pQueries->DrainLock);
+
+	while (TRUE)
+	{
+		PIRP pIrp = nullptr;
+
+		{
+			AutoLock<LockType> locker(QueueLock);
+
+			if (IsListEmpty(pQueueHead))
+			{
+				break;
+			}
+
+			// null if every waiting query was cancelled meanwhile
+			pIrp = IoCsqRemoveNextIrp(&pQueries->Csq, nullptr);
+		}
+
+		if (nullptr == pIrp)
+		{
+			break;
+		}
+
+		Tuple<NTSTATUS, ULONG> res = DrainQuery(pIrp);
+
+		pIrp->IoStatus.Status      = res.First();
+		pIrp->IoStatus.Information = res.Second();
+
+		IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+	}
+}
+
+// have the work item fill pending queries, unless it is already queued
+VOID QueueQueryCompletion()
+{
+	if (InterlockedExchange(&g_GlobalState.CompleteQueued, 1) == 0)
+	{
+		IoQueueWorkItem(g_GlobalState.CompleteWorkItem, CompletePendingQueries, DelayedWorkQueue, nullptr);
+	}
+}
+
+// work item routine; runs at PASSIVE_LEVEL in a system thread
+_Use_decl_annotations_
+VOID CompletePendingQueries(PDEVICE_OBJECT pDeviceObject, PVOID pContext)
+{
+	UNREFERENCED_PARAMETER(pDeviceObject);
+	UNREFERENCED_PARAMETER(pContext);
+
+	// cleared first, so a push from here on queues another pass
+	InterlockedExchange(&g_GlobalState.CompleteQueued, 0);
+
+	FillPendingQueries(
+		&g_GlobalState.ProcessQueries,
+		&g_GlobalState.ProcessEventQueueHead,
+		g_GlobalState.ProcessEventQueueLock);
+
+	FillPendingQueries(
+		&g_GlobalState.ThreadQueries,
+		&g_GlobalState.ThreadEventQueueHead,
+		g_GlobalState.ThreadEventQueueLock);
+}
+
+VOID InitializePendingQueries(PPENDING_QUERIES pQueries)
+{
+	InitializeListHead(&pQueries->Head);
+	KeInitializeSpinLock(&pQueries->Lock);
+	pQueries->Count = 0;
+	pQueries->DrainLock.Init();
+
+	IoCsqInitialize(
+		&pQueries->Csq,
+		QueryCsqInsertIrp,
+		QueryCsqRemoveIrp,
+		QueryCsqPeekNextIrp,
+		QueryCsqAcquireLock,
+		QueryCsqReleaseLock,
+		QueryCsqCompleteCanceledIrp);
+}
+
+/* ----------------------------------------------------------------------------
+ *	Cancel-Safe Query Queue Callbacks
+ */
+
+_Use_decl_annotations_
+VOID QueryCsqInsertIrp(PIO_CSQ pCsq, PIRP pIrp)
+{
+	auto pQueries = CONTAINING_RECORD(pCsq, PENDING_QUERIES, Csq);
+
+	InsertTailList(&pQueries->Head, &pIrp->Tail.Overlay.ListEntry);
+	pQueries->Count++;
+}
+
+_Use_decl_annotations_
+VOID QueryCsqRemoveIrp(PIO_CSQ pCsq, PIRP pIrp)
+{
+	auto pQueries = CONTAINING_RECORD(pCsq, PENDING_QUERIES, Csq);
+
+	RemoveEntryList(&pIrp->Tail.Overlay.ListEntry);
+	pQueries->Count--;
+}
+
+// the next IRP after pIrp, or the first; with a file object as the peek
+// context, the next one issued on that handle
+_Use_decl_annotations_
+PIRP QueryCsqPeekNextIrp(PIO_CSQ pCsq, PIRP pIrp, PVOID PeekContext)
+{
+	auto pQueries = CONTAINING_RECORD(pCsq, PENDING_QUERIES, Csq);
+
+	auto pEntry = (nullptr == pIrp) ? pQueries->Head.Flink : pIrp->Tail.Overlay.ListEntry.Flink;
+
+	for (; pEntry != &pQueries->Head; pEntry = pEntry->Flink)
+	{
+		auto pNext = CONTAINING_RECORD(pEntry, IRP, Tail.Overlay.ListEntry);
+
+		if (nullptr == PeekContext || IoGetCurrentIrpStackLocation(pNext)->FileObject == PeekContext)
+		{
+			return pNext;
+		}
 	}
-}
\ No newline at end of file
+
+	return nullptr;
+}
+
+_Use_decl_annotations_
+VOID QueryCsqAcquireLock(PIO_CSQ pCsq, PKIRQL pIrql)
+{
+	auto pQueries = CONTAINING_RECORD(pCsq, PENDING_QUERIES, Csq);
+
+	KeAcquireSpinLock(&pQueries->Lock, pIrql);
+}
+
+_Use_decl_annotations_
+VOID QueryCsqReleaseLock(PIO_CSQ pCsq, KIRQL Irql)
+{
+	auto pQueries = CONTAINING_RECORD(pCsq, PENDING_QUERIES, Csq);
+
+	KeReleaseSpinLock(&pQueries->Lock, Irql);
+}
+
+_Use_decl_annotations_
+VOID QueryCsqCompleteCanceledIrp(PIO_CSQ pCsq, PIRP pIrp)
+{
+	UNREFERENCED_PARAMETER(pCsq);
+
+	pIrp->IoStatus.Status = STATUS_CANCELLED;
+	pIrp->IoStatus.Information = 0;
+
+	IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+}
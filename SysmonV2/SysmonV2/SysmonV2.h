@@ -5,7 +5,9 @@
 
 #include <ntddk.h>
 
+#include "Tuple.h"
 #include "SyncHelpers.h"
+#include "CommandLineCache.h"
 
 // maximum number of items allowed in the queue
 constexpr auto MAX_QUEUE_ITEMS = 512;
@@ -13,6 +15,18 @@ constexpr auto MAX_QUEUE_ITEMS = 512;
 // tag for dynamic allocations
 constexpr ULONG SYSMONV2_ALLOC_TAG = 0x13371337;
 
+// overlapped queries waiting for events on one of the event queues;
+// pended while the queue is empty and filled, oldest first, once events
+// arrive
+typedef struct _PENDING_QUERIES
+{
+	IO_CSQ     Csq;
+	LIST_ENTRY Head;
+	KSPIN_LOCK Lock;
+	LONG       Count;
+	FastMutex  DrainLock;  // one drain at a time, so queries complete in event order
+} PENDING_QUERIES, *PPENDING_QUERIES;
+
 // global state manager
 typedef struct _GLOBAL_STATE
 {
@@ -20,8 +34,19 @@ typedef struct _GLOBAL_STATE
 	LIST_ENTRY ThreadEventQueueHead;
 	ULONG      ProcessEventQueueCount;
 	ULONG      ThreadEventQueueCount;
+	ULONGLONG  ProcessEventQueueDropped;
+	ULONGLONG  ThreadEventQueueDropped;
 	FastMutex  ProcessEventQueueLock;
 	FastMutex  ThreadEventQueueLock;
+	ULONG      CaptureFlags;
+	CommandLineCache CommandLines;
+
+	// pending queries are filled at PASSIVE_LEVEL by a work item queued
+	// from the push path; at most one is queued at a time
+	PENDING_QUERIES ProcessQueries;
+	PENDING_QUERIES ThreadQueries;
+	PIO_WORKITEM    CompleteWorkItem;
+	LONG            CompleteQueued;
 } GLOBAL_STATE, *PGLOBAL_STATE;
 
 // generic queue item
@@ -29,6 +54,7 @@ template <typename T>
 struct QUEUE_ITEM
 {
 	LIST_ENTRY ListEntry;
+	ULONG      CommandLineHandle;  // lazy command line, never copied out
 	T          Data;
 };
 
@@ -45,6 +71,10 @@ _Dispatch_type_(IRP_MJ_CLOSE)
 _Function_class_(DRIVER_DISPATCH)
 NTSTATUS DispatchClose(PDEVICE_OBJECT pDeviceObject, PIRP pIrp);
 
+_Dispatch_type_(IRP_MJ_CLEANUP)
+_Function_class_(DRIVER_DISPATCH)
+NTSTATUS DispatchCleanup(PDEVICE_OBJECT pDeviceObject, PIRP pIrp);
+
 _Dispatch_type_(IRP_MJ_DEVICE_CONTROL)
 _Function_class_(DRIVER_DISPATCH)
 NTSTATUS DispatchDeviceIoControl(PDEVICE_OBJECT pDeviceObject, PIRP pIrp);
@@ -54,8 +84,8 @@ VOID OnProcessNotify(
 	HANDLE ProcessId, 
 	PPS_CREATE_NOTIFY_INFO pCreateInfo);
 
-VOID HandleProcessCreate(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo);
-VOID HandleProcessExit(HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo);
+VOID HandleProcessCreate(PEPROCESS pProcess, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo);
+VOID HandleProcessExit(PEPROCESS pProcess, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO pCreateInfo);
 
 VOID OnThreadNotify(HANDLE ProcessId, HANDLE ThreadId, BOOLEAN bCreate);
 
@@ -71,12 +101,24 @@ Tuple<NTSTATUS, ULONG> FlushEventQueueToBufferSafe(
 	PUCHAR buffer,
 	ULONG bufferSize);
 
+_Requires_lock_not_held_(QueueLock)
+template<typename LockType>
+Tuple<NTSTATUS, ULONG> FlushProcessEventQueueToBufferSafe(
+	PLIST_ENTRY pQueueHead,
+	LockType& QueueLock,
+	ULONG& QueueCount,
+	PUCHAR buffer,
+	ULONG bufferSize,
+	BOOLEAN bWantCommandLine);
+
 _Requires_lock_not_held_(QueueLock)
 template <typename LockType>
 VOID PushQueueSafe(
 	PLIST_ENTRY pQueueHead,
 	LockType& QueueLock,
 	ULONG& QueueCount,
+	ULONGLONG& DroppedCount,
+	PPENDING_QUERIES pQueries,
 	PLIST_ENTRY entry);
 
 _Requires_lock_not_held_(QueueLock)
@@ -84,3 +126,27 @@ template<typename LockType>
 VOID FlushQueueSafe(
 	const PLIST_ENTRY pQueueHead, 
 	LockType& QueueLock);
+
+VOID FreeQueueItem(PLIST_ENTRY entry);
+
+Tuple<NTSTATUS, ULONG> DrainQuery(PIRP pIrp);
+
+_Requires_lock_not_held_(QueueLock)
+template<typename LockType>
+VOID FillPendingQueries(
+	PPENDING_QUERIES pQueries,
+	PLIST_ENTRY pQueueHead,
+	LockType& QueueLock);
+
+VOID QueueQueryCompletion();
+
+VOID CompletePendingQueries(PDEVICE_OBJECT pDeviceObject, PVOID pContext);
+
+VOID InitializePendingQueries(PPENDING_QUERIES pQueries);
+
+VOID QueryCsqInsertIrp(PIO_CSQ pCsq, PIRP pIrp);
+VOID QueryCsqRemoveIrp(PIO_CSQ pCsq, PIRP pIrp);
+PIRP QueryCsqPeekNextIrp(PIO_CSQ pCsq, PIRP pIrp, PVOID PeekContext);
+VOID QueryCsqAcquireLock(PIO_CSQ pCsq, PKIRQL pIrql);
+VOID QueryCsqReleaseLock(PIO_CSQ pCsq, KIRQL Irql);
+VOID QueryCsqCompleteCanceledIrp(PIO_CSQ pCsq, PIRP pIrp);
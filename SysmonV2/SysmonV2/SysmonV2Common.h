@@ -12,6 +12,36 @@
 
 #define IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS CTL_CODE(SYSMONV2_DEVICE, 0x800, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
 #define IOCTL_SYSMONV2_QUERY_THREAD_EVENTS CTL_CODE(SYSMONV2_DEVICE, 0x801, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX CTL_CODE(SYSMONV2_DEVICE, 0x802, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_SYSMONV2_SET_CAPTURE_MODE CTL_CODE(SYSMONV2_DEVICE, 0x803, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SYSMONV2_QUERY_STATS CTL_CODE(SYSMONV2_DEVICE, 0x804, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// capture flags for IOCTL_SYSMONV2_SET_CAPTURE_MODE
+constexpr ULONG CAPTURE_FLAG_LAZY_COMMAND_LINE = 0x1;  // defer command line copy to drain
+
+// query flags for IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX
+constexpr ULONG QUERY_FLAG_COMMAND_LINE = 0x1;  // include command lines in results
+
+// input to IOCTL_SYSMONV2_SET_CAPTURE_MODE
+struct CaptureModeRequest
+{
+	ULONG Flags;
+};
+
+// input to IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX
+struct QueryRequest
+{
+	ULONG Flags;
+};
+
+// output of IOCTL_SYSMONV2_QUERY_STATS; counts since the driver loaded
+struct QueueStats
+{
+	ULONG     ProcessQueueDepth;
+	ULONG     ThreadQueueDepth;
+	ULONGLONG ProcessEventsDropped;  // oldest items discarded from a full queue
+	ULONGLONG ThreadEventsDropped;
+};
 
 
 enum class ItemType : USHORT
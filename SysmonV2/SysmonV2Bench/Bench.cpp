@@ -0,0 +1,49 @@
+// Bench.cpp
+// Host-side checks and benchmarks for the SysmonV2 client.
+
+#include <cstdio>
+#include <cstring>
+
+#include "Bench.h"
+
+struct BenchCommand {
+	const char* Name;
+	int (*Run)(int argc, char* argv[]);
+	const char* Description;
+};
+
+const BenchCommand Commands[] = {
+	{ "capture", RunCaptureBench, "capture round trip checks, write throughput and time-range query latency" },
+	{ "encoding", RunEncodingBench, "UTF-16 to UTF-8 equivalence fuzzing, SSE2 against scalar throughput" },
+	{ "follow", RunFollowBench, "K outstanding queries against a stand-in driver that pends them until events arrive" },
+	{ "hitters", RunHittersBench, "count-min and top-K accuracy against exact counts on a Zipf stream, throughput" },
+	{ "index", RunIndexBench, "secondary index size and the query speedup from chunk pruning" },
+	{ "metrics", RunMetricsBench, "pipeline throughput with and without counting and exporting metrics once a second" },
+	{ "query", RunQueryBench, "query engine scaling from 1 thread to every hardware thread" },
+	{ "tree", RunTreeBench, "process tree checks, throughput with PID reuse and eviction, ancestry queries" },
+	{ "window", RunWindowBench, "window counts against a recount, per-event cost as the window grows" },
+};
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 2)
+	{
+		for (const auto& command : Commands)
+		{
+			if (0 == ::strcmp(argv[1], command.Name))
+				return command.Run(argc - 2, argv + 2);
+		}
+	}
+
+	printf("usage: %s <command> [options]\n", argc > 0 ? argv[0] : "SysmonV2Bench");
+	for (const auto& command : Commands)
+	{
+		printf("  %-10s %s\n", command.Name, command.Description);
+	}
+
+	return 1;
+}
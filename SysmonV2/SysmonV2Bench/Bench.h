@@ -0,0 +1,25 @@
+// Bench.h
+// Host-side checks and benchmarks for the SysmonV2 client.
+
+#pragma once
+
+#include <chrono>
+
+typedef std::chrono::steady_clock BenchClock;
+
+inline double SecondsSince(BenchClock::time_point start)
+{
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// each returns the process exit code, nonzero if a check failed; argv
+// excludes the command name
+int RunCaptureBench(int argc, char* argv[]);
+int RunEncodingBench(int argc, char* argv[]);
+int RunFollowBench(int argc, char* argv[]);
+int RunHittersBench(int argc, char* argv[]);
+int RunIndexBench(int argc, char* argv[]);
+int RunMetricsBench(int argc, char* argv[]);
+int RunQueryBench(int argc, char* argv[]);
+int RunTreeBench(int argc, char* argv[]);
+int RunWindowBench(int argc, char* argv[]);
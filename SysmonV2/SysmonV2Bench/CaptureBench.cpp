@@ -0,0 +1,402 @@
+// CaptureBench.cpp
+// Columnar capture checks and benchmarks.
+//
+// Checks first: synthetic events are written with small chunks and a
+// time gap wide enough to force an early chunk break, then read back
+// column by column and compared with what went in. A capture cut off
+// inside its last chunk must open with every earlier chunk recovered,
+// and one whose chunks sit off their 8-byte boundaries must be rejected.
+//
+// Then write throughput through CaptureWriter, and the latency of
+// time-range queries of several widths through the memory-mapped reader:
+// chunk selection from the directory, then a scan of the time column of
+// every selected chunk.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "Bench.h"
+#include "Synthetic.h"
+#include "CaptureReader.h"
+#include "CaptureWriter.h"
+#include "TextEncoding.h"
+
+/* ----------------------------------------------------------------------------
+ *	Checks
+ */
+
+static BOOL ReadWholeFile(const char* path, std::vector<char>& data)
+{
+	auto file = OpenStdioFile(path, "rb");
+	if (nullptr == file)
+	{
+		return FALSE;
+	}
+
+	data.clear();
+
+	char block[1 << 16];
+	size_t read;
+	while ((read = fread(block, 1, sizeof(block), file)) > 0)
+	{
+		data.insert(data.end(), block, block + read);
+	}
+
+	fclose(file);
+	return TRUE;
+}
+
+static BOOL WriteWholeFile(const char* path, const char* data, size_t size)
+{
+	auto file = OpenStdioFile(path, "wb");
+	if (nullptr == file)
+	{
+		return FALSE;
+	}
+
+	const auto written = fwrite(data, 1, size, file);
+	return (0 == fclose(file)) && written == size;
+}
+
+// every event read back equals the one written, in order
+static BOOL CheckRoundTrip(const char* path, const std::vector<EventRecord>& records, size_t& chunks)
+{
+	CaptureReader reader;
+	if (!reader.Open(path))
+	{
+		printf("FAILED: cannot open %s\n", path);
+		return FALSE;
+	}
+
+	chunks = reader.ChunkCount();
+
+	std::string expected;
+	size_t next = 0;
+
+	for (size_t i = 0; i < reader.ChunkCount(); ++i)
+	{
+		CaptureChunk chunk;
+		if (!reader.Chunk(i, chunk))
+		{
+			printf("FAILED: chunk %zu rejected\n", i);
+			return FALSE;
+		}
+
+		for (ULONG row = 0; row < chunk.EventCount; ++row, ++next)
+		{
+			if (next >= records.size())
+			{
+				printf("FAILED: more events read than written\n");
+				return FALSE;
+			}
+
+			const auto& record = records[next];
+
+			expected.clear();
+			AppendUtf8(expected, record.CommandLine, record.CommandLineLength);
+
+			ULONG length = 0;
+			const auto commandLine = chunk.CommandLine(row, length);
+
+			if (chunk.Type[row] != static_cast<UCHAR>(record.Type)
+				|| chunk.Time(row) != record.Time
+				|| chunk.ProcessId[row] != record.ProcessId
+				|| chunk.ThreadId[row] != record.ThreadId
+				|| chunk.ParentProcessId[row] != record.ParentProcessId
+				|| length != expected.size()
+				|| (length > 0 && 0 != std::memcmp(commandLine, expected.data(), length)))
+			{
+				printf("FAILED: event %zu differs after the round trip\n", next);
+				return FALSE;
+			}
+		}
+	}
+
+	if (next != records.size())
+	{
+		printf("FAILED: %zu events read back, %zu written\n", next, records.size());
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL RunChecks(const char* path)
+{
+	SyntheticOptions options;
+	options.Events = 200000;
+
+	SyntheticEvents events{ options };
+	auto records = events.Records();
+
+	// a gap the 32-bit time deltas cannot span ends a chunk early
+	for (size_t i = records.size() / 2; i < records.size(); ++i)
+	{
+		records[i].Time += CAPTURE_MAX_CHUNK_SPAN + 1;
+	}
+
+	if (!WriteSyntheticCapture(path, records, FALSE, 4096))
+	{
+		printf("FAILED: cannot write %s\n", path);
+		return FALSE;
+	}
+
+	size_t chunks = 0;
+	if (!CheckRoundTrip(path, records, chunks))
+	{
+		return FALSE;
+	}
+
+	printf("round trip: %zu events in %zu chunks\n", records.size(), chunks);
+
+	std::vector<char> data;
+	if (!ReadWholeFile(path, data))
+	{
+		printf("FAILED: cannot read %s\n", path);
+		return FALSE;
+	}
+
+	CaptureTrailer trailer;
+	std::memcpy(&trailer, data.data() + data.size() - sizeof(trailer), sizeof(trailer));
+
+	CaptureChunkFooter last;
+	std::memcpy(&last, data.data() + trailer.DirectoryOffset + (trailer.ChunkCount - 1) * sizeof(last), sizeof(last));
+
+	const auto damaged = std::string(path) + ".damaged";
+
+	// cut inside the last chunk: the directory is gone, and the chunks
+	// before it must be found by walking from the front
+	if (!WriteWholeFile(damaged.c_str(), data.data(), static_cast<size_t>(last.ChunkOffset + 64)))
+	{
+		printf("FAILED: cannot write %s\n", damaged.c_str());
+		return FALSE;
+	}
+
+	{
+		CaptureReader reader;
+		CaptureChunk chunk;
+
+		if (!reader.Open(damaged.c_str()) || reader.ChunkCount() != chunks - 1 || !reader.Chunk(chunks - 2, chunk))
+		{
+			printf("FAILED: truncated capture did not recover %zu chunks\n", chunks - 1);
+			return FALSE;
+		}
+	}
+
+	printf("truncated capture: %zu of %zu chunks recovered\n", chunks - 1, chunks);
+
+	// shift everything after the file header by 4 bytes, fixing up the
+	// directory to match, so every chunk is intact but misaligned
+	std::vector<char> shifted(data.begin(), data.begin() + sizeof(CaptureFileHeader));
+	shifted.resize(shifted.size() + 4, 0);
+	shifted.insert(shifted.end(), data.begin() + sizeof(CaptureFileHeader), data.end());
+
+	const auto directory = shifted.data() + trailer.DirectoryOffset + 4;
+	for (ULONG i = 0; i < trailer.ChunkCount; ++i)
+	{
+		CaptureChunkFooter footer;
+		std::memcpy(&footer, directory + i * sizeof(footer), sizeof(footer));
+		footer.ChunkOffset += 4;
+		std::memcpy(directory + i * sizeof(footer), &footer, sizeof(footer));
+	}
+
+	trailer.DirectoryOffset += 4;
+	std::memcpy(shifted.data() + shifted.size() - sizeof(trailer), &trailer, sizeof(trailer));
+
+	if (!WriteWholeFile(damaged.c_str(), shifted.data(), shifted.size()))
+	{
+		printf("FAILED: cannot write %s\n", damaged.c_str());
+		return FALSE;
+	}
+
+	{
+		CaptureReader reader;
+		CaptureChunk chunk;
+
+		if (!reader.Open(damaged.c_str()) || reader.ChunkCount() != chunks)
+		{
+			printf("FAILED: misaligned capture did not open\n");
+			return FALSE;
+		}
+
+		for (size_t i = 0; i < reader.ChunkCount(); ++i)
+		{
+			if (reader.Chunk(i, chunk))
+			{
+				printf("FAILED: misaligned chunk %zu accepted\n", i);
+				return FALSE;
+			}
+		}
+	}
+
+	printf("misaligned capture: all %zu chunks rejected\n", chunks);
+
+	std::remove(damaged.c_str());
+	return TRUE;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Benchmarks
+ */
+
+// events within [from, to], by directory lookup and a time column scan
+static ULONGLONG CountRange(const CaptureReader& reader, LONGLONG from, LONGLONG to, std::vector<size_t>& chunks)
+{
+	ULONGLONG count = 0;
+
+	chunks.clear();
+	reader.FindChunks(from, to, chunks);
+
+	for (auto index : chunks)
+	{
+		CaptureChunk chunk;
+		if (!reader.Chunk(index, chunk))
+		{
+			continue;
+		}
+
+		for (ULONG row = 0; row < chunk.EventCount; ++row)
+		{
+			const auto time = chunk.Time(row);
+			count += (time >= from && time <= to) ? 1 : 0;
+		}
+	}
+
+	return count;
+}
+
+static BOOL RunWriteBench(const char* path, const std::vector<EventRecord>& records)
+{
+	CaptureWriter writer;
+	if (!writer.Open(path))
+	{
+		printf("FAILED: cannot write %s\n", path);
+		return FALSE;
+	}
+
+	const auto start = BenchClock::now();
+
+	writer.Consume(records.data(), records.size());
+
+	if (!writer.Close())
+	{
+		printf("FAILED: cannot finish %s\n", path);
+		return FALSE;
+	}
+
+	const auto seconds = SecondsSince(start);
+
+	printf("\nwrite: %llu events, %.1f MB in %.2f s: %.2f M events/s, %.1f MB/s\n",
+		static_cast<unsigned long long>(writer.EventsWritten()),
+		writer.BytesWritten() / 1e6, seconds,
+		writer.EventsWritten() / seconds / 1e6, writer.BytesWritten() / seconds / 1e6);
+
+	return TRUE;
+}
+
+static BOOL RunQueryBench(const char* path, unsigned queries)
+{
+	CaptureReader reader;
+	if (!reader.Open(path) || 0 == reader.ChunkCount())
+	{
+		printf("FAILED: cannot open %s\n", path);
+		return FALSE;
+	}
+
+	const auto first = reader.Footer(0).MinTime;
+	const auto last  = reader.Footer(reader.ChunkCount() - 1).MaxTime;
+
+	printf("\ntime-range queries over %zu chunks, %.0f s of events, %u queries per width\n",
+		reader.ChunkCount(), (last - first) / 1e7, queries);
+	printf("%10s %10s %12s %10s %10s %10s\n", "width", "chunks", "events", "p50 us", "p99 us", "max us");
+
+	const LONGLONG widths[] = { 10000, 10000000, 100000000, 600000000, last - first };
+	const char* names[] = { "1 ms", "1 s", "10 s", "1 min", "all" };
+
+	std::mt19937 random(7);
+	std::vector<size_t> chunks;
+	std::vector<double> latencies;
+
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w)
+	{
+		const auto width = std::min(widths[w], last - first);
+		const auto span = static_cast<ULONGLONG>(last - first - width) + 1;
+
+		ULONGLONG chunkTotal = 0;
+		ULONGLONG eventTotal = 0;
+
+		latencies.clear();
+
+		for (unsigned q = 0; q < queries; ++q)
+		{
+			const auto from = first + static_cast<LONGLONG>(((static_cast<ULONGLONG>(random()) << 32) | random()) % span);
+
+			const auto start = BenchClock::now();
+			eventTotal += CountRange(reader, from, from + width, chunks);
+			latencies.push_back(SecondsSince(start) * 1e6);
+
+			chunkTotal += chunks.size();
+		}
+
+		std::sort(latencies.begin(), latencies.end());
+
+		printf("%10s %10.1f %12.0f %10.1f %10.1f %10.1f\n", names[w],
+			static_cast<double>(chunkTotal) / queries, static_cast<double>(eventTotal) / queries,
+			latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+	}
+
+	return TRUE;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+// SysmonV2Bench capture [--events N] [--queries N] [--path FILE]
+int RunCaptureBench(int argc, char* argv[])
+{
+	SyntheticOptions options;
+	options.Events = 5000000;
+
+	unsigned queries = 200;
+	const char* path = "SysmonV2Bench.cap";
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--events"))
+			options.Events = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (0 == ::strcmp(argv[i], "--queries"))
+			queries = static_cast<unsigned>(std::strtoul(argv[i + 1], nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--path"))
+			path = argv[i + 1];
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == options.Events || 0 == queries)
+	{
+		printf("events and queries must be positive\n");
+		return 1;
+	}
+
+	if (!RunChecks(path))
+	{
+		return 1;
+	}
+
+	SyntheticEvents events{ options };
+
+	if (!RunWriteBench(path, events.Records()) || !RunQueryBench(path, queries))
+	{
+		return 1;
+	}
+
+	std::remove(path);
+	return 0;
+}
@@ -0,0 +1,196 @@
+// EncodingBench.cpp
+// UTF-16 to UTF-8 conversion: vectorized against scalar.
+//
+// Checks first: random strings mixing ASCII, two- and three-byte code
+// points and paired and unpaired surrogates, at every starting offset
+// within a 16-byte vector, must convert to the same bytes through
+// Utf16ToUtf8 and Utf16ToUtf8Scalar, and IsValidUtf16 must agree with a
+// one-unit-at-a-time surrogate check.
+//
+// Then the throughput of both converters over command-line sized strings
+// with ASCII shares from 100% down to none.
+
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "Bench.h"
+#include "TextEncoding.h"
+
+/* ----------------------------------------------------------------------------
+ *	Checks
+ */
+
+static BOOL IsValidUtf16Reference(const WCHAR* source, size_t length)
+{
+	for (size_t i = 0; i < length; ++i)
+	{
+		const auto unit = static_cast<ULONG>(source[i]);
+
+		if (unit >= 0xD800 && unit <= 0xDBFF && i + 1 < length && (source[i + 1] & 0xFC00) == 0xDC00)
+		{
+			++i;
+		}
+		else if ((unit & 0xF800) == 0xD800)
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL RunChecks(size_t strings)
+{
+	std::mt19937 random(1);
+
+	// room for the longest string at the largest offset
+	std::vector<WCHAR> source(8 + 512);
+	std::vector<char> vectorized(Utf8Capacity(source.size()));
+	std::vector<char> scalar(Utf8Capacity(source.size()));
+
+	std::string appended;
+
+	for (size_t n = 0; n < strings; ++n)
+	{
+		const auto length = random() % 512;
+		const auto offset = n % 8;
+		const auto mostlyAscii = (random() % 4) == 0;
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			const auto roll = random() % 100;
+			WCHAR unit;
+
+			if (mostlyAscii || roll < 80)
+				unit = static_cast<WCHAR>(0x20 + random() % 95);
+			else if (roll < 88)
+				unit = static_cast<WCHAR>(0x80 + random() % 0x780);
+			else if (roll < 94)
+				unit = static_cast<WCHAR>(0xD800 + random() % 0x800);
+			else
+				unit = static_cast<WCHAR>(0x800 + random() % 0xF000);
+
+			source[offset + i] = unit;
+		}
+
+		const auto text = source.data() + offset;
+		const auto vectorizedSize = Utf16ToUtf8(text, length, vectorized.data());
+		const auto scalarSize = Utf16ToUtf8Scalar(text, length, scalar.data());
+
+		if (vectorizedSize != scalarSize || 0 != std::memcmp(vectorized.data(), scalar.data(), scalarSize))
+		{
+			printf("FAILED: string %zu (%zu units at offset %zu) converts differently\n", n, length, offset);
+			return FALSE;
+		}
+
+		appended.clear();
+		AppendUtf8(appended, text, length);
+
+		if (appended.size() != scalarSize || 0 != std::memcmp(appended.data(), scalar.data(), scalarSize))
+		{
+			printf("FAILED: string %zu appends differently\n", n);
+			return FALSE;
+		}
+
+		if (IsValidUtf16(text, length) != IsValidUtf16Reference(text, length))
+		{
+			printf("FAILED: string %zu validity differs\n", n);
+			return FALSE;
+		}
+	}
+
+	printf("%zu random strings convert identically at every offset\n", strings);
+	return TRUE;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Benchmark
+ */
+
+typedef size_t (*Utf16ToUtf8Routine)(const WCHAR* source, size_t length, char* out);
+
+// GB/s of UTF-16 input through convert, length units at a time
+static double MeasureConversion(Utf16ToUtf8Routine convert, const std::vector<WCHAR>& input, size_t length, std::vector<char>& output)
+{
+	const int passes = 20;
+	size_t total = 0;
+
+	const auto start = BenchClock::now();
+
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		for (size_t offset = 0; offset + length <= input.size(); offset += length)
+		{
+			total += convert(input.data() + offset, length, output.data());
+		}
+	}
+
+	const auto seconds = SecondsSince(start);
+
+	// keep the conversions from being optimized away
+	if (0 == total && !input.empty())
+	{
+		printf("(no output)\n");
+	}
+
+	return passes * (input.size() / length) * length * sizeof(WCHAR) / seconds / 1e9;
+}
+
+// SysmonV2Bench encoding [--strings N] [--length N]
+int RunEncodingBench(int argc, char* argv[])
+{
+	size_t strings = 200000;
+	size_t length = 120;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		const auto value = std::strtoull(argv[i + 1], nullptr, 10);
+
+		if (0 == ::strcmp(argv[i], "--strings"))
+			strings = value;
+		else if (0 == ::strcmp(argv[i], "--length"))
+			length = value;
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == strings || 0 == length || length > 32768)
+	{
+		printf("strings must be positive, length 1 to 32768\n");
+		return 1;
+	}
+
+	if (!RunChecks(strings))
+	{
+		return 1;
+	}
+
+	printf("\n%zu-unit strings, GB/s of UTF-16 in\n", length);
+	printf("%8s %10s %10s %8s\n", "ascii", "scalar", "sse2", "speedup");
+
+	std::mt19937 random(2);
+	std::vector<WCHAR> input(1 << 20);
+	std::vector<char> output(Utf8Capacity(length));
+
+	const unsigned shares[] = { 100, 98, 90, 50, 0 };
+
+	for (auto share : shares)
+	{
+		for (auto& unit : input)
+		{
+			unit = static_cast<WCHAR>((random() % 100 < share) ? 0x20 + random() % 95 : 0x400 + random() % 0x100);
+		}
+
+		const auto scalar = MeasureConversion(Utf16ToUtf8Scalar, input, length, output);
+		const auto vectorized = MeasureConversion(Utf16ToUtf8, input, length, output);
+
+		printf("%7u%% %10.2f %10.2f %8.2f\n", share, scalar, vectorized, vectorized / scalar);
+	}
+
+	return 0;
+}
@@ -0,0 +1,364 @@
+// FollowBench.cpp
+// Following a live event stream with K queries outstanding.
+//
+// The reader runs against a stand-in for the driver: a producer thread
+// pushes thread events into a bounded queue at a fixed offered rate,
+// dropping the oldest past the cap as the driver does. Queries arriving
+// while the queue is empty, or behind queries already waiting, are pended
+// and completed oldest first as events are pushed; the driver does that
+// from a work item, the stand-in from the producer. A consumer stage
+// spends a fixed cost per event, standing in for formatting.
+//
+// For K from 1 to 16 and a few offered rates, the report gives events
+// consumed per second, events dropped, completions and how long the
+// oldest event of each completion waited in the queue. Every event
+// offered must be consumed, dropped or still queued at the end, and no
+// query may complete empty.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Bench.h"
+#include "OverlappedReader.h"
+
+/* ----------------------------------------------------------------------------
+ *	Stand-in Driver
+ */
+
+class StandInPort : public QueryPort
+{
+public:
+	explicit StandInPort(ULONGLONG capacity)
+		: m_Capacity(capacity),
+		m_Queued(0),
+		m_Dropped(0),
+		m_Waits(0),
+		m_WaitSeconds(0)
+	{
+		ThreadCreateItem item{};
+		item.Type      = ItemType::ThreadCreate;
+		item.Size      = sizeof(item);
+		item.ProcessId = 4;
+		item.ThreadId  = 8;
+
+		m_Item.assign(reinterpret_cast<const UCHAR*>(&item), reinterpret_cast<const UCHAR*>(&item) + sizeof(item));
+	}
+
+	BOOL Submit(PendingQuery& request) override
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+
+		// pend with nothing queued, or behind queries already waiting
+		if (0 == m_Queued || !m_Pending.empty())
+		{
+			m_Pending.push_back(&request);
+			return TRUE;
+		}
+
+		Fill(request, BenchClock::now());
+		return TRUE;
+	}
+
+	PendingQuery* WaitCompletion(ULONG timeoutMs, ULONG& bytes, BOOL& bSuccess) override
+	{
+		std::unique_lock<std::mutex> lock(m_Lock);
+
+		if (!m_Ready.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() { return !m_Done.empty(); }))
+		{
+			return nullptr;
+		}
+
+		const auto done = m_Done.front();
+		m_Done.pop_front();
+
+		bytes    = done.Bytes;
+		bSuccess = done.bSuccess;
+		return done.Request;
+	}
+
+	VOID CancelAll() override
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+
+		for (auto request : m_Pending)
+		{
+			m_Done.push_back(Completion{ request, 0, FALSE });
+		}
+
+		m_Pending.clear();
+		m_Ready.notify_all();
+	}
+
+	// producer side: queue count events, then fill waiting queries
+	VOID Push(ULONGLONG count)
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+
+		const auto now = BenchClock::now();
+
+		m_Bursts.push_back(Burst{ now, count });
+		m_Queued += count;
+
+		// too many items, drop the oldest
+		while (m_Queued > m_Capacity)
+		{
+			auto& oldest = m_Bursts.front();
+			const auto drop = std::min(oldest.Count, m_Queued - m_Capacity);
+
+			oldest.Count -= drop;
+			m_Queued     -= drop;
+			m_Dropped    += drop;
+
+			if (0 == oldest.Count)
+			{
+				m_Bursts.pop_front();
+			}
+		}
+
+		while (m_Queued > 0 && !m_Pending.empty())
+		{
+			auto request = m_Pending.front();
+			m_Pending.pop_front();
+
+			Fill(*request, now);
+		}
+	}
+
+	ULONGLONG Queued() const { return m_Queued; }
+	ULONGLONG Dropped() const { return m_Dropped; }
+
+	// mean time the oldest event of a completion spent queued
+	double MeanWaitSeconds() const
+	{
+		return m_Waits > 0 ? m_WaitSeconds / m_Waits : 0;
+	}
+
+private:
+	struct Burst
+	{
+		BenchClock::time_point Time;
+		ULONGLONG              Count;
+	};
+
+	struct Completion
+	{
+		PendingQuery* Request;
+		ULONG         Bytes;
+		BOOL          bSuccess;
+	};
+
+	// copy as many queued events as fit; called with the lock held
+	VOID Fill(PendingQuery& request, BenchClock::time_point now)
+	{
+		const auto fit  = request.Buffer->Data.size() / m_Item.size();
+		const auto take = std::min<ULONGLONG>(m_Queued, fit);
+
+		m_WaitSeconds += std::chrono::duration<double>(now - m_Bursts.front().Time).count();
+		m_Waits++;
+
+		for (ULONGLONG i = 0; i < take; ++i)
+		{
+			std::memcpy(request.Buffer->Data.data() + i * m_Item.size(), m_Item.data(), m_Item.size());
+		}
+
+		for (auto remaining = take; remaining > 0;)
+		{
+			auto& oldest = m_Bursts.front();
+			const auto used = std::min(oldest.Count, remaining);
+
+			oldest.Count -= used;
+			remaining    -= used;
+
+			if (0 == oldest.Count)
+			{
+				m_Bursts.pop_front();
+			}
+		}
+
+		m_Queued -= take;
+
+		m_Done.push_back(Completion{ &request, static_cast<ULONG>(take * m_Item.size()), TRUE });
+		m_Ready.notify_one();
+	}
+
+	std::mutex                m_Lock;
+	std::condition_variable   m_Ready;
+	std::deque<PendingQuery*> m_Pending;
+	std::deque<Completion>    m_Done;
+	std::deque<Burst>         m_Bursts;
+	std::vector<UCHAR>        m_Item;
+	ULONGLONG                 m_Capacity;
+	ULONGLONG                 m_Queued;
+	ULONGLONG                 m_Dropped;
+	ULONGLONG                 m_Waits;
+	double                    m_WaitSeconds;
+};
+
+// counts events, spending costNs on each as formatting would
+class CostlyConsumer : public RecordConsumer
+{
+public:
+	explicit CostlyConsumer(ULONG costNs)
+		: m_CostNs(costNs),
+		m_Events(0)
+	{}
+
+	VOID Consume(const EventRecord*, size_t count) override
+	{
+		m_Events += count;
+
+		const auto until = BenchClock::now() + std::chrono::nanoseconds(count * m_CostNs);
+		while (BenchClock::now() < until)
+		{
+		}
+	}
+
+	ULONGLONG Events() const { return m_Events; }
+
+private:
+	ULONG                  m_CostNs;
+	std::atomic<ULONGLONG> m_Events;
+};
+
+/* ----------------------------------------------------------------------------
+ *	Benchmark
+ */
+
+// the driver's MAX_QUEUE_ITEMS
+constexpr ULONGLONG FOLLOW_QUEUE_CAPACITY = 20000;
+
+// how often the producer pushes a burst
+constexpr auto FOLLOW_BURST_INTERVAL = std::chrono::microseconds(100);
+
+// SysmonV2Bench follow [--seconds N] [--rate N] [--cost NS] [--buffer BYTES]
+int RunFollowBench(int argc, char* argv[])
+{
+	double seconds = 1;
+	ULONGLONG rate = 4000000;
+	ULONG cost = 40;
+	size_t bufferSize = 1 << 16;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--seconds"))
+			seconds = std::strtod(argv[i + 1], nullptr);
+		else if (0 == ::strcmp(argv[i], "--rate"))
+			rate = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (0 == ::strcmp(argv[i], "--cost"))
+			cost = static_cast<ULONG>(std::strtoul(argv[i + 1], nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--buffer"))
+			bufferSize = std::strtoull(argv[i + 1], nullptr, 10);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (seconds <= 0 || 0 == rate || bufferSize < sizeof(ThreadCreateItem))
+	{
+		printf("seconds and rate must be positive, buffer at least one event\n");
+		return 1;
+	}
+
+	// an idle host, a busy one, and the given rate
+	const ULONGLONG rates[] = { 10000, rate / 10, rate };
+	const size_t depths[] = { 1, 2, 4, 8, 16 };
+
+	printf("%zu-byte buffers, %u ns per event consumed, %llu-event driver queue\n",
+		bufferSize, cost, static_cast<unsigned long long>(FOLLOW_QUEUE_CAPACITY));
+	printf("%10s %4s %12s %12s %12s %12s %10s\n", "offered/s", "K", "consumed/s", "dropped", "completions", "events each", "wait us");
+
+	int result = 0;
+
+	for (auto offered : rates)
+	{
+		// bursts keep the offered rate whatever the interval
+		const auto perBurst = offered * FOLLOW_BURST_INTERVAL.count() / 1000000.0;
+
+		for (auto depth : depths)
+		{
+			StandInPort port{ FOLLOW_QUEUE_CAPACITY };
+			CostlyConsumer consumer{ cost };
+
+			// depth buffers in flight, and a few being decoded and consumed
+			EventPipeline pipeline{ depth + 4, bufferSize };
+			pipeline.AddConsumer(consumer);
+
+			OverlappedReader reader{ pipeline, port, depth, 0 };
+			std::atomic<bool> stop{ false };
+			ULONGLONG produced = 0;
+
+			pipeline.Start();
+
+			std::thread producer([&]()
+			{
+				auto next = BenchClock::now();
+				double owed = 0;
+
+				while (!stop)
+				{
+					next += FOLLOW_BURST_INTERVAL;
+					std::this_thread::sleep_until(next);
+
+					owed += perBurst;
+
+					const auto count = static_cast<ULONGLONG>(owed);
+					if (count > 0)
+					{
+						owed -= count;
+						produced += count;
+						port.Push(count);
+					}
+				}
+			});
+
+			BOOL bSuccess = TRUE;
+			std::thread readerThread([&]()
+			{
+				bSuccess = reader.Run(stop);
+			});
+
+			std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+
+			stop = true;
+			readerThread.join();
+			producer.join();
+			pipeline.Stop();
+
+			const auto& stats = reader.Stats();
+			const auto consumed = consumer.Events();
+			const auto filled = stats.Completions - stats.EmptyCompletions;
+
+			printf("%10llu %4zu %12.0f %12llu %12llu %12.0f %10.0f\n",
+				static_cast<unsigned long long>(offered), depth, consumed / seconds,
+				static_cast<unsigned long long>(port.Dropped()),
+				static_cast<unsigned long long>(stats.Completions),
+				filled > 0 ? static_cast<double>(consumed) / filled : 0.0,
+				port.MeanWaitSeconds() * 1e6);
+
+			if (!bSuccess || consumed + port.Dropped() + port.Queued() != produced)
+			{
+				printf("FAILED: %llu events produced, %llu consumed, %llu dropped, %llu still queued\n",
+					static_cast<unsigned long long>(produced), static_cast<unsigned long long>(consumed),
+					static_cast<unsigned long long>(port.Dropped()), static_cast<unsigned long long>(port.Queued()));
+				result = 1;
+			}
+
+			// completions at shutdown are cancellations, not counted as empty
+			if (stats.EmptyCompletions > 0)
+			{
+				printf("FAILED: %llu queries completed with no events\n",
+					static_cast<unsigned long long>(stats.EmptyCompletions));
+				result = 1;
+			}
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,179 @@
+// HittersBench.cpp
+// Heavy hitter accuracy checks and throughput.
+//
+// Draws a Zipf-distributed key stream and feeds it through the count-min
+// sketch and space-saving top-K exactly as HeavyHitterMonitor does, then
+// compares both against exact counts: no key may be undercounted, at most
+// a delta fraction of keys may be overcounted by more than epsilon * N,
+// and the top-K must hold the true K most frequent keys. Throughput is
+// measured over the same stream with the keys pre-drawn.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
+#include "Bench.h"
+#include "HeavyHitters.h"
+
+// keys with Zipf(skew) frequencies over keys distinct values, scattered
+// so that frequent keys are not adjacent
+static std::vector<ULONGLONG> ZipfKeys(size_t events, size_t keys, double skew, unsigned seed)
+{
+	std::vector<double> cdf(keys);
+	double sum = 0;
+
+	for (size_t i = 0; i < keys; ++i)
+	{
+		sum += 1.0 / std::pow(static_cast<double>(i + 1), skew);
+		cdf[i] = sum;
+	}
+
+	std::mt19937_64 random(seed);
+	std::uniform_real_distribution<double> uniform(0, sum);
+	std::vector<ULONGLONG> stream(events);
+
+	for (auto& key : stream)
+	{
+		const auto rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(random)) - cdf.begin();
+		key = static_cast<ULONGLONG>(rank) * 7919 + 13;
+	}
+
+	return stream;
+}
+
+// SysmonV2Bench hitters [--events N] [--keys N] [--skew S] [--k N] [--epsilon E] [--delta D]
+int RunHittersBench(int argc, char* argv[])
+{
+	size_t events  = 20000000;
+	size_t keys    = 1000000;
+	double skew    = 1.1;
+	size_t k       = 10;
+	double epsilon = 0.0005;
+	double delta   = 0.01;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--events"))
+			events = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (0 == ::strcmp(argv[i], "--keys"))
+			keys = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (0 == ::strcmp(argv[i], "--skew"))
+			skew = std::strtod(argv[i + 1], nullptr);
+		else if (0 == ::strcmp(argv[i], "--k"))
+			k = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (0 == ::strcmp(argv[i], "--epsilon"))
+			epsilon = std::strtod(argv[i + 1], nullptr);
+		else if (0 == ::strcmp(argv[i], "--delta"))
+			delta = std::strtod(argv[i + 1], nullptr);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == events || 0 == keys || 0 == k || k > keys || skew <= 0
+		|| epsilon <= 0 || epsilon >= 1 || delta <= 0 || delta >= 1)
+	{
+		printf("events and keys must be positive, k at most keys, skew positive, epsilon and delta in (0, 1)\n");
+		return 1;
+	}
+
+	const auto stream = ZipfKeys(events, keys, skew, 3);
+
+	CountMinSketch sketch{ epsilon, delta };
+	SpaceSavingTopK top{ k };
+
+	const auto start = BenchClock::now();
+
+	for (auto key : stream)
+	{
+		top.Offer(key, sketch.Add(key));
+	}
+
+	const auto seconds = SecondsSince(start);
+
+	printf("%zu events over %zu keys, Zipf %.2f: %.1f M events/s\n", events, keys, skew, events / seconds / 1e6);
+	printf("sketch: %zu x %zu, %zu KB; epsilon %g, delta %g\n",
+		sketch.Depth(), sketch.Width(), sketch.MemoryBytes() / 1024, epsilon, delta);
+
+	std::unordered_map<ULONGLONG, ULONG> exact;
+	for (auto key : stream)
+	{
+		exact[key]++;
+	}
+
+	// sketch error over every key seen
+	const auto bound = epsilon * events;
+	double maxOver = 0;
+	size_t overBound = 0;
+	int result = 0;
+
+	for (const auto& entry : exact)
+	{
+		const auto estimate = sketch.Estimate(entry.first);
+		if (estimate < entry.second)
+		{
+			printf("FAILED: key %llu estimated at %u, seen %u times\n",
+				static_cast<unsigned long long>(entry.first), estimate, entry.second);
+			return 1;
+		}
+
+		const double over = estimate - entry.second;
+		maxOver = std::max(maxOver, over);
+		overBound += (over > bound) ? 1 : 0;
+	}
+
+	printf("overcount: at most %.0f, bound epsilon * N = %.0f, %zu of %zu keys beyond it\n",
+		maxOver, bound, overBound, exact.size());
+
+	if (overBound > delta * exact.size())
+	{
+		printf("FAILED: %.3f%% of keys overcounted beyond the bound, delta is %g%%\n",
+			100.0 * overBound / exact.size(), 100 * delta);
+		result = 1;
+	}
+
+	// top-K against the exact K most frequent
+	std::vector<std::pair<ULONG, ULONGLONG>> ranked;
+	ranked.reserve(exact.size());
+
+	for (const auto& entry : exact)
+	{
+		ranked.emplace_back(entry.second, entry.first);
+	}
+
+	std::partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(), std::greater<std::pair<ULONG, ULONGLONG>>());
+
+	std::vector<HeavyHitter> hitters;
+	top.Snapshot(hitters);
+
+	printf("\n%6s %12s %12s %12s\n", "rank", "key", "estimate", "exact");
+
+	size_t found = 0;
+	for (size_t i = 0; i < hitters.size(); ++i)
+	{
+		const auto& hitter = hitters[i];
+
+		printf("%6zu %12llu %12u %12u\n", i + 1,
+			static_cast<unsigned long long>(hitter.Key), hitter.Count, exact[hitter.Key]);
+
+		found += std::any_of(ranked.begin(), ranked.begin() + k, [&](const std::pair<ULONG, ULONGLONG>& entry)
+		{
+			return entry.second == hitter.Key;
+		}) ? 1 : 0;
+	}
+
+	printf("recall: %zu of the top %zu\n", found, k);
+
+	if (found != k)
+	{
+		printf("FAILED: the top-%zu missed %zu of the most frequent keys\n", k, k - found);
+		result = 1;
+	}
+
+	return result;
+}
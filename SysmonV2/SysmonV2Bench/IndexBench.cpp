@@ -0,0 +1,178 @@
+// IndexBench.cpp
+// Size and payoff of the secondary capture index.
+//
+// Writes the same synthetic capture twice, without and with its index,
+// and reports what the index costs on disk and at write time. PIDs and
+// TIDs are retired as the capture goes on, as they are on a real host, so
+// each one only appears in a stretch of the capture for the bloom filters
+// to find. Then runs PID, TID and command line queries against the indexed
+// capture with and without consulting the index; both must return the
+// same rows, and the report shows how many chunks the index ruled out and
+// what that saved. Everything runs on one worker thread so the speedup is
+// the pruning alone.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "Bench.h"
+#include "Synthetic.h"
+#include "CaptureQuery.h"
+
+struct IndexQuery
+{
+	const char* Name;
+	QueryFilter Filter;
+};
+
+struct IndexRun
+{
+	ULONGLONG Matches;
+	ULONGLONG ChunksScanned;
+	double    Seconds;  // median
+};
+
+static IndexRun RunIndexQuery(CaptureQuery& query, const QueryFilter& filter, unsigned repeats)
+{
+	IndexRun run{};
+	std::vector<double> times;
+
+	for (unsigned r = 0; r < repeats; ++r)
+	{
+		ULONGLONG matches = 0;
+
+		const auto start = BenchClock::now();
+		query.Scan(filter, [&](size_t, const CaptureChunk&, const ULONG*, size_t count)
+		{
+			matches += count;
+		});
+		times.push_back(SecondsSince(start));
+
+		run.Matches       = matches;
+		run.ChunksScanned = query.Stats().ChunksScanned;
+	}
+
+	std::sort(times.begin(), times.end());
+	run.Seconds = times[times.size() / 2];
+
+	return run;
+}
+
+// SysmonV2Bench index [--events N] [--repeats N] [--path FILE]
+int RunIndexBench(int argc, char* argv[])
+{
+	SyntheticOptions options;
+	options.Events   = 5000000;
+	options.Lifetime = 1000;
+
+	unsigned repeats = 9;
+	const char* path = "SysmonV2Bench.cap";
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--events"))
+			options.Events = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (0 == ::strcmp(argv[i], "--repeats"))
+			repeats = static_cast<unsigned>(std::strtoul(argv[i + 1], nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--path"))
+			path = argv[i + 1];
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == options.Events || 0 == repeats)
+	{
+		printf("events and repeats must be positive\n");
+		return 1;
+	}
+
+	const auto indexPath = CaptureIndexPath(path);
+
+	auto start = BenchClock::now();
+	const auto plainSize = WriteSyntheticCapture(path, options, FALSE);
+	const auto plainSeconds = SecondsSince(start);
+
+	start = BenchClock::now();
+	const auto captureSize = WriteSyntheticCapture(path, options, TRUE);
+	const auto indexSeconds = SecondsSince(start);
+
+	if (0 == plainSize || 0 == captureSize)
+	{
+		printf("FAILED: cannot write %s\n", path);
+		return 1;
+	}
+
+	CaptureReader reader;
+	CaptureIndex index;
+
+	if (!reader.Open(path) || !index.Open(indexPath.c_str(), reader))
+	{
+		printf("FAILED: cannot open %s and its index\n", path);
+		return 1;
+	}
+
+	printf("%zu events in %zu chunks: capture %.1f MB, index %.2f MB (%.2f%%)\n",
+		options.Events, reader.ChunkCount(), captureSize / 1e6, index.FileSize() / 1e6,
+		100.0 * index.FileSize() / captureSize);
+	printf("write: %.2f s without the index, %.2f s with it (%+.0f%%)\n\n",
+		plainSeconds, indexSeconds, 100.0 * (indexSeconds - plainSeconds) / plainSeconds);
+
+	// a PID and a TID live in the middle of the capture
+	const auto middle = options.Events / 2;
+
+	IndexQuery queries[4];
+
+	queries[0].Name = "pid";
+	queries[0].Filter.MatchProcessId = TRUE;
+	queries[0].Filter.ProcessId = SyntheticEvents::FirstProcessId(options, middle) + 4 * (options.Processes / 2);
+
+	queries[1].Name = "tid";
+	queries[1].Filter.MatchThreadId = TRUE;
+	queries[1].Filter.ThreadId = SyntheticEvents::FirstThreadId(options, middle) + 4 * (options.Threads / 2);
+
+	// a rarely launched command line, and one that never was
+	queries[2].Name = "rare text";
+	queries[2].Filter.CommandLineContains = SyntheticEvents::CommandLine(options.CommandLines - 8);
+
+	queries[3].Name = "absent text";
+	queries[3].Filter.CommandLineContains = SyntheticEvents::CommandLine(options.CommandLines + 1000);
+
+	WorkStealingPool pool{ 1 };
+	CaptureQuery query{ reader, pool };
+	int result = 0;
+
+	printf("%12s %10s %10s %10s %10s %10s %8s\n", "query", "matches", "chunks", "indexed", "full ms", "index ms", "speedup");
+
+	for (const auto& each : queries)
+	{
+		query.UseIndex(nullptr);
+		const auto full = RunIndexQuery(query, each.Filter, repeats);
+
+		query.UseIndex(&index);
+		const auto pruned = RunIndexQuery(query, each.Filter, repeats);
+
+		printf("%12s %10llu %10llu %10llu %10.2f %10.2f %8.1f\n", each.Name,
+			static_cast<unsigned long long>(full.Matches),
+			static_cast<unsigned long long>(full.ChunksScanned),
+			static_cast<unsigned long long>(pruned.ChunksScanned),
+			full.Seconds * 1e3, pruned.Seconds * 1e3, full.Seconds / pruned.Seconds);
+
+		if (full.Matches != pruned.Matches)
+		{
+			printf("FAILED: %s matched %llu rows with the index, %llu without\n", each.Name,
+				static_cast<unsigned long long>(pruned.Matches), static_cast<unsigned long long>(full.Matches));
+			result = 1;
+		}
+	}
+
+	index.Close();
+	reader.Close();
+
+	std::remove(path);
+	std::remove(indexPath.c_str());
+
+	return result;
+}
@@ -0,0 +1,277 @@
+// MetricsBench.cpp
+// What exporting metrics costs the event pipeline.
+//
+// Pushes the same buffer of driver results through a pipeline with a
+// consumer that does nothing, first bare and then with the metrics
+// consumer attached and the exporter writing once a second, alternating
+// for a few repeats. Events per second of each are compared; the median
+// slowdown is the overhead of counting plus exporting.
+//
+// Checks: after each run with metrics, the final exported file must carry
+// the pipeline's own buffer count and per-type event counts summing to
+// its event count. The cost of a single export (render and replace the
+// file) is reported as well.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "Bench.h"
+#include "EventPipeline.h"
+#include "Metrics.h"
+
+/* ----------------------------------------------------------------------------
+ *	Checks
+ */
+
+// sum of the samples of a counter family; FALSE if it has none
+static BOOL ReadCounter(const std::string& text, const char* name, ULONGLONG& sum)
+{
+	const std::string prefix = std::string(name) + "_total";
+
+	std::istringstream lines(text);
+	std::string line;
+	size_t samples = 0;
+
+	sum = 0;
+
+	while (std::getline(lines, line))
+	{
+		if (0 == line.compare(0, prefix.size(), prefix)
+			&& line.size() > prefix.size() && (' ' == line[prefix.size()] || '{' == line[prefix.size()]))
+		{
+			sum += std::strtoull(line.c_str() + line.rfind(' ') + 1, nullptr, 10);
+			++samples;
+		}
+	}
+
+	return samples > 0;
+}
+
+static BOOL CheckExport(const char* path, const PipelineStats& totals)
+{
+	std::ifstream file(path);
+	std::stringstream text;
+	text << file.rdbuf();
+
+	ULONGLONG buffers = 0;
+	ULONGLONG events = 0;
+
+	if (!ReadCounter(text.str(), "sysmonv2_buffers", buffers) || !ReadCounter(text.str(), "sysmonv2_events", events))
+	{
+		printf("FAILED: %s is missing the buffer or event counters\n", path);
+		return FALSE;
+	}
+
+	if (buffers != totals.Buffers || events != totals.Events)
+	{
+		printf("FAILED: exported %llu buffers and %llu events, the pipeline saw %llu and %llu\n",
+			static_cast<unsigned long long>(buffers), static_cast<unsigned long long>(events),
+			static_cast<unsigned long long>(totals.Buffers), static_cast<unsigned long long>(totals.Events));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Benchmark
+ */
+
+class NullConsumer : public RecordConsumer
+{
+public:
+	VOID Consume(const EventRecord*, size_t) override {}
+};
+
+// a driver results buffer of thread and process events
+static std::vector<UCHAR> ResultsBuffer(size_t size)
+{
+	std::vector<UCHAR> buffer;
+
+	const auto append = [&](const VOID* item, size_t itemSize)
+	{
+		const auto bytes = static_cast<const UCHAR*>(item);
+		buffer.insert(buffer.end(), bytes, bytes + itemSize);
+	};
+
+	for (ULONG n = 0; ; ++n)
+	{
+		ThreadCreateItem create{};
+		create.Type      = (n & 1) ? ItemType::ThreadExit : ItemType::ThreadCreate;
+		create.Size      = sizeof(create);
+		create.ProcessId = 4 + 4 * (n % 64);
+		create.ThreadId  = 8 + 4 * n;
+
+		ProcessExitItem exit{};
+		exit.Type      = ItemType::ProcessExit;
+		exit.Size      = sizeof(exit);
+		exit.ProcessId = 4 + 4 * (n % 64);
+
+		if (buffer.size() + sizeof(create) + sizeof(exit) > size)
+		{
+			break;
+		}
+
+		append(&create, sizeof(create));
+		append(&exit, sizeof(exit));
+	}
+
+	return buffer;
+}
+
+struct MetricsRun
+{
+	double    EventsPerSecond;
+	ULONGLONG Exports;
+	BOOL      bOk;
+};
+
+static MetricsRun RunPipeline(const std::vector<UCHAR>& results, double seconds, BOOL bMetrics, ULONG intervalMs, const char* path)
+{
+	EventPipeline pipeline{ 8, results.size() };
+	NullConsumer sink;
+
+	ClientMetrics metrics;
+	MetricsConsumer metricsConsumer{ metrics };
+	MetricsRegistry registry;
+
+	metrics.Register(registry);
+
+	// the collect callback as StreamEvents sets it up, less the driver poll
+	MetricsExporter exporter{ registry, path, intervalMs, [&]()
+	{
+		const auto totals = pipeline.Stats();
+		metrics.Buffers.Set(totals.Buffers);
+		metrics.Bytes.Set(totals.Bytes);
+	} };
+
+	pipeline.AddConsumer(sink);
+
+	if (bMetrics)
+	{
+		pipeline.AddConsumer(metricsConsumer);
+		exporter.Start();
+	}
+
+	pipeline.Start();
+
+	const auto start = BenchClock::now();
+
+	while (SecondsSince(start) < seconds)
+	{
+		for (int i = 0; i < 64; ++i)
+		{
+			auto buffer = pipeline.AcquireBuffer();
+
+			std::memcpy(buffer->Data.data(), results.data(), results.size());
+			buffer->Size = static_cast<ULONG>(results.size());
+
+			pipeline.SubmitBuffer(buffer);
+		}
+	}
+
+	pipeline.Stop();
+
+	const auto elapsed = SecondsSince(start);
+	const auto totals = pipeline.Stats();
+
+	MetricsRun run{ totals.Events / elapsed, 0, TRUE };
+
+	if (bMetrics)
+	{
+		exporter.Stop();
+
+		run.Exports = exporter.Exports();
+		run.bOk = (0 == exporter.Failures()) && CheckExport(path, totals);
+	}
+
+	return run;
+}
+
+// SysmonV2Bench metrics [--seconds N] [--repeats N] [--interval MS] [--path FILE]
+int RunMetricsBench(int argc, char* argv[])
+{
+	double seconds = 3;
+	unsigned repeats = 5;
+	ULONG intervalMs = 1000;
+	const char* path = "SysmonV2Bench.prom";
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--seconds"))
+			seconds = std::strtod(argv[i + 1], nullptr);
+		else if (0 == ::strcmp(argv[i], "--repeats"))
+			repeats = static_cast<unsigned>(std::strtoul(argv[i + 1], nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--interval"))
+			intervalMs = static_cast<ULONG>(std::strtoul(argv[i + 1], nullptr, 10));
+		else if (0 == ::strcmp(argv[i], "--path"))
+			path = argv[i + 1];
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (seconds <= 0 || 0 == repeats || 0 == intervalMs)
+	{
+		printf("seconds, repeats and interval must be positive\n");
+		return 1;
+	}
+
+	const auto results = ResultsBuffer(1 << 16);
+
+	printf("%.0f s runs, exports every %u ms\n", seconds, intervalMs);
+	printf("%8s %14s %14s %10s %8s\n", "repeat", "bare ev/s", "metrics ev/s", "overhead", "exports");
+
+	std::vector<double> overheads;
+	int result = 0;
+
+	for (unsigned r = 0; r < repeats; ++r)
+	{
+		const auto bare = RunPipeline(results, seconds, FALSE, intervalMs, path);
+		const auto measured = RunPipeline(results, seconds, TRUE, intervalMs, path);
+
+		const auto overhead = 1 - measured.EventsPerSecond / bare.EventsPerSecond;
+		overheads.push_back(overhead);
+
+		printf("%8u %14.0f %14.0f %9.1f%% %8llu\n", r + 1, bare.EventsPerSecond, measured.EventsPerSecond,
+			100 * overhead, static_cast<unsigned long long>(measured.Exports));
+
+		if (!measured.bOk)
+		{
+			result = 1;
+		}
+	}
+
+	std::sort(overheads.begin(), overheads.end());
+	printf("median overhead %.1f%%\n", 100 * overheads[overheads.size() / 2]);
+
+	// one export on its own: render and replace the file
+	ClientMetrics metrics;
+	MetricsRegistry registry;
+	metrics.Register(registry);
+
+	MetricsExporter exporter{ registry, path, intervalMs };
+	const int exports = 1000;
+
+	const auto start = BenchClock::now();
+
+	for (int i = 0; i < exports; ++i)
+	{
+		if (!exporter.ExportNow())
+		{
+			printf("FAILED: cannot write %s\n", path);
+			return 1;
+		}
+	}
+
+	printf("one export: %.0f us\n", SecondsSince(start) / exports * 1e6);
+
+	std::remove(path);
+
+	return result;
+}
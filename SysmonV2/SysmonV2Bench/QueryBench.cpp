@@ -0,0 +1,172 @@
+// QueryBench.cpp
+// Core scaling of the parallel capture query engine.
+//
+// Writes a synthetic capture (20M events, about 600MB, by default; pass
+// --events for multi-GB captures) and runs three full-capture queries at
+// 1, 2, 4, ... worker threads up to the hardware thread count: processes
+// spawned by one parent (type and parent PID predicates), the most common
+// command lines (every process creation materialized), and a command
+// line substring search. Every thread count must return the same answers
+// as one thread. The first, untimed pass pulls the capture into the page
+// cache, so the timings are of the scan rather than the disk.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "Bench.h"
+#include "Synthetic.h"
+#include "CaptureQuery.h"
+
+struct QueryAnswers
+{
+	size_t    Spawned;
+	ULONGLONG TopCount;
+	ULONGLONG GrepMatches;
+
+	bool operator==(const QueryAnswers& other) const
+	{
+		return Spawned == other.Spawned && TopCount == other.TopCount && GrepMatches == other.GrepMatches;
+	}
+};
+
+struct QueryTimes
+{
+	double Spawned;
+	double Top;
+	double Grep;
+};
+
+static QueryAnswers RunQueries(const CaptureReader& reader, size_t threads, const std::string& text, QueryTimes& times)
+{
+	WorkStealingPool pool{ threads };
+	CaptureQuery query{ reader, pool };
+	QueryAnswers answers{};
+
+	auto start = BenchClock::now();
+	answers.Spawned = FindSpawnedProcesses(query, 4, std::numeric_limits<LONGLONG>::min(), std::numeric_limits<LONGLONG>::max()).size();
+	times.Spawned = SecondsSince(start);
+
+	start = BenchClock::now();
+	const auto top = TopCommandLines(query, 10, std::numeric_limits<LONGLONG>::min(), std::numeric_limits<LONGLONG>::max());
+	answers.TopCount = top.empty() ? 0 : top.front().Count;
+	times.Top = SecondsSince(start);
+
+	QueryFilter filter;
+	filter.CommandLineContains = text;
+
+	std::vector<ULONGLONG> matches(pool.WorkerCount(), 0);
+
+	start = BenchClock::now();
+	query.Scan(filter, [&](size_t worker, const CaptureChunk&, const ULONG*, size_t count)
+	{
+		matches[worker] += count;
+	});
+	times.Grep = SecondsSince(start);
+
+	for (auto count : matches)
+	{
+		answers.GrepMatches += count;
+	}
+
+	return answers;
+}
+
+// SysmonV2Bench query [--events N] [--threads N] [--path FILE]
+int RunQueryBench(int argc, char* argv[])
+{
+	SyntheticOptions options;
+	options.Events = 20000000;
+
+	size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	const char* path = "SysmonV2Bench.cap";
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--events"))
+			options.Events = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (0 == ::strcmp(argv[i], "--threads"))
+			maxThreads = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (0 == ::strcmp(argv[i], "--path"))
+			path = argv[i + 1];
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == options.Events || 0 == maxThreads)
+	{
+		printf("events and threads must be positive\n");
+		return 1;
+	}
+
+	const auto size = WriteSyntheticCapture(path, options, FALSE);
+	if (0 == size)
+	{
+		printf("FAILED: cannot write %s\n", path);
+		return 1;
+	}
+
+	CaptureReader reader;
+	if (!reader.Open(path))
+	{
+		printf("FAILED: cannot open %s\n", path);
+		return 1;
+	}
+
+	// one of the rarer command lines
+	const auto text = SyntheticEvents::CommandLine(200);
+
+	printf("%zu events, %.0f MB in %zu chunks, %u hardware threads\n",
+		options.Events, size / 1e6, reader.ChunkCount(), std::thread::hardware_concurrency());
+
+	QueryTimes times;
+	const auto expected = RunQueries(reader, 1, text, times);
+
+	printf("spawned by pid 4: %zu, top command line: %llu launches, \"%s\": %llu matches\n\n",
+		expected.Spawned, static_cast<unsigned long long>(expected.TopCount),
+		text.c_str(), static_cast<unsigned long long>(expected.GrepMatches));
+
+	printf("%8s %12s %8s %12s %8s %12s %8s\n", "threads", "spawned s", "speedup", "top s", "speedup", "grep s", "speedup");
+
+	QueryTimes single{};
+	int result = 0;
+
+	// powers of two, then the maximum if it is not one
+	std::vector<size_t> counts;
+	for (size_t threads = 1; threads < maxThreads; threads *= 2)
+	{
+		counts.push_back(threads);
+	}
+
+	counts.push_back(maxThreads);
+
+	for (auto threads : counts)
+	{
+		const auto answers = RunQueries(reader, threads, text, times);
+		if (!(answers == expected))
+		{
+			printf("FAILED: %zu threads disagree with one thread\n", threads);
+			result = 1;
+			break;
+		}
+
+		if (1 == threads)
+		{
+			single = times;
+		}
+
+		printf("%8zu %12.3f %8.2f %12.3f %8.2f %12.3f %8.2f\n", threads,
+			times.Spawned, single.Spawned / times.Spawned,
+			times.Top, single.Top / times.Top,
+			times.Grep, single.Grep / times.Grep);
+	}
+
+	reader.Close();
+	std::remove(path);
+
+	return result;
+}
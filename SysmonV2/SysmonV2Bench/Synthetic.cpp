@@ -0,0 +1,145 @@
+// Synthetic.cpp
+// Synthetic event streams for the SysmonV2 client checks and benchmarks.
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+#include "Synthetic.h"
+#include "CaptureWriter.h"
+
+// events generated at a time by the streaming capture writer
+constexpr size_t SYNTHETIC_BLOCK_EVENTS = 1 << 20;
+
+SyntheticEvents::SyntheticEvents(const SyntheticOptions& options)
+{
+	std::mt19937 random(options.Seed);
+
+	m_CommandLines.resize(options.CommandLines);
+	for (ULONG i = 0; i < options.CommandLines; ++i)
+	{
+		const auto text = CommandLine(i);
+		m_CommandLines[i].assign(text.begin(), text.end());
+	}
+
+	m_Records.reserve(options.Events);
+
+	auto time = options.StartTime;
+
+	for (size_t i = 0; i < options.Events; ++i)
+	{
+		EventRecord record{};
+		const auto roll = random() % 100;
+		const auto firstProcessId = FirstProcessId(options, options.FirstEvent + i);
+
+		time += random() % (options.MaxGap + 1);
+
+		record.Time      = time;
+		record.ProcessId = firstProcessId + 4 * (random() % options.Processes);
+		record.ThreadId  = FirstThreadId(options, options.FirstEvent + i) + 4 * (random() % options.Threads);
+
+		if (roll < options.ProcessShare / 2 && !m_CommandLines.empty())
+		{
+			// the product of two uniform draws favours low numbers
+			const auto line = static_cast<ULONG>(
+				static_cast<ULONGLONG>(random() % options.CommandLines) * (random() % options.CommandLines) / options.CommandLines);
+
+			record.Type              = ItemType::ProcessCreate;
+			record.ThreadId          = 0;
+			record.ParentProcessId   = firstProcessId + 4 * (random() % options.Processes);
+			record.CommandLine       = m_CommandLines[line].data();
+			record.CommandLineLength = static_cast<USHORT>(m_CommandLines[line].size());
+		}
+		else if (roll < options.ProcessShare)
+		{
+			record.Type     = ItemType::ProcessExit;
+			record.ThreadId = 0;
+		}
+		else
+		{
+			record.Type = (roll & 1) ? ItemType::ThreadCreate : ItemType::ThreadExit;
+		}
+
+		m_Records.push_back(record);
+	}
+}
+
+std::string SyntheticEvents::CommandLine(ULONG index)
+{
+	char text[96];
+	snprintf(text, sizeof(text), "C:\\Windows\\System32\\tool%u.exe -k group%u -p", index, index);
+
+	return text;
+}
+
+ULONG SyntheticEvents::FirstProcessId(const SyntheticOptions& options, size_t event)
+{
+	const auto generation = (0 != options.Lifetime) ? event / options.Lifetime : 0;
+	return static_cast<ULONG>(4 + 4 * generation);
+}
+
+ULONG SyntheticEvents::FirstThreadId(const SyntheticOptions& options, size_t event)
+{
+	const auto generation = (0 != options.Lifetime) ? event / options.Lifetime : 0;
+	return static_cast<ULONG>(4 + 4 * (generation * options.Threads / options.Processes));
+}
+
+BOOL WriteSyntheticCapture(
+	const char* path,
+	const std::vector<EventRecord>& records,
+	BOOL bIndex,
+	ULONG chunkEvents)
+{
+	CaptureWriter writer{ chunkEvents };
+
+	if (bIndex)
+	{
+		writer.EnableIndex();
+	}
+
+	if (!writer.Open(path))
+	{
+		return FALSE;
+	}
+
+	writer.Consume(records.data(), records.size());
+
+	return writer.Close();
+}
+
+ULONGLONG WriteSyntheticCapture(const char* path, const SyntheticOptions& options, BOOL bIndex)
+{
+	CaptureWriter writer;
+
+	if (bIndex)
+	{
+		writer.EnableIndex();
+	}
+
+	if (!writer.Open(path))
+	{
+		return 0;
+	}
+
+	auto block = options;
+
+	for (size_t written = 0; written < options.Events; written += block.Events)
+	{
+		block.Events = std::min(SYNTHETIC_BLOCK_EVENTS, options.Events - written);
+
+		SyntheticEvents events{ block };
+		writer.Consume(events.Records().data(), events.Records().size());
+
+		// the next block carries on where this one stopped
+		block.StartTime = events.Records().back().Time;
+		block.FirstEvent += block.Events;
+		block.Seed++;
+	}
+
+	if (!writer.Close())
+	{
+		return 0;
+	}
+
+	return writer.BytesWritten();
+}
@@ -0,0 +1,70 @@
+// Synthetic.h
+// Synthetic event streams for the SysmonV2 client checks and benchmarks.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "EventDecoder.h"
+#include "CaptureFormat.h"
+
+// FILETIME of the first synthetic event, in 2020
+constexpr LONGLONG SYNTHETIC_START_TIME = 132500000000000000LL;
+
+struct SyntheticOptions
+{
+	size_t   Events       = 1000000;
+	unsigned ProcessShare = 20;    // percent of events that are process creates or exits
+	ULONG    Processes    = 512;   // distinct PIDs live at once
+	ULONG    Threads      = 8192;  // distinct TIDs live at once
+	ULONG    Lifetime     = 0;     // events between retiring the oldest PID, 0 to never
+	ULONG    CommandLines = 256;   // distinct command lines, low numbers the most common
+	ULONG    MaxGap       = 2000;  // 100ns units between events, at most
+	LONGLONG StartTime    = SYNTHETIC_START_TIME;
+	unsigned Seed         = 1;
+	size_t   FirstEvent   = 0;     // number of the first event, when generating in blocks
+};
+
+// Decoded events as the pipeline would hand them to a consumer, with the
+// command line text they point into. PIDs and TIDs are multiples of 4 as
+// on Windows; command line n is "C:\Windows\System32\tool<n>.exe -k
+// group<n> -p". With a lifetime, the live PIDs (and TIDs, in proportion)
+// are a window that moves up by one every Lifetime events, so each one
+// appears in a limited stretch of the capture.
+class SyntheticEvents
+{
+public:
+	explicit SyntheticEvents(const SyntheticOptions& options);
+
+	SyntheticEvents(const SyntheticEvents&) = delete;
+	SyntheticEvents& operator=(const SyntheticEvents&) = delete;
+
+	const std::vector<EventRecord>& Records() const
+	{
+		return m_Records;
+	}
+
+	// command line n, as UTF-8
+	static std::string CommandLine(ULONG index);
+
+	// lowest live PID and TID at event n
+	static ULONG FirstProcessId(const SyntheticOptions& options, size_t event);
+	static ULONG FirstThreadId(const SyntheticOptions& options, size_t event);
+
+private:
+	std::vector<std::basic_string<WCHAR>> m_CommandLines;
+	std::vector<EventRecord>              m_Records;
+};
+
+// write records to a capture file, with its index alongside if asked
+BOOL WriteSyntheticCapture(
+	const char* path,
+	const std::vector<EventRecord>& records,
+	BOOL bIndex,
+	ULONG chunkEvents = CAPTURE_CHUNK_EVENTS);
+
+// write options.Events synthetic events to a capture file, generated a
+// block at a time so captures can be far larger than memory; returns the
+// capture's size in bytes, 0 on failure
+ULONGLONG WriteSyntheticCapture(const char* path, const SyntheticOptions& options, BOOL bIndex);
@@ -0,0 +1,334 @@
+// TreeBench.cpp
+// Process tree checks and throughput.
+//
+// Checks first: a small hand-built stream covering ancestry, a parent PID
+// reused by an unrelated process, retention of exited ancestors of a live
+// process and eviction of whole exited subtrees.
+//
+// Then a multi-million event stream fed through Consume() in pipeline-sized
+// batches. A few long-running services start first; after that processes
+// are created and exit at the same rate around a steady live population,
+// most of them children of a service and the rest of any live process,
+// and PIDs are handed out from a free list as Windows does, so they are
+// reused within moments of exiting.
+//
+// The report gives events per second, how many nodes the tree held at most
+// against the live population, and the cost of ancestry queries; sampled
+// ancestry is checked against the parents the generator chose.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <unordered_map>
+
+#include "Bench.h"
+#include "Synthetic.h"
+#include "ProcessTree.h"
+
+/* ----------------------------------------------------------------------------
+ *	Checks
+ */
+
+static size_t AncestryLength(const ProcessTree& tree, ULONG processId)
+{
+	std::vector<ProcessNodeId> ancestry;
+	tree.Ancestry(tree.FindLive(processId), ancestry);
+
+	return ancestry.size();
+}
+
+static BOOL RunChecks()
+{
+	ProcessTree tree{ 100 };
+
+	tree.Apply(ItemType::ProcessCreate, 10, 4, 0, 0, "System", 6);
+	tree.Apply(ItemType::ProcessCreate, 11, 100, 0, 4, "a", 1);
+	tree.Apply(ItemType::ProcessCreate, 12, 200, 0, 100, "b", 1);
+	tree.Apply(ItemType::ProcessCreate, 13, 300, 0, 200, "c", 1);
+
+	if (AncestryLength(tree, 300) != 4)
+	{
+		printf("FAILED: ancestry of a 4-deep process\n");
+		return FALSE;
+	}
+
+	// 200 is reused while its old parent is gone: the new one is a root
+	tree.Apply(ItemType::ProcessExit, 20, 100, 0, 0, nullptr, 0);
+	tree.Apply(ItemType::ProcessExit, 21, 200, 0, 0, nullptr, 0);
+	tree.Apply(ItemType::ProcessCreate, 22, 200, 0, 100, "reused", 6);
+
+	if (AncestryLength(tree, 200) != 1)
+	{
+		printf("FAILED: a reused PID inherited an exited parent\n");
+		return FALSE;
+	}
+
+	// past retention, the exited ancestors of a live process stay
+	tree.Apply(ItemType::ThreadCreate, 500, 4, 8, 0, nullptr, 0);
+	tree.Evict();
+
+	if (AncestryLength(tree, 300) != 4 || tree.NodeCount() != 5)
+	{
+		printf("FAILED: exited ancestors of a live process were evicted\n");
+		return FALSE;
+	}
+
+	// once the last descendant exits, the whole subtree goes
+	tree.Apply(ItemType::ProcessExit, 501, 300, 0, 0, nullptr, 0);
+	tree.Apply(ItemType::ThreadCreate, 700, 4, 8, 0, nullptr, 0);
+	tree.Evict();
+
+	std::vector<ProcessNodeId> subtree;
+	tree.Subtree(tree.FindLive(4), subtree);
+
+	if (tree.NodeCount() != 2 || subtree.size() != 1)
+	{
+		printf("FAILED: an exited subtree was not evicted\n");
+		return FALSE;
+	}
+
+	printf("checks: ancestry, PID reuse, retention and eviction\n");
+	return TRUE;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Benchmark
+ */
+
+// live processes that never exit, System included
+constexpr ULONG TREE_BENCH_SERVICES = 32;
+
+// creates and exits processes around a steady live population
+class ProcessChurn
+{
+public:
+	ProcessChurn(ULONG population, unsigned seed)
+		: m_Population(population),
+		m_Random(seed),
+		m_NextProcessId(8),
+		m_Time(SYNTHETIC_START_TIME),
+		m_Reused(0)
+	{
+		for (ULONG i = 0; i < 64; ++i)
+		{
+			const auto text = SyntheticEvents::CommandLine(i);
+			m_CommandLines.emplace_back(text.begin(), text.end());
+		}
+
+		m_Live.push_back(4);
+		m_Parent[4] = 0;
+	}
+
+	const std::vector<ULONG>& Live() const
+	{
+		return m_Live;
+	}
+
+	ULONG Parent(ULONG processId) const
+	{
+		return m_Parent.at(processId);
+	}
+
+	ULONGLONG Reused() const
+	{
+		return m_Reused;
+	}
+
+	VOID Next(EventRecord& record)
+	{
+		const auto roll = m_Random() % 100;
+
+		record = EventRecord{};
+		record.Time = (m_Time += 200);
+
+		if (m_Live.size() < TREE_BENCH_SERVICES || (roll < 10 && m_Live.size() < 2 * m_Population))
+		{
+			// services are at the front of the live list
+			const auto parent = (m_Live.size() < TREE_BENCH_SERVICES) ? 4
+				: m_Live[m_Random() % ((roll < 8) ? TREE_BENCH_SERVICES : m_Live.size())];
+			const auto line = m_Random() % m_CommandLines.size();
+
+			record.Type              = ItemType::ProcessCreate;
+			record.ProcessId         = AllocateProcessId();
+			record.ParentProcessId   = parent;
+			record.CommandLine       = m_CommandLines[line].data();
+			record.CommandLineLength = static_cast<USHORT>(m_CommandLines[line].size());
+
+			m_Parent[record.ProcessId] = parent;
+			m_Live.push_back(record.ProcessId);
+		}
+		else if (roll < 20 && m_Live.size() > std::max(m_Population / 2, TREE_BENCH_SERVICES))
+		{
+			const auto index = TREE_BENCH_SERVICES + m_Random() % (m_Live.size() - TREE_BENCH_SERVICES);
+
+			record.Type      = ItemType::ProcessExit;
+			record.ProcessId = m_Live[index];
+
+			m_Parent.erase(record.ProcessId);
+			m_Free.push_back(record.ProcessId);
+
+			m_Live[index] = m_Live.back();
+			m_Live.pop_back();
+		}
+		else
+		{
+			record.Type      = (roll & 1) ? ItemType::ThreadCreate : ItemType::ThreadExit;
+			record.ProcessId = m_Live[m_Random() % m_Live.size()];
+			record.ThreadId  = 4 + 4 * (m_Random() % 65536);
+		}
+	}
+
+private:
+	ULONG AllocateProcessId()
+	{
+		// a short delay before reuse, as the PID table's free list has
+		if (m_Free.size() > 16)
+		{
+			const auto processId = m_Free.front();
+			m_Free.pop_front();
+			m_Reused++;
+
+			return processId;
+		}
+
+		const auto processId = m_NextProcessId;
+		m_NextProcessId += 4;
+
+		return processId;
+	}
+
+	ULONG                                 m_Population;
+	std::mt19937                          m_Random;
+	ULONG                                 m_NextProcessId;
+	LONGLONG                              m_Time;
+	ULONGLONG                             m_Reused;
+	std::vector<ULONG>                    m_Live;
+	std::deque<ULONG>                     m_Free;
+	std::unordered_map<ULONG, ULONG>      m_Parent;  // live PID -> parent PID at creation
+	std::vector<std::basic_string<WCHAR>> m_CommandLines;
+};
+
+// the live process and its direct parent agree with what the generator
+// created
+static BOOL CheckAncestry(const ProcessTree& tree, const ProcessChurn& churn, ULONG processId, std::vector<ProcessNodeId>& ancestry)
+{
+	ancestry.clear();
+	tree.Ancestry(tree.FindLive(processId), ancestry);
+
+	if (ancestry.empty() || tree.Get(ancestry[0])->ProcessId != processId)
+	{
+		return FALSE;
+	}
+
+	if (ancestry.size() > 1)
+	{
+		const auto node   = tree.Get(ancestry[0]);
+		const auto parent = tree.Get(ancestry[1]);
+
+		return parent->ProcessId == churn.Parent(processId) && parent->StartTime <= node->StartTime;
+	}
+
+	return TRUE;
+}
+
+// SysmonV2Bench tree [--events N] [--population N] [--batch N]
+int RunTreeBench(int argc, char* argv[])
+{
+	size_t events = 5000000;
+	ULONG population = 2000;
+	size_t batch = 1024;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		const auto value = std::strtoull(argv[i + 1], nullptr, 10);
+
+		if (0 == ::strcmp(argv[i], "--events"))
+			events = value;
+		else if (0 == ::strcmp(argv[i], "--population"))
+			population = static_cast<ULONG>(value);
+		else if (0 == ::strcmp(argv[i], "--batch"))
+			batch = value;
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == events || population < TREE_BENCH_SERVICES || 0 == batch)
+	{
+		printf("events and batch must be positive, population at least %u\n", TREE_BENCH_SERVICES);
+		return 1;
+	}
+
+	if (!RunChecks())
+	{
+		return 1;
+	}
+
+	// one second of retention, about 50,000 events
+	ProcessTree tree{ 10LL * 1000 * 1000 };
+	ProcessChurn churn{ population, 7 };
+
+	tree.Apply(ItemType::ProcessCreate, SYNTHETIC_START_TIME, 4, 0, 0, "System", 6);
+
+	std::vector<EventRecord> records(batch);
+	size_t maxNodes = 0;
+	double seconds = 0;
+
+	for (size_t done = 0; done < events; done += records.size())
+	{
+		records.resize(std::min(batch, events - done));
+
+		for (auto& record : records)
+		{
+			churn.Next(record);
+		}
+
+		const auto start = BenchClock::now();
+		tree.Consume(records.data(), records.size());
+		seconds += SecondsSince(start);
+
+		maxNodes = std::max(maxNodes, tree.NodeCount());
+	}
+
+	printf("\n%zu events in batches of %zu: %.2f M events/s, %llu PIDs reused\n",
+		events, batch, events / seconds / 1e6, static_cast<unsigned long long>(churn.Reused()));
+	printf("nodes: %zu at most, %zu at the end, %zu live\n", maxNodes, tree.NodeCount(), tree.LiveCount());
+
+	if (tree.LiveCount() != churn.Live().size())
+	{
+		printf("FAILED: %zu live processes in the tree, %zu created and not exited\n", tree.LiveCount(), churn.Live().size());
+		return 1;
+	}
+
+	std::mt19937 random(11);
+	std::vector<ProcessNodeId> ancestry;
+	const size_t queries = 200000;
+	size_t depth = 0;
+
+	const auto start = BenchClock::now();
+
+	for (size_t q = 0; q < queries; ++q)
+	{
+		const auto& live = churn.Live();
+		const auto processId = live[random() % live.size()];
+
+		if (!CheckAncestry(tree, churn, processId, ancestry))
+		{
+			printf("FAILED: ancestry of pid %u does not match its creation\n", processId);
+			return 1;
+		}
+
+		depth += ancestry.size();
+	}
+
+	const auto querySeconds = SecondsSince(start);
+
+	printf("ancestry: %.1f deep on average, %.0f ns per query\n",
+		static_cast<double>(depth) / queries, querySeconds / queries * 1e9);
+
+	return 0;
+}
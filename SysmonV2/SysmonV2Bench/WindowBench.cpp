@@ -0,0 +1,209 @@
+// WindowBench.cpp
+// Window aggregation checks and the cost of window length.
+//
+// Checks first: sliding and tumbling windows over a synthetic stream are
+// compared, at every slide, with exact counts of the events inside the
+// window, both the window total and each of the top groups it reports.
+//
+// Then the per-event cost of one sliding window, 100 ms panes sliding by
+// one pane, as the window grows from 1 s to 1000 s. Each slide fetches
+// the top groups as WindowMonitor does. Since a pane is added to the
+// running totals once and subtracted once, the cost per event should stay
+// flat however many panes the window spans.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#include "Bench.h"
+#include "Synthetic.h"
+#include "WindowAggregator.h"
+
+/* ----------------------------------------------------------------------------
+ *	Checks
+ */
+
+// the window ending at windowEnd agrees with a recount of records
+static BOOL CheckSlide(const WindowAggregator& window, LONGLONG windowEnd, const std::vector<EventRecord>& records)
+{
+	const auto& spec = window.Spec();
+	const auto windowStart = windowEnd - spec.PaneWidth * spec.WindowPanes;
+
+	const auto first = std::lower_bound(records.begin(), records.end(), windowStart, [](const EventRecord& record, LONGLONG time)
+	{
+		return record.Time < time;
+	});
+
+	std::map<ULONG, ULONGLONG> exact;
+	ULONGLONG total = 0;
+
+	for (auto it = first; it != records.end() && it->Time < windowEnd; ++it)
+	{
+		if (it->Type == spec.Type)
+		{
+			++exact[it->ProcessId];
+			++total;
+		}
+	}
+
+	if (window.WindowCount() != total || window.GroupCount() != exact.size())
+	{
+		printf("FAILED: %s window ending %lld holds %llu events in %zu groups, expected %llu in %zu\n",
+			spec.Name.c_str(), static_cast<long long>(windowEnd),
+			static_cast<unsigned long long>(window.WindowCount()), window.GroupCount(),
+			static_cast<unsigned long long>(total), exact.size());
+		return FALSE;
+	}
+
+	std::vector<WindowGroup> groups;
+	window.TopGroups(groups);
+
+	for (const auto& group : groups)
+	{
+		if (exact[group.Key] != group.Count)
+		{
+			printf("FAILED: %s window ending %lld counts %llu for %u, expected %llu\n",
+				spec.Name.c_str(), static_cast<long long>(windowEnd),
+				static_cast<unsigned long long>(group.Count), group.Key,
+				static_cast<unsigned long long>(exact[group.Key]));
+			return FALSE;
+		}
+	}
+
+	// nothing left out of the top groups counts more than the last one in
+	if (!groups.empty())
+	{
+		for (const auto& entry : exact)
+		{
+			const auto listed = std::any_of(groups.begin(), groups.end(), [&](const WindowGroup& group)
+			{
+				return group.Key == entry.first;
+			});
+
+			if (!listed && entry.second > groups.back().Count)
+			{
+				printf("FAILED: %s window ending %lld left out %u with %llu events\n",
+					spec.Name.c_str(), static_cast<long long>(windowEnd), entry.first,
+					static_cast<unsigned long long>(entry.second));
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL RunChecks()
+{
+	SyntheticOptions options;
+	options.Events    = 300000;
+	options.Processes = 64;
+
+	SyntheticEvents events{ options };
+	const auto& records = events.Records();
+
+	const WindowSpec specs[] = {
+		{ "sliding 1 s", ItemType::ThreadExit, GroupBy::ProcessId, WINDOW_SECOND / 10, 10, 1, WINDOW_SECOND, "s", 5 },
+		{ "sliding 5 s", ItemType::ThreadExit, GroupBy::ProcessId, WINDOW_SECOND / 10, 50, 10, WINDOW_SECOND, "s", 5 },
+		{ "tumbling 2 s", ItemType::ThreadExit, GroupBy::ProcessId, WINDOW_SECOND / 10, 20, 20, WINDOW_SECOND, "s", 5 },
+	};
+
+	for (const auto& spec : specs)
+	{
+		BOOL bOk = TRUE;
+		size_t slides = 0;
+
+		WindowAggregator window{ spec, [&](const WindowAggregator& w, LONGLONG windowEnd)
+		{
+			++slides;
+			bOk = bOk && CheckSlide(w, windowEnd, records);
+		} };
+
+		for (const auto& record : records)
+		{
+			window.Add(record);
+		}
+
+		if (!bOk)
+		{
+			return FALSE;
+		}
+
+		printf("%-12s %zu slides match a recount\n", spec.Name.c_str(), slides);
+	}
+
+	return TRUE;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Benchmark
+ */
+
+// SysmonV2Bench window [--events N]
+int RunWindowBench(int argc, char* argv[])
+{
+	// 10M events over about 2000 s, so even the longest window fills
+	SyntheticOptions options;
+	options.Events = 10000000;
+	options.MaxGap = 4000;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == ::strcmp(argv[i], "--events"))
+			options.Events = std::strtoull(argv[i + 1], nullptr, 10);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (0 == options.Events)
+	{
+		printf("events must be positive\n");
+		return 1;
+	}
+
+	if (!RunChecks())
+	{
+		return 1;
+	}
+
+	SyntheticEvents events{ options };
+	const auto& records = events.Records();
+	const auto span = records.back().Time - records.front().Time;
+
+	printf("\n%zu events over %.0f s, 100 ms panes sliding by one\n", records.size(), span / 1e7);
+	printf("%10s %10s %10s %12s\n", "window", "panes", "slides", "ns/event");
+
+	const ULONG panes[] = { 10, 100, 1000, 10000 };
+	std::vector<WindowGroup> groups;
+
+	for (auto count : panes)
+	{
+		size_t slides = 0;
+
+		WindowAggregator window{
+			WindowSpec{ "bench", ItemType::ThreadExit, GroupBy::ProcessId, WINDOW_SECOND / 10, count, 1, WINDOW_SECOND, "s", 5 },
+			[&](const WindowAggregator& w, LONGLONG)
+			{
+				++slides;
+				w.TopGroups(groups);
+			} };
+
+		const auto start = BenchClock::now();
+
+		for (const auto& record : records)
+		{
+			window.Add(record);
+		}
+
+		const auto seconds = SecondsSince(start);
+
+		printf("%8.0f s %10u %10zu %12.1f%s\n", count / 10.0, count, slides,
+			seconds / records.size() * 1e9, (count * WINDOW_SECOND / 10 > span) ? "  (longer than the stream)" : "");
+	}
+
+	return 0;
+}
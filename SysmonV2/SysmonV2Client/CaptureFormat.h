@@ -0,0 +1,119 @@
+// CaptureFormat.h
+// On-disk layout of SysmonV2 event captures.
+//
+// A capture is a file header, a sequence of self-contained chunks, and a
+// directory of chunk footers followed by a fixed-size trailer:
+//
+//   [CaptureFileHeader]
+//   [Chunk 0] [Chunk 1] ... [Chunk N-1]
+//   [CaptureChunkFooter x N]
+//   [CaptureTrailer]
+//
+// Each chunk stores its events column by column:
+//
+//   [CaptureChunkHeader]
+//   Type            UCHAR[count]
+//   TimeDelta       ULONG[count]   100ns units past the chunk's MinTime
+//   ProcessId       ULONG[count]
+//   ThreadId        ULONG[count]
+//   ParentProcessId ULONG[count]
+//   CommandLineOff  ULONG[count]   byte offset into the string heap
+//   CommandLineLen  ULONG[count]   UTF-8 length in bytes, 0 if none
+//   StringHeap      UCHAR[HeapSize]
+//   [CaptureChunkFooter]
+//
+// Every column starts on an 8-byte boundary. The footer is repeated in the
+// directory so a reader can select chunks by time without touching them;
+// a capture whose writer never finished can still be read by walking the
+// chunk headers from the front.
+
+#pragma once
+
+#include "Platform.h"
+
+constexpr char  CAPTURE_FILE_MAGIC[8]    = { 'S', 'V', '2', 'C', 'A', 'P', 'T', '\0' };
+constexpr ULONG CAPTURE_FILE_VERSION     = 1;
+constexpr ULONG CAPTURE_CHUNK_MAGIC      = 0x4B4E4843;  // 'CHNK'
+constexpr ULONG CAPTURE_FOOTER_MAGIC     = 0x52544F46;  // 'FOTR'
+constexpr ULONG CAPTURE_TRAILER_MAGIC    = 0x4C525254;  // 'TRRL'
+
+// default number of events per chunk
+constexpr ULONG CAPTURE_CHUNK_EVENTS     = 1 << 16;
+
+// time deltas are 32 bits wide, which bounds the span of a single chunk
+constexpr LONGLONG CAPTURE_MAX_CHUNK_SPAN = 0xFFFFFFFFLL;
+
+#pragma pack(push, 8)
+
+struct CaptureFileHeader
+{
+	char  Magic[8];
+	ULONG Version;
+	ULONG Reserved;
+};
+
+struct CaptureChunkHeader
+{
+	ULONG Magic;
+	ULONG EventCount;
+	ULONG HeapSize;
+	ULONG Reserved;
+};
+
+struct CaptureChunkFooter
+{
+	ULONG     Magic;
+	ULONG     EventCount;
+	ULONGLONG ChunkOffset;  // file offset of the chunk header
+	ULONGLONG ChunkSize;    // header through footer, inclusive
+	LONGLONG  MinTime;
+	LONGLONG  MaxTime;
+};
+
+struct CaptureTrailer
+{
+	ULONGLONG DirectoryOffset;
+	ULONG     ChunkCount;
+	ULONG     Magic;
+};
+
+#pragma pack(pop)
+
+// byte offsets of each column relative to the chunk header
+struct CaptureChunkLayout
+{
+	ULONGLONG Type;
+	ULONGLONG TimeDelta;
+	ULONGLONG ProcessId;
+	ULONGLONG ThreadId;
+	ULONGLONG ParentProcessId;
+	ULONGLONG CommandLineOffset;
+	ULONGLONG CommandLineLength;
+	ULONGLONG StringHeap;
+	ULONGLONG Footer;
+	ULONGLONG Size;  // total chunk size, including the footer
+};
+
+inline ULONGLONG CaptureAlign(ULONGLONG value)
+{
+	return (value + 7) & ~7ULL;
+}
+
+inline CaptureChunkLayout ComputeChunkLayout(ULONG eventCount, ULONG heapSize)
+{
+	const ULONGLONG column = CaptureAlign(static_cast<ULONGLONG>(eventCount) * sizeof(ULONG));
+
+	CaptureChunkLayout layout;
+	layout.Type              = sizeof(CaptureChunkHeader);
+	layout.TimeDelta         = layout.Type + CaptureAlign(eventCount);
+	layout.ProcessId         = layout.TimeDelta + column;
+	layout.ThreadId          = layout.ProcessId + column;
+	layout.ParentProcessId   = layout.ThreadId + column;
+	layout.CommandLineOffset = layout.ParentProcessId + column;
+	layout.CommandLineLength = layout.CommandLineOffset + column;
+	layout.StringHeap        = layout.CommandLineLength + column;
+	layout.Footer            = layout.StringHeap + CaptureAlign(heapSize);
+	layout.Size              = layout.Footer + sizeof(CaptureChunkFooter);
+
+	return layout;
+}
@@ -0,0 +1,379 @@
+// CaptureIndex.cpp
+// Optional secondary indexes over a capture file.
+
+#include <algorithm>
+#include <cstring>
+
+#include "CaptureIndex.h"
+
+// smallest bloom filter, in 64-bit words
+constexpr ULONG CAPTURE_BLOOM_MIN_WORDS = 8;
+
+static ULONGLONG MixHash(ULONG value)
+{
+	// splitmix64 finalizer
+	ULONGLONG h = value + 0x9E3779B97F4A7C15ULL;
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+	return h ^ (h >> 31);
+}
+
+// probe i of value lands on bit (h1 + i * h2) mod bits (double hashing)
+static VOID BloomAdd(ULONGLONG* words, ULONG wordCount, ULONG value)
+{
+	const auto mask = static_cast<ULONGLONG>(wordCount) * 64 - 1;
+	const auto h = MixHash(value);
+	const auto h2 = (h >> 32) | 1;
+
+	for (ULONG i = 0; i < CAPTURE_BLOOM_PROBES; ++i)
+	{
+		const auto bit = (h + i * h2) & mask;
+		words[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+static BOOL BloomTest(const ULONGLONG* words, ULONG wordCount, ULONG value)
+{
+	const auto mask = static_cast<ULONGLONG>(wordCount) * 64 - 1;
+	const auto h = MixHash(value);
+	const auto h2 = (h >> 32) | 1;
+
+	for (ULONG i = 0; i < CAPTURE_BLOOM_PROBES; ++i)
+	{
+		const auto bit = (h + i * h2) & mask;
+		if (0 == (words[bit / 64] & (1ULL << (bit % 64))))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static ULONG PackTrigram(const char* text)
+{
+	return (static_cast<ULONG>(static_cast<UCHAR>(text[0])) << 16)
+		| (static_cast<ULONG>(static_cast<UCHAR>(text[1])) << 8)
+		| static_cast<ULONG>(static_cast<UCHAR>(text[2]));
+}
+
+/* ----------------------------------------------------------------------------
+ *	Builder
+ */
+
+VOID CaptureIndexBuilder::AddChunk(const CaptureChunk& chunk)
+{
+	const auto chunkNumber = static_cast<ULONG>(m_ProcessBlooms.size());
+
+	m_ProcessBlooms.emplace_back();
+	m_ThreadBlooms.emplace_back();
+
+	BuildBloom(chunk.ProcessId, chunk.EventCount, m_Scratch, m_ProcessBlooms.back());
+	BuildBloom(chunk.ThreadId, chunk.EventCount, m_Scratch, m_ThreadBlooms.back());
+
+	// distinct trigrams of this chunk, then one posting per trigram
+	m_Scratch.clear();
+
+	for (ULONG row = 0; row < chunk.EventCount; ++row)
+	{
+		ULONG length;
+		const auto text = chunk.CommandLine(row, length);
+
+		for (ULONG i = 0; i + 3 <= length; ++i)
+		{
+			m_Scratch.push_back(PackTrigram(text + i));
+		}
+	}
+
+	std::sort(m_Scratch.begin(), m_Scratch.end());
+	m_Scratch.erase(std::unique(m_Scratch.begin(), m_Scratch.end()), m_Scratch.end());
+
+	for (auto trigram : m_Scratch)
+	{
+		m_Postings[trigram].push_back(chunkNumber);
+	}
+}
+
+VOID CaptureIndexBuilder::BuildBloom(
+	const ULONG* column,
+	ULONG count,
+	std::vector<ULONG>& scratch,
+	std::vector<ULONGLONG>& bloom)
+{
+	scratch.assign(column, column + count);
+	std::sort(scratch.begin(), scratch.end());
+	scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+
+	const auto bits = static_cast<ULONGLONG>(scratch.size()) * CAPTURE_BLOOM_BITS_PER_VALUE;
+
+	ULONG words = CAPTURE_BLOOM_MIN_WORDS;
+	while (static_cast<ULONGLONG>(words) * 64 < bits)
+	{
+		words <<= 1;
+	}
+
+	bloom.assign(words, 0);
+	for (auto value : scratch)
+	{
+		BloomAdd(bloom.data(), words, value);
+	}
+}
+
+BOOL CaptureIndexBuilder::Write(const char* path, ULONGLONG captureSize)
+{
+	const auto chunkCount = static_cast<ULONG>(m_ProcessBlooms.size());
+
+	std::vector<CaptureIndexTrigram> trigrams;
+	trigrams.reserve(m_Postings.size());
+
+	for (auto& entry : m_Postings)
+	{
+		trigrams.push_back(CaptureIndexTrigram{ entry.first, static_cast<ULONG>(entry.second.size()), 0 });
+	}
+
+	std::sort(trigrams.begin(), trigrams.end(), [](const CaptureIndexTrigram& a, const CaptureIndexTrigram& b)
+	{
+		return a.Trigram < b.Trigram;
+	});
+
+	// lay out the variable-sized sections
+	ULONGLONG offset = sizeof(CaptureIndexHeader)
+		+ static_cast<ULONGLONG>(chunkCount) * sizeof(CaptureIndexChunk)
+		+ static_cast<ULONGLONG>(trigrams.size()) * sizeof(CaptureIndexTrigram);
+
+	std::vector<CaptureIndexChunk> chunks(chunkCount);
+	for (ULONG i = 0; i < chunkCount; ++i)
+	{
+		chunks[i].ProcessBloomOffset = offset;
+		chunks[i].ProcessBloomWords  = static_cast<ULONG>(m_ProcessBlooms[i].size());
+		offset += m_ProcessBlooms[i].size() * sizeof(ULONGLONG);
+
+		chunks[i].ThreadBloomOffset = offset;
+		chunks[i].ThreadBloomWords  = static_cast<ULONG>(m_ThreadBlooms[i].size());
+		offset += m_ThreadBlooms[i].size() * sizeof(ULONGLONG);
+	}
+
+	for (auto& trigram : trigrams)
+	{
+		trigram.PostingOffset = offset;
+		offset += static_cast<ULONGLONG>(trigram.PostingCount) * sizeof(ULONG);
+	}
+
+	CaptureIndexHeader header{};
+	std::memcpy(header.Magic, CAPTURE_INDEX_MAGIC, sizeof(header.Magic));
+	header.Version      = CAPTURE_INDEX_VERSION;
+	header.ChunkCount   = chunkCount;
+	header.TrigramCount = static_cast<ULONG>(trigrams.size());
+	header.CaptureSize  = captureSize;
+
+	auto file = OpenStdioFile(path, "wb");
+	if (nullptr == file)
+	{
+		return FALSE;
+	}
+
+	size_t written = 0;
+	size_t expected = 0;
+
+	auto write = [&](const void* data, size_t size)
+	{
+		if (size > 0)
+		{
+			written += fwrite(data, 1, size, file);
+			expected += size;
+		}
+	};
+
+	write(&header, sizeof(header));
+	write(chunks.data(), chunks.size() * sizeof(CaptureIndexChunk));
+	write(trigrams.data(), trigrams.size() * sizeof(CaptureIndexTrigram));
+
+	for (ULONG i = 0; i < chunkCount; ++i)
+	{
+		write(m_ProcessBlooms[i].data(), m_ProcessBlooms[i].size() * sizeof(ULONGLONG));
+		write(m_ThreadBlooms[i].data(), m_ThreadBlooms[i].size() * sizeof(ULONGLONG));
+	}
+
+	for (const auto& trigram : trigrams)
+	{
+		const auto& postings = m_Postings[trigram.Trigram];
+		write(postings.data(), postings.size() * sizeof(ULONG));
+	}
+
+	const auto closed = (0 == fclose(file));
+
+	m_BytesWritten = written;
+
+	return closed && written == expected;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Reader
+ */
+
+BOOL CaptureIndex::Open(const char* path, const CaptureReader& capture)
+{
+	Close();
+
+	if (!m_File.Open(path))
+	{
+		return FALSE;
+	}
+
+	const auto size = m_File.Size();
+	const auto data = m_File.Data();
+
+	if (size < sizeof(CaptureIndexHeader))
+	{
+		Close();
+		return FALSE;
+	}
+
+	// the mapping is page aligned and every section is 8-byte aligned
+	auto header = reinterpret_cast<const CaptureIndexHeader*>(data);
+
+	if (std::memcmp(header->Magic, CAPTURE_INDEX_MAGIC, sizeof(header->Magic)) != 0
+		|| header->Version != CAPTURE_INDEX_VERSION
+		|| header->ChunkCount != capture.ChunkCount()
+		|| header->CaptureSize != capture.FileSize())
+	{
+		Close();
+		return FALSE;
+	}
+
+	const auto tables = sizeof(CaptureIndexHeader)
+		+ static_cast<ULONGLONG>(header->ChunkCount) * sizeof(CaptureIndexChunk)
+		+ static_cast<ULONGLONG>(header->TrigramCount) * sizeof(CaptureIndexTrigram);
+
+	if (tables > size)
+	{
+		Close();
+		return FALSE;
+	}
+
+	auto chunks = reinterpret_cast<const CaptureIndexChunk*>(data + sizeof(CaptureIndexHeader));
+	auto trigrams = reinterpret_cast<const CaptureIndexTrigram*>(chunks + header->ChunkCount);
+
+	// validate every reference once so lookups need no bounds checks
+	auto fits = [size](ULONGLONG offset, ULONGLONG bytes)
+	{
+		return offset <= size && bytes <= size - offset && 0 == offset % sizeof(ULONG);
+	};
+
+	for (ULONG i = 0; i < header->ChunkCount; ++i)
+	{
+		const auto& chunk = chunks[i];
+		const auto validWords = [](ULONG words) { return words > 0 && 0 == (words & (words - 1)); };
+
+		if (!validWords(chunk.ProcessBloomWords) || !validWords(chunk.ThreadBloomWords)
+			|| 0 != chunk.ProcessBloomOffset % sizeof(ULONGLONG)
+			|| 0 != chunk.ThreadBloomOffset % sizeof(ULONGLONG)
+			|| !fits(chunk.ProcessBloomOffset, static_cast<ULONGLONG>(chunk.ProcessBloomWords) * sizeof(ULONGLONG))
+			|| !fits(chunk.ThreadBloomOffset, static_cast<ULONGLONG>(chunk.ThreadBloomWords) * sizeof(ULONGLONG)))
+		{
+			Close();
+			return FALSE;
+		}
+	}
+
+	for (ULONG i = 0; i < header->TrigramCount; ++i)
+	{
+		if (!fits(trigrams[i].PostingOffset, static_cast<ULONGLONG>(trigrams[i].PostingCount) * sizeof(ULONG)))
+		{
+			Close();
+			return FALSE;
+		}
+	}
+
+	m_Header   = header;
+	m_Chunks   = chunks;
+	m_Trigrams = trigrams;
+
+	return TRUE;
+}
+
+VOID CaptureIndex::Close()
+{
+	m_Header   = nullptr;
+	m_Chunks   = nullptr;
+	m_Trigrams = nullptr;
+
+	m_File.Close();
+}
+
+BOOL CaptureIndex::MayContainProcess(size_t chunk, ULONG processId) const
+{
+	const auto& entry = m_Chunks[chunk];
+	const auto words = reinterpret_cast<const ULONGLONG*>(m_File.Data() + entry.ProcessBloomOffset);
+
+	return BloomTest(words, entry.ProcessBloomWords, processId);
+}
+
+BOOL CaptureIndex::MayContainThread(size_t chunk, ULONG threadId) const
+{
+	const auto& entry = m_Chunks[chunk];
+	const auto words = reinterpret_cast<const ULONGLONG*>(m_File.Data() + entry.ThreadBloomOffset);
+
+	return BloomTest(words, entry.ThreadBloomWords, threadId);
+}
+
+BOOL CaptureIndex::FindCommandLineChunks(const char* text, size_t length, std::vector<size_t>& chunks) const
+{
+	if (length < 3)
+	{
+		return FALSE;
+	}
+
+	// start from the rarest trigram and intersect the others into it
+	std::vector<const CaptureIndexTrigram*> postings;
+
+	for (size_t i = 0; i + 3 <= length; ++i)
+	{
+		const auto entry = FindTrigram(PackTrigram(text + i));
+		if (nullptr == entry)
+		{
+			chunks.clear();
+			return TRUE;
+		}
+
+		postings.push_back(entry);
+	}
+
+	std::sort(postings.begin(), postings.end(), [](const CaptureIndexTrigram* a, const CaptureIndexTrigram* b)
+	{
+		return a->PostingCount < b->PostingCount;
+	});
+
+	auto list = [this](const CaptureIndexTrigram* entry)
+	{
+		return reinterpret_cast<const ULONG*>(m_File.Data() + entry->PostingOffset);
+	};
+
+	chunks.assign(list(postings[0]), list(postings[0]) + postings[0]->PostingCount);
+
+	for (size_t i = 1; i < postings.size() && !chunks.empty(); ++i)
+	{
+		const auto first = list(postings[i]);
+		const auto last  = first + postings[i]->PostingCount;
+
+		chunks.erase(std::remove_if(chunks.begin(), chunks.end(), [&](size_t chunk)
+		{
+			return !std::binary_search(first, last, static_cast<ULONG>(chunk));
+		}), chunks.end());
+	}
+
+	return TRUE;
+}
+
+const CaptureIndexTrigram* CaptureIndex::FindTrigram(ULONG trigram) const
+{
+	const auto first = m_Trigrams;
+	const auto last  = m_Trigrams + m_Header->TrigramCount;
+
+	const auto it = std::lower_bound(first, last, trigram, [](const CaptureIndexTrigram& entry, ULONG value)
+	{
+		return entry.Trigram < value;
+	});
+
+	return (it != last && it->Trigram == trigram) ? it : nullptr;
+}
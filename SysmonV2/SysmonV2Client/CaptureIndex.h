@@ -0,0 +1,124 @@
+// CaptureIndex.h
+// Optional secondary indexes over a capture file.
+//
+// An index lives next to its capture as "<capture>.idx" and holds, per
+// chunk, bloom filters over the ProcessId and ThreadId columns, plus one
+// trigram inverted index over all command lines mapping each trigram to
+// the chunks it occurs in:
+//
+//   [CaptureIndexHeader]
+//   [CaptureIndexChunk   x ChunkCount]
+//   [CaptureIndexTrigram x TrigramCount]   sorted by Trigram
+//   bloom filter words   (ULONGLONG)
+//   posting lists        (ULONG chunk numbers, ascending)
+//
+// Both structures only ever produce false positives, so a query still
+// evaluates its predicates on every chunk the index lets through.
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CaptureReader.h"
+
+constexpr char  CAPTURE_INDEX_MAGIC[8] = { 'S', 'V', '2', 'I', 'N', 'D', 'X', '\0' };
+constexpr ULONG CAPTURE_INDEX_VERSION  = 1;
+
+// bloom filter sizing: bits per distinct value and probes per lookup,
+// roughly a 2% false positive rate
+constexpr ULONG CAPTURE_BLOOM_BITS_PER_VALUE = 8;
+constexpr ULONG CAPTURE_BLOOM_PROBES         = 4;
+
+#pragma pack(push, 8)
+
+struct CaptureIndexHeader
+{
+	char      Magic[8];
+	ULONG     Version;
+	ULONG     ChunkCount;
+	ULONG     TrigramCount;
+	ULONG     Reserved;
+	ULONGLONG CaptureSize;  // size of the indexed capture, to detect stale indexes
+};
+
+struct CaptureIndexChunk
+{
+	ULONGLONG ProcessBloomOffset;
+	ULONGLONG ThreadBloomOffset;
+	ULONG     ProcessBloomWords;  // power of two
+	ULONG     ThreadBloomWords;   // power of two
+};
+
+struct CaptureIndexTrigram
+{
+	ULONG     Trigram;
+	ULONG     PostingCount;
+	ULONGLONG PostingOffset;
+};
+
+#pragma pack(pop)
+
+inline std::string CaptureIndexPath(const char* capturePath)
+{
+	return std::string(capturePath) + ".idx";
+}
+
+// Accumulates index data one chunk at a time; fed either by the capture
+// writer as it flushes chunks or by an offline pass over a capture.
+class CaptureIndexBuilder
+{
+public:
+	VOID AddChunk(const CaptureChunk& chunk);
+
+	BOOL Write(const char* path, ULONGLONG captureSize);
+
+	ULONGLONG BytesWritten() const
+	{
+		return m_BytesWritten;
+	}
+
+private:
+	static VOID BuildBloom(const ULONG* column, ULONG count, std::vector<ULONG>& scratch, std::vector<ULONGLONG>& bloom);
+
+	std::vector<std::vector<ULONGLONG>>            m_ProcessBlooms;
+	std::vector<std::vector<ULONGLONG>>            m_ThreadBlooms;
+	std::unordered_map<ULONG, std::vector<ULONG>>  m_Postings;
+	std::vector<ULONG>                             m_Scratch;
+	ULONGLONG                                      m_BytesWritten = 0;
+};
+
+// read side, over a memory-mapped index file
+class CaptureIndex
+{
+public:
+	// fails if the index is missing, malformed or does not match capture
+	BOOL Open(const char* path, const CaptureReader& capture);
+	VOID Close();
+
+	BOOL IsOpen() const
+	{
+		return m_Header != nullptr;
+	}
+
+	BOOL MayContainProcess(size_t chunk, ULONG processId) const;
+	BOOL MayContainThread(size_t chunk, ULONG threadId) const;
+
+	// chunks whose command lines may contain text, ascending; returns
+	// FALSE if the index cannot narrow the search (text too short)
+	BOOL FindCommandLineChunks(const char* text, size_t length, std::vector<size_t>& chunks) const;
+
+	ULONGLONG FileSize() const
+	{
+		return m_File.Size();
+	}
+
+private:
+	const CaptureIndexTrigram* FindTrigram(ULONG trigram) const;
+
+	MappedFile                 m_File;
+	const CaptureIndexHeader*  m_Header   = nullptr;
+	const CaptureIndexChunk*   m_Chunks   = nullptr;
+	const CaptureIndexTrigram* m_Trigrams = nullptr;
+};
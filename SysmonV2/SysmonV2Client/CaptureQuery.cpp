@@ -0,0 +1,332 @@
+// CaptureQuery.cpp
+// Parallel filtered scans and canned queries over capture files.
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+
+#include "CaptureQuery.h"
+#include "ColumnFilter.h"
+
+CaptureQuery::CaptureQuery(const CaptureReader& reader, WorkStealingPool& pool)
+	: m_Reader(reader),
+	m_Pool(pool),
+	m_Index(nullptr),
+	m_Scratch(pool.WorkerCount()),
+	m_ChunksTotal(0),
+	m_ChunksPruned(0),
+	m_ChunksScanned(0),
+	m_RowsScanned(0),
+	m_RowsMatched(0)
+{}
+
+VOID CaptureQuery::Scan(const QueryFilter& filter, const ChunkVisitor& visit)
+{
+	m_ChunksTotal   = m_Reader.ChunkCount();
+	m_ChunksPruned  = 0;
+	m_ChunksScanned = 0;
+	m_RowsScanned   = 0;
+	m_RowsMatched   = 0;
+
+	if (filter.FromTime > filter.ToTime)
+	{
+		return;
+	}
+
+	std::vector<size_t> chunks;
+	m_Reader.FindChunks(filter.FromTime, filter.ToTime, chunks);
+
+	if (m_Index != nullptr)
+	{
+		const auto candidates = chunks.size();
+		PruneChunks(filter, chunks);
+		m_ChunksPruned = candidates - chunks.size();
+	}
+
+	m_Pool.ParallelFor(chunks.size(), [&](size_t task, size_t worker)
+	{
+		ScanChunk(filter, chunks[task], worker, visit);
+	});
+}
+
+QueryStats CaptureQuery::Stats() const
+{
+	return QueryStats{
+		m_ChunksTotal.load(),
+		m_ChunksPruned.load(),
+		m_ChunksScanned.load(),
+		m_RowsScanned.load(),
+		m_RowsMatched.load()
+	};
+}
+
+VOID CaptureQuery::PruneChunks(const QueryFilter& filter, std::vector<size_t>& chunks) const
+{
+	if (!filter.CommandLineContains.empty())
+	{
+		std::vector<size_t> textChunks;
+		const auto& text = filter.CommandLineContains;
+
+		if (m_Index->FindCommandLineChunks(text.data(), text.size(), textChunks))
+		{
+			// both lists are ascending
+			std::vector<size_t> both;
+			std::set_intersection(
+				chunks.begin(), chunks.end(),
+				textChunks.begin(), textChunks.end(),
+				std::back_inserter(both));
+
+			chunks.swap(both);
+		}
+	}
+
+	chunks.erase(std::remove_if(chunks.begin(), chunks.end(), [&](size_t chunk)
+	{
+		return (filter.MatchProcessId && !m_Index->MayContainProcess(chunk, filter.ProcessId))
+			|| (filter.MatchThreadId && !m_Index->MayContainThread(chunk, filter.ThreadId));
+	}), chunks.end());
+}
+
+VOID CaptureQuery::ScanChunk(const QueryFilter& filter, size_t index, size_t worker, const ChunkVisitor& visit)
+{
+	CaptureChunk chunk;
+	if (!m_Reader.Chunk(index, chunk) || 0 == chunk.EventCount)
+	{
+		return;
+	}
+
+	auto& scratch = m_Scratch[worker];
+	const auto count = chunk.EventCount;
+	const auto words = SelectionWords(count);
+
+	scratch.Bits.resize(words);
+	scratch.Rows.resize(count);
+
+	auto bits = scratch.Bits.data();
+
+	if (filter.MatchType)
+	{
+		SelectEqual(chunk.Type, count, static_cast<UCHAR>(filter.Type), bits);
+	}
+	else
+	{
+		std::fill(bits, bits + words, ~0ULL);
+		if (count % 64 != 0)
+		{
+			bits[words - 1] = (1ULL << (count % 64)) - 1;
+		}
+	}
+
+	if (filter.MatchProcessId)
+	{
+		RefineEqual(chunk.ProcessId, count, filter.ProcessId, bits);
+	}
+
+	if (filter.MatchParentProcessId)
+	{
+		RefineEqual(chunk.ParentProcessId, count, filter.ParentProcessId, bits);
+	}
+
+	if (filter.MatchThreadId)
+	{
+		RefineEqual(chunk.ThreadId, count, filter.ThreadId, bits);
+	}
+
+	// only chunks straddling a range boundary need the time column
+	if (chunk.MinTime < filter.FromTime || chunk.MaxTime > filter.ToTime)
+	{
+		const auto span = chunk.MaxTime - chunk.MinTime;
+		const auto low  = std::max<LONGLONG>(filter.FromTime, chunk.MinTime) - chunk.MinTime;
+		const auto high = std::min<LONGLONG>(filter.ToTime, chunk.MaxTime) - chunk.MinTime;
+
+		RefineRange(
+			chunk.TimeDelta,
+			count,
+			static_cast<ULONG>(std::min(low, span)),
+			static_cast<ULONG>(std::min(high, span)),
+			bits);
+	}
+
+	auto selected = ExtractRows(bits, count, scratch.Rows.data());
+
+	// text predicates are evaluated last, on the surviving rows only
+	if (!filter.CommandLineContains.empty())
+	{
+		const auto& text = filter.CommandLineContains;
+		const auto rows = scratch.Rows.data();
+		size_t kept = 0;
+
+		for (size_t i = 0; i < selected; ++i)
+		{
+			ULONG length;
+			const auto commandLine = chunk.CommandLine(rows[i], length);
+
+			if (commandLine != nullptr
+				&& std::search(commandLine, commandLine + length, text.begin(), text.end()) != commandLine + length)
+			{
+				rows[kept++] = rows[i];
+			}
+		}
+
+		selected = kept;
+	}
+
+	m_ChunksScanned.fetch_add(1, std::memory_order_relaxed);
+	m_RowsScanned.fetch_add(count, std::memory_order_relaxed);
+	m_RowsMatched.fetch_add(selected, std::memory_order_relaxed);
+
+	if (selected > 0)
+	{
+		visit(worker, chunk, scratch.Rows.data(), selected);
+	}
+}
+
+std::vector<SpawnedProcess> FindSpawnedProcesses(
+	CaptureQuery& query,
+	ULONG parentProcessId,
+	LONGLONG from,
+	LONGLONG to)
+{
+	QueryFilter filter;
+	filter.FromTime             = from;
+	filter.ToTime               = to;
+	filter.MatchType            = TRUE;
+	filter.Type                 = ItemType::ProcessCreate;
+	filter.MatchParentProcessId = TRUE;
+	filter.ParentProcessId      = parentProcessId;
+
+	std::vector<std::vector<SpawnedProcess>> partial(query.WorkerCount());
+
+	query.Scan(filter, [&](size_t worker, const CaptureChunk& chunk, const ULONG* rows, size_t count)
+	{
+		auto& out = partial[worker];
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto row = rows[i];
+
+			ULONG length;
+			const auto commandLine = chunk.CommandLine(row, length);
+
+			out.push_back(SpawnedProcess{
+				chunk.Time(row),
+				chunk.ProcessId[row],
+				commandLine != nullptr ? std::string(commandLine, length) : std::string()
+			});
+		}
+	});
+
+	std::vector<SpawnedProcess> results;
+	for (auto& p : partial)
+	{
+		std::move(p.begin(), p.end(), std::back_inserter(results));
+	}
+
+	std::sort(results.begin(), results.end(), [](const SpawnedProcess& a, const SpawnedProcess& b)
+	{
+		return a.Time < b.Time;
+	});
+
+	return results;
+}
+
+std::vector<QueryEvent> CollectEvents(
+	CaptureQuery& query,
+	const QueryFilter& filter)
+{
+	std::vector<std::vector<QueryEvent>> partial(query.WorkerCount());
+
+	query.Scan(filter, [&](size_t worker, const CaptureChunk& chunk, const ULONG* rows, size_t count)
+	{
+		auto& out = partial[worker];
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto row = rows[i];
+
+			ULONG length;
+			const auto commandLine = chunk.CommandLine(row, length);
+
+			out.push_back(QueryEvent{
+				static_cast<ItemType>(chunk.Type[row]),
+				chunk.Time(row),
+				chunk.ProcessId[row],
+				chunk.ThreadId[row],
+				chunk.ParentProcessId[row],
+				commandLine != nullptr ? std::string(commandLine, length) : std::string()
+			});
+		}
+	});
+
+	std::vector<QueryEvent> results;
+	for (auto& p : partial)
+	{
+		std::move(p.begin(), p.end(), std::back_inserter(results));
+	}
+
+	std::sort(results.begin(), results.end(), [](const QueryEvent& a, const QueryEvent& b)
+	{
+		return a.Time < b.Time;
+	});
+
+	return results;
+}
+
+std::vector<CommandLineCount> TopCommandLines(
+	CaptureQuery& query,
+	size_t limit,
+	LONGLONG from,
+	LONGLONG to)
+{
+	QueryFilter filter;
+	filter.FromTime  = from;
+	filter.ToTime    = to;
+	filter.MatchType = TRUE;
+	filter.Type      = ItemType::ProcessCreate;
+
+	// count per worker, merge once at the end
+	std::vector<std::unordered_map<std::string, ULONGLONG>> partial(query.WorkerCount());
+
+	query.Scan(filter, [&](size_t worker, const CaptureChunk& chunk, const ULONG* rows, size_t count)
+	{
+		auto& counts = partial[worker];
+		std::string key;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			ULONG length;
+			const auto commandLine = chunk.CommandLine(rows[i], length);
+
+			key.assign(commandLine != nullptr ? commandLine : "", length);
+			++counts[key];
+		}
+	});
+
+	auto& merged = partial[0];
+	for (size_t w = 1; w < partial.size(); ++w)
+	{
+		for (auto& entry : partial[w])
+		{
+			merged[entry.first] += entry.second;
+		}
+	}
+
+	std::vector<CommandLineCount> results;
+	results.reserve(merged.size());
+
+	for (auto& entry : merged)
+	{
+		results.push_back(CommandLineCount{ entry.first, entry.second });
+	}
+
+	const auto top = std::min(limit, results.size());
+	std::partial_sort(results.begin(), results.begin() + top, results.end(),
+		[](const CommandLineCount& a, const CommandLineCount& b)
+	{
+		return a.Count > b.Count || (a.Count == b.Count && a.CommandLine < b.CommandLine);
+	});
+
+	results.resize(top);
+
+	return results;
+}
@@ -0,0 +1,138 @@
+// CaptureQuery.h
+// Parallel filtered scans and canned queries over capture files.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "CaptureIndex.h"
+#include "CaptureReader.h"
+#include "WorkStealingPool.h"
+
+// conjunction of the supported predicates; unset fields match everything
+struct QueryFilter
+{
+	LONGLONG FromTime = std::numeric_limits<LONGLONG>::min();
+	LONGLONG ToTime   = std::numeric_limits<LONGLONG>::max();
+
+	BOOL     MatchType            = FALSE;
+	ItemType Type                 = ItemType::None;
+	BOOL     MatchProcessId       = FALSE;
+	ULONG    ProcessId            = 0;
+	BOOL     MatchParentProcessId = FALSE;
+	ULONG    ParentProcessId      = 0;
+	BOOL     MatchThreadId        = FALSE;
+	ULONG    ThreadId             = 0;
+
+	// substring of the UTF-8 command line; empty matches everything
+	std::string CommandLineContains;
+};
+
+struct QueryStats
+{
+	ULONGLONG ChunksTotal;
+	ULONGLONG ChunksPruned;    // chunks ruled out by the secondary index
+	ULONGLONG ChunksScanned;   // chunks whose columns were read
+	ULONGLONG RowsScanned;
+	ULONGLONG RowsMatched;
+};
+
+// invoked once per chunk with matching rows; rows are ascending row
+// numbers within the chunk and are only valid for the call
+using ChunkVisitor = std::function<VOID(size_t worker, const CaptureChunk& chunk, const ULONG* rows, size_t count)>;
+
+// Scans are pushed down in steps: the time range selects chunks from the
+// capture directory, the secondary index (if any) rules out chunks that
+// cannot hold the wanted PID, TID or command line text, and the remaining
+// predicates are evaluated column by column into a selection bitmap
+// before any row is visited.
+class CaptureQuery
+{
+public:
+	CaptureQuery(const CaptureReader& reader, WorkStealingPool& pool);
+
+	// consult an index for chunk pruning; it must outlive the query
+	VOID UseIndex(const CaptureIndex* index)
+	{
+		m_Index = index;
+	}
+
+	VOID Scan(const QueryFilter& filter, const ChunkVisitor& visit);
+
+	size_t WorkerCount() const
+	{
+		return m_Pool.WorkerCount();
+	}
+
+	QueryStats Stats() const;
+
+private:
+	VOID PruneChunks(const QueryFilter& filter, std::vector<size_t>& chunks) const;
+	VOID ScanChunk(const QueryFilter& filter, size_t index, size_t worker, const ChunkVisitor& visit);
+
+	const CaptureReader& m_Reader;
+	WorkStealingPool&    m_Pool;
+	const CaptureIndex*  m_Index;
+
+	// per-worker scratch space for bitmaps and row lists
+	struct Scratch
+	{
+		std::vector<ULONGLONG> Bits;
+		std::vector<ULONG>     Rows;
+	};
+
+	std::vector<Scratch> m_Scratch;
+
+	std::atomic<ULONGLONG> m_ChunksTotal;
+	std::atomic<ULONGLONG> m_ChunksPruned;
+	std::atomic<ULONGLONG> m_ChunksScanned;
+	std::atomic<ULONGLONG> m_RowsScanned;
+	std::atomic<ULONGLONG> m_RowsMatched;
+};
+
+struct SpawnedProcess
+{
+	LONGLONG    Time;
+	ULONG       ProcessId;
+	std::string CommandLine;
+};
+
+// a fully materialized event
+struct QueryEvent
+{
+	ItemType    Type;
+	LONGLONG    Time;
+	ULONG       ProcessId;
+	ULONG       ThreadId;
+	ULONG       ParentProcessId;
+	std::string CommandLine;
+};
+
+struct CommandLineCount
+{
+	std::string CommandLine;
+	ULONGLONG   Count;
+};
+
+// processes created by parentProcessId within [from, to], in time order
+std::vector<SpawnedProcess> FindSpawnedProcesses(
+	CaptureQuery& query,
+	ULONG parentProcessId,
+	LONGLONG from,
+	LONGLONG to);
+
+// every event matching filter, in time order
+std::vector<QueryEvent> CollectEvents(
+	CaptureQuery& query,
+	const QueryFilter& filter);
+
+// the limit most frequently launched command lines within [from, to]
+std::vector<CommandLineCount> TopCommandLines(
+	CaptureQuery& query,
+	size_t limit,
+	LONGLONG from,
+	LONGLONG to);
@@ -0,0 +1,182 @@
+// CaptureReader.cpp
+// Memory-mapped reader for columnar capture files.
+
+#include <cstring>
+
+#include "CaptureReader.h"
+
+BOOL CaptureReader::Open(const char* path)
+{
+	Close();
+
+	if (!m_File.Open(path))
+	{
+		return FALSE;
+	}
+
+	CaptureFileHeader header;
+	if (m_File.Size() < sizeof(header))
+	{
+		Close();
+		return FALSE;
+	}
+
+	std::memcpy(&header, m_File.Data(), sizeof(header));
+	if (std::memcmp(header.Magic, CAPTURE_FILE_MAGIC, sizeof(header.Magic)) != 0
+		|| header.Version != CAPTURE_FILE_VERSION)
+	{
+		Close();
+		return FALSE;
+	}
+
+	// an unfinished capture has no directory; recover it from the chunks
+	if (!LoadDirectory() && !ScanChunks())
+	{
+		Close();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+VOID CaptureReader::Close()
+{
+	m_Directory.clear();
+	m_File.Close();
+}
+
+BOOL CaptureReader::Chunk(size_t index, CaptureChunk& chunk) const
+{
+	if (index >= m_Directory.size())
+	{
+		return FALSE;
+	}
+
+	const auto& footer = m_Directory[index];
+	if (footer.ChunkOffset > m_File.Size() || footer.ChunkSize > m_File.Size() - footer.ChunkOffset)
+	{
+		return FALSE;
+	}
+
+	// the columns are read in place, which needs the chunk 8-byte aligned
+	if (0 != (footer.ChunkOffset & 7))
+	{
+		return FALSE;
+	}
+
+	const auto base = m_File.Data() + footer.ChunkOffset;
+
+	CaptureChunkHeader header;
+	std::memcpy(&header, base, sizeof(header));
+
+	if (header.Magic != CAPTURE_CHUNK_MAGIC || header.EventCount != footer.EventCount)
+	{
+		return FALSE;
+	}
+
+	const auto layout = ComputeChunkLayout(header.EventCount, header.HeapSize);
+	if (layout.Size != footer.ChunkSize)
+	{
+		return FALSE;
+	}
+
+	// column offsets are 8-byte aligned, as is the mapping
+	chunk.EventCount        = header.EventCount;
+	chunk.MinTime           = footer.MinTime;
+	chunk.MaxTime           = footer.MaxTime;
+	chunk.Type              = base + layout.Type;
+	chunk.TimeDelta         = reinterpret_cast<const ULONG*>(base + layout.TimeDelta);
+	chunk.ProcessId         = reinterpret_cast<const ULONG*>(base + layout.ProcessId);
+	chunk.ThreadId          = reinterpret_cast<const ULONG*>(base + layout.ThreadId);
+	chunk.ParentProcessId   = reinterpret_cast<const ULONG*>(base + layout.ParentProcessId);
+	chunk.CommandLineOffset = reinterpret_cast<const ULONG*>(base + layout.CommandLineOffset);
+	chunk.CommandLineLength = reinterpret_cast<const ULONG*>(base + layout.CommandLineLength);
+	chunk.StringHeap        = reinterpret_cast<const char*>(base + layout.StringHeap);
+	chunk.HeapSize          = header.HeapSize;
+
+	return TRUE;
+}
+
+VOID CaptureReader::FindChunks(LONGLONG from, LONGLONG to, std::vector<size_t>& chunks) const
+{
+	for (size_t i = 0; i < m_Directory.size(); ++i)
+	{
+		const auto& footer = m_Directory[i];
+		if (footer.MaxTime >= from && footer.MinTime <= to)
+		{
+			chunks.push_back(i);
+		}
+	}
+}
+
+// read the directory written at close
+BOOL CaptureReader::LoadDirectory()
+{
+	const auto size = m_File.Size();
+	if (size < sizeof(CaptureFileHeader) + sizeof(CaptureTrailer))
+	{
+		return FALSE;
+	}
+
+	CaptureTrailer trailer;
+	std::memcpy(&trailer, m_File.Data() + size - sizeof(trailer), sizeof(trailer));
+
+	if (trailer.Magic != CAPTURE_TRAILER_MAGIC)
+	{
+		return FALSE;
+	}
+
+	const auto directorySize = static_cast<ULONGLONG>(trailer.ChunkCount) * sizeof(CaptureChunkFooter);
+	if (trailer.DirectoryOffset + directorySize + sizeof(trailer) != size)
+	{
+		return FALSE;
+	}
+
+	m_Directory.resize(trailer.ChunkCount);
+	if (trailer.ChunkCount > 0)
+	{
+		std::memcpy(m_Directory.data(), m_File.Data() + trailer.DirectoryOffset, directorySize);
+	}
+
+	return TRUE;
+}
+
+// rebuild the directory by walking chunk headers from the front,
+// stopping at the first incomplete chunk
+BOOL CaptureReader::ScanChunks()
+{
+	const auto size = m_File.Size();
+	ULONGLONG offset = sizeof(CaptureFileHeader);
+
+	m_Directory.clear();
+
+	while (size - offset >= sizeof(CaptureChunkHeader))
+	{
+		CaptureChunkHeader header;
+		std::memcpy(&header, m_File.Data() + offset, sizeof(header));
+
+		if (header.Magic != CAPTURE_CHUNK_MAGIC)
+		{
+			break;
+		}
+
+		const auto layout = ComputeChunkLayout(header.EventCount, header.HeapSize);
+		if (layout.Size > size - offset)
+		{
+			break;
+		}
+
+		CaptureChunkFooter footer;
+		std::memcpy(&footer, m_File.Data() + offset + layout.Footer, sizeof(footer));
+
+		if (footer.Magic != CAPTURE_FOOTER_MAGIC || footer.ChunkOffset != offset)
+		{
+			break;
+		}
+
+		m_Directory.push_back(footer);
+		offset += layout.Size;
+	}
+
+	return TRUE;
+}
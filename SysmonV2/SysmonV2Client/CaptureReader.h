@@ -0,0 +1,82 @@
+// CaptureReader.h
+// Memory-mapped reader for columnar capture files.
+
+#pragma once
+
+#include <vector>
+
+#include "CaptureFormat.h"
+#include "MappedFile.h"
+
+// a view of one chunk's columns, pointing into the mapped file
+struct CaptureChunk
+{
+	ULONG        EventCount;
+	LONGLONG     MinTime;
+	LONGLONG     MaxTime;
+	const UCHAR* Type;
+	const ULONG* TimeDelta;
+	const ULONG* ProcessId;
+	const ULONG* ThreadId;
+	const ULONG* ParentProcessId;
+	const ULONG* CommandLineOffset;
+	const ULONG* CommandLineLength;
+	const char*  StringHeap;
+	ULONG        HeapSize;
+
+	LONGLONG Time(ULONG index) const
+	{
+		return MinTime + TimeDelta[index];
+	}
+
+	// UTF-8 command line of an event (not NUL terminated), nullptr if none
+	const char* CommandLine(ULONG index, ULONG& length) const
+	{
+		const auto offset = CommandLineOffset[index];
+		length = CommandLineLength[index];
+
+		if (0 == length || offset > HeapSize || length > HeapSize - offset)
+		{
+			length = 0;
+			return nullptr;
+		}
+
+		return StringHeap + offset;
+	}
+};
+
+class CaptureReader
+{
+public:
+	BOOL Open(const char* path);
+	VOID Close();
+
+	size_t ChunkCount() const
+	{
+		return m_Directory.size();
+	}
+
+	const CaptureChunkFooter& Footer(size_t index) const
+	{
+		return m_Directory[index];
+	}
+
+	// map the columns of a chunk; fails if the chunk is malformed
+	BOOL Chunk(size_t index, CaptureChunk& chunk) const;
+
+	// chunks that may hold events in [from, to], decided from the
+	// directory alone without touching chunk data
+	VOID FindChunks(LONGLONG from, LONGLONG to, std::vector<size_t>& chunks) const;
+
+	ULONGLONG FileSize() const
+	{
+		return m_File.Size();
+	}
+
+private:
+	BOOL LoadDirectory();
+	BOOL ScanChunks();
+
+	MappedFile                      m_File;
+	std::vector<CaptureChunkFooter> m_Directory;
+};
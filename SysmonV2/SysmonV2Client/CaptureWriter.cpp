@@ -0,0 +1,263 @@
+// CaptureWriter.cpp
+// Writes decoded events to a columnar capture file.
+
+#include <cstring>
+
+#include "CaptureWriter.h"
+#include "TextEncoding.h"
+
+// stdio buffer for the capture file; chunks are written in a few large pieces
+constexpr size_t CAPTURE_WRITE_BUFFER = 1 << 20;
+
+// upper bound on the string heap of a single chunk
+constexpr size_t CAPTURE_MAX_HEAP = 64u << 20;
+
+CaptureWriter::CaptureWriter(ULONG chunkEvents)
+	: m_File(nullptr),
+	m_ChunkEvents(chunkEvents),
+	m_Failed(FALSE),
+	m_Offset(0),
+	m_EventsWritten(0),
+	m_BytesWritten(0),
+	m_MinTime(0),
+	m_MaxTime(0)
+{}
+
+CaptureWriter::~CaptureWriter()
+{
+	Close();
+}
+
+BOOL CaptureWriter::Open(const char* path)
+{
+	m_File = OpenStdioFile(path, "wb");
+	if (nullptr == m_File)
+	{
+		return FALSE;
+	}
+
+	setvbuf(m_File, nullptr, _IOFBF, CAPTURE_WRITE_BUFFER);
+
+	m_Path = path;
+
+	CaptureFileHeader header{};
+	std::memcpy(header.Magic, CAPTURE_FILE_MAGIC, sizeof(header.Magic));
+	header.Version = CAPTURE_FILE_VERSION;
+
+	m_Failed = FALSE;
+	m_Offset = 0;
+	m_Directory.clear();
+
+	WriteBytes(&header, sizeof(header));
+
+	return !m_Failed;
+}
+
+BOOL CaptureWriter::Close()
+{
+	if (nullptr == m_File)
+	{
+		return FALSE;
+	}
+
+	FlushChunk();
+
+	CaptureTrailer trailer{};
+	trailer.DirectoryOffset = m_Offset;
+	trailer.ChunkCount      = static_cast<ULONG>(m_Directory.size());
+	trailer.Magic           = CAPTURE_TRAILER_MAGIC;
+
+	if (!m_Directory.empty())
+	{
+		WriteBytes(m_Directory.data(), m_Directory.size() * sizeof(CaptureChunkFooter));
+	}
+
+	WriteBytes(&trailer, sizeof(trailer));
+
+	if (fclose(m_File) != 0)
+	{
+		m_Failed = TRUE;
+	}
+
+	m_File = nullptr;
+
+	if (m_Index && !m_Failed)
+	{
+		if (!m_Index->Write(CaptureIndexPath(m_Path.c_str()).c_str(), m_Offset))
+		{
+			m_Failed = TRUE;
+		}
+	}
+
+	return !m_Failed;
+}
+
+VOID CaptureWriter::EnableIndex()
+{
+	m_Index.reset(new CaptureIndexBuilder{});
+}
+
+VOID CaptureWriter::Append(const EventRecord& record)
+{
+	if (!m_Type.empty())
+	{
+		// keep every delta within 32 bits of the chunk minimum
+		const auto newMin = record.Time < m_MinTime ? record.Time : m_MinTime;
+		const auto newMax = record.Time > m_MaxTime ? record.Time : m_MaxTime;
+
+		if (newMax - newMin > CAPTURE_MAX_CHUNK_SPAN
+			|| m_Heap.size() + Utf8Capacity(record.CommandLineLength) > CAPTURE_MAX_HEAP)
+		{
+			FlushChunk();
+		}
+	}
+
+	if (m_Type.empty())
+	{
+		m_MinTime = record.Time;
+		m_MaxTime = record.Time;
+	}
+	else
+	{
+		m_MinTime = record.Time < m_MinTime ? record.Time : m_MinTime;
+		m_MaxTime = record.Time > m_MaxTime ? record.Time : m_MaxTime;
+	}
+
+	const auto heapOffset = m_Heap.size();
+	if (record.CommandLineLength > 0)
+	{
+		AppendUtf8(m_Heap, record.CommandLine, record.CommandLineLength);
+	}
+
+	m_Type.push_back(static_cast<UCHAR>(record.Type));
+	m_Time.push_back(record.Time);
+	m_ProcessId.push_back(record.ProcessId);
+	m_ThreadId.push_back(record.ThreadId);
+	m_ParentProcessId.push_back(record.ParentProcessId);
+	m_CommandLineOffset.push_back(static_cast<ULONG>(heapOffset));
+	m_CommandLineLength.push_back(static_cast<ULONG>(m_Heap.size() - heapOffset));
+
+	if (m_Type.size() >= m_ChunkEvents)
+	{
+		FlushChunk();
+	}
+}
+
+VOID CaptureWriter::Consume(const EventRecord* records, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		Append(records[i]);
+	}
+}
+
+VOID CaptureWriter::FlushChunk()
+{
+	const auto count = static_cast<ULONG>(m_Type.size());
+	if (0 == count || nullptr == m_File)
+	{
+		return;
+	}
+
+	const auto heapSize = static_cast<ULONG>(m_Heap.size());
+	const auto layout = ComputeChunkLayout(count, heapSize);
+
+	m_TimeDelta.resize(count);
+	for (ULONG i = 0; i < count; ++i)
+	{
+		m_TimeDelta[i] = static_cast<ULONG>(m_Time[i] - m_MinTime);
+	}
+
+	CaptureChunkHeader header{};
+	header.Magic      = CAPTURE_CHUNK_MAGIC;
+	header.EventCount = count;
+	header.HeapSize   = heapSize;
+
+	CaptureChunkFooter footer{};
+	footer.Magic       = CAPTURE_FOOTER_MAGIC;
+	footer.EventCount  = count;
+	footer.ChunkOffset = m_Offset;
+	footer.ChunkSize   = layout.Size;
+	footer.MinTime     = m_MinTime;
+	footer.MaxTime     = m_MaxTime;
+
+	const size_t column = count * sizeof(ULONG);
+	const size_t columnPad = static_cast<size_t>(CaptureAlign(column) - column);
+
+	WriteBytes(&header, sizeof(header));
+	WriteBytes(m_Type.data(), count);
+	WritePadding(static_cast<size_t>(CaptureAlign(count) - count));
+
+	const ULONG* columns[] = {
+		m_TimeDelta.data(),
+		m_ProcessId.data(),
+		m_ThreadId.data(),
+		m_ParentProcessId.data(),
+		m_CommandLineOffset.data(),
+		m_CommandLineLength.data()
+	};
+
+	for (auto pColumn : columns)
+	{
+		WriteBytes(pColumn, column);
+		WritePadding(columnPad);
+	}
+
+	WriteBytes(m_Heap.data(), heapSize);
+	WritePadding(static_cast<size_t>(CaptureAlign(heapSize) - heapSize));
+	WriteBytes(&footer, sizeof(footer));
+
+	m_Directory.push_back(footer);
+	m_EventsWritten += count;
+
+	if (m_Index)
+	{
+		// index straight from the columns still in memory
+		CaptureChunk view;
+		view.EventCount        = count;
+		view.MinTime           = m_MinTime;
+		view.MaxTime           = m_MaxTime;
+		view.Type              = m_Type.data();
+		view.TimeDelta         = m_TimeDelta.data();
+		view.ProcessId         = m_ProcessId.data();
+		view.ThreadId          = m_ThreadId.data();
+		view.ParentProcessId   = m_ParentProcessId.data();
+		view.CommandLineOffset = m_CommandLineOffset.data();
+		view.CommandLineLength = m_CommandLineLength.data();
+		view.StringHeap        = m_Heap.data();
+		view.HeapSize          = heapSize;
+
+		m_Index->AddChunk(view);
+	}
+
+	m_Type.clear();
+	m_Time.clear();
+	m_ProcessId.clear();
+	m_ThreadId.clear();
+	m_ParentProcessId.clear();
+	m_CommandLineOffset.clear();
+	m_CommandLineLength.clear();
+	m_Heap.clear();
+}
+
+VOID CaptureWriter::WriteBytes(const void* data, size_t size)
+{
+	if (0 == size)
+	{
+		return;
+	}
+
+	if (fwrite(data, 1, size, m_File) != size)
+	{
+		m_Failed = TRUE;
+	}
+
+	m_Offset       += size;
+	m_BytesWritten += size;
+}
+
+VOID CaptureWriter::WritePadding(size_t size)
+{
+	static const UCHAR zeros[8] = {};
+	WriteBytes(zeros, size);
+}
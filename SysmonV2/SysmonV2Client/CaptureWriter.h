@@ -0,0 +1,75 @@
+// CaptureWriter.h
+// Writes decoded events to a columnar capture file.
+
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CaptureFormat.h"
+#include "CaptureIndex.h"
+#include "EventDecoder.h"
+
+// Buffers one chunk of events in column form and writes it out when the
+// chunk is full (or its time span would overflow the delta encoding).
+// Not thread safe; intended to run as a single pipeline consumer.
+class CaptureWriter : public RecordConsumer
+{
+public:
+	explicit CaptureWriter(ULONG chunkEvents = CAPTURE_CHUNK_EVENTS);
+	~CaptureWriter();
+
+	CaptureWriter(const CaptureWriter&) = delete;
+	CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+	BOOL Open(const char* path);
+
+	// also build the secondary index, written next to the capture at
+	// Close(); must be called before Open()
+	VOID EnableIndex();
+
+	// flush the final chunk, write the directory and trailer
+	BOOL Close();
+
+	VOID Append(const EventRecord& record);
+
+	VOID Consume(const EventRecord* records, size_t count) override;
+
+	ULONGLONG EventsWritten() const { return m_EventsWritten; }
+	ULONGLONG BytesWritten() const { return m_BytesWritten; }
+	ULONGLONG IndexBytesWritten() const { return m_Index ? m_Index->BytesWritten() : 0; }
+
+private:
+	VOID FlushChunk();
+	VOID WriteBytes(const void* data, size_t size);
+	VOID WritePadding(size_t size);
+
+	FILE*       m_File;
+	std::string m_Path;
+	ULONG       m_ChunkEvents;
+	BOOL        m_Failed;
+	ULONGLONG   m_Offset;
+	ULONGLONG   m_EventsWritten;
+	ULONGLONG   m_BytesWritten;
+
+	// current chunk, column by column
+	std::vector<UCHAR>    m_Type;
+	std::vector<LONGLONG> m_Time;
+	std::vector<ULONG>    m_ProcessId;
+	std::vector<ULONG>    m_ThreadId;
+	std::vector<ULONG>    m_ParentProcessId;
+	std::vector<ULONG>    m_CommandLineOffset;
+	std::vector<ULONG>    m_CommandLineLength;
+	std::string           m_Heap;
+	LONGLONG              m_MinTime;
+	LONGLONG              m_MaxTime;
+
+	// scratch space for the delta-encoded time column
+	std::vector<ULONG>    m_TimeDelta;
+
+	std::vector<CaptureChunkFooter> m_Directory;
+
+	std::unique_ptr<CaptureIndexBuilder> m_Index;
+};
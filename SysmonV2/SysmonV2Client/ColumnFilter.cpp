@@ -0,0 +1,186 @@
+// ColumnFilter.cpp
+// Vectorized predicate evaluation over capture columns.
+
+#include "ColumnFilter.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define COLUMN_FILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static ULONG LowestSetBit(ULONGLONG word)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanForward(&index, static_cast<unsigned long>(word)))
+	{
+		return index;
+	}
+
+	_BitScanForward(&index, static_cast<unsigned long>(word >> 32));
+	return index + 32;
+#else
+	return static_cast<ULONG>(__builtin_ctzll(word));
+#endif
+}
+
+#ifdef COLUMN_FILTER_SSE2
+
+// compare 64 bytes against value, one result bit per byte
+static ULONGLONG MatchBytes64(const UCHAR* column, __m128i value)
+{
+	ULONGLONG mask = 0;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i * 16));
+		const auto m = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, value)));
+		mask |= static_cast<ULONGLONG>(m) << (i * 16);
+	}
+
+	return mask;
+}
+
+// compare 64 ULONGs against value, one result bit per element
+static ULONGLONG MatchUlongs64(const ULONG* column, __m128i value)
+{
+	ULONGLONG mask = 0;
+
+	for (int i = 0; i < 16; ++i)
+	{
+		const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i * 4));
+		const auto m = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, value))));
+		mask |= static_cast<ULONGLONG>(m) << (i * 4);
+	}
+
+	return mask;
+}
+
+// SSE2 only has signed compares; flipping the sign bit of both sides
+// turns them into unsigned ones
+static ULONGLONG MatchRange64(const ULONG* column, __m128i low, __m128i high)
+{
+	const auto bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+	ULONGLONG mask = 0;
+
+	for (int i = 0; i < 16; ++i)
+	{
+		const auto v = _mm_xor_si128(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i * 4)), bias);
+
+		const auto outside = _mm_or_si128(_mm_cmplt_epi32(v, low), _mm_cmpgt_epi32(v, high));
+		const auto m = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(outside)));
+		mask |= static_cast<ULONGLONG>(~m & 0xF) << (i * 4);
+	}
+
+	return mask;
+}
+
+#endif
+
+VOID SelectEqual(const UCHAR* column, ULONG count, UCHAR value, ULONGLONG* bits)
+{
+	ULONG row = 0;
+
+#ifdef COLUMN_FILTER_SSE2
+	const auto v = _mm_set1_epi8(static_cast<char>(value));
+	for (; row + 64 <= count; row += 64)
+	{
+		bits[row / 64] = MatchBytes64(column + row, v);
+	}
+#endif
+
+	if (row < count)
+	{
+		ULONGLONG mask = 0;
+		for (ULONG i = row; i < count; ++i)
+		{
+			mask |= static_cast<ULONGLONG>(column[i] == value) << (i - row);
+		}
+
+		bits[row / 64] = mask;
+	}
+}
+
+VOID RefineEqual(const ULONG* column, ULONG count, ULONG value, ULONGLONG* bits)
+{
+	ULONG row = 0;
+
+#ifdef COLUMN_FILTER_SSE2
+	const auto v = _mm_set1_epi32(static_cast<int>(value));
+	for (; row + 64 <= count; row += 64)
+	{
+		auto& word = bits[row / 64];
+		if (word != 0)
+		{
+			word &= MatchUlongs64(column + row, v);
+		}
+	}
+#endif
+
+	if (row < count)
+	{
+		ULONGLONG mask = 0;
+		for (ULONG i = row; i < count; ++i)
+		{
+			mask |= static_cast<ULONGLONG>(column[i] == value) << (i - row);
+		}
+
+		bits[row / 64] &= mask;
+	}
+}
+
+VOID RefineRange(const ULONG* column, ULONG count, ULONG low, ULONG high, ULONGLONG* bits)
+{
+	ULONG row = 0;
+
+#ifdef COLUMN_FILTER_SSE2
+	const auto lo = _mm_set1_epi32(static_cast<int>(low ^ 0x80000000u));
+	const auto hi = _mm_set1_epi32(static_cast<int>(high ^ 0x80000000u));
+	for (; row + 64 <= count; row += 64)
+	{
+		auto& word = bits[row / 64];
+		if (word != 0)
+		{
+			word &= MatchRange64(column + row, lo, hi);
+		}
+	}
+#endif
+
+	if (row < count)
+	{
+		ULONGLONG mask = 0;
+		for (ULONG i = row; i < count; ++i)
+		{
+			mask |= static_cast<ULONGLONG>(column[i] >= low && column[i] <= high) << (i - row);
+		}
+
+		bits[row / 64] &= mask;
+	}
+}
+
+size_t ExtractRows(const ULONGLONG* bits, ULONG count, ULONG* rows)
+{
+	size_t selected = 0;
+	const auto words = SelectionWords(count);
+
+	for (size_t w = 0; w < words; ++w)
+	{
+		auto word = bits[w];
+		while (word != 0)
+		{
+			rows[selected++] = static_cast<ULONG>(w * 64 + LowestSetBit(word));
+			word &= word - 1;
+		}
+	}
+
+	return selected;
+}
@@ -0,0 +1,27 @@
+// ColumnFilter.h
+// Vectorized predicate evaluation over capture columns.
+
+#pragma once
+
+#include "Platform.h"
+
+// Predicates are evaluated into a selection bitmap, one bit per row,
+// 64 rows per word. The first predicate assigns the bitmap, later ones
+// AND into it and skip words that are already all zero.
+
+inline size_t SelectionWords(ULONG count)
+{
+	return (static_cast<size_t>(count) + 63) / 64;
+}
+
+// bits[row] = (column[row] == value)
+VOID SelectEqual(const UCHAR* column, ULONG count, UCHAR value, ULONGLONG* bits);
+
+// bits[row] &= (column[row] == value)
+VOID RefineEqual(const ULONG* column, ULONG count, ULONG value, ULONGLONG* bits);
+
+// bits[row] &= (low <= column[row] <= high), unsigned
+VOID RefineRange(const ULONG* column, ULONG count, ULONG low, ULONG high, ULONGLONG* bits);
+
+// write the selected row numbers to rows, returning how many there are
+size_t ExtractRows(const ULONGLONG* bits, ULONG count, ULONG* rows);
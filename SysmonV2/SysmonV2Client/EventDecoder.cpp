@@ -0,0 +1,94 @@
+// EventDecoder.cpp
+// Decoding of raw driver query buffers into fixed-size event records.
+
+#include <cstring>
+
+#include "EventDecoder.h"
+
+// copy a fixed-size item out of the buffer; records are packed
+// back-to-back, so they are not guaranteed to be aligned
+template <typename T>
+static T ReadItem(const UCHAR* buffer)
+{
+	T item;
+	std::memcpy(&item, buffer, sizeof(T));
+	return item;
+}
+
+ULONG DecodeBuffer(const UCHAR* buffer, ULONG size, std::vector<EventRecord>& records)
+{
+	ULONG offset = 0;
+
+	while (size - offset >= sizeof(ItemHeader))
+	{
+		const auto header = ReadItem<ItemHeader>(buffer + offset);
+		if (header.Size < sizeof(ItemHeader) || header.Size > size - offset)
+		{
+			break;
+		}
+
+		EventRecord record{};
+		record.Type = header.Type;
+		record.Time = header.Time.QuadPart;
+
+		switch (header.Type)
+		{
+		case ItemType::ProcessCreate:
+		{
+			if (header.Size < sizeof(ProcessCreateItem))
+			{
+				return offset;
+			}
+
+			const auto item = ReadItem<ProcessCreateItem>(buffer + offset);
+			record.ProcessId       = item.ProcessId;
+			record.ParentProcessId = item.ParentProcessId;
+
+			const ULONG commandLineEnd = item.CommandLineOffset
+				+ static_cast<ULONG>(item.CommandLineLength) * sizeof(WCHAR);
+
+			if (item.CommandLineLength > 0 && commandLineEnd <= header.Size)
+			{
+				record.CommandLine = reinterpret_cast<const WCHAR*>(buffer + offset + item.CommandLineOffset);
+				record.CommandLineLength = item.CommandLineLength;
+			}
+
+			break;
+		}
+		case ItemType::ProcessExit:
+		{
+			if (header.Size < sizeof(ProcessExitItem))
+			{
+				return offset;
+			}
+
+			record.ProcessId = ReadItem<ProcessExitItem>(buffer + offset).ProcessId;
+			break;
+		}
+		case ItemType::ThreadCreate:
+		case ItemType::ThreadExit:
+		{
+			if (header.Size < sizeof(ThreadCreateItem))
+			{
+				return offset;
+			}
+
+			const auto item = ReadItem<ThreadCreateItem>(buffer + offset);
+			record.ProcessId = item.ProcessId;
+			record.ThreadId  = item.ThreadId;
+			break;
+		}
+		default:
+		{
+			// unknown types are skipped using their size
+			offset += header.Size;
+			continue;
+		}
+		}
+
+		records.push_back(record);
+		offset += header.Size;
+	}
+
+	return offset;
+}
@@ -0,0 +1,36 @@
+// EventDecoder.h
+// Decoding of raw driver query buffers into fixed-size event records.
+
+#pragma once
+
+#include <vector>
+
+#include "Platform.h"
+
+// a single decoded event; the command line points into the source buffer
+struct EventRecord
+{
+	ItemType     Type;
+	ULONG        ProcessId;
+	ULONG        ThreadId;
+	ULONG        ParentProcessId;
+	LONGLONG     Time;
+	const WCHAR* CommandLine;
+	USHORT       CommandLineLength;  // in characters
+};
+
+// a stage that receives decoded events; called from a single thread
+class RecordConsumer
+{
+public:
+	virtual ~RecordConsumer() = default;
+
+	virtual VOID Consume(const EventRecord* records, size_t count) = 0;
+
+	// called when no further events are immediately available
+	virtual VOID Idle() {}
+};
+
+// decode every well-formed record in the buffer, appending to records;
+// stops at the first malformed record and returns the number of bytes consumed
+ULONG DecodeBuffer(const UCHAR* buffer, ULONG size, std::vector<EventRecord>& records);
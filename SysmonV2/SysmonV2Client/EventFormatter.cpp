@@ -0,0 +1,178 @@
+// EventFormatter.cpp
+// Batched text formatting of decoded events.
+
+#include <cstring>
+
+#include "EventFormatter.h"
+#include "TextEncoding.h"
+
+constexpr LONGLONG TICKS_PER_MILLISECOND = 10 * 1000;
+constexpr LONGLONG TICKS_PER_SECOND      = 1000 * TICKS_PER_MILLISECOND;
+constexpr LONGLONG SECONDS_PER_DAY       = 24 * 60 * 60;
+
+#define LITERAL(s) s, sizeof(s) - 1
+
+static inline VOID PutTwoDigits(char* out, ULONG value)
+{
+	out[0] = static_cast<char>('0' + value / 10);
+	out[1] = static_cast<char>('0' + value % 10);
+}
+
+/* ----------------------------------------------------------------------------
+ *	TimeFormatter
+ */
+
+VOID TimeFormatter::Format(LONGLONG time, char* out)
+{
+	const auto second = time / TICKS_PER_SECOND;
+	if (second != m_CachedSecond)
+	{
+		const auto secondOfDay = static_cast<ULONG>(second % SECONDS_PER_DAY);
+
+		PutTwoDigits(m_Cached + 0, secondOfDay / 3600);
+		m_Cached[2] = ':';
+		PutTwoDigits(m_Cached + 3, (secondOfDay / 60) % 60);
+		m_Cached[5] = ':';
+		PutTwoDigits(m_Cached + 6, secondOfDay % 60);
+		m_Cached[8] = '.';
+
+		m_CachedSecond = second;
+	}
+
+	const auto millis = static_cast<ULONG>((time / TICKS_PER_MILLISECOND) % 1000);
+
+	std::memcpy(out, m_Cached, sizeof(m_Cached));
+	out[9]  = static_cast<char>('0' + millis / 100);
+	out[10] = static_cast<char>('0' + (millis / 10) % 10);
+	out[11] = static_cast<char>('0' + millis % 10);
+	out[12] = ':';
+	out[13] = ' ';
+}
+
+/* ----------------------------------------------------------------------------
+ *	EventFormatter
+ */
+
+EventFormatter::EventFormatter(OutputSink& sink, size_t flushThreshold)
+	: m_Sink(sink), m_FlushThreshold(flushThreshold)
+{
+	m_Buffer.reserve(flushThreshold + 4096);
+}
+
+VOID EventFormatter::Format(const EventRecord* records, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		FormatOne(records[i]);
+
+		if (m_Buffer.size() >= m_FlushThreshold)
+		{
+			m_Sink.Write(m_Buffer.data(), m_Buffer.size());
+			m_Buffer.clear();
+		}
+	}
+}
+
+VOID EventFormatter::Flush()
+{
+	if (m_Buffer.empty())
+	{
+		return;
+	}
+
+	m_Sink.Write(m_Buffer.data(), m_Buffer.size());
+	m_Buffer.clear();
+
+	m_Sink.Flush();
+}
+
+VOID EventFormatter::FormatOne(const EventRecord& record)
+{
+	switch (record.Type)
+	{
+	case ItemType::ProcessCreate:
+	{
+		const auto start = m_Buffer.size();
+		m_Buffer.resize(start + TimeFormatter::Width);
+		m_Time.Format(record.Time, &m_Buffer[start]);
+
+		AppendLiteral(LITERAL("Process "));
+		AppendNumber(record.ProcessId);
+		AppendLiteral(LITERAL(" Created. Command Line: "));
+		AppendUtf8(m_Buffer, record.CommandLine, record.CommandLineLength);
+		m_Buffer.push_back('\n');
+		break;
+	}
+	case ItemType::ProcessExit:
+	{
+		const auto start = m_Buffer.size();
+		m_Buffer.resize(start + TimeFormatter::Width);
+		m_Time.Format(record.Time, &m_Buffer[start]);
+
+		AppendLiteral(LITERAL("Process "));
+		AppendNumber(record.ProcessId);
+		AppendLiteral(LITERAL(" Exited\n"));
+		break;
+	}
+	case ItemType::ThreadCreate:
+	case ItemType::ThreadExit:
+	{
+		const auto start = m_Buffer.size();
+		m_Buffer.resize(start + TimeFormatter::Width);
+		m_Time.Format(record.Time, &m_Buffer[start]);
+
+		AppendLiteral(LITERAL("Thread "));
+		AppendNumber(record.ThreadId);
+		if (record.Type == ItemType::ThreadCreate)
+		{
+			AppendLiteral(LITERAL(" Created in Process "));
+		}
+		else
+		{
+			AppendLiteral(LITERAL(" Exited from Process "));
+		}
+		AppendNumber(record.ProcessId);
+		m_Buffer.push_back('\n');
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+VOID EventFormatter::AppendNumber(ULONG value)
+{
+	char digits[10];
+	size_t n = 0;
+
+	do
+	{
+		digits[n++] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+
+	while (n > 0)
+	{
+		m_Buffer.push_back(digits[--n]);
+	}
+}
+
+VOID EventFormatter::AppendLiteral(const char* text, size_t length)
+{
+	m_Buffer.append(text, length);
+}
+
+/* ----------------------------------------------------------------------------
+ *	DisplayResults
+ */
+
+VOID DisplayResults(const UCHAR* buffer, ULONG size, OutputSink& sink)
+{
+	std::vector<EventRecord> records;
+	DecodeBuffer(buffer, size, records);
+
+	EventFormatter formatter{ sink };
+
+	formatter.Format(records.data(), records.size());
+	formatter.Flush();
+}
@@ -0,0 +1,88 @@
+// EventFormatter.h
+// Batched text formatting of decoded events.
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "EventDecoder.h"
+
+// destination for formatted output
+class OutputSink
+{
+public:
+	virtual ~OutputSink() = default;
+	virtual VOID Write(const char* data, size_t size) = 0;
+	virtual VOID Flush() {}
+};
+
+// sink over a stdio stream
+class FileSink : public OutputSink
+{
+public:
+	explicit FileSink(FILE* file)
+		: m_File(file) {}
+
+	VOID Write(const char* data, size_t size) override
+	{
+		fwrite(data, 1, size, m_File);
+	}
+
+	VOID Flush() override
+	{
+		fflush(m_File);
+	}
+
+private:
+	FILE* m_File;
+};
+
+// formats event timestamps (UTC, FILETIME units) as "HH:MM:SS.mmm: ",
+// redoing the hours / minutes / seconds only when the second changes
+class TimeFormatter
+{
+public:
+	static constexpr size_t Width = 14;
+
+	// writes exactly Width characters to out
+	VOID Format(LONGLONG time, char* out);
+
+private:
+	LONGLONG m_CachedSecond = -1;
+	char     m_Cached[9];  // "HH:MM:SS."
+};
+
+// formats events into an internal buffer and hands the sink large writes
+class EventFormatter : public RecordConsumer
+{
+public:
+	explicit EventFormatter(OutputSink& sink, size_t flushThreshold = (1 << 16));
+
+	VOID Format(const EventRecord* records, size_t count);
+	VOID Flush();
+
+	VOID Consume(const EventRecord* records, size_t count) override
+	{
+		Format(records, count);
+	}
+
+	VOID Idle() override
+	{
+		Flush();
+	}
+
+private:
+	VOID FormatOne(const EventRecord& record);
+	VOID AppendNumber(ULONG value);
+	VOID AppendLiteral(const char* text, size_t length);
+
+	OutputSink&   m_Sink;
+	size_t        m_FlushThreshold;
+	std::string   m_Buffer;
+	TimeFormatter m_Time;
+};
+
+// decode one driver results buffer and write it to the sink; used by the
+// client for one-shot queries
+VOID DisplayResults(const UCHAR* buffer, ULONG size, OutputSink& sink);
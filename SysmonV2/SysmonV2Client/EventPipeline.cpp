@@ -0,0 +1,167 @@
+// EventPipeline.cpp
+// Reader -> decoder -> consumer pipeline for continuous event streaming.
+
+#include "EventPipeline.h"
+
+EventPipeline::EventPipeline(size_t bufferCount, size_t bufferSize)
+	: m_FreeQueue(bufferCount),
+	m_DecodeQueue(bufferCount),
+	m_ConsumeQueue(bufferCount),
+	m_ReaderDone(false),
+	m_DecoderDone(false),
+	m_StatBuffers(0),
+	m_StatBytes(0),
+	m_StatEvents(0)
+{
+	for (size_t i = 0; i < bufferCount; ++i)
+	{
+		std::unique_ptr<PipelineBuffer> buffer{ new PipelineBuffer{} };
+		buffer->Data.resize(bufferSize);
+		buffer->Size = 0;
+
+		m_FreeQueue.TryPush(buffer.get());
+		m_Buffers.push_back(std::move(buffer));
+	}
+}
+
+EventPipeline::~EventPipeline()
+{
+	Stop();
+}
+
+VOID EventPipeline::AddConsumer(RecordConsumer& consumer)
+{
+	m_Consumers.push_back(&consumer);
+}
+
+VOID EventPipeline::Start()
+{
+	m_ReaderDone  = false;
+	m_DecoderDone = false;
+
+	m_DecodeThread = std::thread(&EventPipeline::DecodeLoop, this);
+	m_ConsumeThread = std::thread(&EventPipeline::ConsumeLoop, this);
+}
+
+VOID EventPipeline::Stop()
+{
+	m_ReaderDone = true;
+
+	if (m_DecodeThread.joinable())
+	{
+		m_DecodeThread.join();
+	}
+
+	if (m_ConsumeThread.joinable())
+	{
+		m_ConsumeThread.join();
+	}
+}
+
+PipelineBuffer* EventPipeline::AcquireBuffer()
+{
+	PipelineBuffer* buffer = nullptr;
+	Backoff backoff;
+
+	while (!m_FreeQueue.TryPop(buffer))
+	{
+		backoff.Pause();
+	}
+
+	buffer->Size = 0;
+	buffer->Records.clear();
+
+	return buffer;
+}
+
+VOID EventPipeline::SubmitBuffer(PipelineBuffer* buffer)
+{
+	// cannot fail: there are never more buffers than queue slots
+	m_DecodeQueue.TryPush(buffer);
+}
+
+PipelineStats EventPipeline::Stats() const
+{
+	return PipelineStats{ m_StatBuffers.load(), m_StatBytes.load(), m_StatEvents.load() };
+}
+
+VOID EventPipeline::DecodeLoop()
+{
+	Backoff backoff;
+
+	while (true)
+	{
+		PipelineBuffer* buffer = nullptr;
+		if (!m_DecodeQueue.TryPop(buffer))
+		{
+			// the reader stopped before we observed an empty queue
+			if (m_ReaderDone && m_DecodeQueue.Empty())
+			{
+				break;
+			}
+
+			backoff.Pause();
+			continue;
+		}
+
+		backoff.Reset();
+
+		DecodeBuffer(buffer->Data.data(), buffer->Size, buffer->Records);
+
+		m_StatBuffers.fetch_add(1, std::memory_order_relaxed);
+		m_StatBytes.fetch_add(buffer->Size, std::memory_order_relaxed);
+		m_StatEvents.fetch_add(buffer->Records.size(), std::memory_order_relaxed);
+
+		m_ConsumeQueue.TryPush(buffer);
+	}
+
+	m_DecoderDone = true;
+}
+
+VOID EventPipeline::ConsumeLoop()
+{
+	Backoff backoff;
+	bool bIdle = true;
+
+	while (true)
+	{
+		PipelineBuffer* buffer = nullptr;
+		if (!m_ConsumeQueue.TryPop(buffer))
+		{
+			if (m_DecoderDone && m_ConsumeQueue.Empty())
+			{
+				break;
+			}
+
+			// nothing in flight; let consumers push out what they have
+			if (!bIdle)
+			{
+				for (auto consumer : m_Consumers)
+				{
+					consumer->Idle();
+				}
+
+				bIdle = true;
+			}
+
+			backoff.Pause();
+			continue;
+		}
+
+		backoff.Reset();
+		bIdle = false;
+
+		for (auto consumer : m_Consumers)
+		{
+			consumer->Consume(buffer->Records.data(), buffer->Records.size());
+		}
+
+		// the records point into the buffer, so recycle it only now
+		m_FreeQueue.TryPush(buffer);
+	}
+
+	for (auto consumer : m_Consumers)
+	{
+		consumer->Idle();
+	}
+}
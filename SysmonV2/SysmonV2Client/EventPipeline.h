@@ -0,0 +1,81 @@
+// EventPipeline.h
+// Reader -> decoder -> consumer pipeline for continuous event streaming.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "EventDecoder.h"
+#include "SpscQueue.h"
+
+// a driver results buffer and the records decoded from it; buffers
+// circulate reader -> decoder -> consumers -> reader
+struct PipelineBuffer
+{
+	std::vector<UCHAR>       Data;
+	ULONG                    Size;
+	std::vector<EventRecord> Records;
+};
+
+struct PipelineStats
+{
+	ULONGLONG Buffers;
+	ULONGLONG Bytes;
+	ULONGLONG Events;
+};
+
+// The reader side runs on the caller's thread (or a thread the caller
+// owns) and is platform specific; decoding and consuming (formatting,
+// recording, ...) each run on a dedicated thread and are not. Stages are
+// connected by bounded SPSC queues, so at most bufferCount driver buffers
+// are ever in flight.
+class EventPipeline
+{
+public:
+	EventPipeline(size_t bufferCount, size_t bufferSize);
+	~EventPipeline();
+
+	EventPipeline(const EventPipeline&) = delete;
+	EventPipeline& operator=(const EventPipeline&) = delete;
+
+	// register a consumer; must be called before Start()
+	VOID AddConsumer(RecordConsumer& consumer);
+
+	VOID Start();
+
+	// drain everything submitted so far, then stop the worker stages
+	VOID Stop();
+
+	// reader side: take an empty buffer, blocking until one is recycled
+	PipelineBuffer* AcquireBuffer();
+
+	// reader side: hand a filled buffer to the decoder
+	VOID SubmitBuffer(PipelineBuffer* buffer);
+
+	PipelineStats Stats() const;
+
+private:
+	VOID DecodeLoop();
+	VOID ConsumeLoop();
+
+	std::vector<std::unique_ptr<PipelineBuffer>> m_Buffers;
+
+	SpscQueue<PipelineBuffer*> m_FreeQueue;     // consumers -> reader
+	SpscQueue<PipelineBuffer*> m_DecodeQueue;   // reader -> decoder
+	SpscQueue<PipelineBuffer*> m_ConsumeQueue;  // decoder -> consumers
+
+	std::vector<RecordConsumer*> m_Consumers;
+
+	std::atomic<bool> m_ReaderDone;
+	std::atomic<bool> m_DecoderDone;
+
+	std::thread       m_DecodeThread;
+	std::thread       m_ConsumeThread;
+
+	std::atomic<ULONGLONG> m_StatBuffers;
+	std::atomic<ULONGLONG> m_StatBytes;
+	std::atomic<ULONGLONG> m_StatEvents;
+};
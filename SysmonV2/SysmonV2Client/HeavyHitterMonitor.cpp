@@ -0,0 +1,139 @@
+// HeavyHitterMonitor.cpp
+// Periodic top-K reports of thread churn and command line launches.
+
+#include "HeavyHitterMonitor.h"
+#include "TextEncoding.h"
+
+// longest command line prefix kept as a label
+constexpr size_t HEAVY_HITTER_LABEL_LENGTH = 120;
+
+HeavyHitterMonitor::HeavyHitterMonitor(OutputSink& sink, const HeavyHitterConfig& config)
+	: m_Sink(sink),
+	m_Config(config),
+	m_ThreadSketch(config.Epsilon, config.Delta),
+	m_ThreadTop(config.TopK),
+	m_LaunchSketch(config.Epsilon, config.Delta),
+	m_LaunchTop(config.TopK),
+	m_IntervalStart(0),
+	m_IntervalEvents(0)
+{}
+
+VOID HeavyHitterMonitor::Consume(const EventRecord* records, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto& record = records[i];
+
+		if (0 == m_IntervalStart)
+		{
+			m_IntervalStart = record.Time;
+		}
+		else if (record.Time - m_IntervalStart >= m_Config.Interval)
+		{
+			Report();
+			m_IntervalStart = record.Time;
+		}
+
+		++m_IntervalEvents;
+
+		switch (record.Type)
+		{
+		case ItemType::ThreadCreate:
+		case ItemType::ThreadExit:
+		{
+			const auto estimate = m_ThreadSketch.Add(record.ProcessId);
+			m_ThreadTop.Offer(record.ProcessId, estimate);
+			break;
+		}
+		case ItemType::ProcessCreate:
+		{
+			// key on the raw UTF-16; convert only when a line enters the top set
+			const auto key = HashBytes(record.CommandLine, record.CommandLineLength * sizeof(WCHAR));
+			const auto estimate = m_LaunchSketch.Add(key);
+
+			auto entry = m_LaunchTop.Offer(key, estimate);
+			if (entry != nullptr && record.CommandLineLength > 0)
+			{
+				const auto length = record.CommandLineLength < HEAVY_HITTER_LABEL_LENGTH
+					? record.CommandLineLength
+					: HEAVY_HITTER_LABEL_LENGTH;
+
+				AppendUtf8(entry->Label, record.CommandLine, length);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+VOID HeavyHitterMonitor::Report()
+{
+	if (0 == m_IntervalEvents)
+	{
+		return;
+	}
+
+	char stamp[TimeFormatter::Width];
+	m_Time.Format(m_IntervalStart, stamp);
+
+	m_Buffer.clear();
+	m_Buffer.append("---- heavy hitters from ");
+	m_Buffer.append(stamp, TimeFormatter::Width - 2);
+	m_Buffer.append(" (");
+	m_Buffer.append(std::to_string(m_IntervalEvents));
+	m_Buffer.append(" events, counts may be high by up to ");
+	m_Buffer.append(std::to_string(static_cast<ULONGLONG>(m_Config.Epsilon * m_IntervalEvents)));
+	m_Buffer.append(") ----\n");
+
+	ReportSection("thread churn by process", m_ThreadTop, FALSE);
+	ReportSection("launches by command line", m_LaunchTop, TRUE);
+
+	m_Sink.Write(m_Buffer.data(), m_Buffer.size());
+	m_Sink.Flush();
+
+	m_ThreadSketch.Clear();
+	m_ThreadTop.Clear();
+	m_LaunchSketch.Clear();
+	m_LaunchTop.Clear();
+
+	m_IntervalEvents = 0;
+}
+
+size_t HeavyHitterMonitor::MemoryBytes() const
+{
+	return m_ThreadSketch.MemoryBytes() + m_LaunchSketch.MemoryBytes();
+}
+
+VOID HeavyHitterMonitor::ReportSection(const char* title, const SpaceSavingTopK& top, BOOL bCommandLines)
+{
+	top.Snapshot(m_Snapshot);
+	if (m_Snapshot.empty())
+	{
+		return;
+	}
+
+	m_Buffer.append(title);
+	m_Buffer.append(":\n");
+
+	for (const auto& entry : m_Snapshot)
+	{
+		m_Buffer.append("  ");
+		m_Buffer.append(std::to_string(entry.Count));
+
+		m_Buffer.append("\t");
+
+		if (bCommandLines)
+		{
+			m_Buffer.append(entry.Label);
+		}
+		else
+		{
+			m_Buffer.append("Process ");
+			m_Buffer.append(std::to_string(entry.Key));
+		}
+
+		m_Buffer.append("\n");
+	}
+}
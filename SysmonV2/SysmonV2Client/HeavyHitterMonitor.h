@@ -0,0 +1,54 @@
+// HeavyHitterMonitor.h
+// Periodic top-K reports of thread churn and command line launches.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "EventFormatter.h"
+#include "HeavyHitters.h"
+
+struct HeavyHitterConfig
+{
+	size_t   TopK     = 10;
+	double   Epsilon  = 0.0005;   // sketch error, as a fraction of events per interval
+	double   Delta    = 0.01;     // probability of exceeding it
+	LONGLONG Interval = 10LL * 1000 * 1000 * 10;  // 100ns units (10 seconds)
+};
+
+// Tracks, per reporting interval of event time, the processes with the
+// most thread creates + exits and the most frequently launched command
+// lines. Memory is fixed by the configuration: two count-min sketches and
+// two top-K sets, whatever the number of distinct keys. At the end of each
+// interval the top entries are written to the sink and everything resets.
+class HeavyHitterMonitor : public RecordConsumer
+{
+public:
+	HeavyHitterMonitor(OutputSink& sink, const HeavyHitterConfig& config = HeavyHitterConfig{});
+
+	VOID Consume(const EventRecord* records, size_t count) override;
+
+	// report the partial interval in progress
+	VOID Report();
+
+	size_t MemoryBytes() const;
+
+private:
+	VOID ReportSection(const char* title, const SpaceSavingTopK& top, BOOL bCommandLines);
+
+	OutputSink&       m_Sink;
+	HeavyHitterConfig m_Config;
+
+	CountMinSketch    m_ThreadSketch;
+	SpaceSavingTopK   m_ThreadTop;
+	CountMinSketch    m_LaunchSketch;
+	SpaceSavingTopK   m_LaunchTop;
+
+	LONGLONG          m_IntervalStart;
+	ULONGLONG         m_IntervalEvents;
+
+	TimeFormatter            m_Time;
+	std::string              m_Buffer;
+	std::vector<HeavyHitter> m_Snapshot;
+};
@@ -0,0 +1,302 @@
+// HeavyHitters.cpp
+// Fixed-memory frequency estimation and top-K tracking for event streams.
+
+#include <algorithm>
+#include <cmath>
+
+#include "HeavyHitters.h"
+
+// heap position of a free table slot
+constexpr ULONG EMPTY_SLOT = 0xFFFFFFFF;
+
+static ULONGLONG MixKey(ULONGLONG key)
+{
+	// splitmix64 finalizer
+	key += 0x9E3779B97F4A7C15ULL;
+	key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+	return key ^ (key >> 31);
+}
+
+ULONGLONG HashBytes(const void* data, size_t size)
+{
+	auto bytes = static_cast<const UCHAR*>(data);
+	ULONGLONG hash = 0xCBF29CE484222325ULL;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/* ----------------------------------------------------------------------------
+ *	Count-Min Sketch
+ */
+
+CountMinSketch::CountMinSketch(double epsilon, double delta)
+{
+	// width e / epsilon bounds the error, depth ln(1 / delta) its probability
+	const auto width = static_cast<size_t>(std::ceil(std::exp(1.0) / epsilon));
+	const auto depth = static_cast<size_t>(std::ceil(std::log(1.0 / delta)));
+
+	m_Width = 1;
+	while (m_Width < width)
+	{
+		m_Width <<= 1;
+	}
+
+	m_Depth = std::min(std::max<size_t>(depth, 1), size_t{ MAX_DEPTH });
+	m_Counters.assign(m_Width * m_Depth, 0);
+}
+
+// each row mixes the key with its own seed, so keys that share a slot in
+// one row are independent in the others; double hashing (h1 + i * h2)
+// would put two keys that agree on h1 and h2 together in every row
+VOID CountMinSketch::Slots(ULONGLONG key, size_t* slots) const
+{
+	for (size_t row = 0; row < m_Depth; ++row)
+	{
+		const auto h = MixKey(key ^ (row * 0xD6E8FEB86659FD93ULL));
+		slots[row] = row * m_Width + (static_cast<size_t>(h) & (m_Width - 1));
+	}
+}
+
+ULONG CountMinSketch::Add(ULONGLONG key, ULONG count)
+{
+	size_t slots[MAX_DEPTH];
+	Slots(key, slots);
+
+	auto estimate = m_Counters[slots[0]];
+	for (size_t row = 1; row < m_Depth; ++row)
+	{
+		estimate = std::min(estimate, m_Counters[slots[row]]);
+	}
+
+	// conservative update: raise only the counters below the new estimate
+	const auto updated = (estimate > 0xFFFFFFFF - count) ? 0xFFFFFFFF : estimate + count;
+
+	for (size_t row = 0; row < m_Depth; ++row)
+	{
+		auto& counter = m_Counters[slots[row]];
+		if (counter < updated)
+		{
+			counter = updated;
+		}
+	}
+
+	return updated;
+}
+
+ULONG CountMinSketch::Estimate(ULONGLONG key) const
+{
+	size_t slots[MAX_DEPTH];
+	Slots(key, slots);
+
+	auto estimate = m_Counters[slots[0]];
+	for (size_t row = 1; row < m_Depth; ++row)
+	{
+		estimate = std::min(estimate, m_Counters[slots[row]]);
+	}
+
+	return estimate;
+}
+
+VOID CountMinSketch::Clear()
+{
+	std::fill(m_Counters.begin(), m_Counters.end(), 0);
+}
+
+/* ----------------------------------------------------------------------------
+ *	Space-Saving Top-K
+ */
+
+SpaceSavingTopK::SpaceSavingTopK(size_t k)
+	: m_Capacity(k)
+{
+	size_t slots = 2;
+	while (slots < 2 * k)
+	{
+		slots <<= 1;
+	}
+
+	m_Heap.reserve(k);
+	m_SlotKeys.assign(slots, 0);
+	m_SlotPositions.assign(slots, EMPTY_SLOT);
+	m_SlotMask = slots - 1;
+}
+
+HeavyHitter* SpaceSavingTopK::Offer(ULONGLONG key, ULONG estimate)
+{
+	if (0 == m_Capacity)
+	{
+		return nullptr;
+	}
+
+	const auto slot = FindSlot(key);
+
+	if (m_SlotPositions[slot] != EMPTY_SLOT)
+	{
+		// estimates only grow, so a monitored key can only sink deeper
+		const auto position = m_SlotPositions[slot];
+		if (estimate > m_Heap[position].Count)
+		{
+			m_Heap[position].Count = estimate;
+			SiftDown(position);
+		}
+
+		return nullptr;
+	}
+
+	if (m_Heap.size() < m_Capacity)
+	{
+		m_Heap.push_back(HeavyHitter{ key, estimate, std::string() });
+		InsertSlot(key, static_cast<ULONG>(m_Heap.size() - 1));
+
+		const auto position = m_Heap.size() - 1;
+		SiftUp(position);
+
+		return &m_Heap[m_SlotPositions[FindSlot(key)]];
+	}
+
+	auto& minimum = m_Heap[0];
+	if (estimate <= minimum.Count)
+	{
+		return nullptr;
+	}
+
+	// replace the minimum; unlike plain space-saving the newcomer does not
+	// inherit the evicted count, since the sketch already estimates it
+	EraseSlot(minimum.Key);
+
+	minimum.Key   = key;
+	minimum.Count = estimate;
+	minimum.Label.clear();
+
+	InsertSlot(key, 0);
+	SiftDown(0);
+
+	return &m_Heap[m_SlotPositions[FindSlot(key)]];
+}
+
+VOID SpaceSavingTopK::Clear()
+{
+	m_Heap.clear();
+	std::fill(m_SlotPositions.begin(), m_SlotPositions.end(), EMPTY_SLOT);
+}
+
+VOID SpaceSavingTopK::Snapshot(std::vector<HeavyHitter>& out) const
+{
+	out.assign(m_Heap.begin(), m_Heap.end());
+
+	std::sort(out.begin(), out.end(), [](const HeavyHitter& a, const HeavyHitter& b)
+	{
+		return a.Count > b.Count;
+	});
+}
+
+size_t SpaceSavingTopK::FindSlot(ULONGLONG key) const
+{
+	auto slot = static_cast<size_t>(MixKey(key)) & m_SlotMask;
+
+	while (m_SlotPositions[slot] != EMPTY_SLOT && m_SlotKeys[slot] != key)
+	{
+		slot = (slot + 1) & m_SlotMask;
+	}
+
+	return slot;
+}
+
+VOID SpaceSavingTopK::InsertSlot(ULONGLONG key, ULONG position)
+{
+	const auto slot = FindSlot(key);
+
+	m_SlotKeys[slot]      = key;
+	m_SlotPositions[slot] = position;
+}
+
+// backward-shift deletion keeps probe sequences intact without tombstones
+VOID SpaceSavingTopK::EraseSlot(ULONGLONG key)
+{
+	auto hole = FindSlot(key);
+	if (EMPTY_SLOT == m_SlotPositions[hole])
+	{
+		return;
+	}
+
+	auto next = (hole + 1) & m_SlotMask;
+	while (m_SlotPositions[next] != EMPTY_SLOT)
+	{
+		const auto home = static_cast<size_t>(MixKey(m_SlotKeys[next])) & m_SlotMask;
+
+		// move next into the hole unless its home lies cyclically in (hole, next]
+		const auto distanceToHole = (next - hole) & m_SlotMask;
+		const auto distanceToHome = (next - home) & m_SlotMask;
+
+		if (distanceToHome >= distanceToHole)
+		{
+			m_SlotKeys[hole]      = m_SlotKeys[next];
+			m_SlotPositions[hole] = m_SlotPositions[next];
+			hole = next;
+		}
+
+		next = (next + 1) & m_SlotMask;
+	}
+
+	m_SlotPositions[hole] = EMPTY_SLOT;
+}
+
+VOID SpaceSavingTopK::SiftUp(size_t position)
+{
+	while (position > 0)
+	{
+		const auto parent = (position - 1) / 2;
+		if (m_Heap[parent].Count <= m_Heap[position].Count)
+		{
+			break;
+		}
+
+		Swap(parent, position);
+		position = parent;
+	}
+}
+
+VOID SpaceSavingTopK::SiftDown(size_t position)
+{
+	const auto size = m_Heap.size();
+
+	while (true)
+	{
+		const auto left = 2 * position + 1;
+		const auto right = left + 1;
+		auto smallest = position;
+
+		if (left < size && m_Heap[left].Count < m_Heap[smallest].Count)
+		{
+			smallest = left;
+		}
+
+		if (right < size && m_Heap[right].Count < m_Heap[smallest].Count)
+		{
+			smallest = right;
+		}
+
+		if (smallest == position)
+		{
+			break;
+		}
+
+		Swap(smallest, position);
+		position = smallest;
+	}
+}
+
+VOID SpaceSavingTopK::Swap(size_t a, size_t b)
+{
+	std::swap(m_Heap[a], m_Heap[b]);
+
+	m_SlotPositions[FindSlot(m_Heap[a].Key)] = static_cast<ULONG>(a);
+	m_SlotPositions[FindSlot(m_Heap[b].Key)] = static_cast<ULONG>(b);
+}
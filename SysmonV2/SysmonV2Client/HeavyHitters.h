@@ -0,0 +1,90 @@
+// HeavyHitters.h
+// Fixed-memory frequency estimation and top-K tracking for event streams.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+
+// Count-min sketch with conservative update. Estimates never undercount;
+// with probability 1 - delta they overcount by at most epsilon * N, N being
+// the total count added since the last Clear().
+class CountMinSketch
+{
+public:
+	CountMinSketch(double epsilon, double delta);
+
+	// add count to key and return its new estimate
+	ULONG Add(ULONGLONG key, ULONG count = 1);
+
+	ULONG Estimate(ULONGLONG key) const;
+
+	VOID Clear();
+
+	size_t Width() const { return m_Width; }
+	size_t Depth() const { return m_Depth; }
+
+	size_t MemoryBytes() const
+	{
+		return m_Counters.size() * sizeof(ULONG);
+	}
+
+private:
+	static constexpr size_t MAX_DEPTH = 16;
+
+	VOID Slots(ULONGLONG key, size_t* slots) const;
+
+	size_t             m_Width;  // power of two
+	size_t             m_Depth;
+	std::vector<ULONG> m_Counters;
+};
+
+struct HeavyHitter
+{
+	ULONGLONG   Key;
+	ULONG       Count;  // estimated count
+	std::string Label;
+};
+
+// Space-saving top-K over externally supplied estimates: the K largest
+// keys are kept in a min-heap, and a key outside the set replaces the
+// minimum once its estimate exceeds it. Keys are located through a
+// fixed-size open addressing table, so memory is set at construction.
+class SpaceSavingTopK
+{
+public:
+	explicit SpaceSavingTopK(size_t k);
+
+	// record the current estimate for key; returns the entry if key was
+	// just admitted (so the caller can label it), nullptr otherwise
+	HeavyHitter* Offer(ULONGLONG key, ULONG estimate);
+
+	VOID Clear();
+
+	// current entries, largest first
+	VOID Snapshot(std::vector<HeavyHitter>& out) const;
+
+	size_t Capacity() const { return m_Capacity; }
+
+private:
+	size_t FindSlot(ULONGLONG key) const;
+	VOID   InsertSlot(ULONGLONG key, ULONG position);
+	VOID   EraseSlot(ULONGLONG key);
+
+	VOID SiftUp(size_t position);
+	VOID SiftDown(size_t position);
+	VOID Swap(size_t a, size_t b);
+
+	size_t                   m_Capacity;
+	std::vector<HeavyHitter> m_Heap;  // min-heap on Count
+
+	// key -> heap position, linear probing, at most half full
+	std::vector<ULONGLONG>   m_SlotKeys;
+	std::vector<ULONG>       m_SlotPositions;
+	size_t                   m_SlotMask;
+};
+
+// 64-bit FNV-1a, used to key command lines without converting them
+ULONGLONG HashBytes(const void* data, size_t size);
@@ -0,0 +1,136 @@
+// MappedFile.cpp
+// Read-only memory mapping of a whole file.
+
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+BOOL MappedFile::Open(const char* path)
+{
+	Close();
+
+	m_hFile = CreateFileA(
+		path,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN,
+		nullptr
+	);
+	if (INVALID_HANDLE_VALUE == m_hFile)
+	{
+		return FALSE;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size) || 0 == size.QuadPart)
+	{
+		Close();
+		return FALSE;
+	}
+
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (nullptr == m_hMapping)
+	{
+		Close();
+		return FALSE;
+	}
+
+	m_Data = static_cast<const UCHAR*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+	if (nullptr == m_Data)
+	{
+		Close();
+		return FALSE;
+	}
+
+	m_Size = static_cast<ULONGLONG>(size.QuadPart);
+
+	return TRUE;
+}
+
+VOID MappedFile::Close()
+{
+	if (m_Data != nullptr)
+	{
+		UnmapViewOfFile(m_Data);
+		m_Data = nullptr;
+	}
+
+	if (m_hMapping != nullptr)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = nullptr;
+	}
+
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	m_Size = 0;
+}
+
+#else
+
+BOOL MappedFile::Open(const char* path)
+{
+	Close();
+
+	m_Fd = open(path, O_RDONLY);
+	if (m_Fd < 0)
+	{
+		return FALSE;
+	}
+
+	struct stat st;
+	if (fstat(m_Fd, &st) != 0 || 0 == st.st_size)
+	{
+		Close();
+		return FALSE;
+	}
+
+	auto data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, m_Fd, 0);
+	if (MAP_FAILED == data)
+	{
+		Close();
+		return FALSE;
+	}
+
+	m_Data = static_cast<const UCHAR*>(data);
+	m_Size = static_cast<ULONGLONG>(st.st_size);
+
+	return TRUE;
+}
+
+VOID MappedFile::Close()
+{
+	if (m_Data != nullptr)
+	{
+		munmap(const_cast<UCHAR*>(m_Data), static_cast<size_t>(m_Size));
+		m_Data = nullptr;
+	}
+
+	if (m_Fd >= 0)
+	{
+		close(m_Fd);
+		m_Fd = -1;
+	}
+
+	m_Size = 0;
+}
+
+#endif
@@ -0,0 +1,33 @@
+// MappedFile.h
+// Read-only memory mapping of a whole file.
+
+#pragma once
+
+#include "Platform.h"
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	BOOL Open(const char* path);
+	VOID Close();
+
+	const UCHAR* Data() const { return m_Data; }
+	ULONGLONG    Size() const { return m_Size; }
+
+private:
+	const UCHAR* m_Data = nullptr;
+	ULONGLONG    m_Size = 0;
+
+#ifdef _WIN32
+	HANDLE m_hFile    = INVALID_HANDLE_VALUE;
+	HANDLE m_hMapping = nullptr;
+#else
+	int    m_Fd       = -1;
+#endif
+};
@@ -0,0 +1,366 @@
+// Metrics.cpp
+// Lock-free counters and histograms, exported as OpenMetrics text files.
+
+#include <chrono>
+#include <cstdio>
+
+#include "Metrics.h"
+
+// event type label values, indexed by ItemType
+static const char* const EVENT_TYPE_LABELS[] = {
+	"none",
+	"process_create",
+	"process_exit",
+	"thread_create",
+	"thread_exit"
+};
+
+constexpr size_t EVENT_TYPE_COUNT = sizeof(EVENT_TYPE_LABELS) / sizeof(EVENT_TYPE_LABELS[0]);
+static_assert(EVENT_TYPE_COUNT == METRIC_EVENT_TYPES, "one label per event type");
+
+static VOID AppendValue(std::string& out, ULONGLONG value)
+{
+	char number[32];
+	snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(value));
+	out.append(number);
+}
+
+static VOID AppendSigned(std::string& out, LONGLONG value)
+{
+	char number[32];
+	snprintf(number, sizeof(number), "%lld", static_cast<long long>(value));
+	out.append(number);
+}
+
+// "name{labels} " or "name "
+static VOID AppendSampleName(std::string& out, const std::string& name, const char* suffix, const std::string& labels)
+{
+	out.append(name);
+	out.append(suffix);
+
+	if (!labels.empty())
+	{
+		out.push_back('{');
+		out.append(labels);
+		out.push_back('}');
+	}
+
+	out.push_back(' ');
+}
+
+/* ----------------------------------------------------------------------------
+ *	Histogram
+ */
+
+MetricHistogram::MetricHistogram(std::vector<ULONGLONG> bounds)
+	: m_Bounds(std::move(bounds)),
+	m_Buckets(new std::atomic<ULONGLONG>[m_Bounds.size() + 1])
+{
+	for (size_t i = 0; i <= m_Bounds.size(); ++i)
+	{
+		m_Buckets[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+VOID MetricHistogram::Observe(ULONGLONG value)
+{
+	// few buckets; a linear scan beats a binary search here
+	size_t bucket = 0;
+	while (bucket < m_Bounds.size() && value > m_Bounds[bucket])
+	{
+		++bucket;
+	}
+
+	m_Buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	m_Sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+VOID MetricHistogram::Snapshot(std::vector<ULONGLONG>& cumulative, ULONGLONG& sum) const
+{
+	cumulative.resize(m_Bounds.size() + 1);
+
+	ULONGLONG running = 0;
+	for (size_t i = 0; i <= m_Bounds.size(); ++i)
+	{
+		running += m_Buckets[i].load(std::memory_order_relaxed);
+		cumulative[i] = running;
+	}
+
+	sum = m_Sum.load(std::memory_order_relaxed);
+}
+
+/* ----------------------------------------------------------------------------
+ *	Registry
+ */
+
+MetricsRegistry::Family& MetricsRegistry::FamilyFor(const std::string& name, const std::string& help, MetricType type)
+{
+	for (auto& family : m_Families)
+	{
+		if (family.Name == name)
+		{
+			return family;
+		}
+	}
+
+	m_Families.push_back(Family{ name, help, type, {} });
+	return m_Families.back();
+}
+
+VOID MetricsRegistry::AddCounter(const std::string& name, const std::string& help, const std::string& labels, const MetricCounter& counter)
+{
+	FamilyFor(name, help, MetricType::Counter).Samples.push_back(Sample{ labels, &counter, nullptr, nullptr });
+}
+
+VOID MetricsRegistry::AddGauge(const std::string& name, const std::string& help, const std::string& labels, const MetricGauge& gauge)
+{
+	FamilyFor(name, help, MetricType::Gauge).Samples.push_back(Sample{ labels, nullptr, &gauge, nullptr });
+}
+
+VOID MetricsRegistry::AddHistogram(const std::string& name, const std::string& help, const MetricHistogram& histogram)
+{
+	FamilyFor(name, help, MetricType::Histogram).Samples.push_back(Sample{ std::string(), nullptr, nullptr, &histogram });
+}
+
+VOID MetricsRegistry::Render(std::string& out) const
+{
+	static const char* const TYPE_NAMES[] = { "counter", "gauge", "histogram" };
+
+	std::vector<ULONGLONG> cumulative;
+
+	for (const auto& family : m_Families)
+	{
+		out.append("# TYPE ");
+		out.append(family.Name);
+		out.push_back(' ');
+		out.append(TYPE_NAMES[static_cast<int>(family.Type)]);
+		out.push_back('\n');
+
+		out.append("# HELP ");
+		out.append(family.Name);
+		out.push_back(' ');
+		out.append(family.Help);
+		out.push_back('\n');
+
+		for (const auto& sample : family.Samples)
+		{
+			switch (family.Type)
+			{
+			case MetricType::Counter:
+				AppendSampleName(out, family.Name, "_total", sample.Labels);
+				AppendValue(out, sample.Counter->Value());
+				out.push_back('\n');
+				break;
+
+			case MetricType::Gauge:
+				AppendSampleName(out, family.Name, "", sample.Labels);
+				AppendSigned(out, sample.Gauge->Value());
+				out.push_back('\n');
+				break;
+
+			case MetricType::Histogram:
+			{
+				ULONGLONG sum = 0;
+				sample.Histogram->Snapshot(cumulative, sum);
+
+				const auto& bounds = sample.Histogram->Bounds();
+				for (size_t i = 0; i <= bounds.size(); ++i)
+				{
+					std::string le = "le=\"";
+					if (i < bounds.size())
+					{
+						AppendValue(le, bounds[i]);
+					}
+					else
+					{
+						le.append("+Inf");
+					}
+					le.push_back('"');
+
+					AppendSampleName(out, family.Name, "_bucket", le);
+					AppendValue(out, cumulative[i]);
+					out.push_back('\n');
+				}
+
+				AppendSampleName(out, family.Name, "_count", sample.Labels);
+				AppendValue(out, cumulative.back());
+				out.push_back('\n');
+
+				AppendSampleName(out, family.Name, "_sum", sample.Labels);
+				AppendValue(out, sum);
+				out.push_back('\n');
+				break;
+			}
+			}
+		}
+	}
+
+	out.append("# EOF\n");
+}
+
+/* ----------------------------------------------------------------------------
+ *	Exporter
+ */
+
+MetricsExporter::MetricsExporter(const MetricsRegistry& registry, std::string path, ULONG intervalMs, CollectCallback collect)
+	: m_Registry(registry),
+	m_Path(std::move(path)),
+	m_IntervalMs(intervalMs > 0 ? intervalMs : 1000),
+	m_Collect(std::move(collect)),
+	m_bStop(FALSE),
+	m_Exports(0),
+	m_Failures(0)
+{
+	m_TempPath = m_Path + ".tmp";
+}
+
+MetricsExporter::~MetricsExporter()
+{
+	Stop();
+}
+
+VOID MetricsExporter::Start()
+{
+	m_bStop = FALSE;
+	m_Thread = std::thread(&MetricsExporter::ExportLoop, this);
+}
+
+VOID MetricsExporter::Stop()
+{
+	if (!m_Thread.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_bStop = TRUE;
+	}
+
+	m_Wake.notify_one();
+	m_Thread.join();
+}
+
+BOOL MetricsExporter::ExportNow()
+{
+	if (m_Collect)
+	{
+		m_Collect();
+	}
+
+	m_Text.clear();
+	m_Registry.Render(m_Text);
+
+	auto file = OpenStdioFile(m_TempPath.c_str(), "wb");
+	if (nullptr == file)
+	{
+		++m_Failures;
+		return FALSE;
+	}
+
+	const auto written = fwrite(m_Text.data(), 1, m_Text.size(), file);
+	const auto closed = fclose(file);
+
+	if (written != m_Text.size() || closed != 0)
+	{
+		++m_Failures;
+		return FALSE;
+	}
+
+	// replace the previous export in one step
+#ifdef _WIN32
+	const BOOL bRenamed = MoveFileExA(m_TempPath.c_str(), m_Path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	const BOOL bRenamed = (0 == rename(m_TempPath.c_str(), m_Path.c_str()));
+#endif
+
+	if (!bRenamed)
+	{
+		++m_Failures;
+		return FALSE;
+	}
+
+	++m_Exports;
+	return TRUE;
+}
+
+VOID MetricsExporter::ExportLoop()
+{
+	std::unique_lock<std::mutex> lock(m_Lock);
+	BOOL bStop = FALSE;
+
+	while (!bStop)
+	{
+		m_Wake.wait_for(lock, std::chrono::milliseconds(m_IntervalMs), [this]()
+		{
+			return m_bStop;
+		});
+
+		// a stop requested while exporting still gets an export of its own,
+		// so the last one always follows Stop()
+		bStop = m_bStop;
+
+		// the lock only guards the stop flag; never hold it while exporting
+		lock.unlock();
+		ExportNow();
+		lock.lock();
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ *	Client Metrics
+ */
+
+ClientMetrics::ClientMetrics()
+	: BufferEvents({ 1, 4, 16, 64, 256, 1024, 4096 })
+{}
+
+VOID ClientMetrics::Register(MetricsRegistry& registry)
+{
+	for (size_t type = 1; type < EVENT_TYPE_COUNT; ++type)
+	{
+		registry.AddCounter(
+			"sysmonv2_events",
+			"Events received from the driver.",
+			std::string("type=\"") + EVENT_TYPE_LABELS[type] + "\"",
+			Events[type]);
+	}
+
+	registry.AddCounter("sysmonv2_buffers", "Driver result buffers decoded.", "", Buffers);
+	registry.AddCounter("sysmonv2_bytes", "Bytes of driver results decoded.", "", Bytes);
+	registry.AddHistogram("sysmonv2_buffer_events", "Events per driver result buffer.", BufferEvents);
+
+	registry.AddGauge("sysmonv2_driver_queue_depth", "Events waiting in the driver queue.", "queue=\"process\"", ProcessQueueDepth);
+	registry.AddGauge("sysmonv2_driver_queue_depth", "Events waiting in the driver queue.", "queue=\"thread\"", ThreadQueueDepth);
+	registry.AddCounter("sysmonv2_driver_dropped", "Events discarded by the driver from a full queue.", "queue=\"process\"", ProcessEventsDropped);
+	registry.AddCounter("sysmonv2_driver_dropped", "Events discarded by the driver from a full queue.", "queue=\"thread\"", ThreadEventsDropped);
+}
+
+/* ----------------------------------------------------------------------------
+ *	Metrics Consumer
+ */
+
+VOID MetricsConsumer::Consume(const EventRecord* records, size_t count)
+{
+	ULONGLONG counts[EVENT_TYPE_COUNT] = {};
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto type = static_cast<size_t>(records[i].Type);
+		if (type < EVENT_TYPE_COUNT)
+		{
+			++counts[type];
+		}
+	}
+
+	for (size_t type = 1; type < EVENT_TYPE_COUNT; ++type)
+	{
+		if (counts[type] > 0)
+		{
+			m_Metrics.Events[type].Add(counts[type]);
+		}
+	}
+
+	// the pipeline hands over one driver buffer per call
+	m_Metrics.BufferEvents.Observe(count);
+}
@@ -0,0 +1,206 @@
+// Metrics.h
+// Lock-free counters and histograms, exported as OpenMetrics text files.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventDecoder.h"
+
+// Monotonic count. Updates are relaxed atomic adds, so any thread may
+// update and the exporter may read at any time without locking.
+class MetricCounter
+{
+public:
+	VOID Add(ULONGLONG value = 1)
+	{
+		m_Value.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	// mirror a count kept elsewhere (e.g. by the driver)
+	VOID Set(ULONGLONG value)
+	{
+		m_Value.store(value, std::memory_order_relaxed);
+	}
+
+	ULONGLONG Value() const
+	{
+		return m_Value.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<ULONGLONG> m_Value{ 0 };
+};
+
+class MetricGauge
+{
+public:
+	VOID Set(LONGLONG value)
+	{
+		m_Value.store(value, std::memory_order_relaxed);
+	}
+
+	LONGLONG Value() const
+	{
+		return m_Value.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<LONGLONG> m_Value{ 0 };
+};
+
+// Fixed-bucket histogram; an observation is one relaxed add to its
+// bucket and one to the sum. Buckets are stored non-cumulatively and
+// accumulated at export, so a reader may see an observation in the
+// buckets slightly before (or after) it shows in the sum.
+class MetricHistogram
+{
+public:
+	// upper bounds, ascending; +Inf is implied
+	explicit MetricHistogram(std::vector<ULONGLONG> bounds);
+
+	VOID Observe(ULONGLONG value);
+
+	const std::vector<ULONGLONG>& Bounds() const { return m_Bounds; }
+
+	// cumulative bucket counts (the last is +Inf, i.e. the total count)
+	VOID Snapshot(std::vector<ULONGLONG>& cumulative, ULONGLONG& sum) const;
+
+private:
+	std::vector<ULONGLONG>                 m_Bounds;
+	std::unique_ptr<std::atomic<ULONGLONG>[]> m_Buckets;
+	std::atomic<ULONGLONG>                 m_Sum{ 0 };
+};
+
+// The set of metrics to export. Metrics are registered once, before
+// export starts, and must outlive the registry; registration is not
+// thread-safe, updates and Render are.
+class MetricsRegistry
+{
+public:
+	// labels are pre-rendered, e.g. "type=\"process_create\"", or empty;
+	// samples sharing a name form one metric family
+	VOID AddCounter(const std::string& name, const std::string& help, const std::string& labels, const MetricCounter& counter);
+	VOID AddGauge(const std::string& name, const std::string& help, const std::string& labels, const MetricGauge& gauge);
+	VOID AddHistogram(const std::string& name, const std::string& help, const MetricHistogram& histogram);
+
+	// append the OpenMetrics text exposition, ending with "# EOF"
+	VOID Render(std::string& out) const;
+
+private:
+	enum class MetricType { Counter, Gauge, Histogram };
+
+	struct Sample
+	{
+		std::string            Labels;
+		const MetricCounter*   Counter;
+		const MetricGauge*     Gauge;
+		const MetricHistogram* Histogram;
+	};
+
+	struct Family
+	{
+		std::string         Name;
+		std::string         Help;
+		MetricType          Type;
+		std::vector<Sample> Samples;
+	};
+
+	Family& FamilyFor(const std::string& name, const std::string& help, MetricType type);
+
+	std::vector<Family> m_Families;
+};
+
+// Periodically renders a registry to a file. Each export is written to
+// "<path>.tmp" and renamed over the target, so a scraper only ever sees
+// a complete file. The collect callback runs on the export thread just
+// before each render, to refresh values that are polled rather than
+// counted (driver queue depths and the like).
+class MetricsExporter
+{
+public:
+	using CollectCallback = std::function<VOID()>;
+
+	MetricsExporter(const MetricsRegistry& registry, std::string path, ULONG intervalMs, CollectCallback collect = nullptr);
+	~MetricsExporter();
+
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	VOID Start();
+
+	// stop the export thread after one final export
+	VOID Stop();
+
+	// export once, now, on the calling thread
+	BOOL ExportNow();
+
+	ULONGLONG Exports() const { return m_Exports; }
+	ULONGLONG Failures() const { return m_Failures; }
+
+private:
+	VOID ExportLoop();
+
+	const MetricsRegistry& m_Registry;
+	std::string            m_Path;
+	std::string            m_TempPath;
+	ULONG                  m_IntervalMs;
+	CollectCallback        m_Collect;
+
+	std::string            m_Text;
+
+	std::mutex              m_Lock;
+	std::condition_variable m_Wake;
+	BOOL                    m_bStop;
+	std::thread             m_Thread;
+
+	std::atomic<ULONGLONG> m_Exports;
+	std::atomic<ULONGLONG> m_Failures;
+};
+
+// ItemType values, including None
+constexpr size_t METRIC_EVENT_TYPES = 5;
+
+// The client's own metrics: events by type, buffers and bytes received,
+// events per buffer, plus the driver's queue depths and drop counts,
+// which are filled in by whoever polls the driver.
+struct ClientMetrics
+{
+	ClientMetrics();
+
+	VOID Register(MetricsRegistry& registry);
+
+	MetricCounter   Events[METRIC_EVENT_TYPES];  // indexed by ItemType
+	MetricCounter   Buffers;
+	MetricCounter   Bytes;
+	MetricHistogram BufferEvents;
+
+	MetricGauge     ProcessQueueDepth;
+	MetricGauge     ThreadQueueDepth;
+	MetricCounter   ProcessEventsDropped;
+	MetricCounter   ThreadEventsDropped;
+};
+
+// Pipeline consumer feeding ClientMetrics. Counts are accumulated per
+// batch and published with one atomic add per counter, so the cost per
+// event is a local increment.
+class MetricsConsumer : public RecordConsumer
+{
+public:
+	explicit MetricsConsumer(ClientMetrics& metrics)
+		: m_Metrics(metrics) {}
+
+	VOID Consume(const EventRecord* records, size_t count) override;
+
+	VOID Idle() override {}
+
+private:
+	ClientMetrics& m_Metrics;
+};
@@ -0,0 +1,195 @@
+// OverlappedReader.cpp
+// Keeps several driver queries in flight, recycling their buffers through
+// a completion port.
+
+#include "OverlappedReader.h"
+
+// how long to wait for a completion before rechecking for stop
+constexpr ULONG QUERY_POLL_MS = 50;
+
+/* ----------------------------------------------------------------------------
+ *	Overlapped Reader
+ */
+
+OverlappedReader::OverlappedReader(EventPipeline& pipeline, QueryPort& port, size_t depth, ULONG queryFlags)
+	: m_Pipeline(pipeline),
+	m_Port(port),
+	m_Requests(depth > 0 ? depth : 1),
+	m_InFlight(0),
+	m_NextQuery(0),
+	m_QueryFlags(queryFlags),
+	m_Stats{}
+{
+	for (size_t i = 0; i < m_Requests.size(); ++i)
+	{
+		m_Requests[i].IoControlCode = 0;
+		m_Requests[i].Input.Flags = 0;
+		m_Requests[i].Slot = static_cast<ULONG>(i);
+		m_Requests[i].Buffer = nullptr;
+	}
+}
+
+BOOL OverlappedReader::Run(const std::atomic<bool>& stop)
+{
+	BOOL bFailed = FALSE;
+	BOOL bCancelled = FALSE;
+
+	for (auto& request : m_Requests)
+	{
+		if (!Issue(request))
+		{
+			bFailed = TRUE;
+			break;
+		}
+	}
+
+	while (m_InFlight > 0)
+	{
+		// stop issuing, and stop waiting on queries that have nothing to return
+		if ((stop || bFailed) && !bCancelled)
+		{
+			m_Port.CancelAll();
+			bCancelled = TRUE;
+		}
+
+		ULONG bytes = 0;
+		BOOL bSuccess = FALSE;
+
+		auto request = m_Port.WaitCompletion(QUERY_POLL_MS, bytes, bSuccess);
+		if (nullptr == request)
+		{
+			continue;
+		}
+
+		--m_InFlight;
+		++m_Stats.Completions;
+
+		if (!bSuccess)
+		{
+			// cancellations during shutdown are expected
+			if (!bCancelled)
+			{
+				bFailed = TRUE;
+			}
+
+			continue;
+		}
+
+		if (bytes > 0)
+		{
+			request->Buffer->Size = bytes;
+			m_Pipeline.SubmitBuffer(request->Buffer);
+			request->Buffer = nullptr;
+		}
+		else
+		{
+			++m_Stats.EmptyCompletions;
+		}
+
+		if (bCancelled)
+		{
+			continue;
+		}
+
+		// reissued at once: the driver holds a query until its queue has
+		// events, so an idle reader simply waits here for completions
+		if (!Issue(*request))
+		{
+			bFailed = TRUE;
+		}
+	}
+
+	return !bFailed;
+}
+
+BOOL OverlappedReader::Issue(PendingQuery& request)
+{
+	if (nullptr == request.Buffer)
+	{
+		// blocks until the consumers hand one back
+		request.Buffer = m_Pipeline.AcquireBuffer();
+	}
+
+	// alternate between the queues so neither starves
+	request.IoControlCode = static_cast<ULONG>(0 == m_NextQuery
+		? IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX
+		: IOCTL_SYSMONV2_QUERY_THREAD_EVENTS);
+	request.Input.Flags = m_QueryFlags;
+	m_NextQuery ^= 1;
+
+	if (!m_Port.Submit(request))
+	{
+		return FALSE;
+	}
+
+	++m_InFlight;
+	return TRUE;
+}
+
+#ifdef _WIN32
+
+/* ----------------------------------------------------------------------------
+ *	Device Query Port
+ */
+
+DeviceQueryPort::DeviceQueryPort(HANDLE hDevice, size_t depth)
+	: m_hDevice(hDevice),
+	m_hPort(CreateIoCompletionPort(hDevice, nullptr, 0, 1)),
+	m_Slots(depth > 0 ? depth : 1)
+{}
+
+DeviceQueryPort::~DeviceQueryPort()
+{
+	if (m_hPort != nullptr)
+	{
+		CloseHandle(m_hPort);
+	}
+}
+
+BOOL DeviceQueryPort::Submit(PendingQuery& request)
+{
+	auto& slot = m_Slots[request.Slot];
+
+	RtlZeroMemory(&slot.Overlapped, sizeof(slot.Overlapped));
+	slot.Request = &request;
+
+	const BOOL bHasInput = (IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX == request.IoControlCode);
+
+	// a query that completes at once still queues a completion packet,
+	// so success and ERROR_IO_PENDING are handled alike
+	const BOOL status = DeviceIoControl(
+		m_hDevice,
+		request.IoControlCode,
+		bHasInput ? static_cast<LPVOID>(&request.Input) : nullptr,
+		bHasInput ? sizeof(request.Input) : 0,
+		static_cast<LPVOID>(request.Buffer->Data.data()),
+		static_cast<DWORD>(request.Buffer->Data.size()),
+		nullptr,
+		&slot.Overlapped
+	);
+
+	return status || ERROR_IO_PENDING == GetLastError();
+}
+
+PendingQuery* DeviceQueryPort::WaitCompletion(ULONG timeoutMs, ULONG& bytes, BOOL& bSuccess)
+{
+	DWORD dwBytes = 0;
+	ULONG_PTR key = 0;
+	LPOVERLAPPED pOverlapped = nullptr;
+
+	bSuccess = GetQueuedCompletionStatus(m_hPort, &dwBytes, &key, &pOverlapped, timeoutMs);
+	if (nullptr == pOverlapped)
+	{
+		return nullptr;
+	}
+
+	bytes = dwBytes;
+	return CONTAINING_RECORD(pOverlapped, Slot, Overlapped)->Request;
+}
+
+VOID DeviceQueryPort::CancelAll()
+{
+	CancelIoEx(m_hDevice, nullptr);
+}
+
+#endif
@@ -0,0 +1,113 @@
+// OverlappedReader.h
+// Keeps several driver queries in flight, recycling their buffers through
+// a completion port.
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "EventPipeline.h"
+
+// one outstanding query: the IOCTL it issues, its input, and the pipeline
+// buffer the driver completes it into
+struct PendingQuery
+{
+	ULONG           IoControlCode;
+	QueryRequest    Input;       // sent with IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX only
+	ULONG           Slot;        // index of the request, for the port's own bookkeeping
+	PipelineBuffer* Buffer;
+};
+
+// Source of asynchronous query completions. On Windows this is an I/O
+// completion port associated with an overlapped device handle; elsewhere
+// it can be any stand-in that completes requests from another thread.
+class QueryPort
+{
+public:
+	virtual ~QueryPort() = default;
+
+	// start filling request.Buffer->Data; FALSE if the query could not be issued
+	virtual BOOL Submit(PendingQuery& request) = 0;
+
+	// wait up to timeoutMs for one completion; nullptr on timeout, otherwise
+	// the request with bytes set and bSuccess FALSE if it failed or was cancelled
+	virtual PendingQuery* WaitCompletion(ULONG timeoutMs, ULONG& bytes, BOOL& bSuccess) = 0;
+
+	// cancel whatever is outstanding; completions are still delivered
+	virtual VOID CancelAll() = 0;
+};
+
+struct OverlappedReaderStats
+{
+	ULONGLONG Completions;
+	ULONGLONG EmptyCompletions;
+};
+
+// Drives a pipeline from a query port with Depth queries outstanding at
+// all times. Each request owns a pipeline buffer while in flight; a
+// completed buffer goes to the decoder and the request is reissued at
+// once with a fresh one, so the driver always has somewhere to put
+// events while earlier buffers are being decoded. The driver pends a
+// query while its queue is empty and completes it as events arrive, so
+// an idle reader blocks on the port rather than polling. Requests
+// alternate between the process and thread queues; process queries
+// carry queryFlags, so command lines are only resolved when asked for.
+//
+// The pipeline must hold at least Depth buffers more than it needs for
+// decoding and consuming, or the reader will stall waiting for them.
+class OverlappedReader
+{
+public:
+	OverlappedReader(EventPipeline& pipeline, QueryPort& port, size_t depth, ULONG queryFlags);
+
+	// run until stop is set and every outstanding request has completed;
+	// FALSE if a query failed before that
+	BOOL Run(const std::atomic<bool>& stop);
+
+	const OverlappedReaderStats& Stats() const { return m_Stats; }
+
+private:
+	BOOL Issue(PendingQuery& request);
+
+	EventPipeline&            m_Pipeline;
+	QueryPort&                m_Port;
+	std::vector<PendingQuery> m_Requests;
+	size_t                    m_InFlight;
+	ULONG                     m_NextQuery;
+	ULONG                     m_QueryFlags;
+	OverlappedReaderStats     m_Stats;
+};
+
+#ifdef _WIN32
+
+// Query port over an I/O completion port. The device handle must have
+// been opened with FILE_FLAG_OVERLAPPED.
+class DeviceQueryPort : public QueryPort
+{
+public:
+	DeviceQueryPort(HANDLE hDevice, size_t depth);
+	~DeviceQueryPort();
+
+	DeviceQueryPort(const DeviceQueryPort&) = delete;
+	DeviceQueryPort& operator=(const DeviceQueryPort&) = delete;
+
+	BOOL IsValid() const { return m_hPort != nullptr; }
+
+	BOOL Submit(PendingQuery& request) override;
+	PendingQuery* WaitCompletion(ULONG timeoutMs, ULONG& bytes, BOOL& bSuccess) override;
+	VOID CancelAll() override;
+
+private:
+	struct Slot
+	{
+		OVERLAPPED    Overlapped;
+		PendingQuery* Request;
+	};
+
+	HANDLE            m_hDevice;
+	HANDLE            m_hPort;
+	std::vector<Slot> m_Slots;
+};
+
+#endif
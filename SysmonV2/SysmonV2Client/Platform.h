@@ -0,0 +1,64 @@
+// Platform.h
+// Windows type definitions for the portions of the client that also build
+// (and are benchmarked) off Windows, from recorded driver buffers.
+
+#pragma once
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <cstdint>
+
+typedef uint8_t  UCHAR;
+typedef uint16_t USHORT;
+typedef uint32_t ULONG;
+typedef int64_t  LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef int      BOOL;
+typedef char16_t WCHAR;
+
+typedef UCHAR*   PUCHAR;
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		ULONG   LowPart;
+		int32_t HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+#ifndef VOID
+#define VOID void
+#endif
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+// for the IOCTL codes in SysmonV2Common.h
+#define METHOD_BUFFERED   0
+#define METHOD_OUT_DIRECT 2
+#define FILE_ANY_ACCESS   0
+
+#endif  // _WIN32
+
+#include <cstdio>
+
+#include "SysmonV2Common.h"
+
+// fopen, without tripping the CRT's deprecation checks on Windows
+inline FILE* OpenStdioFile(const char* path, const char* mode)
+{
+#ifdef _WIN32
+	FILE* file = nullptr;
+	return (0 == fopen_s(&file, path, mode)) ? file : nullptr;
+#else
+	return fopen(path, mode);
+#endif
+}
@@ -0,0 +1,334 @@
+// ProcessTree.cpp
+// Incrementally maintained process tree built from the event stream.
+
+#include "ProcessTree.h"
+#include "TextEncoding.h"
+
+constexpr ULONG INVALID_ARENA_INDEX = 0xFFFFFFFF;
+
+ProcessTree::ProcessTree(LONGLONG retention)
+	: m_Retention(retention),
+	m_Now(0),
+	m_NodeCount(0)
+{}
+
+VOID ProcessTree::Apply(
+	ItemType type,
+	LONGLONG time,
+	ULONG processId,
+	ULONG /* threadId */,
+	ULONG parentProcessId,
+	const char* commandLine,
+	size_t commandLineLength)
+{
+	if (time > m_Now)
+	{
+		m_Now = time;
+	}
+
+	switch (type)
+	{
+	case ItemType::ProcessCreate:
+		OnProcessCreate(time, processId, parentProcessId, commandLine, commandLineLength);
+		break;
+
+	case ItemType::ProcessExit:
+		OnProcessExit(time, processId);
+		break;
+
+	case ItemType::ThreadCreate:
+	case ItemType::ThreadExit:
+	{
+		const auto live = m_Live.find(processId);
+		if (live != m_Live.end())
+		{
+			auto& node = m_Nodes[live->second];
+			if (ItemType::ThreadCreate == type)
+			{
+				++node.ThreadCount;
+			}
+			else if (node.ThreadCount > 0)
+			{
+				--node.ThreadCount;
+			}
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+VOID ProcessTree::Consume(const EventRecord* records, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto& record = records[i];
+
+		m_Scratch.clear();
+		if (record.CommandLineLength > 0)
+		{
+			AppendUtf8(m_Scratch, record.CommandLine, record.CommandLineLength);
+		}
+
+		Apply(
+			record.Type,
+			record.Time,
+			record.ProcessId,
+			record.ThreadId,
+			record.ParentProcessId,
+			m_Scratch.data(),
+			m_Scratch.size());
+	}
+
+	Evict();
+}
+
+VOID ProcessTree::Evict()
+{
+	while (!m_Exited.empty() && m_Exited.front().ExitTime <= m_Now - m_Retention)
+	{
+		const auto entry = m_Exited.front();
+		m_Exited.pop_front();
+
+		// skip entries whose node was already recycled
+		if (m_Nodes[entry.Index].InUse && m_Nodes[entry.Index].Generation == entry.Generation)
+		{
+			TryEvict(entry.Index);
+		}
+	}
+}
+
+const ProcessNode* ProcessTree::Get(ProcessNodeId id) const
+{
+	const auto index = Resolve(id);
+	return INVALID_ARENA_INDEX == index ? nullptr : &m_Nodes[index];
+}
+
+ProcessNodeId ProcessTree::FindLive(ULONG processId) const
+{
+	const auto live = m_Live.find(processId);
+	return live == m_Live.end() ? INVALID_PROCESS_NODE : MakeId(live->second);
+}
+
+ProcessNodeId ProcessTree::Find(ULONG processId, LONGLONG startTime) const
+{
+	const auto it = m_ByKey.find(ProcessKey{ processId, startTime });
+	return it == m_ByKey.end() ? INVALID_PROCESS_NODE : MakeId(it->second);
+}
+
+VOID ProcessTree::Ancestry(ProcessNodeId id, std::vector<ProcessNodeId>& out) const
+{
+	for (auto index = Resolve(id); index != INVALID_ARENA_INDEX; index = m_Nodes[index].Parent)
+	{
+		out.push_back(MakeId(index));
+	}
+}
+
+VOID ProcessTree::Subtree(ProcessNodeId id, std::vector<ProcessNodeId>& out) const
+{
+	const auto root = Resolve(id);
+	if (INVALID_ARENA_INDEX == root)
+	{
+		return;
+	}
+
+	// walk the child/sibling links without an explicit stack
+	auto index = root;
+	while (true)
+	{
+		out.push_back(MakeId(index));
+
+		if (m_Nodes[index].FirstChild != INVALID_ARENA_INDEX)
+		{
+			index = m_Nodes[index].FirstChild;
+			continue;
+		}
+
+		while (index != root && INVALID_ARENA_INDEX == m_Nodes[index].NextSibling)
+		{
+			index = m_Nodes[index].Parent;
+		}
+
+		if (index == root)
+		{
+			return;
+		}
+
+		index = m_Nodes[index].NextSibling;
+	}
+}
+
+VOID ProcessTree::LiveChildren(ProcessNodeId id, std::vector<ProcessNodeId>& out) const
+{
+	const auto parent = Resolve(id);
+	if (INVALID_ARENA_INDEX == parent)
+	{
+		return;
+	}
+
+	for (auto child = m_Nodes[parent].FirstChild; child != INVALID_ARENA_INDEX; child = m_Nodes[child].NextSibling)
+	{
+		if (m_Nodes[child].IsLive())
+		{
+			out.push_back(MakeId(child));
+		}
+	}
+}
+
+VOID ProcessTree::OnProcessCreate(
+	LONGLONG time,
+	ULONG processId,
+	ULONG parentProcessId,
+	const char* commandLine,
+	size_t length)
+{
+	// a live node with this PID means we missed its exit
+	const auto previous = m_Live.find(processId);
+	if (previous != m_Live.end())
+	{
+		MarkExited(previous->second, time);
+		m_Live.erase(previous);
+	}
+
+	auto parent = INVALID_ARENA_INDEX;
+	const auto live = m_Live.find(parentProcessId);
+	if (live != m_Live.end() && m_Nodes[live->second].StartTime <= time)
+	{
+		parent = live->second;
+	}
+
+	const auto index = AllocateNode();
+	auto& node = m_Nodes[index];
+
+	node.ProcessId       = processId;
+	node.ParentProcessId = parentProcessId;
+	node.StartTime       = time;
+	node.ExitTime        = 0;
+	node.ThreadCount     = 0;
+	node.CommandLine.assign(commandLine != nullptr ? commandLine : "", commandLine != nullptr ? length : 0);
+	node.Parent          = parent;
+	node.FirstChild      = INVALID_ARENA_INDEX;
+	node.PrevSibling     = INVALID_ARENA_INDEX;
+	node.NextSibling     = INVALID_ARENA_INDEX;
+
+	if (parent != INVALID_ARENA_INDEX)
+	{
+		auto& p = m_Nodes[parent];
+
+		node.NextSibling = p.FirstChild;
+		if (p.FirstChild != INVALID_ARENA_INDEX)
+		{
+			m_Nodes[p.FirstChild].PrevSibling = index;
+		}
+
+		p.FirstChild = index;
+	}
+
+	m_Live[processId] = index;
+	m_ByKey[ProcessKey{ processId, time }] = index;
+}
+
+VOID ProcessTree::OnProcessExit(LONGLONG time, ULONG processId)
+{
+	const auto live = m_Live.find(processId);
+	if (live == m_Live.end())
+	{
+		// started before the stream; nothing to record
+		return;
+	}
+
+	MarkExited(live->second, time);
+	m_Live.erase(live);
+}
+
+VOID ProcessTree::MarkExited(ULONG index, LONGLONG time)
+{
+	auto& node = m_Nodes[index];
+
+	node.ExitTime = time;
+	node.ThreadCount = 0;
+
+	m_Exited.push_back(ExitEntry{ time, index, node.Generation });
+}
+
+ULONG ProcessTree::AllocateNode()
+{
+	ULONG index;
+
+	if (!m_FreeList.empty())
+	{
+		index = m_FreeList.back();
+		m_FreeList.pop_back();
+	}
+	else
+	{
+		index = static_cast<ULONG>(m_Nodes.size());
+		m_Nodes.emplace_back();
+		m_Nodes.back().Generation = 0;
+	}
+
+	m_Nodes[index].InUse = TRUE;
+	++m_NodeCount;
+
+	return index;
+}
+
+// evict index if its retention expired and it has no retained children,
+// then give its parent the same chance
+VOID ProcessTree::TryEvict(ULONG index)
+{
+	while (index != INVALID_ARENA_INDEX)
+	{
+		auto& node = m_Nodes[index];
+
+		if (node.IsLive()
+			|| node.ExitTime > m_Now - m_Retention
+			|| node.FirstChild != INVALID_ARENA_INDEX)
+		{
+			return;
+		}
+
+		const auto parent = node.Parent;
+
+		// unlink from the parent's child list
+		if (node.PrevSibling != INVALID_ARENA_INDEX)
+		{
+			m_Nodes[node.PrevSibling].NextSibling = node.NextSibling;
+		}
+		else if (parent != INVALID_ARENA_INDEX)
+		{
+			m_Nodes[parent].FirstChild = node.NextSibling;
+		}
+
+		if (node.NextSibling != INVALID_ARENA_INDEX)
+		{
+			m_Nodes[node.NextSibling].PrevSibling = node.PrevSibling;
+		}
+
+		m_ByKey.erase(ProcessKey{ node.ProcessId, node.StartTime });
+
+		node.InUse = FALSE;
+		++node.Generation;
+		std::string().swap(node.CommandLine);
+
+		m_FreeList.push_back(index);
+		--m_NodeCount;
+
+		index = parent;
+	}
+}
+
+ULONG ProcessTree::Resolve(ProcessNodeId id) const
+{
+	const auto index = static_cast<ULONG>(id & 0xFFFFFFFF);
+	const auto generation = static_cast<ULONG>(id >> 32);
+
+	if (index >= m_Nodes.size() || !m_Nodes[index].InUse || m_Nodes[index].Generation != generation)
+	{
+		return INVALID_ARENA_INDEX;
+	}
+
+	return index;
+}
@@ -0,0 +1,160 @@
+// ProcessTree.h
+// Incrementally maintained process tree built from the event stream.
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EventDecoder.h"
+
+// identifies one process instance; stays unique across PID reuse and
+// becomes stale (rather than dangling) once the node is evicted
+typedef ULONGLONG ProcessNodeId;
+
+constexpr ProcessNodeId INVALID_PROCESS_NODE = ~0ULL;
+
+// default time exited processes are kept for, in 100ns units (10 minutes)
+constexpr LONGLONG PROCESS_TREE_DEFAULT_RETENTION = 10LL * 60 * 1000 * 1000 * 10;
+
+struct ProcessNode
+{
+	ULONG       ProcessId;
+	ULONG       ParentProcessId;
+	LONGLONG    StartTime;
+	LONGLONG    ExitTime;      // 0 while running
+	ULONG       ThreadCount;   // live threads seen since the process started
+	std::string CommandLine;   // UTF-8
+
+	BOOL IsLive() const
+	{
+		return 0 == ExitTime;
+	}
+
+private:
+	friend class ProcessTree;
+
+	// arena links, 0xFFFFFFFF when absent
+	ULONG Parent;
+	ULONG FirstChild;
+	ULONG NextSibling;
+	ULONG PrevSibling;
+	ULONG Generation;
+	BOOL  InUse;
+};
+
+// Nodes live in a flat arena and refer to each other by index: each node
+// links to its parent and to a doubly linked list of its children, so
+// ancestry is O(depth), live children O(children) and subtrees O(size).
+//
+// A process is keyed by (PID, start time). The parent of a new process is
+// whichever process currently owns its parent PID, provided that process
+// started first; otherwise (parent exited or predates the stream) the
+// process becomes a root.
+//
+// Exited processes are retained so ancestry of their descendants stays
+// answerable; a node is evicted once it has been exited for longer than
+// the retention window and all of its children have been evicted, which
+// removes whole exited subtrees bottom-up. Not thread safe.
+class ProcessTree : public RecordConsumer
+{
+public:
+	explicit ProcessTree(LONGLONG retention = PROCESS_TREE_DEFAULT_RETENTION);
+
+	// apply one event; commandLine is UTF-8 and may be null
+	VOID Apply(
+		ItemType type,
+		LONGLONG time,
+		ULONG processId,
+		ULONG threadId,
+		ULONG parentProcessId,
+		const char* commandLine,
+		size_t commandLineLength);
+
+	VOID Consume(const EventRecord* records, size_t count) override;
+
+	// evict what has expired as of the newest event time seen
+	VOID Evict();
+
+	const ProcessNode* Get(ProcessNodeId id) const;
+
+	ProcessNodeId FindLive(ULONG processId) const;
+	ProcessNodeId Find(ULONG processId, LONGLONG startTime) const;
+
+	// id first, then parent, grandparent, ... up to the root
+	VOID Ancestry(ProcessNodeId id, std::vector<ProcessNodeId>& out) const;
+
+	// id and all of its retained descendants, depth first
+	VOID Subtree(ProcessNodeId id, std::vector<ProcessNodeId>& out) const;
+
+	VOID LiveChildren(ProcessNodeId id, std::vector<ProcessNodeId>& out) const;
+
+	size_t NodeCount() const
+	{
+		return m_NodeCount;
+	}
+
+	size_t LiveCount() const
+	{
+		return m_Live.size();
+	}
+
+private:
+	struct ProcessKey
+	{
+		ULONG    ProcessId;
+		LONGLONG StartTime;
+
+		bool operator==(const ProcessKey& other) const
+		{
+			return ProcessId == other.ProcessId && StartTime == other.StartTime;
+		}
+	};
+
+	struct ProcessKeyHash
+	{
+		size_t operator()(const ProcessKey& key) const
+		{
+			return std::hash<ULONGLONG>()(
+				(static_cast<ULONGLONG>(key.ProcessId) << 32) ^ static_cast<ULONGLONG>(key.StartTime));
+		}
+	};
+
+	struct ExitEntry
+	{
+		LONGLONG ExitTime;
+		ULONG    Index;
+		ULONG    Generation;
+	};
+
+	VOID OnProcessCreate(LONGLONG time, ULONG processId, ULONG parentProcessId, const char* commandLine, size_t length);
+	VOID OnProcessExit(LONGLONG time, ULONG processId);
+	VOID MarkExited(ULONG index, LONGLONG time);
+
+	ULONG AllocateNode();
+	VOID  TryEvict(ULONG index);
+
+	ULONG Resolve(ProcessNodeId id) const;
+
+	ProcessNodeId MakeId(ULONG index) const
+	{
+		return (static_cast<ULONGLONG>(m_Nodes[index].Generation) << 32) | index;
+	}
+
+	LONGLONG                 m_Retention;
+	LONGLONG                 m_Now;
+	size_t                   m_NodeCount;
+
+	std::vector<ProcessNode> m_Nodes;
+	std::vector<ULONG>       m_FreeList;
+
+	std::unordered_map<ULONG, ULONG>                      m_Live;   // PID -> running instance
+	std::unordered_map<ProcessKey, ULONG, ProcessKeyHash> m_ByKey;  // every retained instance
+
+	// exited processes in exit order, for eviction
+	std::deque<ExitEntry>    m_Exited;
+
+	std::string              m_Scratch;
+};
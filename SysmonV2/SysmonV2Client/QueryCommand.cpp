@@ -0,0 +1,352 @@
+// QueryCommand.cpp
+// Offline commands over recorded captures; no driver required.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "QueryCommand.h"
+#include "CaptureQuery.h"
+#include "EventFormatter.h"
+#include "ProcessTree.h"
+
+static VOID PrintQueryUsage()
+{
+	fprintf(stderr,
+		"usage:\n"
+		"\tquery <capture> spawned <ppid> [<from> <to>]\n"
+		"\tquery <capture> top [<count>] [<from> <to>]\n"
+		"\tquery <capture> pid <pid>\n"
+		"\tquery <capture> grep <text>\n"
+		"\tindex <capture>\n"
+		"\ttree <capture> <pid>\n");
+}
+
+static BOOL ParseTimeRange(int argc, char* argv[], int first, LONGLONG& from, LONGLONG& to)
+{
+	from = std::numeric_limits<LONGLONG>::min();
+	to   = std::numeric_limits<LONGLONG>::max();
+
+	if (argc == first)
+	{
+		return TRUE;
+	}
+
+	if (argc != first + 2)
+	{
+		return FALSE;
+	}
+
+	from = std::strtoll(argv[first], nullptr, 10);
+	to   = std::strtoll(argv[first + 1], nullptr, 10);
+
+	return TRUE;
+}
+
+static const char* ItemTypeName(ItemType type)
+{
+	switch (type)
+	{
+	case ItemType::ProcessCreate: return "ProcessCreate";
+	case ItemType::ProcessExit:   return "ProcessExit";
+	case ItemType::ThreadCreate:  return "ThreadCreate";
+	case ItemType::ThreadExit:    return "ThreadExit";
+	default:                      return "Unknown";
+	}
+}
+
+static VOID PrintEvents(const std::vector<QueryEvent>& events)
+{
+	TimeFormatter times;
+	char stamp[TimeFormatter::Width + 1] = {};
+
+	for (const auto& e : events)
+	{
+		times.Format(e.Time, stamp);
+		printf("%s%-13s pid %u tid %u ppid %u %s\n",
+			stamp,
+			ItemTypeName(e.Type),
+			e.ProcessId,
+			e.ThreadId,
+			e.ParentProcessId,
+			e.CommandLine.c_str());
+	}
+}
+
+static VOID PrintQueryStats(const QueryStats& stats, double seconds)
+{
+	fprintf(stderr,
+		"[+] %llu / %llu chunks pruned by index, %llu scanned, %llu rows scanned, %llu matched in %.3f s (%.1f M rows/s)\n",
+		static_cast<unsigned long long>(stats.ChunksPruned),
+		static_cast<unsigned long long>(stats.ChunksTotal),
+		static_cast<unsigned long long>(stats.ChunksScanned),
+		static_cast<unsigned long long>(stats.RowsScanned),
+		static_cast<unsigned long long>(stats.RowsMatched),
+		seconds,
+		seconds > 0 ? stats.RowsScanned / seconds / 1e6 : 0.0);
+}
+
+int RunQueryCommand(int argc, char* argv[])
+{
+	// argv[0] is the program, argv[1] "query"
+	if (argc < 4)
+	{
+		PrintQueryUsage();
+		return 1;
+	}
+
+	CaptureReader reader;
+	if (!reader.Open(argv[2]))
+	{
+		fprintf(stderr, "[!] Failed to open capture %s\n", argv[2]);
+		return 1;
+	}
+
+	WorkStealingPool pool;
+	CaptureQuery query{ reader, pool };
+
+	CaptureIndex index;
+	if (index.Open(CaptureIndexPath(argv[2]).c_str(), reader))
+	{
+		query.UseIndex(&index);
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	TimeFormatter times;
+	char stamp[TimeFormatter::Width + 1] = {};
+
+	if (0 == std::strcmp(argv[3], "spawned") && argc >= 5)
+	{
+		const auto ppid = static_cast<ULONG>(std::strtoul(argv[4], nullptr, 10));
+
+		LONGLONG from, to;
+		if (!ParseTimeRange(argc, argv, 5, from, to))
+		{
+			PrintQueryUsage();
+			return 1;
+		}
+
+		const auto results = FindSpawnedProcesses(query, ppid, from, to);
+
+		for (const auto& result : results)
+		{
+			times.Format(result.Time, stamp);
+			printf("%s%u %s\n", stamp, result.ProcessId, result.CommandLine.c_str());
+		}
+	}
+	else if (0 == std::strcmp(argv[3], "top"))
+	{
+		size_t limit = 10;
+		int next = 4;
+
+		// an odd argument count means the optional count is present
+		if (argc == 5 || argc == 7)
+		{
+			limit = std::strtoul(argv[4], nullptr, 10);
+			next = 5;
+		}
+
+		LONGLONG from, to;
+		if (!ParseTimeRange(argc, argv, next, from, to))
+		{
+			PrintQueryUsage();
+			return 1;
+		}
+
+		const auto results = TopCommandLines(query, limit, from, to);
+
+		for (const auto& result : results)
+		{
+			printf("%10llu %s\n", static_cast<unsigned long long>(result.Count), result.CommandLine.c_str());
+		}
+	}
+	else if (0 == std::strcmp(argv[3], "pid") && 5 == argc)
+	{
+		QueryFilter filter;
+		filter.MatchProcessId = TRUE;
+		filter.ProcessId      = static_cast<ULONG>(std::strtoul(argv[4], nullptr, 10));
+
+		PrintEvents(CollectEvents(query, filter));
+	}
+	else if (0 == std::strcmp(argv[3], "grep") && 5 == argc)
+	{
+		QueryFilter filter;
+		filter.MatchType           = TRUE;
+		filter.Type                = ItemType::ProcessCreate;
+		filter.CommandLineContains = argv[4];
+
+		PrintEvents(CollectEvents(query, filter));
+	}
+	else
+	{
+		PrintQueryUsage();
+		return 1;
+	}
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	PrintQueryStats(query.Stats(), elapsed.count());
+
+	return 0;
+}
+
+int RunIndexCommand(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		PrintQueryUsage();
+		return 1;
+	}
+
+	CaptureReader reader;
+	if (!reader.Open(argv[2]))
+	{
+		fprintf(stderr, "[!] Failed to open capture %s\n", argv[2]);
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	CaptureIndexBuilder builder;
+	for (size_t i = 0; i < reader.ChunkCount(); ++i)
+	{
+		CaptureChunk chunk;
+		if (!reader.Chunk(i, chunk))
+		{
+			fprintf(stderr, "[!] Malformed chunk %zu\n", i);
+			return 1;
+		}
+
+		builder.AddChunk(chunk);
+	}
+
+	const auto path = CaptureIndexPath(argv[2]);
+	if (!builder.Write(path.c_str(), reader.FileSize()))
+	{
+		fprintf(stderr, "[!] Failed to write index %s\n", path.c_str());
+		return 1;
+	}
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	fprintf(stderr,
+		"[+] Indexed %zu chunks in %.3f s; index is %llu bytes (%.2f%% of capture)\n",
+		reader.ChunkCount(),
+		elapsed.count(),
+		static_cast<unsigned long long>(builder.BytesWritten()),
+		100.0 * builder.BytesWritten() / reader.FileSize());
+
+	return 0;
+}
+
+static VOID PrintProcessNode(const ProcessNode& node, size_t depth)
+{
+	printf("%*s%u%s %s\n",
+		static_cast<int>(depth * 2), "",
+		node.ProcessId,
+		node.IsLive() ? "" : " (exited)",
+		node.CommandLine.c_str());
+}
+
+int RunTreeCommand(int argc, char* argv[])
+{
+	if (argc != 4)
+	{
+		PrintQueryUsage();
+		return 1;
+	}
+
+	CaptureReader reader;
+	if (!reader.Open(argv[2]))
+	{
+		fprintf(stderr, "[!] Failed to open capture %s\n", argv[2]);
+		return 1;
+	}
+
+	const auto target = static_cast<ULONG>(std::strtoul(argv[3], nullptr, 10));
+	LONGLONG targetStart = 0;
+	BOOL bFound = FALSE;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	ProcessTree tree;
+	ULONGLONG events = 0;
+
+	for (size_t i = 0; i < reader.ChunkCount(); ++i)
+	{
+		CaptureChunk chunk;
+		if (!reader.Chunk(i, chunk))
+		{
+			fprintf(stderr, "[!] Malformed chunk %zu\n", i);
+			return 1;
+		}
+
+		for (ULONG row = 0; row < chunk.EventCount; ++row)
+		{
+			const auto type = static_cast<ItemType>(chunk.Type[row]);
+			const auto time = chunk.Time(row);
+
+			ULONG length;
+			const auto commandLine = chunk.CommandLine(row, length);
+
+			tree.Apply(
+				type,
+				time,
+				chunk.ProcessId[row],
+				chunk.ThreadId[row],
+				chunk.ParentProcessId[row],
+				commandLine,
+				length);
+
+			if (ItemType::ProcessCreate == type && target == chunk.ProcessId[row])
+			{
+				targetStart = time;
+				bFound = TRUE;
+			}
+		}
+
+		events += chunk.EventCount;
+		tree.Evict();
+	}
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	const auto id = bFound ? tree.Find(target, targetStart) : INVALID_PROCESS_NODE;
+	if (nullptr == tree.Get(id))
+	{
+		fprintf(stderr, "[-] Process %u is not in the retained tree\n", target);
+	}
+	else
+	{
+		std::vector<ProcessNodeId> ancestry;
+		tree.Ancestry(id, ancestry);
+
+		// root first, each generation indented one step further
+		printf("ancestry:\n");
+		for (size_t i = ancestry.size(); i > 0; --i)
+		{
+			PrintProcessNode(*tree.Get(ancestry[i - 1]), ancestry.size() - i + 1);
+		}
+
+		std::vector<ProcessNodeId> subtree;
+		tree.Subtree(id, subtree);
+
+		printf("descendants:\n");
+		for (auto node : subtree)
+		{
+			std::vector<ProcessNodeId> path;
+			tree.Ancestry(node, path);
+			PrintProcessNode(*tree.Get(node), path.size() - ancestry.size() + 1);
+		}
+	}
+
+	fprintf(stderr,
+		"[+] Replayed %llu events in %.3f s (%.1f M events/s); %zu nodes retained, %zu live\n",
+		static_cast<unsigned long long>(events),
+		elapsed.count(),
+		elapsed.count() > 0 ? events / elapsed.count() / 1e6 : 0.0,
+		tree.NodeCount(),
+		tree.LiveCount());
+
+	return 0;
+}
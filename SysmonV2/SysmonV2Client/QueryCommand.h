@@ -0,0 +1,26 @@
+// QueryCommand.h
+// Offline commands over recorded captures; no driver required.
+
+#pragma once
+
+#include "Platform.h"
+
+// SysmonV2Client query <capture> spawned <ppid> [<from> <to>]
+// SysmonV2Client query <capture> top [<count>] [<from> <to>]
+// SysmonV2Client query <capture> pid <pid>
+// SysmonV2Client query <capture> grep <text>
+//
+// times are FILETIME values (100ns units since 1601, UTC); queries use
+// "<capture>.idx" when it exists and matches the capture
+int RunQueryCommand(int argc, char* argv[]);
+
+// SysmonV2Client index <capture>
+//
+// builds "<capture>.idx" for a capture recorded without one
+int RunIndexCommand(int argc, char* argv[]);
+
+// SysmonV2Client tree <capture> <pid>
+//
+// replays a capture into a process tree and prints the ancestry and
+// retained descendants of the most recent process with that PID
+int RunTreeCommand(int argc, char* argv[]);
@@ -0,0 +1,105 @@
+// SpscQueue.h
+// Bounded single-producer, single-consumer queue connecting pipeline stages.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Fixed-capacity ring of T; exactly one thread may push and exactly one
+// (other) thread may pop. Capacity is rounded up to a power of two.
+template <typename T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(size_t capacity)
+		: m_Mask(RoundUp(capacity) - 1), m_Slots(RoundUp(capacity)), m_Head(0), m_Tail(0)
+	{}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	bool TryPush(const T& value)
+	{
+		const auto tail = m_Tail.load(std::memory_order_relaxed);
+		if (tail - m_Head.load(std::memory_order_acquire) > m_Mask)
+		{
+			return false;
+		}
+
+		m_Slots[tail & m_Mask] = value;
+		m_Tail.store(tail + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	bool TryPop(T& value)
+	{
+		const auto head = m_Head.load(std::memory_order_relaxed);
+		if (head == m_Tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		value = m_Slots[head & m_Mask];
+		m_Head.store(head + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	bool Empty() const
+	{
+		return m_Head.load(std::memory_order_acquire) == m_Tail.load(std::memory_order_acquire);
+	}
+
+private:
+	static size_t RoundUp(size_t n)
+	{
+		size_t p = 1;
+		while (p < n)
+		{
+			p <<= 1;
+		}
+		return p;
+	}
+
+	const size_t   m_Mask;
+	std::vector<T> m_Slots;
+
+	// producer and consumer indices live on separate cache lines
+	alignas(64) std::atomic<size_t> m_Head;
+	alignas(64) std::atomic<size_t> m_Tail;
+};
+
+// Spin briefly, then yield, then sleep; keeps idle stages off the CPU
+// without adding latency while events are flowing.
+class Backoff
+{
+public:
+	void Pause()
+	{
+		if (m_Spins < 64)
+		{
+			++m_Spins;
+		}
+		else if (m_Spins < 128)
+		{
+			++m_Spins;
+			std::this_thread::yield();
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	void Reset()
+	{
+		m_Spins = 0;
+	}
+
+private:
+	unsigned m_Spins = 0;
+};
@@ -4,32 +4,84 @@
 #include <tchar.h>
 #include <windows.h>
 
+#include <atomic>
+#include <cstdlib>
+#include <thread>
 #include <iostream>
 
 #include "SysmonV2Common.h"
+#include "EventPipeline.h"
+#include "CaptureWriter.h"
+#include "HeavyHitterMonitor.h"
+#include "WindowAggregator.h"
+#include "QueryCommand.h"
+#include "OverlappedReader.h"
+#include "Metrics.h"
 
 // 64KB results buffer
 constexpr auto BUFFER_SIZE = (1 << 16);
 
+// follow-mode queries kept outstanding against the driver by default
+constexpr auto FOLLOW_QUERY_DEPTH = 4;
+constexpr auto FOLLOW_QUERY_DEPTH_MAX = 64;
+
+// driver buffers being decoded or consumed, on top of those owned by
+// outstanding queries
+constexpr auto FOLLOW_BUFFER_COUNT = 4;
+
+constexpr auto DEVICE_NAME = "\\\\.\\SysmonV2";
+
+// how often streaming commands rewrite the metrics file
+constexpr auto METRICS_EXPORT_INTERVAL_MS = 1000;
+
+// settings shared by the streaming commands
+struct StreamOptions
+{
+	HANDLE      hDevice;      // synchronous handle, for polling driver stats
+	ULONG       Depth;        // overlapped queries kept in flight
+	ULONG       QueryFlags;   // QUERY_FLAG_* for process queries, set per command
+	std::string MetricsPath;  // OpenMetrics export target, empty for none
+};
+
 constexpr auto STATUS_SUCCESS_I = 0x0;
 constexpr auto STATUS_FAILURE_I = 0x01;
 
 DWORD DoProcessEventQuery(HANDLE hDevice, LPBYTE buffer);
 DWORD DoThreadEventQuery(HANDLE hDevice, LPBYTE buffer);
-
-void DisplayResults(LPBYTE buffer, DWORD size);
-void DisplayTime(const LARGE_INTEGER& time);
+BOOL DoSetCaptureMode(HANDLE hDevice, ULONG flags);
+BOOL DoQueryStats(HANDLE hDevice, QueueStats& stats);
+VOID DoFollowCommand(StreamOptions options);
+VOID DoRecordCommand(StreamOptions options, const char* path);
+VOID DoHeavyHittersCommand(StreamOptions options);
+VOID DoWindowCommand(StreamOptions options);
+BOOL StreamEvents(EventPipeline& pipeline, const StreamOptions& options);
 
 VOID LogInfo(const std::string& msg);
 VOID LogWarning(const std::string& msg);
 VOID LogError(const std::string& msg);
 
-INT _tmain()
+INT _tmain(INT argc, TCHAR* argv[])
 {
+	// offline commands over recorded captures need no driver
+	if (argc > 1 && 0 == _tcscmp(argv[1], _T("query")))
+	{
+		return RunQueryCommand(argc, argv);
+	}
+
+	if (argc > 1 && 0 == _tcscmp(argv[1], _T("index")))
+	{
+		return RunIndexCommand(argc, argv);
+	}
+
+	if (argc > 1 && 0 == _tcscmp(argv[1], _T("tree")))
+	{
+		return RunTreeCommand(argc, argv);
+	}
+
 	LogInfo("SysmonV2 - Improved System Event Monitoring");
 
 	HANDLE hDevice = CreateFile(
-		"\\\\.\\SysmonV2",
+		DEVICE_NAME,
 		GENERIC_READ | GENERIC_WRITE,
 		FILE_SHARE_READ | FILE_SHARE_WRITE,
 		nullptr,
@@ -47,14 +99,24 @@ INT _tmain()
 	LogInfo("Entering command loop; <COMMAND> + ENTER to execute:");
 	LogInfo("\t(p) query PROCESS events");
 	LogInfo("\t(t) query THREAD events");
+	LogInfo("\t(l) toggle LAZY command line capture");
+	LogInfo("\t(f [depth]) FOLLOW all events until ENTER, with depth queries in flight");
+	LogInfo("\t(r <path>) RECORD all events to a capture file until ENTER");
+	LogInfo("\t(h) report HEAVY hitters periodically until ENTER");
+	LogInfo("\t(w) report WINDOWED event rates until ENTER");
+	LogInfo("\t(m [path]) export METRICS to path while streaming; no path to stop");
 
 	DWORD dwBytesReturned;
 	BOOL quit = FALSE;
+	ULONG captureFlags = 0;
+
+	StreamOptions streamOptions{ hDevice, FOLLOW_QUERY_DEPTH, 0, std::string() };
 
 	CHAR cmdBuffer[256];
 	RtlZeroMemory(cmdBuffer, 256);
 
 	LPBYTE resultsBuffer = static_cast<LPBYTE>(HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, BUFFER_SIZE));
+	FileSink consoleSink{ stdout };
 
 	while (!quit)
 	{
@@ -71,7 +133,7 @@ INT _tmain()
 			dwBytesReturned = DoProcessEventQuery(hDevice, resultsBuffer);
 			if (dwBytesReturned > 0)
 			{
-				DisplayResults(resultsBuffer, dwBytesReturned);
+				DisplayResults(resultsBuffer, dwBytesReturned, consoleSink);
 			}
 
 			break;
@@ -84,7 +146,84 @@ INT _tmain()
 			dwBytesReturned = DoThreadEventQuery(hDevice, resultsBuffer);
 			if (dwBytesReturned > 0)
 			{
-				DisplayResults(resultsBuffer, dwBytesReturned);
+				DisplayResults(resultsBuffer, dwBytesReturned, consoleSink);
+			}
+
+			break;
+		}
+		case 'f':
+		case 'F':
+		{
+			auto options = streamOptions;
+
+			options.Depth = static_cast<ULONG>(strtoul(cmdBuffer + 1, nullptr, 10));
+			if (0 == options.Depth || options.Depth > FOLLOW_QUERY_DEPTH_MAX)
+			{
+				options.Depth = FOLLOW_QUERY_DEPTH;
+			}
+
+			LogInfo("Following events; press ENTER to stop...");
+			DoFollowCommand(options);
+			break;
+		}
+		case 'r':
+		case 'R':
+		{
+			const char* path = cmdBuffer + 1;
+			while (' ' == *path)
+			{
+				++path;
+			}
+
+			if ('\0' == *path)
+			{
+				LogWarning("Usage: r <path>");
+				break;
+			}
+
+			LogInfo("Recording events; press ENTER to stop...");
+			DoRecordCommand(streamOptions, path);
+			break;
+		}
+		case 'h':
+		case 'H':
+		{
+			LogInfo("Tracking heavy hitters; press ENTER to stop...");
+			DoHeavyHittersCommand(streamOptions);
+			break;
+		}
+		case 'w':
+		case 'W':
+		{
+			LogInfo("Reporting windowed rates; press ENTER to stop...");
+			DoWindowCommand(streamOptions);
+			break;
+		}
+		case 'm':
+		case 'M':
+		{
+			const char* path = cmdBuffer + 1;
+			while (' ' == *path)
+			{
+				++path;
+			}
+
+			streamOptions.MetricsPath = path;
+			LogInfo(streamOptions.MetricsPath.empty()
+				? "Metrics export DISABLED"
+				: "Metrics will be exported to " + streamOptions.MetricsPath);
+			break;
+		}
+		case 'l':
+		case 'L':
+		{
+			auto newFlags = captureFlags ^ CAPTURE_FLAG_LAZY_COMMAND_LINE;
+			if (DoSetCaptureMode(hDevice, newFlags))
+			{
+				captureFlags = newFlags;
+				LogInfo((captureFlags & CAPTURE_FLAG_LAZY_COMMAND_LINE)
+					? "Lazy command line capture ENABLED"
+					: "Lazy command line capture DISABLED");
 			}
 
 			break;
@@ -102,17 +241,19 @@ INT _tmain()
 	return STATUS_SUCCESS_I;
 }
 
-// perform process event query
+// perform process event query; the results are displayed, so command
+// lines are always wanted
 DWORD DoProcessEventQuery(HANDLE hDevice, LPBYTE buffer)
 {
 	DWORD dwBytesReturned;
+	QueryRequest request{ QUERY_FLAG_COMMAND_LINE };
 
 	// perform the IO
 	BOOL status = DeviceIoControl(
 		hDevice,
-		IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS,
-		nullptr,
-		0,
+		IOCTL_SYSMONV2_QUERY_PROCESS_EVENTS_EX,
+		static_cast<LPVOID>(&request),
+		sizeof(request),
 		static_cast<LPVOID>(buffer),
 		BUFFER_SIZE,
 		&dwBytesReturned,
@@ -154,60 +295,239 @@ DWORD DoThreadEventQuery(HANDLE hDevice, LPBYTE buffer)
 	return dwBytesReturned;
 }
 
-// display information recvd from driver query
-void DisplayResults(LPBYTE buffer, DWORD size)
+// set the driver's capture mode flags
+BOOL DoSetCaptureMode(HANDLE hDevice, ULONG flags)
 {
-	auto bufferRemaining = size;
-	while (bufferRemaining > 0)
+	DWORD dwBytesReturned;
+	CaptureModeRequest request{ flags };
+
+	BOOL status = DeviceIoControl(
+		hDevice,
+		IOCTL_SYSMONV2_SET_CAPTURE_MODE,
+		static_cast<LPVOID>(&request),
+		sizeof(request),
+		nullptr,
+		0,
+		&dwBytesReturned,
+		nullptr
+	);
+
+	if (!status)
 	{
-		auto header = reinterpret_cast<ItemHeader*>(buffer);
+		LogError("Failed to set capture mode (DeviceIoControl())");
+	}
 
-		switch (header->Type) {
-		case ItemType::ProcessCreate:
-		{
-			auto pItem = reinterpret_cast<ProcessCreateItem*>(buffer);
-			DisplayTime(pItem->Time);
-			std::wstring commandLine{ reinterpret_cast<WCHAR*>(buffer) + pItem->CommandLineOffset };
-			printf("Process %d Created. Command Line: %ws\n", pItem->ProcessId, commandLine.c_str());
-			break;
-		}
-		case ItemType::ProcessExit:
+	return status;
+}
+
+// snapshot the driver's queue depths and drop counts
+BOOL DoQueryStats(HANDLE hDevice, QueueStats& stats)
+{
+	DWORD dwBytesReturned;
+
+	BOOL status = DeviceIoControl(
+		hDevice,
+		IOCTL_SYSMONV2_QUERY_STATS,
+		nullptr,
+		0,
+		static_cast<LPVOID>(&stats),
+		sizeof(stats),
+		&dwBytesReturned,
+		nullptr
+	);
+
+	return status && dwBytesReturned >= sizeof(stats);
+}
+
+// continuously stream events to the console until the user presses ENTER
+VOID DoFollowCommand(StreamOptions options)
+{
+	options.QueryFlags = QUERY_FLAG_COMMAND_LINE;
+
+	FileSink sink{ stdout };
+	EventFormatter formatter{ sink };
+	EventPipeline pipeline{ options.Depth + FOLLOW_BUFFER_COUNT, BUFFER_SIZE };
+
+	pipeline.AddConsumer(formatter);
+	StreamEvents(pipeline, options);
+
+	const auto stats = pipeline.Stats();
+	LogInfo("Follow stopped: " 
+		+ std::to_string(stats.Events) + " events, " 
+		+ std::to_string(stats.Bytes) + " bytes in " 
+		+ std::to_string(stats.Buffers) + " buffers");
+}
+
+// continuously stream events into a columnar capture file until the
+// user presses ENTER
+VOID DoRecordCommand(StreamOptions options, const char* path)
+{
+	options.QueryFlags = QUERY_FLAG_COMMAND_LINE;
+
+	CaptureWriter writer;
+	writer.EnableIndex();
+
+	if (!writer.Open(path))
+	{
+		LogError("Failed to open capture file");
+		return;
+	}
+
+	EventPipeline pipeline{ options.Depth + FOLLOW_BUFFER_COUNT, BUFFER_SIZE };
+
+	pipeline.AddConsumer(writer);
+	StreamEvents(pipeline, options);
+
+	if (!writer.Close())
+	{
+		LogError("Failed to finalize capture file");
+		return;
+	}
+
+	LogInfo("Recording stopped: " 
+		+ std::to_string(writer.EventsWritten()) + " events, " 
+		+ std::to_string(writer.BytesWritten()) + " bytes written, "
+		+ std::to_string(writer.IndexBytesWritten()) + " bytes of index");
+}
+
+// continuously report the busiest processes and command lines until
+// the user presses ENTER
+VOID DoHeavyHittersCommand(StreamOptions options)
+{
+	// command lines are tracked alongside processes
+	options.QueryFlags = QUERY_FLAG_COMMAND_LINE;
+
+	FileSink sink{ stdout };
+	HeavyHitterMonitor monitor{ sink };
+	EventPipeline pipeline{ options.Depth + FOLLOW_BUFFER_COUNT, BUFFER_SIZE };
+
+	pipeline.AddConsumer(monitor);
+	StreamEvents(pipeline, options);
+
+	monitor.Report();
+}
+
+// continuously report sliding window event rates until the user
+// presses ENTER
+VOID DoWindowCommand(StreamOptions options)
+{
+	// rates only; lazily captured command lines are never resolved
+	options.QueryFlags = 0;
+
+	FileSink sink{ stdout };
+	WindowMonitor monitor{ sink };
+	EventPipeline pipeline{ options.Depth + FOLLOW_BUFFER_COUNT, BUFFER_SIZE };
+
+	monitor.AddDefaultWindows();
+
+	pipeline.AddConsumer(monitor);
+	StreamEvents(pipeline, options);
+}
+
+// drive a pipeline from the driver until the user presses ENTER; a
+// reader thread keeps depth overlapped queries outstanding on a handle
+// of its own while the decoder and consumer stages work through earlier
+// buffers; with a metrics path set, metrics are exported alongside
+BOOL StreamEvents(EventPipeline& pipeline, const StreamOptions& options)
+{
+	HANDLE hDevice = CreateFile(
+		DEVICE_NAME,
+		GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_FLAG_OVERLAPPED,
+		nullptr
+	);
+	if (INVALID_HANDLE_VALUE == hDevice)
+	{
+		LogError("Failed to open SysmonV2 device for overlapped I/O (CreateFile())");
+		return FALSE;
+	}
+
+	DeviceQueryPort port{ hDevice, options.Depth };
+	if (!port.IsValid())
+	{
+		LogError("Failed to create completion port (CreateIoCompletionPort())");
+		CloseHandle(hDevice);
+		return FALSE;
+	}
+
+	// counted on the consumer thread; driver stats and pipeline totals
+	// are polled by the exporter just before each export
+	ClientMetrics metrics;
+	MetricsConsumer metricsConsumer{ metrics };
+	MetricsRegistry registry;
+	std::unique_ptr<MetricsExporter> exporter;
+
+	if (!options.MetricsPath.empty())
+	{
+		metrics.Register(registry);
+		pipeline.AddConsumer(metricsConsumer);
+
+		exporter.reset(new MetricsExporter(registry, options.MetricsPath, METRICS_EXPORT_INTERVAL_MS, [&]()
 		{
-			auto pItem = reinterpret_cast<ProcessExitItem*>(buffer);
-			DisplayTime(pItem->Time);
-			printf("Process %d Exited\n", pItem->ProcessId);
-			break;
-		}
-		case ItemType::ThreadCreate:
+			const auto totals = pipeline.Stats();
+			metrics.Buffers.Set(totals.Buffers);
+			metrics.Bytes.Set(totals.Bytes);
+
+			QueueStats driverStats;
+			if (DoQueryStats(options.hDevice, driverStats))
+			{
+				metrics.ProcessQueueDepth.Set(driverStats.ProcessQueueDepth);
+				metrics.ThreadQueueDepth.Set(driverStats.ThreadQueueDepth);
+				metrics.ProcessEventsDropped.Set(driverStats.ProcessEventsDropped);
+				metrics.ThreadEventsDropped.Set(driverStats.ThreadEventsDropped);
+			}
+		}));
+	}
+
+	OverlappedReader reader{ pipeline, port, options.Depth, options.QueryFlags };
+	std::atomic<bool> stop{ false };
+	BOOL bSuccess = TRUE;
+
+	pipeline.Start();
+
+	if (exporter)
+	{
+		exporter->Start();
+	}
+
+	std::thread readerThread([&]()
+	{
+		bSuccess = reader.Run(stop);
+		if (!bSuccess)
 		{
-			auto pItem = reinterpret_cast<ThreadCreateItem*>(buffer);
-			DisplayTime(pItem->Time);
-			printf("Thread %d Created in Process %d\n", pItem->ThreadId, pItem->ProcessId);
-			break;
+			LogError("Failed to query events (DeviceIoControl())");
 		}
+	});
+
+	CHAR line[16];
+	std::cin.getline(line, sizeof(line));
+
+	stop = true;
+	readerThread.join();
+	pipeline.Stop();
+
+	// final export reflects everything drained above
+	if (exporter)
+	{
+		exporter->Stop();
 
-		case ItemType::ThreadExit:
+		if (exporter->Failures() > 0)
 		{
-			auto pItem = reinterpret_cast<ThreadExitItem*>(buffer);
-			DisplayTime(pItem->Time);
-			printf("Thread %d Exited from Process %d\n", pItem->ThreadId, pItem->ProcessId);
-			break;
+			LogWarning(std::to_string(exporter->Failures()) + " metrics exports failed");
 		}
-		default:
-			break;
-		}
-
-		buffer          += header->Size;
-		bufferRemaining -= header->Size;
 	}
-}
 
-// disiplay time in human-readable format
-void DisplayTime(const LARGE_INTEGER& time)
-{
-	SYSTEMTIME st;
-	FileTimeToSystemTime((FILETIME*)&time, &st);
-	printf("%02d:%02d:%02d.%03d: ", st.wHour, st.wMinute, st.wSecond, st.wMilliseconds);
+	CloseHandle(hDevice);
+
+	const auto& stats = reader.Stats();
+	LogInfo(std::to_string(stats.Completions) + " queries completed with " 
+		+ std::to_string(options.Depth) + " in flight, " 
+		+ std::to_string(stats.EmptyCompletions) + " empty");
+
+	return bSuccess;
 }
 
 VOID LogInfo(const std::string& msg)
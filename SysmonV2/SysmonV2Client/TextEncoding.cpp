@@ -0,0 +1,267 @@
+// TextEncoding.cpp
+// UTF-16 to UTF-8 conversion for command lines.
+
+#include <cstring>
+
+#include "TextEncoding.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define TEXT_ENCODING_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// read one UTF-16 code unit; command lines follow packed records
+// and so may not be 2-byte aligned
+static inline ULONG LoadUnit(const WCHAR* source, size_t index)
+{
+	USHORT unit;
+	std::memcpy(&unit, source + index, sizeof(unit));
+	return unit;
+}
+
+// convert the code point starting at source[index]; returns the number
+// of units consumed (2 for a surrogate pair, otherwise 1)
+static inline size_t ConvertUnit(const WCHAR* source, size_t index, size_t length, UCHAR*& dst)
+{
+	ULONG cp = LoadUnit(source, index);
+
+	if (cp < 0x80)
+	{
+		*dst++ = static_cast<UCHAR>(cp);
+		return 1;
+	}
+
+	if (cp < 0x800)
+	{
+		*dst++ = static_cast<UCHAR>(0xC0 | (cp >> 6));
+		*dst++ = static_cast<UCHAR>(0x80 | (cp & 0x3F));
+		return 1;
+	}
+
+	if (cp >= 0xD800 && cp <= 0xDFFF)
+	{
+		const bool bHigh = cp <= 0xDBFF;
+		const ULONG next = (index + 1 < length) ? LoadUnit(source, index + 1) : 0;
+
+		if (bHigh && next >= 0xDC00 && next <= 0xDFFF)
+		{
+			// a valid pair always fits: 4 bytes out for 2 units in
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (next - 0xDC00);
+
+			*dst++ = static_cast<UCHAR>(0xF0 | (cp >> 18));
+			*dst++ = static_cast<UCHAR>(0x80 | ((cp >> 12) & 0x3F));
+			*dst++ = static_cast<UCHAR>(0x80 | ((cp >> 6) & 0x3F));
+			*dst++ = static_cast<UCHAR>(0x80 | (cp & 0x3F));
+			return 2;
+		}
+
+		// unpaired surrogate
+		cp = 0xFFFD;
+	}
+
+	*dst++ = static_cast<UCHAR>(0xE0 | (cp >> 12));
+	*dst++ = static_cast<UCHAR>(0x80 | ((cp >> 6) & 0x3F));
+	*dst++ = static_cast<UCHAR>(0x80 | (cp & 0x3F));
+	return 1;
+}
+
+// number of units making up a well-formed code point at source[index],
+// or 0 for an unpaired surrogate
+static inline size_t ValidateUnit(const WCHAR* source, size_t index, size_t length)
+{
+	const auto cp = LoadUnit(source, index);
+
+	if ((cp & 0xF800) != 0xD800)
+	{
+		return 1;
+	}
+
+	if (cp <= 0xDBFF && index + 1 < length)
+	{
+		const auto next = LoadUnit(source, index + 1);
+		if (next >= 0xDC00 && next <= 0xDFFF)
+		{
+			return 2;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef TEXT_ENCODING_SSE2
+
+// loadu has no alignment requirement, so the unaligned command lines
+// can be read directly
+static inline __m128i LoadUnits(const WCHAR* source, size_t index)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + index));
+}
+
+// one pair of mask bits per unit of v, set where the unit is below 0x80
+static inline ULONG AsciiMask(__m128i v)
+{
+	const auto high = _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xFF80)));
+	return static_cast<ULONG>(_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())));
+}
+
+// TRUE if every unit of v is below 0x80
+static inline BOOL IsAscii(__m128i v)
+{
+	return 0xFFFF == AsciiMask(v);
+}
+
+static inline ULONG CountTrailingZeros(ULONG mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return static_cast<ULONG>(__builtin_ctz(mask));
+#endif
+}
+
+// TRUE if any unit of v is a surrogate (0xD800 - 0xDFFF)
+static inline BOOL HasSurrogate(__m128i v)
+{
+	const auto top = _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xF800)));
+	return 0 != _mm_movemask_epi8(_mm_cmpeq_epi16(top, _mm_set1_epi16(static_cast<short>(0xD800))));
+}
+
+#endif
+
+size_t Utf16ToUtf8(const WCHAR* source, size_t length, char* out)
+{
+	auto dst = reinterpret_cast<UCHAR*>(out);
+	size_t i = 0;
+
+#ifdef TEXT_ENCODING_SSE2
+	while (i + 16 <= length)
+	{
+		// all-ASCII blocks narrow to bytes with a saturating pack, which
+		// is exact when no unit exceeds 0x7F
+		if (i + 32 <= length)
+		{
+			const auto a = LoadUnits(source, i);
+			const auto b = LoadUnits(source, i + 8);
+			const auto c = LoadUnits(source, i + 16);
+			const auto d = LoadUnits(source, i + 24);
+
+			if (IsAscii(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))))
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(a, b));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_packus_epi16(c, d));
+				i += 32;
+				dst += 32;
+				continue;
+			}
+		}
+
+		const auto a = LoadUnits(source, i);
+		const auto b = LoadUnits(source, i + 8);
+		const auto ascii = AsciiMask(a) | (AsciiMask(b) << 16);
+
+		// at least 3 * 16 bytes of the output remain, so the whole block
+		// can be stored and only its ASCII prefix kept
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(a, b));
+
+		if (0xFFFFFFFF == ascii)
+		{
+			i += 16;
+			dst += 16;
+			continue;
+		}
+
+		const auto prefix = CountTrailingZeros(~ascii) / 2;
+		const auto blockEnd = i + 16;
+
+		i += prefix;
+		dst += prefix;
+
+		// convert the rest of the block one unit at a time (a pair
+		// straddling the block end is consumed whole), then carry on
+		// through the non-ASCII run so text with little ASCII does not
+		// pay for a failed vector test every 16 units
+		while (i < blockEnd || (i < length && LoadUnit(source, i) >= 0x80))
+		{
+			i += ConvertUnit(source, i, length, dst);
+		}
+	}
+#endif
+
+	while (i < length)
+	{
+		i += ConvertUnit(source, i, length, dst);
+	}
+
+	return dst - reinterpret_cast<UCHAR*>(out);
+}
+
+size_t Utf16ToUtf8Scalar(const WCHAR* source, size_t length, char* out)
+{
+	auto dst = reinterpret_cast<UCHAR*>(out);
+
+	for (size_t i = 0; i < length; )
+	{
+		i += ConvertUnit(source, i, length, dst);
+	}
+
+	return dst - reinterpret_cast<UCHAR*>(out);
+}
+
+BOOL IsValidUtf16(const WCHAR* source, size_t length)
+{
+	size_t i = 0;
+
+#ifdef TEXT_ENCODING_SSE2
+	while (i + 16 <= length)
+	{
+		const auto a = LoadUnits(source, i);
+		const auto b = LoadUnits(source, i + 8);
+
+		if (!HasSurrogate(a) && !HasSurrogate(b))
+		{
+			i += 16;
+			continue;
+		}
+
+		const auto blockEnd = i + 16;
+		while (i < blockEnd)
+		{
+			const auto units = ValidateUnit(source, i, length);
+			if (0 == units)
+			{
+				return FALSE;
+			}
+
+			i += units;
+		}
+	}
+#endif
+
+	while (i < length)
+	{
+		const auto units = ValidateUnit(source, i, length);
+		if (0 == units)
+		{
+			return FALSE;
+		}
+
+		i += units;
+	}
+
+	return TRUE;
+}
+
+VOID AppendUtf8(std::string& out, const WCHAR* source, size_t length)
+{
+	const auto start = out.size();
+
+	out.resize(start + Utf8Capacity(length));
+	const auto written = Utf16ToUtf8(source, length, &out[start]);
+	out.resize(start + written);
+}
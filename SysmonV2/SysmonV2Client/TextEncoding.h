@@ -0,0 +1,33 @@
+// TextEncoding.h
+// UTF-16 to UTF-8 conversion for command lines.
+
+#pragma once
+
+#include <string>
+
+#include "Platform.h"
+
+// worst-case UTF-8 size of a UTF-16 string of the given length
+constexpr size_t Utf8Capacity(size_t utf16Length)
+{
+	return utf16Length * 3;
+}
+
+// convert UTF-16 to UTF-8, writing at most Utf8Capacity(length) bytes to
+// out; unpaired surrogates are replaced with U+FFFD; returns bytes written
+//
+// runs of ASCII are converted 32 or 16 units at a time with SSE2 where
+// available; everything else takes the scalar path
+size_t Utf16ToUtf8(const WCHAR* source, size_t length, char* out);
+
+// the same conversion one unit at a time, kept as the reference and
+// baseline for the vectorized path
+size_t Utf16ToUtf8Scalar(const WCHAR* source, size_t length, char* out);
+
+// TRUE if the string is well-formed UTF-16, i.e. every surrogate is part
+// of a pair and the conversion will not need U+FFFD replacements
+BOOL IsValidUtf16(const WCHAR* source, size_t length);
+
+// convert UTF-16 to UTF-8, appending to the output string; reusing the
+// same string across calls avoids any allocation once it has grown
+VOID AppendUtf8(std::string& out, const WCHAR* source, size_t length);
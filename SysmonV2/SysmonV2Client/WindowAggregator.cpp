@@ -0,0 +1,250 @@
+// WindowAggregator.cpp
+// Pane-based sliding and tumbling window counts over the event stream.
+
+#include <algorithm>
+#include <cstdio>
+
+#include "WindowAggregator.h"
+
+/* ----------------------------------------------------------------------------
+ *	Window Aggregator
+ */
+
+WindowAggregator::WindowAggregator(const WindowSpec& spec, SlideCallback onSlide)
+	: m_Spec(spec),
+	m_OnSlide(std::move(onSlide)),
+	m_Panes(spec.WindowPanes > 0 ? spec.WindowPanes : 1),
+	m_CurrentPane(0),
+	m_bStarted(FALSE),
+	m_WindowCount(0),
+	m_LateEvents(0)
+{
+	m_Spec.WindowPanes = static_cast<ULONG>(m_Panes.size());
+
+	if (0 == m_Spec.SlidePanes || m_Spec.SlidePanes > m_Spec.WindowPanes)
+	{
+		m_Spec.SlidePanes = m_Spec.WindowPanes;
+	}
+
+	for (auto& pane : m_Panes)
+	{
+		pane.Total = 0;
+	}
+}
+
+VOID WindowAggregator::Add(const EventRecord& record)
+{
+	if (record.Type != m_Spec.Type)
+	{
+		return;
+	}
+
+	const auto pane = record.Time / m_Spec.PaneWidth;
+
+	if (!m_bStarted)
+	{
+		m_CurrentPane = pane;
+		m_bStarted = TRUE;
+	}
+	else if (pane > m_CurrentPane)
+	{
+		AdvanceTo(pane);
+	}
+	else if (pane <= m_CurrentPane - m_Spec.WindowPanes)
+	{
+		++m_LateEvents;
+		return;
+	}
+
+	const auto key = KeyOf(record);
+	auto& slot = m_Panes[static_cast<size_t>(pane % m_Spec.WindowPanes)];
+
+	++slot.Counts[key];
+	++slot.Total;
+
+	++m_Totals[key];
+	++m_WindowCount;
+}
+
+VOID WindowAggregator::TopGroups(std::vector<WindowGroup>& out) const
+{
+	out.clear();
+	out.reserve(m_Totals.size());
+
+	for (const auto& total : m_Totals)
+	{
+		out.push_back(WindowGroup{ total.first, total.second });
+	}
+
+	const auto top = std::min(m_Spec.TopN, out.size());
+	std::partial_sort(out.begin(), out.begin() + top, out.end(), [](const WindowGroup& a, const WindowGroup& b)
+	{
+		return a.Count > b.Count || (a.Count == b.Count && a.Key < b.Key);
+	});
+
+	out.resize(top);
+}
+
+double WindowAggregator::Rate(ULONGLONG count) const
+{
+	const auto length = static_cast<double>(m_Spec.PaneWidth) * m_Spec.WindowPanes;
+	return count * static_cast<double>(m_Spec.RateUnit) / length;
+}
+
+// move the window forward pane by pane, reporting at slide boundaries
+// before the oldest pane is dropped
+VOID WindowAggregator::AdvanceTo(LONGLONG pane)
+{
+	// after a gap longer than the window, only the last few panes matter
+	if (pane - m_CurrentPane > m_Spec.WindowPanes + m_Spec.SlidePanes)
+	{
+		const auto skipTo = pane - m_Spec.WindowPanes - m_Spec.SlidePanes;
+
+		if (m_WindowCount > 0)
+		{
+			for (auto& p : m_Panes)
+			{
+				ExpirePane(p);
+			}
+		}
+
+		m_CurrentPane = skipTo;
+	}
+
+	while (m_CurrentPane < pane)
+	{
+		++m_CurrentPane;
+
+		// the window [m_CurrentPane - WindowPanes, m_CurrentPane) is complete
+		if (0 == m_CurrentPane % m_Spec.SlidePanes && m_WindowCount > 0 && m_OnSlide)
+		{
+			m_OnSlide(*this, m_CurrentPane * m_Spec.PaneWidth);
+		}
+
+		// the ring slot of the new pane still holds the one leaving the window
+		ExpirePane(m_Panes[static_cast<size_t>(m_CurrentPane % m_Spec.WindowPanes)]);
+	}
+}
+
+VOID WindowAggregator::ExpirePane(Pane& pane)
+{
+	if (0 == pane.Total)
+	{
+		return;
+	}
+
+	for (const auto& count : pane.Counts)
+	{
+		auto total = m_Totals.find(count.first);
+		if (total != m_Totals.end())
+		{
+			total->second -= count.second;
+			if (0 == total->second)
+			{
+				m_Totals.erase(total);
+			}
+		}
+	}
+
+	m_WindowCount -= pane.Total;
+
+	pane.Counts.clear();
+	pane.Total = 0;
+}
+
+ULONG WindowAggregator::KeyOf(const EventRecord& record) const
+{
+	switch (m_Spec.Key)
+	{
+	case GroupBy::ProcessId:       return record.ProcessId;
+	case GroupBy::ParentProcessId: return record.ParentProcessId;
+	case GroupBy::ThreadId:        return record.ThreadId;
+	default:                       return 0;
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ *	Window Monitor
+ */
+
+WindowMonitor::WindowMonitor(OutputSink& sink)
+	: m_Sink(sink)
+{}
+
+VOID WindowMonitor::AddWindow(const WindowSpec& spec)
+{
+	m_Windows.emplace_back(spec, [this](const WindowAggregator& window, LONGLONG windowEnd)
+	{
+		Summarize(window, windowEnd);
+	});
+}
+
+VOID WindowMonitor::AddDefaultWindows()
+{
+	AddWindow(WindowSpec{
+		"process creates by parent",
+		ItemType::ProcessCreate,
+		GroupBy::ParentProcessId,
+		WINDOW_SECOND,
+		10,
+		5,
+		WINDOW_SECOND,
+		"s",
+		5
+	});
+
+	AddWindow(WindowSpec{
+		"thread exits by process",
+		ItemType::ThreadExit,
+		GroupBy::ProcessId,
+		5 * WINDOW_SECOND,
+		12,
+		2,
+		WINDOW_MINUTE,
+		"min",
+		5
+	});
+}
+
+VOID WindowMonitor::Consume(const EventRecord* records, size_t count)
+{
+	for (auto& window : m_Windows)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			window.Add(records[i]);
+		}
+	}
+}
+
+// "HH:MM:SS.mmm  process creates by parent [10s]: 4=12.30/s 812=4.10/s (53 groups, 20.40/s)"
+VOID WindowMonitor::Summarize(const WindowAggregator& window, LONGLONG windowEnd)
+{
+	const auto& spec = window.Spec();
+	char number[64];
+
+	char stamp[TimeFormatter::Width];
+	m_Time.Format(windowEnd, stamp);
+
+	m_Line.assign(stamp, TimeFormatter::Width - 2);
+	m_Line.append("  ");
+	m_Line.append(spec.Name);
+
+	snprintf(number, sizeof(number), " [%llds]:",
+		static_cast<long long>(spec.PaneWidth * spec.WindowPanes / WINDOW_SECOND));
+	m_Line.append(number);
+
+	window.TopGroups(m_Groups);
+
+	for (const auto& group : m_Groups)
+	{
+		snprintf(number, sizeof(number), " %u=%.2f/%s", group.Key, window.Rate(group.Count), spec.RateLabel);
+		m_Line.append(number);
+	}
+
+	snprintf(number, sizeof(number), " (%zu groups, %.2f/%s)\n",
+		window.GroupCount(), window.Rate(window.WindowCount()), spec.RateLabel);
+	m_Line.append(number);
+
+	m_Sink.Write(m_Line.data(), m_Line.size());
+}
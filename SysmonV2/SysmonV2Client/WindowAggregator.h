@@ -0,0 +1,130 @@
+// WindowAggregator.h
+// Pane-based sliding and tumbling window counts over the event stream.
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EventFormatter.h"
+
+// 100ns units
+constexpr LONGLONG WINDOW_SECOND = 10LL * 1000 * 1000;
+constexpr LONGLONG WINDOW_MINUTE = 60 * WINDOW_SECOND;
+
+enum class GroupBy
+{
+	None,
+	ProcessId,
+	ParentProcessId,
+	ThreadId
+};
+
+// A window of WindowPanes panes of PaneWidth each, evaluated every
+// SlidePanes panes; SlidePanes == WindowPanes gives a tumbling window.
+struct WindowSpec
+{
+	std::string Name;
+	ItemType    Type;
+	GroupBy     Key;
+	LONGLONG    PaneWidth;
+	ULONG       WindowPanes;
+	ULONG       SlidePanes;
+	LONGLONG    RateUnit;   // rates are reported per RateUnit
+	const char* RateLabel;  // e.g. "s", "min"
+	size_t      TopN;
+};
+
+struct WindowGroup
+{
+	ULONG     Key;
+	ULONGLONG Count;
+};
+
+// Counts matching events per group key. Each pane keeps its own partial
+// counts and the window keeps running totals: an event updates its pane
+// and the totals, and a pane leaving the window is subtracted from the
+// totals once. Per-event cost therefore does not depend on the window
+// length, and no pane is ever rescanned.
+//
+// Time is event time. Events older than the window are dropped; events
+// older than the current pane but still inside the window are credited
+// to their own pane.
+class WindowAggregator
+{
+public:
+	// invoked when the window slides, with the end (exclusive) of the
+	// window being reported
+	using SlideCallback = std::function<VOID(const WindowAggregator& window, LONGLONG windowEnd)>;
+
+	WindowAggregator(const WindowSpec& spec, SlideCallback onSlide);
+
+	VOID Add(const EventRecord& record);
+
+	// the TopN largest groups of the current window, largest first
+	VOID TopGroups(std::vector<WindowGroup>& out) const;
+
+	const WindowSpec& Spec() const { return m_Spec; }
+
+	ULONGLONG WindowCount() const { return m_WindowCount; }
+	size_t    GroupCount() const { return m_Totals.size(); }
+	ULONGLONG LateEvents() const { return m_LateEvents; }
+
+	// rate of count over the full window, per RateUnit
+	double Rate(ULONGLONG count) const;
+
+private:
+	struct Pane
+	{
+		std::unordered_map<ULONG, ULONG> Counts;
+		ULONGLONG                        Total;
+	};
+
+	VOID AdvanceTo(LONGLONG pane);
+	VOID ExpirePane(Pane& pane);
+
+	ULONG KeyOf(const EventRecord& record) const;
+
+	WindowSpec    m_Spec;
+	SlideCallback m_OnSlide;
+
+	std::vector<Pane> m_Panes;  // ring, indexed by pane number % WindowPanes
+	LONGLONG          m_CurrentPane;
+	BOOL              m_bStarted;
+
+	std::unordered_map<ULONG, ULONGLONG> m_Totals;
+	ULONGLONG                            m_WindowCount;
+	ULONGLONG                            m_LateEvents;
+};
+
+// Runs a set of window aggregations as a pipeline consumer and writes a
+// one-line summary per window slide.
+class WindowMonitor : public RecordConsumer
+{
+public:
+	explicit WindowMonitor(OutputSink& sink);
+
+	VOID AddWindow(const WindowSpec& spec);
+
+	// process creates per second by parent over 10 s, and thread exits
+	// per minute by process over 1 min
+	VOID AddDefaultWindows();
+
+	VOID Consume(const EventRecord* records, size_t count) override;
+
+	VOID Idle() override
+	{
+		m_Sink.Flush();
+	}
+
+private:
+	VOID Summarize(const WindowAggregator& window, LONGLONG windowEnd);
+
+	OutputSink&                    m_Sink;
+	std::vector<WindowAggregator>  m_Windows;
+	std::vector<WindowGroup>       m_Groups;
+	std::string                    m_Line;
+	TimeFormatter                  m_Time;
+};
@@ -0,0 +1,152 @@
+// WorkStealingPool.cpp
+// Fixed set of worker threads with per-worker task deques and stealing.
+
+#include "WorkStealingPool.h"
+
+WorkStealingPool::WorkStealingPool(size_t threads)
+	: m_Job(nullptr),
+	m_Generation(0),
+	m_Busy(0),
+	m_Shutdown(false)
+{
+	if (0 == threads)
+	{
+		threads = std::thread::hardware_concurrency();
+	}
+
+	if (0 == threads)
+	{
+		threads = 1;
+	}
+
+	for (size_t i = 0; i < threads; ++i)
+	{
+		m_Workers.emplace_back(new Worker{});
+	}
+
+	for (size_t i = 0; i < threads; ++i)
+	{
+		m_Threads.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock{ m_Lock };
+		m_Shutdown = true;
+	}
+
+	m_WorkReady.notify_all();
+
+	for (auto& thread : m_Threads)
+	{
+		thread.join();
+	}
+}
+
+VOID WorkStealingPool::ParallelFor(size_t count, const std::function<VOID(size_t, size_t)>& fn)
+{
+	if (0 == count)
+	{
+		return;
+	}
+
+	const auto workers = m_Workers.size();
+
+	// contiguous blocks keep each worker walking the file sequentially
+	for (size_t w = 0; w < workers; ++w)
+	{
+		const auto first = count * w / workers;
+		const auto last  = count * (w + 1) / workers;
+
+		std::lock_guard<std::mutex> lock{ m_Workers[w]->Lock };
+		for (auto i = first; i < last; ++i)
+		{
+			m_Workers[w]->Tasks.push_back(i);
+		}
+	}
+
+	std::unique_lock<std::mutex> lock{ m_Lock };
+
+	m_Job  = &fn;
+	m_Busy = workers;
+	++m_Generation;
+
+	m_WorkReady.notify_all();
+
+	// a worker only reports done once every deque it could steal from
+	// was empty, so no task can still be pending when m_Busy hits zero
+	m_WorkDone.wait(lock, [this]() { return 0 == m_Busy; });
+
+	m_Job = nullptr;
+}
+
+VOID WorkStealingPool::WorkerLoop(size_t id)
+{
+	ULONGLONG seen = 0;
+
+	while (true)
+	{
+		const std::function<VOID(size_t, size_t)>* job = nullptr;
+
+		{
+			std::unique_lock<std::mutex> lock{ m_Lock };
+			m_WorkReady.wait(lock, [&]() { return m_Shutdown || m_Generation != seen; });
+
+			if (m_Shutdown)
+			{
+				return;
+			}
+
+			seen = m_Generation;
+			job  = m_Job;
+		}
+
+		size_t task;
+		while (TakeTask(id, task))
+		{
+			(*job)(task, id);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock{ m_Lock };
+			if (0 == --m_Busy)
+			{
+				m_WorkDone.notify_one();
+			}
+		}
+	}
+}
+
+BOOL WorkStealingPool::TakeTask(size_t id, size_t& task)
+{
+	{
+		auto& own = *m_Workers[id];
+		std::lock_guard<std::mutex> lock{ own.Lock };
+
+		if (!own.Tasks.empty())
+		{
+			task = own.Tasks.front();
+			own.Tasks.pop_front();
+			return TRUE;
+		}
+	}
+
+	// steal from the far end of a victim's block
+	const auto workers = m_Workers.size();
+	for (size_t n = 1; n < workers; ++n)
+	{
+		auto& victim = *m_Workers[(id + n) % workers];
+		std::lock_guard<std::mutex> lock{ victim.Lock };
+
+		if (!victim.Tasks.empty())
+		{
+			task = victim.Tasks.back();
+			victim.Tasks.pop_back();
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
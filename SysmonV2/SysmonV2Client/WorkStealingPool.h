@@ -0,0 +1,61 @@
+// WorkStealingPool.h
+// Fixed set of worker threads with per-worker task deques and stealing.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Platform.h"
+
+// Each ParallelFor splits its index range into one contiguous block per
+// worker; a worker drains its own block front to back and, once empty,
+// steals from the back of the others. Tasks are coarse (a capture chunk
+// each), so the deques are guarded by plain mutexes.
+class WorkStealingPool
+{
+public:
+	// zero threads means one per hardware thread
+	explicit WorkStealingPool(size_t threads = 0);
+	~WorkStealingPool();
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	size_t WorkerCount() const
+	{
+		return m_Workers.size();
+	}
+
+	// invoke fn(index, worker) for every index in [0, count) and wait for
+	// all of them; worker is in [0, WorkerCount()) and is stable for the
+	// duration of one call, so it can index per-worker state
+	VOID ParallelFor(size_t count, const std::function<VOID(size_t, size_t)>& fn);
+
+private:
+	struct Worker
+	{
+		std::mutex         Lock;
+		std::deque<size_t> Tasks;
+	};
+
+	VOID WorkerLoop(size_t id);
+	BOOL TakeTask(size_t id, size_t& task);
+
+	std::vector<std::unique_ptr<Worker>> m_Workers;
+	std::vector<std::thread>             m_Threads;
+
+	std::mutex              m_Lock;
+	std::condition_variable m_WorkReady;
+	std::condition_variable m_WorkDone;
+
+	const std::function<VOID(size_t, size_t)>* m_Job;
+	ULONGLONG m_Generation;
+	size_t    m_Busy;
+	bool      m_Shutdown;
+};
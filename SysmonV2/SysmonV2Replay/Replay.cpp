@@ -0,0 +1,265 @@
+// Replay.cpp
+// Decode-and-display replay harness for the SysmonV2 and SysMon clients.
+//
+// Feeds recorded (SysmonV2 capture) or synthetic events, encoded as each
+// driver would return them, through the clients' display paths and
+// reports events/sec, bytes/sec and heap allocations per event. Output
+// goes to the null device unless --out is given.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+
+#include "Replay.h"
+#include "Platform.h"
+
+#ifdef _WIN32
+constexpr auto NULL_DEVICE = "NUL";
+#else
+constexpr auto NULL_DEVICE = "/dev/null";
+#endif
+
+// the clients query with 64KB buffers
+constexpr size_t REPLAY_BUFFER_SIZE = 1 << 16;
+
+/* ----------------------------------------------------------------------------
+ *	Allocation Counting
+ */
+
+static std::atomic<unsigned long long> g_Allocations{ 0 };
+static std::atomic<unsigned long long> g_AllocatedBytes{ 0 };
+
+void* operator new(size_t size)
+{
+	g_Allocations.fetch_add(1, std::memory_order_relaxed);
+	g_AllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+
+	if (auto p = std::malloc(size > 0 ? size : 1))
+	{
+		return p;
+	}
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+/* ----------------------------------------------------------------------------
+ *	Synthetic Events
+ */
+
+struct SyntheticOptions
+{
+	size_t   Events        = 1000000;
+	unsigned ProcessShare  = 20;   // percent of events that are process creates or exits
+	size_t   CommandLength = 96;   // characters per command line
+	unsigned NonAscii      = 0;    // percent of command line characters outside ASCII
+	unsigned Seed          = 1;
+};
+
+static void GenerateEvents(const SyntheticOptions& options, std::vector<ReplayEvent>& events)
+{
+	std::mt19937 random(options.Seed);
+	long long time = 132500000000000000LL;  // 2020, FILETIME units
+
+	events.reserve(options.Events);
+
+	for (size_t i = 0; i < options.Events; ++i)
+	{
+		ReplayEvent event;
+		const auto roll = random() % 100;
+
+		time += random() % 2000;
+
+		event.Time = time;
+		event.ProcessId = 4 + 4 * (random() % 512);
+		event.ThreadId = 4 + 4 * (random() % 8192);
+		event.ParentProcessId = 0;
+
+		if (roll < options.ProcessShare / 2)
+		{
+			event.Type = 1;
+			event.ParentProcessId = 4 + 4 * (random() % 512);
+
+			event.CommandLine.reserve(options.CommandLength);
+			for (size_t c = 0; c < options.CommandLength; ++c)
+			{
+				event.CommandLine.push_back(random() % 100 < options.NonAscii
+					? static_cast<char16_t>(0x400 + random() % 0x100)
+					: static_cast<char16_t>('a' + random() % 26));
+			}
+		}
+		else if (roll < options.ProcessShare)
+		{
+			event.Type = 2;
+		}
+		else
+		{
+			event.Type = (roll & 1) ? 3 : 4;
+		}
+
+		events.push_back(std::move(event));
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ *	Entry Point
+ */
+
+static void PrintUsage()
+{
+	printf("usage: SysmonV2Replay [options]\n");
+	printf("  --capture <path>     replay a SysmonV2 capture instead of synthetic events\n");
+	printf("  --events <n>         synthetic events (default 1000000)\n");
+	printf("  --process <pct>      share of process events (default 20)\n");
+	printf("  --cmdline <chars>    command line length (default 96)\n");
+	printf("  --non-ascii <pct>    non-ASCII command line characters (default 0)\n");
+	printf("  --target <name>      v2, v2-stream or sysmon; repeatable (default all)\n");
+	printf("  --rounds <n>         passes over the buffers (default 5)\n");
+	printf("  --out <path>         write output here instead of the null device\n");
+}
+
+int main(int argc, char* argv[])
+{
+	SyntheticOptions synthetic;
+	const char* capturePath = nullptr;
+	const char* outPath = NULL_DEVICE;
+	unsigned rounds = 5;
+	std::vector<std::string> targetNames;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+		if (nullptr == value)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		if ("--capture" == arg)        capturePath = value;
+		else if ("--events" == arg)    synthetic.Events = std::strtoull(value, nullptr, 10);
+		else if ("--process" == arg)   synthetic.ProcessShare = static_cast<unsigned>(std::atoi(value));
+		else if ("--cmdline" == arg)   synthetic.CommandLength = std::strtoull(value, nullptr, 10);
+		else if ("--non-ascii" == arg) synthetic.NonAscii = static_cast<unsigned>(std::atoi(value));
+		else if ("--target" == arg)    targetNames.push_back(value);
+		else if ("--rounds" == arg)    rounds = static_cast<unsigned>(std::atoi(value));
+		else if ("--out" == arg)       outPath = value;
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		++i;
+	}
+
+	if (targetNames.empty())
+	{
+		targetNames = { "v2", "v2-stream", "sysmon" };
+	}
+
+	std::vector<ReplayEvent> events;
+	if (capturePath != nullptr)
+	{
+		if (!LoadCaptureEvents(capturePath, events))
+		{
+			printf("[!] failed to read capture %s\n", capturePath);
+			return 1;
+		}
+	}
+	else
+	{
+		GenerateEvents(synthetic, events);
+	}
+
+	auto out = OpenStdioFile(outPath, "wb");
+	if (nullptr == out)
+	{
+		printf("[!] failed to open %s\n", outPath);
+		return 1;
+	}
+
+	printf("[+] %zu events, %u rounds\n", events.size(), rounds);
+
+	for (const auto& name : targetNames)
+	{
+		auto target = CreateSysmonV2Target(name, out);
+		if (!target)
+		{
+			target = CreateSysMonTarget(name, out);
+		}
+
+		if (!target)
+		{
+			printf("[-] unknown target %s\n", name.c_str());
+			continue;
+		}
+
+		std::vector<ReplayBuffer> buffers;
+		target->Encode(events, REPLAY_BUFFER_SIZE, buffers);
+
+		unsigned long long bytes = 0;
+		for (const auto& buffer : buffers)
+		{
+			bytes += buffer.size();
+		}
+
+		const auto allocationsBefore = g_Allocations.load();
+		const auto allocatedBefore = g_AllocatedBytes.load();
+		const auto start = std::chrono::steady_clock::now();
+
+		for (unsigned round = 0; round < rounds; ++round)
+		{
+			for (const auto& buffer : buffers)
+			{
+				target->Display(buffer);
+			}
+		}
+
+		target->Finish();
+
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		const auto allocations = g_Allocations.load() - allocationsBefore;
+		const auto allocated = g_AllocatedBytes.load() - allocatedBefore;
+		const auto totalEvents = static_cast<double>(events.size()) * rounds;
+
+		printf("[+] %-10s %8.2f Mevents/s %8.1f MB/s  %6.3f allocs/event  %8.1f bytes allocated/event  (%zu buffers)\n",
+			target->Name(),
+			totalEvents / seconds / 1e6,
+			static_cast<double>(bytes) * rounds / seconds / 1e6,
+			allocations / totalEvents,
+			allocated / totalEvents,
+			buffers.size());
+	}
+
+	fclose(out);
+	return 0;
+}
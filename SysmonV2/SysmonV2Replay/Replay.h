@@ -0,0 +1,56 @@
+// Replay.h
+// Decode-and-display replay harness for the SysmonV2 and SysMon clients.
+//
+// The harness is split by client because the two driver protocols share
+// type names (ItemType, ItemHeader); each Replay<Client>.cpp includes only
+// its own client's headers, and this header only standard types.
+
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// a driver-independent event, encoded into each client's wire format
+struct ReplayEvent
+{
+	unsigned short Type;  // 1 process create, 2 process exit, 3 thread create, 4 thread exit
+	long long      Time;  // FILETIME units
+	unsigned int   ProcessId;
+	unsigned int   ThreadId;
+	unsigned int   ParentProcessId;
+	std::u16string CommandLine;
+};
+
+using ReplayBuffer = std::vector<unsigned char>;
+
+// one client's decode and display path
+class ReplayTarget
+{
+public:
+	virtual ~ReplayTarget() = default;
+
+	virtual const char* Name() const = 0;
+
+	// pack events into driver results buffers of at most bufferSize bytes,
+	// exactly as that client's driver would return them
+	virtual void Encode(const std::vector<ReplayEvent>& events, size_t bufferSize, std::vector<ReplayBuffer>& buffers) = 0;
+
+	// decode and display one buffer
+	virtual void Display(const ReplayBuffer& buffer) = 0;
+
+	// called once after all buffers were displayed
+	virtual void Finish() {}
+};
+
+// SysmonV2Client: "v2" runs DisplayResults as the client does for one-shot
+// queries, "v2-stream" the follow-mode path with a reused decoder and
+// formatter; nullptr for other names
+std::unique_ptr<ReplayTarget> CreateSysmonV2Target(const std::string& name, FILE* out);
+
+// SysMonClient: "sysmon" runs DisplayInfo
+std::unique_ptr<ReplayTarget> CreateSysMonTarget(const std::string& name, FILE* out);
+
+// read every event of a SysmonV2 capture file
+bool LoadCaptureEvents(const char* path, std::vector<ReplayEvent>& events);
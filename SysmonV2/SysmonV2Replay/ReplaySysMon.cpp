@@ -0,0 +1,111 @@
+// ReplaySysMon.cpp
+// Replay target for the SysMon client.
+
+#include <cstring>
+
+#include "Replay.h"
+
+#include "Display.h"
+
+class SysMonTarget : public ReplayTarget
+{
+public:
+	explicit SysMonTarget(FILE* out)
+		: m_Out(out)
+	{}
+
+	const char* Name() const override
+	{
+		return "sysmon";
+	}
+
+	void Encode(const std::vector<ReplayEvent>& events, size_t bufferSize, std::vector<ReplayBuffer>& buffers) override
+	{
+		ReplayBuffer buffer;
+
+		for (const auto& event : events)
+		{
+			const auto commandLineBytes = event.CommandLine.size() * sizeof(WCHAR);
+
+			size_t itemSize;
+			switch (event.Type)
+			{
+			case 1:  itemSize = sizeof(ProcessCreateInfo) + commandLineBytes; break;
+			case 2:  itemSize = sizeof(ProcessExitInfo); break;
+			default: itemSize = sizeof(ThreadCreateExitInfo); break;
+			}
+
+			// the SysMon item size is a USHORT
+			if (itemSize > 0xFFFF)
+			{
+				continue;
+			}
+
+			if (buffer.size() + itemSize > bufferSize && !buffer.empty())
+			{
+				buffers.push_back(std::move(buffer));
+				buffer.clear();
+			}
+
+			const auto start = buffer.size();
+			buffer.resize(start + itemSize);
+
+			auto header = reinterpret_cast<ItemHeader*>(&buffer[start]);
+			header->Type = static_cast<ItemType>(event.Type);
+			header->Size = static_cast<USHORT>(itemSize);
+			header->Time.QuadPart = event.Time;
+
+			switch (event.Type)
+			{
+			case 1:
+			{
+				auto info = reinterpret_cast<ProcessCreateInfo*>(header);
+				info->ProcessId = event.ProcessId;
+				info->ParentProcessId = event.ParentProcessId;
+				info->CommandLineLength = static_cast<USHORT>(event.CommandLine.size());
+				info->CommandLineOffset = static_cast<USHORT>(sizeof(ProcessCreateInfo));
+				std::memcpy(&buffer[start + sizeof(ProcessCreateInfo)], event.CommandLine.data(), commandLineBytes);
+				break;
+			}
+			case 2:
+				reinterpret_cast<ProcessExitInfo*>(header)->ProcessId = event.ProcessId;
+				break;
+			default:
+			{
+				auto info = reinterpret_cast<ThreadCreateExitInfo*>(header);
+				info->ThreadId = event.ThreadId;
+				info->ProcessId = event.ProcessId;
+				break;
+			}
+			}
+		}
+
+		if (!buffer.empty())
+		{
+			buffers.push_back(std::move(buffer));
+		}
+	}
+
+	void Display(const ReplayBuffer& buffer) override
+	{
+		DisplayInfo(buffer.data(), static_cast<DWORD>(buffer.size()), m_Out);
+	}
+
+	void Finish() override
+	{
+		fflush(m_Out);
+	}
+
+private:
+	FILE* m_Out;
+};
+
+std::unique_ptr<ReplayTarget> CreateSysMonTarget(const std::string& name, FILE* out)
+{
+	if (name != "sysmon")
+	{
+		return nullptr;
+	}
+
+	return std::unique_ptr<ReplayTarget>(new SysMonTarget(out));
+}
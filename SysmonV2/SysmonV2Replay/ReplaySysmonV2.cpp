@@ -0,0 +1,236 @@
+// ReplaySysmonV2.cpp
+// Replay targets for the SysmonV2 client, and capture file loading.
+
+#include <cstring>
+
+#include "Replay.h"
+
+#include "CaptureReader.h"
+#include "EventFormatter.h"
+
+static VOID AppendItem(ReplayBuffer& buffer, const void* item, size_t size)
+{
+	auto bytes = static_cast<const UCHAR*>(item);
+	buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+// header fields common to every item
+template <typename T>
+static T MakeItem(const ReplayEvent& event, ItemType type, size_t size)
+{
+	T item;
+	std::memset(&item, 0, sizeof(item));
+
+	item.Type = type;
+	item.Size = static_cast<ULONG>(size);
+	item.Time.QuadPart = event.Time;
+
+	return item;
+}
+
+// UTF-8 to UTF-16; the capture heap holds what the client wrote, so no
+// validation beyond not running off the end
+static VOID AppendUtf16(std::u16string& out, const char* source, ULONG length)
+{
+	auto bytes = reinterpret_cast<const UCHAR*>(source);
+
+	for (ULONG i = 0; i < length; )
+	{
+		ULONG cp = bytes[i];
+		ULONG extra = cp >= 0xF0 ? 3 : cp >= 0xE0 ? 2 : cp >= 0xC0 ? 1 : 0;
+
+		if (i + extra >= length)
+		{
+			break;
+		}
+
+		if (extra > 0)
+		{
+			cp &= (0x3F >> extra);
+			for (ULONG k = 1; k <= extra; ++k)
+			{
+				cp = (cp << 6) | (bytes[i + k] & 0x3F);
+			}
+		}
+
+		i += extra + 1;
+
+		if (cp >= 0x10000)
+		{
+			cp -= 0x10000;
+			out.push_back(static_cast<char16_t>(0xD800 + (cp >> 10)));
+			out.push_back(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+		}
+		else
+		{
+			out.push_back(static_cast<char16_t>(cp));
+		}
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ *	Targets
+ */
+
+class SysmonV2Target : public ReplayTarget
+{
+public:
+	SysmonV2Target(const std::string& name, FILE* out)
+		: m_Name(name),
+		m_bStream("v2-stream" == name),
+		m_Sink(out),
+		m_Formatter(m_Sink)
+	{}
+
+	const char* Name() const override
+	{
+		return m_Name.c_str();
+	}
+
+	void Encode(const std::vector<ReplayEvent>& events, size_t bufferSize, std::vector<ReplayBuffer>& buffers) override
+	{
+		ReplayBuffer buffer;
+
+		for (const auto& event : events)
+		{
+			const auto commandLineBytes = event.CommandLine.size() * sizeof(WCHAR);
+			const auto itemSize = ItemSize(event) + (1 == event.Type ? commandLineBytes : 0);
+
+			if (buffer.size() + itemSize > bufferSize && !buffer.empty())
+			{
+				buffers.push_back(std::move(buffer));
+				buffer.clear();
+			}
+
+			switch (event.Type)
+			{
+			case 1:
+			{
+				auto item = MakeItem<ProcessCreateItem>(event, ItemType::ProcessCreate, itemSize);
+				item.ProcessId = event.ProcessId;
+				item.ParentProcessId = event.ParentProcessId;
+				item.CommandLineLength = static_cast<USHORT>(event.CommandLine.size());
+				item.CommandLineOffset = static_cast<USHORT>(sizeof(item));
+
+				AppendItem(buffer, &item, sizeof(item));
+				AppendItem(buffer, event.CommandLine.data(), commandLineBytes);
+				break;
+			}
+			case 2:
+			{
+				auto item = MakeItem<ProcessExitItem>(event, ItemType::ProcessExit, itemSize);
+				item.ProcessId = event.ProcessId;
+				AppendItem(buffer, &item, sizeof(item));
+				break;
+			}
+			case 3:
+			case 4:
+			{
+				auto item = MakeItem<ThreadCreateItem>(event,
+					3 == event.Type ? ItemType::ThreadCreate : ItemType::ThreadExit, itemSize);
+				item.ThreadId = event.ThreadId;
+				item.ProcessId = event.ProcessId;
+				AppendItem(buffer, &item, sizeof(item));
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		if (!buffer.empty())
+		{
+			buffers.push_back(std::move(buffer));
+		}
+	}
+
+	void Display(const ReplayBuffer& buffer) override
+	{
+		const auto size = static_cast<ULONG>(buffer.size());
+
+		if (!m_bStream)
+		{
+			DisplayResults(buffer.data(), size, m_Sink);
+			return;
+		}
+
+		m_Records.clear();
+		DecodeBuffer(buffer.data(), size, m_Records);
+		m_Formatter.Format(m_Records.data(), m_Records.size());
+	}
+
+	void Finish() override
+	{
+		m_Formatter.Flush();
+	}
+
+private:
+	static size_t ItemSize(const ReplayEvent& event)
+	{
+		switch (event.Type)
+		{
+		case 1:  return sizeof(ProcessCreateItem);
+		case 2:  return sizeof(ProcessExitItem);
+		default: return sizeof(ThreadCreateItem);
+		}
+	}
+
+	std::string              m_Name;
+	BOOL                     m_bStream;
+	FileSink                 m_Sink;
+	EventFormatter           m_Formatter;
+	std::vector<EventRecord> m_Records;
+};
+
+std::unique_ptr<ReplayTarget> CreateSysmonV2Target(const std::string& name, FILE* out)
+{
+	if (name != "v2" && name != "v2-stream")
+	{
+		return nullptr;
+	}
+
+	return std::unique_ptr<ReplayTarget>(new SysmonV2Target(name, out));
+}
+
+/* ----------------------------------------------------------------------------
+ *	Captures
+ */
+
+bool LoadCaptureEvents(const char* path, std::vector<ReplayEvent>& events)
+{
+	CaptureReader reader;
+	if (!reader.Open(path))
+	{
+		return false;
+	}
+
+	for (size_t c = 0; c < reader.ChunkCount(); ++c)
+	{
+		CaptureChunk chunk;
+		if (!reader.Chunk(c, chunk))
+		{
+			return false;
+		}
+
+		for (ULONG i = 0; i < chunk.EventCount; ++i)
+		{
+			ReplayEvent event;
+			event.Type = chunk.Type[i];
+			event.Time = chunk.Time(i);
+			event.ProcessId = chunk.ProcessId[i];
+			event.ThreadId = chunk.ThreadId[i];
+			event.ParentProcessId = chunk.ParentProcessId[i];
+
+			ULONG length = 0;
+			const auto commandLine = chunk.CommandLine(i, length);
+			if (commandLine != nullptr)
+			{
+				AppendUtf16(event.CommandLine, commandLine, length);
+			}
+
+			events.push_back(std::move(event));
+		}
+	}
+
+	return true;
+}